@@ -39,6 +39,7 @@
 
 /* Version
  * 2017/5/18    1.3   fixed address bits lost when reading one 512b word
+ * 2026/10/19   1.4   CSR graph input, neighbors read in bursts
  */
 
 #include <string.h>
@@ -46,7 +47,7 @@
 #include <hls_stream.h>
 #include "action_bfs.H"
 
-#define HW_RELEASE_LEVEL       0x00000013
+#define HW_RELEASE_LEVEL       0x00000014
 
 
 //--------------------------------------------------------------------------------------------
@@ -161,6 +162,82 @@ void fill_vnode_array(snapu32_t vex_num, VexNode_hls * vex_array, snapu64_t  add
     }
 }
 
+// CSR offsets: vex_num + 1 words, 16 in one snap_membus_t
+void fill_csr_offsets(snapu32_t vex_num, snapu32_t * offs_array, snapu64_t address, snap_membus_t * src_mem)
+{
+    snapu64_t       address_xfer_offset = 0;
+    snap_membus_t   block_buf[MAX_NB_OF_BYTES_READ/BPERDW];
+    snapu32_t left_bytes = (vex_num + 1) * sizeof (snapu32_t);
+    snapu32_t xfer_bytes;
+    snapu32_t index = 0;
+
+    while (left_bytes > 0)
+    {
+        xfer_bytes = read_bulk(src_mem, address + address_xfer_offset, left_bytes, block_buf);
+
+        snapu32_t iii;
+        for(iii = 0; iii < xfer_bytes/sizeof(snapu32_t); iii++)
+        {
+            offs_array[index] = block_buf[iii >> 4](iii(3,0) * 32 + 31, iii(3,0) * 32);
+            index ++;
+        }
+        left_bytes -= xfer_bytes;
+        address_xfer_offset += MAX_NB_OF_BYTES_READ;
+    }
+}
+
+// Mark a vertex visited, queue it and put it to buf_out.
+// Commit buf_out if a cacheline is fulfilled.
+static void visit_vex(ap_uint<VEX_WIDTH> adjvex, ap_uint<1> * visited, hls::stream <Q_t> &Q,
+        snapu32_t * buf_out, snapu32_t &vnode_idx, ap_uint<VEX_WIDTH> &vnode_cnt,
+        snap_membus_t * tgt_mem, snapu64_t &commit_address)
+{
+    if(!visited[adjvex])
+    {
+        visited[adjvex] = 1;
+        Q.write(adjvex);
+
+        buf_out[vnode_idx] = adjvex;
+        vnode_cnt ++;
+        vnode_idx ++;
+
+        if((vnode_idx * sizeof(snapu32_t)) >= BPERCL)
+        {
+            write_out_buf(tgt_mem, commit_address, buf_out);
+
+            vnode_idx = 0;
+            commit_address += BPERCL;
+        }
+    }
+}
+
+// CSR neighbors of one vertex: whole snap_membus_t words in bursts
+// of up to MAX_NB_OF_BYTES_READ, instead of one read per edge node.
+static void visit_csr_edges(snapu32_t edge_idx, snapu32_t edge_end, snapu64_t neighbor_address,
+        snap_membus_t * src_mem, ap_uint<1> * visited, hls::stream <Q_t> &Q,
+        snapu32_t * buf_out, snapu32_t &vnode_idx, ap_uint<VEX_WIDTH> &vnode_cnt,
+        snap_membus_t * tgt_mem, snapu64_t &commit_address)
+{
+    snap_membus_t block_buf[MAX_NB_OF_BYTES_READ/BPERDW];
+    snapu64_t fetch_address = neighbor_address + edge_idx * sizeof(snapu32_t);
+    snapu32_t edge_left = edge_end - edge_idx;
+    snapu32_t word = fetch_address(5,2);   // first neighbor in the first word
+    snapu32_t xfer_bytes;
+
+    fetch_address(5,0) = 0;
+    while (edge_left > 0)
+    {
+        xfer_bytes = read_bulk(src_mem, fetch_address,
+                ((word + edge_left) * sizeof(snapu32_t) + BPERDW - 1) & ~(BPERDW - 1), block_buf);
+
+        for (; word < xfer_bytes/sizeof(snapu32_t) && edge_left > 0; word++, edge_left--)
+            visit_vex(block_buf[word >> 4](word(3,0) * 32 + 31, word(3,0) * 32),
+                    visited, Q, buf_out, vnode_idx, vnode_cnt, tgt_mem, commit_address);
+
+        word = 0;
+        fetch_address += xfer_bytes;
+    }
+}
 
 //--------------------------------------------------------------------------------------------
 //--- MAIN PROGRAM ---------------------------------------------------------------------------
@@ -192,6 +269,7 @@ void hls_action(snap_membus_t  *din_gmem, snap_membus_t  *dout_gmem,
     snapu32_t ReturnCode;
 
     snapu64_t input_address;
+    snapu64_t neighbor_address;
     snapu64_t fetch_address;
     snapu64_t commit_address;
 
@@ -203,6 +281,7 @@ void hls_action(snap_membus_t  *din_gmem, snap_membus_t  *dout_gmem,
     snapu64_t edgelink_ptr;
     snap_membus_t edge_node;
     snapu32_t buf_out[32];   //To fill a cacheline and write to output_traverse.
+    snapu32_t format;
 
     /* Required Action Type Detection */
     switch (action_reg->Control.flags) {
@@ -223,6 +302,8 @@ void hls_action(snap_membus_t  *din_gmem, snap_membus_t  *dout_gmem,
     commit_address = action_reg->Data.output_traverse.addr;
     vex_num        = action_reg->Data.vex_num;
     root           = action_reg->Data.start_root;
+    format         = action_reg->Data.format;
+    neighbor_address = action_reg->Data.input_csr_neighbors.addr;
 
 
 
@@ -232,10 +313,14 @@ void hls_action(snap_membus_t  *din_gmem, snap_membus_t  *dout_gmem,
 #pragma HLS stream depth=16384 variable=Q
     //TODO Caution!!! pragma doesn't recognize MAX_VEX_NUM macro.
 
-    //A local RAM to hold vertex array.
+    //A local RAM to hold vertex array, or the CSR offsets.
     //It will improve the performance a lot.
     VexNode_hls vnode_array[MAX_VEX_NUM];
-    fill_vnode_array(vex_num, vnode_array, input_address, din_gmem);
+    snapu32_t   csr_offs[MAX_VEX_NUM + 1];
+    if (format == BFS_FORMAT_CSR)
+        fill_csr_offsets(vex_num, csr_offs, action_reg->Data.input_csr_offsets.addr, din_gmem);
+    else
+        fill_vnode_array(vex_num, vnode_array, input_address, din_gmem);
 
 
 //L0: for (root = 0; root < vex_num; root ++)
@@ -256,6 +341,13 @@ void hls_action(snap_membus_t  *din_gmem, snap_membus_t  *dout_gmem,
         while (!Q.empty())
         {
             current = Q.read();
+            if (format == BFS_FORMAT_CSR)
+            {
+                visit_csr_edges(csr_offs[current], csr_offs[current + 1], neighbor_address,
+                        din_gmem, visited, Q, buf_out, vnode_idx, vnode_cnt,
+                        dout_gmem, commit_address);
+                continue;
+            }
             edgelink_ptr = vnode_array[current].edgelink;
 
             while (edgelink_ptr != 0) //judge with NULL
@@ -271,24 +363,8 @@ void hls_action(snap_membus_t  *din_gmem, snap_membus_t  *dout_gmem,
                 edgelink_ptr = edge_node(63,0);
                 adjvex       = edge_node(95,64);
 
-                if(!visited[adjvex])
-                {
-                    visited[adjvex] = 1;
-                    Q.write(adjvex);
-
-                    buf_out[vnode_idx] = adjvex;
-                    vnode_cnt ++;
-                    vnode_idx ++;
-
-                    //Commit buf_out if a cacheline is fulfilled
-                    if((vnode_idx * sizeof(snapu32_t)) >= BPERCL)
-                    {
-                        write_out_buf(dout_gmem, commit_address, buf_out);
-
-                        vnode_idx = 0;
-                        commit_address += BPERCL;
-                    }
-                }
+                visit_vex(adjvex, visited, Q, buf_out, vnode_idx, vnode_cnt,
+                        dout_gmem, commit_address);
             }
         }
 
@@ -29,6 +29,10 @@ extern "C" {
 #endif
 unsigned int * g_out_ptr;
 
+// Graph formats in bfs_job.format
+#define BFS_FORMAT_ADJLIST  0   // input_adjtable: VexNode array
+#define BFS_FORMAT_CSR      1   // input_csr_offsets + input_csr_neighbors
+
 // BFS Configuration PATTERN.
 // This must match with DATA structure in hls_bfs/kernel.cpp
 typedef struct bfs_job {
@@ -38,6 +42,10 @@ typedef struct bfs_job {
     uint32_t start_root;
     uint32_t status_pos;
     uint32_t status_vex;
+    struct snap_addr input_csr_offsets;     // uint32_t [vex_num + 1]
+    struct snap_addr input_csr_neighbors;   // uint32_t [edge_num]
+    uint32_t format;
+    uint32_t edge_num;
 } bfs_job_t;
 
 /* Example structure for Vex and Edge*/
@@ -78,6 +86,18 @@ typedef struct
     uint32_t edge_num;
 } AdjList;
 
+/*
+ * Compressed sparse row: the edges of vex i are
+ * neighbors[offsets[i]] ... neighbors[offsets[i+1] - 1], packed.
+ */
+typedef struct
+{
+    uint32_t *offsets;
+    uint32_t *neighbors;
+    uint32_t vex_num;
+    uint32_t edge_num;
+} CsrGraph;
+
 typedef struct EdgeEntry {
     uint32_t s_vex;
     uint32_t d_vex;
@@ -101,6 +121,8 @@ typedef struct {
 
 //int bfs_all(VexNode *, unsigned int vex_num );
 void bfs(VexNode *, unsigned int vex_num, unsigned int root);
+void bfs_csr(const uint32_t *offsets, const uint32_t *neighbors,
+        unsigned int vex_num, unsigned int root);
 void output_vex(unsigned int, int);
 
 #ifdef __cplusplus
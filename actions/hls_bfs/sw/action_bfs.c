@@ -280,6 +280,52 @@ void bfs (VexNode * vex_list, unsigned int vex_num, unsigned int root)
     DestoryQueue(Q);
 }
 
+//Breadth-first-search on a CSR graph. Each vertex is queued at most
+//once, so the queue is an array and the edges of a vertex are read
+//in sequence from the neighbor array.
+void bfs_csr (const uint32_t * offsets, const uint32_t * neighbors,
+        unsigned int vex_num, unsigned int root)
+{
+    unsigned int * queue;
+    unsigned char * visited;
+    unsigned int head = 0, tail = 0;
+    unsigned int current, adjvex;
+    uint32_t e;
+
+    queue   = (unsigned int *) malloc (vex_num * sizeof(unsigned int));
+    visited = (unsigned char *) calloc (vex_num, sizeof(unsigned char));
+    if (!queue || !visited)
+    {
+        printf("ERROR: failed to malloc bfs queue.\n");
+        free(queue);
+        free(visited);
+        return;
+    }
+
+    visited[root] = 1;
+    output_vex(root, 0);
+    queue[tail++] = root;
+
+    while (head < tail)
+    {
+        current = queue[head++];
+        for (e = offsets[current]; e < offsets[current + 1]; e++)
+        {
+            adjvex = neighbors[e];
+            if(!visited[adjvex])
+            {
+                visited[adjvex] = 1;
+                output_vex(adjvex, 0);
+                queue[tail++] = adjvex;
+            }
+        }
+    }
+    output_vex(tail, 1); //Indicate a tail, tail is the count
+
+    free(visited);
+    free(queue);
+}
+
 //------------------------------------
 //    action main
 //------------------------------------
@@ -296,7 +342,12 @@ static int action_main(struct snap_sim_action *action,
 
     g_out_ptr = (unsigned int *)js->output_traverse.addr;
 
-    bfs(vex_list, vex_num, js->start_root);
+    if (js->format == BFS_FORMAT_CSR)
+        bfs_csr((const uint32_t *)js->input_csr_offsets.addr,
+                (const uint32_t *)js->input_csr_neighbors.addr,
+                vex_num, js->start_root);
+    else
+        bfs(vex_list, vex_num, js->start_root);
     js->status_vex = vex_num;
     js->status_pos = (unsigned int)((unsigned long long) g_out_ptr & 0xFFFFFFFFull);
     if (rc == 0)
@@ -82,6 +82,8 @@ static void usage(const char *prog)
             "  -t, --timeout <seconds>       When graph is large, need to enlarge it.\n"
             "  -r, --rand_nodes <N>          Generate a random graph with the number\n"
             "  -s, --start_root <num>        Traverse starting node index [0...N-1], default 0\n"
+            "  -c, --csr                     Convert the graph to compressed sparse rows\n"
+            "                                (offsets + packed neighbors) and traverse that.\n"
             "  -v, --verbose                 Show more information on screen.\n"
             "                                Automatically turned off when vex number > 20\n"
             "  -V, --version                 Git version\n"
@@ -91,6 +93,8 @@ static void usage(const char *prog)
             "  snap_bfs   (Traverse a small sample graph and show result on screen)\n"
             "  snap_bfs -r 50 -s 9 -o traverse.bin \n"
             "             (Generate a 50 nodes graph, traverse from node 9) \n"
+            "  snap_bfs -r 50 -s 9 -c\n"
+            "             (The same graph in CSR format) \n"
             "\n",
             prog);
 }
@@ -264,6 +268,53 @@ static void print_graph(AdjList * adj)
 
 }
 
+/*---------------------------------------------------
+ *       Convert Adjacent Table to CSR
+ *---------------------------------------------------*/
+// The neighbors of a vex keep the order of its edge list, so both
+// formats traverse the same. Both arrays are rounded up to whole pages:
+// the FPGA reads whole 64B words.
+static int create_csr_graph(AdjList * adj, CsrGraph * csr, uint32_t page_size)
+{
+    EdgeNode * en;
+    uint32_t i, e = 0;
+    size_t offs_bytes, nbr_bytes;
+
+    csr->vex_num  = adj->vex_num;
+    csr->edge_num = 0;
+    for (i = 0; i < adj->vex_num; i++)
+        for (en = adj->vex_list[i].edgelink; en; en = en->next)
+            csr->edge_num++;
+
+    offs_bytes = (adj->vex_num + 1) * sizeof(uint32_t);
+    nbr_bytes  = csr->edge_num * sizeof(uint32_t);
+    offs_bytes = (offs_bytes + page_size - 1) / page_size * page_size;
+    nbr_bytes  = (nbr_bytes + page_size) / page_size * page_size;  // never 0
+    csr->offsets   = memalign(page_size, offs_bytes);
+    csr->neighbors = memalign(page_size, nbr_bytes);
+    if (csr->offsets == NULL || csr->neighbors == NULL)
+    {
+        printf("ERROR: Fail to malloc CSR arrays\n");
+        return -1;
+    }
+
+    for (i = 0; i < adj->vex_num; i++)
+    {
+        csr->offsets[i] = e;
+        for (en = adj->vex_list[i].edgelink; en; en = en->next)
+            csr->neighbors[e++] = en->adjvex;
+    }
+    csr->offsets[adj->vex_num] = e;
+    printf("construct CSR done, %u edges.\n", csr->edge_num);
+    return 0;
+}
+
+static void destroy_csr_graph(CsrGraph * csr)
+{
+    free(csr->offsets);
+    free(csr->neighbors);
+}
+
 /*---------------------------------------------------
  *       Delete Adjacent Table when exit
  *---------------------------------------------------*/
@@ -299,11 +350,17 @@ static void snap_prepare_bfs(struct snap_job *job,
         uint16_t type_in,
 
         void *addr_out,
-        uint16_t type_out)
+        uint16_t type_out,
+        CsrGraph *csr)
 {
 
     fprintf(stdout, "----------------  Config Space ----------- \n");
-    fprintf(stdout, "input_adjtable_address = %p\n",addr_in);
+    if (csr) {
+        fprintf(stdout, "input_csr_offsets_address = %p\n", csr->offsets);
+        fprintf(stdout, "input_csr_neighbors_address = %p\n", csr->neighbors);
+        fprintf(stdout, "graph edges number = %d\n", csr->edge_num);
+    } else
+        fprintf(stdout, "input_adjtable_address = %p\n",addr_in);
     fprintf(stdout, "output_address = %p\n", addr_out);
     fprintf(stdout, "graph nodes number = %d\n", vex_num_in);
     fprintf(stdout, "start BFS traversing at %d\n", root_in);
@@ -315,9 +372,17 @@ static void snap_prepare_bfs(struct snap_job *job,
     snap_addr_set(&bjob_in->input_adjtable, addr_in, 0,
             type_in, SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
 
+    snap_addr_set(&bjob_in->input_csr_offsets, csr ? csr->offsets : NULL, 0,
+            type_in, SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
+
+    snap_addr_set(&bjob_in->input_csr_neighbors, csr ? csr->neighbors : NULL, 0,
+            type_in, SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
+
     snap_addr_set(&bjob_in->output_traverse, addr_out, 0,
             type_out, SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST | SNAP_ADDRFLAG_END );
 
+    bjob_in->format = csr ? BFS_FORMAT_CSR : BFS_FORMAT_ADJLIST;
+    bjob_in->edge_num = csr ? csr->edge_num : 0;
     bjob_in->vex_num = vex_num_in;
     bjob_in->start_root = root_in;
     bjob_in->status_pos = 0;
@@ -351,6 +416,7 @@ int main(int argc, char *argv[])
     const char *input_file = NULL;
     const char *output_file = NULL;
     int random_graph = 0;
+    int use_csr = 0;
     uint32_t vex_n, edge_n, root_in;
     snap_action_flag_t action_irq = 0;
 
@@ -366,6 +432,7 @@ int main(int argc, char *argv[])
             { "output_file", required_argument, NULL, 'o' },
             { "rand_nodes",	 required_argument, NULL, 'r' },
             { "start_root",	 required_argument, NULL, 's' },
+            { "csr",	 no_argument,	    NULL, 'c' },
             { "timeout",	 required_argument, NULL, 't' },
             { "version",	 no_argument,	    NULL, 'V' },
             { "verbose",	 no_argument,	    NULL, 'v' },
@@ -375,7 +442,7 @@ int main(int argc, char *argv[])
         };
 
         ch = getopt_long(argc, argv,
-                "C:i:o:t:r:s:VvhI",
+                "C:i:o:t:r:s:cVvhI",
                 long_options, &option_index);
         if (ch == -1)	/* all params processed ? */
             break;
@@ -407,6 +474,9 @@ int main(int argc, char *argv[])
             case 's':
                 root_in = strtol(optarg, (char **)NULL, 0);
                 break;
+            case 'c':
+                use_csr = 1;
+                break;
             case 'h':
                 usage(argv[0]);
                 exit(EXIT_SUCCESS);
@@ -446,6 +516,7 @@ int main(int argc, char *argv[])
     //////////////////////////////////////////////////////////////////////
     // Construct the graph, and set to ibuf.
     AdjList adj;
+    CsrGraph csr = { NULL, NULL, 0, 0 };
 
     fprintf(stdout, "DEBUG: page_size is %d\n", page_size);
     fprintf(stdout, "DEBUG: timeout is %ld\n",timeout);
@@ -466,6 +537,13 @@ int main(int argc, char *argv[])
     if(rc < 0)
         goto out_error;
 
+    if (use_csr)
+    {
+        rc = create_csr_graph(&adj, &csr, page_size);
+        if (rc < 0)
+            goto out_error;
+    }
+
     ibuf = adj.vex_list;
 
 
@@ -507,7 +585,8 @@ int main(int argc, char *argv[])
     snap_prepare_bfs(&job, &bjob_in, &bjob_out,
             vex_n, root_in,
             (void *)ibuf, type_in,
-            (void *)obuf, type_out);
+            (void *)obuf, type_out,
+            use_csr ? &csr : NULL);
 
     fprintf(stdout, "INFO: Timer starts...\n");
     gettimeofday(&stime, NULL);
@@ -580,6 +659,7 @@ int main(int argc, char *argv[])
     snap_detach_action(action);
     snap_card_free(card);
     free(obuf);
+    destroy_csr_graph(&csr);
     destroy_graph(adj);
     exit(exit_code);
 
@@ -588,6 +668,7 @@ out_error2:
 out_error1:
     snap_card_free(card);
 out_error:
+    destroy_csr_graph(&csr);
     destroy_graph(adj);
     free(obuf);
     exit(EXIT_FAILURE);
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "action_groupby_hls.H"
+
+typedef struct gb_entry_s {
+	hashkey_t key;
+	unsigned char used;
+	uint64_t count;
+	uint64_t sum;
+	uint32_t min;
+	uint32_t max;
+} gb_entry_t;
+
+static int hashkey_cmp(hashkey_t s1, hashkey_t s2)
+{
+        unsigned char i;
+
+        for (i = 0; i < sizeof(hashkey_t); i++) {
+#pragma HLS UNROLL factor=2
+                if (*s1 == 0 || *s2 == 0)
+                        break;
+
+                if (*s1 != *s2)
+                        return *s1 - *s2;
+
+                s1 += 1;
+                s2 += 1;
+        }
+        return *s1 - *s2;
+}
+
+void hashkey_cpy(hashkey_t dst, hashkey_t src)
+{
+        unsigned char i;
+
+        for (i = 0; i < sizeof(hashkey_t); i++) {
+#pragma HLS UNROLL factor=2
+                *dst = *src;
+                src++;
+                dst++;
+        }
+}
+
+/* Must match gb_hash() in sw/snap_groupby.h */
+static unsigned int gb_hash(hashkey_t key)
+{
+	uint32_t hashval = 0;
+	unsigned char i;
+
+	for (i = 0; i < sizeof(hashkey_t); i++) {
+		if (key[i] == 0)
+			break;
+		hashval = hashval * 31 + (unsigned char)key[i];
+	}
+	return hashval % GROUPBY_HT_SIZE;
+}
+
+/*
+ * Add a row to its group. Returns -1 if the row starts a new group
+ * and the table is filled up already, the row must be spilled.
+ */
+static int gb_update(gb_entry_t *table, unsigned int *groups,
+		     groupby_row_t *row)
+{
+	unsigned int i;
+	unsigned int bin = gb_hash(row->key);
+
+ gb_update_probe:
+	for (i = 0; i < GROUPBY_HT_SIZE; i++) {
+		gb_entry_t *entry = &table[bin];
+
+		if (entry->used == 0) {
+			if (*groups == GROUPBY_HT_FILL)
+				return -1;	/* full, spill it */
+
+			hashkey_cpy(entry->key, row->key);
+			entry->used = 1;
+			entry->count = 1;
+			entry->sum = row->value;
+			entry->min = row->value;
+			entry->max = row->value;
+			*groups = *groups + 1;
+			return 0;
+		}
+
+		if (hashkey_cmp(entry->key, row->key) == 0) {
+			entry->count++;
+			entry->sum += row->value;
+			if (row->value < entry->min)
+				entry->min = row->value;
+			if (row->value > entry->max)
+				entry->max = row->value;
+			return 0;
+		}
+
+		bin = (bin + 1) % GROUPBY_HT_SIZE;	/* collision */
+	}
+	return -1;
+}
+
+/*
+ * Spilled rows and, on the last job of a pass, the groups are streamed
+ * out as they come. Each entry is announced with a 0 on its eos fifo,
+ * a 1 ends the stream, so the writers need not know the counts upfront.
+ */
+void action_groupby_hls(row_fifo_t *fifo_in, unsigned int rows,
+			snapu32_t flags,
+			row_fifo_t *fifo_spill, eos_fifo_t *eos_spill,
+			res_fifo_t *fifo_out, eos_fifo_t *eos_out)
+{
+	unsigned int i;
+	static gb_entry_t __table[GROUPBY_HT_SIZE];
+	static unsigned int __groups = 0;
+
+	/* table is preserved between the jobs of one pass */
+	if (flags & GROUPBY_FLAG_FIRST) {
+	gb_init:
+		for (i = 0; i < GROUPBY_HT_SIZE; i++)
+			__table[i].used = 0;
+		__groups = 0;
+	}
+
+ gb_aggregate:
+	for (i = 0; i < rows; i++) {
+/* #pragma HLS PIPELINE */
+		groupby_row_t row = fifo_in->read();
+
+#if defined(CONFIG_FIFO_DEBUG)
+		fprintf(stderr, "fifo_in->read(%d, %s)\n", i, row.key);
+#endif
+		if (gb_update(__table, &__groups, &row) == 0)
+			continue;
+
+		eos_spill->write(0);
+		fifo_spill->write(row);
+	}
+	eos_spill->write(1);
+
+	if (flags & GROUPBY_FLAG_LAST) {
+	gb_emit:
+		for (i = 0; i < GROUPBY_HT_SIZE; i++) {
+			gb_entry_t *entry = &__table[i];
+			groupby_result_t res;
+
+			if (entry->used == 0)
+				continue;
+
+			hashkey_cpy(res.key, entry->key);
+			res.count = entry->count;
+			res.sum = entry->sum;
+			res.min = entry->min;
+			res.max = entry->max;
+			eos_out->write(0);
+			fifo_out->write(res);
+		}
+	}
+	eos_out->write(1);
+}
@@ -0,0 +1,424 @@
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* SNAP HLS_GROUPBY EXAMPLE */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <hls_minibuf.H>
+
+#include "action_groupby_hls.H"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+// Known Limitations => Issue #39 & #45
+//      => Transfers must be 64 byte aligned and a size of multiples of 64 bytes
+// ----------------------------------------------------------------------------
+static void write_GB_regs(action_reg *reg,
+			  snapu32_t retc,
+			  snapu64_t rows_processed,
+			  snapu64_t rows_spilled,
+			  snapu64_t groups_produced)
+{
+	reg->Control.Retc = (snapu32_t)retc;
+
+	reg->Data.rows_processed  = rows_processed;
+	reg->Data.rows_spilled    = rows_spilled;
+	reg->Data.groups_produced = groups_produced;
+}
+
+static void copy_hashkey(snap_membus_t mem, hashkey_t key)
+{
+	snap_membus_t tmp = mem;
+
+ loop_copy_hashkey:
+	for (unsigned char k = 0; k < sizeof(hashkey_t); k++) {
+#pragma HLS UNROLL /* factor=2 */
+		key[k] = tmp(7, 0);
+		tmp = tmp >> 8;
+	}
+}
+
+static snap_membus_t hashkey_to_mbus(hashkey_t key)
+{
+	snap_membus_t mem = 0;
+
+ loop_hashkey_to_mbus:
+	for (char k = sizeof(hashkey_t)-1; k >= 0; k--) {
+#pragma HLS UNROLL /* factor=2 */
+		mem = mem << 8;
+		mem(7, 0) = key[(unsigned char)k];
+	}
+	return mem;
+}
+
+static void read_rows(snap_membus_t *mem, unsigned int max_lines,
+		      row_fifo_t *fifo, uint32_t rows)
+{
+	unsigned int i;
+	snap_4KiB_t buf;
+
+	snap_4KiB_rinit(&buf, mem, max_lines);
+
+ read_rows_loop:
+	for (i = 0; i < rows; i++) {
+/* #pragma HLS PIPELINE */
+		snap_membus_t b[2];
+		groupby_row_t row;
+
+		snap_4KiB_get(&buf, &b[0]);
+		copy_hashkey(b[0], row.key);
+
+		snap_4KiB_get(&buf, &b[1]);
+		row.value = b[1](31, 0);
+
+		fifo->write(row);
+	}
+}
+
+static void write_rows(snap_membus_t *mem, unsigned int max_lines,
+		       row_fifo_t *fifo, eos_fifo_t *eos, unsigned int *rows)
+{
+	unsigned int i = 0;
+	snap_4KiB_t buf;
+
+	snap_4KiB_winit(&buf, mem, max_lines);
+
+ write_rows_loop:
+	while (eos->read() == 0) {
+/* #pragma HLS PIPELINE */
+		snap_membus_t d[2];
+		groupby_row_t row = fifo->read();
+
+		d[0] = hashkey_to_mbus(row.key);
+		d[1] = 0;
+		d[1](31, 0) = row.value;
+
+		snap_4KiB_put(&buf, d[0]);
+		snap_4KiB_put(&buf, d[1]);
+		i++;
+	}
+	snap_4KiB_flush(&buf);
+	*rows = i;
+}
+
+static void write_results(snap_membus_t *mem, unsigned int max_lines,
+			  res_fifo_t *fifo, eos_fifo_t *eos,
+			  unsigned int *groups)
+{
+	unsigned int i = 0;
+	snap_4KiB_t buf;
+
+	snap_4KiB_winit(&buf, mem, max_lines);
+
+ write_results_loop:
+	while (eos->read() == 0) {
+/* #pragma HLS PIPELINE */
+		snap_membus_t d[2];
+		groupby_result_t res = fifo->read();
+
+		d[0] = hashkey_to_mbus(res.key);
+		d[1] = 0;
+		d[1](63, 0)    = res.count;
+		d[1](127, 64)  = res.sum;
+		d[1](159, 128) = res.min;
+		d[1](191, 160) = res.max;
+
+		snap_4KiB_put(&buf, d[0]);
+		snap_4KiB_put(&buf, d[1]);
+		i++;
+	}
+	snap_4KiB_flush(&buf);
+	*groups = i;
+}
+
+/*
+ * One process owns the output port: spilled rows are drained while the
+ * rows are aggregated, the groups follow once the spill stream ended.
+ */
+static void write_output(snap_membus_t *spill_mem, unsigned int spill_lines,
+			 row_fifo_t *spill_fifo, eos_fifo_t *spill_eos,
+			 unsigned int *spilled,
+			 snap_membus_t *out_mem, unsigned int out_lines,
+			 res_fifo_t *out_fifo, eos_fifo_t *out_eos,
+			 unsigned int *groups)
+{
+	write_rows(spill_mem, spill_lines, spill_fifo, spill_eos, spilled);
+	write_results(out_mem, out_lines, out_fifo, out_eos, groups);
+}
+
+/*
+ * Reading, aggregating and writing overlap, so the fifos never need
+ * to hold more than a few rows.
+ */
+static void groupby_dataflow(snap_membus_t *din_gmem,
+			     snap_membus_t *dout_gmem,
+			     snapu64_t In_address, snapu32_t In_size,
+			     unsigned int rows, snapu32_t Flags,
+			     snapu64_t Spill_address, snapu32_t Spill_size,
+			     unsigned int *spilled,
+			     snapu64_t Out_address, snapu32_t Out_size,
+			     unsigned int *groups)
+{
+	row_fifo_t in_fifo;
+	row_fifo_t spill_fifo;
+	res_fifo_t out_fifo;
+	eos_fifo_t spill_eos;
+	eos_fifo_t out_eos;
+
+#pragma HLS DATAFLOW
+#pragma HLS stream variable=in_fifo depth=32
+#pragma HLS stream variable=spill_fifo depth=32
+#pragma HLS stream variable=out_fifo depth=32
+#pragma HLS stream variable=spill_eos depth=32
+#pragma HLS stream variable=out_eos depth=32
+
+	/* FIXME Just Host DDRAM for now */
+	read_rows(din_gmem + (In_address >> ADDR_RIGHT_SHIFT),
+		  In_size / sizeof(snap_membus_t), &in_fifo, rows);
+
+	action_groupby_hls(&in_fifo, rows, Flags,
+			   &spill_fifo, &spill_eos,
+			   &out_fifo, &out_eos);
+
+	write_output(dout_gmem + (Spill_address >> ADDR_RIGHT_SHIFT),
+		     Spill_size / sizeof(snap_membus_t),
+		     &spill_fifo, &spill_eos, spilled,
+		     dout_gmem + (Out_address >> ADDR_RIGHT_SHIFT),
+		     Out_size / sizeof(snap_membus_t),
+		     &out_fifo, &out_eos, groups);
+}
+
+//-----------------------------------------------------------------------------
+//--- MAIN PROGRAM ------------------------------------------------------------
+//-----------------------------------------------------------------------------
+static void process_action(snap_membus_t *din_gmem,
+			   snap_membus_t *dout_gmem,
+			   action_reg *Action_Register)
+{
+	snapu64_t In_address, Out_address, Spill_address;
+	snapu32_t In_size, Out_size, Spill_size;
+	snapu32_t Flags;
+	unsigned int rows, spilled = 0, groups = 0;
+
+	In_address    = Action_Register->Data.input.addr;
+	In_size       = Action_Register->Data.input.size;
+	Out_address   = Action_Register->Data.output.addr;
+	Out_size      = Action_Register->Data.output.size;
+	Spill_address = Action_Register->Data.spill.addr;
+	Spill_size    = Action_Register->Data.spill.size;
+	Flags         = Action_Register->Data.flags;
+	rows          = In_size / sizeof(groupby_row_t);
+
+	fprintf(stderr, "in: %016lx/%08x out: %016lx/%08x spill: %016lx/%08x\n",
+		(long)In_address, (int)In_size,
+		(long)Out_address, (int)Out_size,
+		(long)Spill_address, (int)Spill_size);
+
+	/* worst case all rows are spilled, all groups need output space */
+	if ((rows > GROUPBY_ROWS_MAX) ||
+	    (Spill_size < In_size) ||
+	    ((Flags & GROUPBY_FLAG_LAST) &&
+	     (Out_size < GROUPBY_HT_FILL * sizeof(groupby_result_t)))) {
+		write_GB_regs(Action_Register, SNAP_RETC_FAILURE, 0, 0, 0);
+		return;
+	}
+
+	groupby_dataflow(din_gmem, dout_gmem, In_address, In_size, rows, Flags,
+			 Spill_address, Spill_size, &spilled,
+			 Out_address, Out_size, &groups);
+
+	write_GB_regs(Action_Register, SNAP_RETC_SUCCESS, rows, spilled,
+		      groups);
+}
+
+//--- TOP LEVEL MODULE ------------------------------------------------------------------
+void hls_action(snap_membus_t *din_gmem,
+		snap_membus_t *dout_gmem,
+		snap_membus_t *d_ddrmem,
+		action_reg *Action_Register,
+		action_RO_config_reg *Action_Config)
+{
+	// Host Memory AXI Interface
+#pragma HLS INTERFACE m_axi port=din_gmem bundle=host_mem offset=slave depth=512 \
+ max_read_burst_length=32  max_write_burst_length=32
+#pragma HLS INTERFACE s_axilite port=din_gmem bundle=ctrl_reg         offset=0x030
+
+#pragma HLS INTERFACE m_axi port=dout_gmem bundle=host_mem offset=slave depth=512 \
+ max_read_burst_length=32  max_write_burst_length=32
+#pragma HLS INTERFACE s_axilite port=dout_gmem bundle=ctrl_reg        offset=0x040
+
+	// DDR memory Interface
+#pragma HLS INTERFACE m_axi port=d_ddrmem bundle=card_mem0 offset=slave depth=512 \
+ max_read_burst_length=32  max_write_burst_length=32
+#pragma HLS INTERFACE s_axilite port=d_ddrmem bundle=ctrl_reg         offset=0x050
+	(void)d_ddrmem;		/* port kept for the SNAP interface, unused */
+
+	// Host Memory AXI Lite Master Interface
+#pragma HLS DATA_PACK variable=Action_Config
+#pragma HLS INTERFACE s_axilite port=Action_Config bundle=ctrl_reg    offset=0x010
+#pragma HLS DATA_PACK variable=Action_Register
+#pragma HLS INTERFACE s_axilite port=Action_Register bundle=ctrl_reg  offset=0x100
+#pragma HLS INTERFACE s_axilite port=return bundle=ctrl_reg
+
+	/* NOTE: switch generates better vhdl than "if" */
+	switch (Action_Register->Control.flags) {
+	case 0:
+		Action_Config->action_type    = (snapu32_t) GROUPBY_ACTION_TYPE;
+		Action_Config->release_level  = (snapu32_t) RELEASE_LEVEL;
+		Action_Register->Control.Retc = (snapu32_t)0xe00f;
+		return;
+		break;
+	default:
+		process_action(din_gmem, dout_gmem, Action_Register);
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//--- TESTBENCH ---------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+#if defined(NO_SYNTH)
+
+#define TEST_ROWS    1500
+#define TEST_KEYS    600	/* more than GROUPBY_HT_FILL, needs spilling */
+#define TEST_JOBROWS 512	/* several jobs per pass */
+
+/* rows, two spill areas and the results, 1 MiB */
+#define MEMORY_LINES 16384
+#define ROWS_OFFS    0x00000
+#define SPILL0_OFFS  0x40000
+#define SPILL1_OFFS  0x80000
+#define OUT_OFFS     0xc0000
+
+static snap_membus_t host_mem[MEMORY_LINES];
+static snap_membus_t d_ddrmem[MEMORY_LINES];    /* card memory is empty */
+static action_reg Action_Register;
+static action_RO_config_reg Action_Config;
+
+static groupby_row_t rows[TEST_ROWS];
+static groupby_result_t expected[TEST_KEYS];
+static unsigned int found[TEST_KEYS];
+
+int main(void)
+{
+	unsigned int i, k, pass = 0;
+	unsigned int nrows = TEST_ROWS, groups_total = 0;
+	unsigned int in_offs = ROWS_OFFS;
+	uint8_t *mem = (uint8_t *)host_mem;
+
+	/* Query ACTION_TYPE ... */
+	Action_Register.Control.flags = 0x0;
+	hls_action(host_mem, host_mem, d_ddrmem, &Action_Register, &Action_Config);
+	fprintf(stderr,
+		"ACTION_TYPE:   %08x\n"
+		"RELEASE_LEVEL: %08x\n"
+		"RETC:          %04x\n",
+		(unsigned int)Action_Config.action_type,
+		(unsigned int)Action_Config.release_level,
+		(unsigned int)Action_Register.Control.Retc);
+
+	/* rows and the expected aggregates */
+	memset(rows, 0, sizeof(rows));
+	memset(expected, 0, sizeof(expected));
+	for (i = 0; i < TEST_ROWS; i++) {
+		k = (i * 7919) % TEST_KEYS;
+		snprintf(rows[i].key, sizeof(rows[i].key), "key-%d", k);
+		rows[i].value = (i * 31) % 1000;
+
+		if (expected[k].count == 0) {
+			hashkey_cpy(expected[k].key, rows[i].key);
+			expected[k].min = rows[i].value;
+			expected[k].max = rows[i].value;
+		}
+		expected[k].count++;
+		expected[k].sum += rows[i].value;
+		expected[k].min = MIN(expected[k].min, rows[i].value);
+		expected[k].max = rows[i].value > expected[k].max ?
+			rows[i].value : expected[k].max;
+	}
+	for (i = 0; i < MEMORY_LINES; i++)
+		host_mem[i] = 0;
+	memcpy(mem + ROWS_OFFS, rows, sizeof(rows));
+
+	Action_Register.Control.flags = 0x1; /* just not 0x0 */
+	while (nrows != 0) {
+		unsigned int spill_offs = (pass % 2) ? SPILL1_OFFS : SPILL0_OFFS;
+		unsigned int spilled = 0, groups;
+		groupby_result_t *res = (groupby_result_t *)(mem + OUT_OFFS);
+
+		for (i = 0; i < nrows; i += TEST_JOBROWS) {
+			unsigned int todo = MIN(nrows - i, TEST_JOBROWS);
+
+			Action_Register.Data.input.addr = in_offs +
+				i * sizeof(groupby_row_t);
+			Action_Register.Data.input.size =
+				todo * sizeof(groupby_row_t);
+			Action_Register.Data.spill.addr = spill_offs +
+				spilled * sizeof(groupby_row_t);
+			Action_Register.Data.spill.size =
+				todo * sizeof(groupby_row_t);
+			Action_Register.Data.output.addr = OUT_OFFS;
+			Action_Register.Data.output.size =
+				GROUPBY_HT_FILL * sizeof(groupby_result_t);
+			Action_Register.Data.flags =
+				((i == 0) ? GROUPBY_FLAG_FIRST : 0) |
+				((i + todo == nrows) ? GROUPBY_FLAG_LAST : 0);
+
+			hls_action(host_mem, host_mem, d_ddrmem,
+				   &Action_Register, &Action_Config);
+			if (Action_Register.Control.Retc != SNAP_RETC_SUCCESS)
+				return 1;
+
+			spilled += (unsigned int)Action_Register.Data.rows_spilled;
+		}
+
+		groups = (unsigned int)Action_Register.Data.groups_produced;
+		fprintf(stderr, "pass %d: %d rows, %d groups, %d spilled\n",
+			pass, nrows, groups, spilled);
+		if (groups == 0)
+			return 1;
+
+		/* check each group against the expected aggregates */
+		for (i = 0; i < groups; i++) {
+			if (sscanf(res[i].key, "key-%d", &k) != 1 ||
+			    k >= TEST_KEYS || found[k]++ ||
+			    res[i].count != expected[k].count ||
+			    res[i].sum != expected[k].sum ||
+			    res[i].min != expected[k].min ||
+			    res[i].max != expected[k].max) {
+				fprintf(stderr, "group %s wrong\n", res[i].key);
+				return 1;
+			}
+		}
+		groups_total += groups;
+		in_offs = spill_offs;
+		nrows = spilled;
+		pass++;
+	}
+
+	fprintf(stderr, ">>>> %d groups in %d passes\n", groups_total, pass);
+	if (groups_total != TEST_KEYS)
+		return 1;
+
+	return 0;
+}
+
+#endif /* NO_SYNTH */
@@ -0,0 +1,79 @@
+#ifndef __ACTION_GROUPBY_H__
+#define __ACTION_GROUPBY_H__
+
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <snap_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GROUPBY_ACTION_TYPE 0x10141006
+#define RELEASE_LEVEL       0x00000001
+
+#define GROUPBY_HT_SIZE  512	/* size of hashtable */
+#define GROUPBY_HT_FILL  (GROUPBY_HT_SIZE / 4 * 3) /* max groups per pass */
+#define GROUPBY_ROWS_MAX 16384	/* max rows per job, 2 MiB */
+
+/* groupby_job.flags */
+#define GROUPBY_FLAG_FIRST 0x00000001 /* 1st job of a pass, clear table */
+#define GROUPBY_FLAG_LAST  0x00000002 /* last job of a pass, emit groups */
+
+typedef char hashkey_t[64];
+
+/* Same layout as table1_t in hls_hashjoin */
+typedef struct groupby_row_s {
+	hashkey_t key;		/* 64 bytes */
+	uint32_t value;		/*  4 bytes */
+	uint8_t reserved[60];	/* 60 bytes */
+} groupby_row_t;
+
+typedef struct groupby_result_s {
+	hashkey_t key;		/* 64 bytes */
+	uint64_t count;		/*  8 bytes */
+	uint64_t sum;		/*  8 bytes */
+	uint32_t min;		/*  4 bytes */
+	uint32_t max;		/*  4 bytes */
+	uint8_t reserved[40];	/* 40 bytes */
+} groupby_result_t;
+
+/*
+ * Rows are aggregated into a hashtable which keeps the groups between
+ * the jobs of one pass. Once GROUPBY_HT_FILL groups are in the table,
+ * rows of new groups are written to the spill area. The host hash
+ * partitions those rows, each partition is the input of a later
+ * pass. Groups of different passes are disjoint, so results of all
+ * passes can simply be concatenated.
+ */
+typedef struct groupby_job {
+	struct snap_addr input;  /* IN: groupby_row_t rows to aggregate */
+	struct snap_addr output; /* OUT: groupby_result_t, FLAG_LAST only */
+	struct snap_addr spill;  /* OUT: rows for the next pass */
+
+	uint32_t flags;          /* IN: GROUPBY_FLAG_* */
+	uint32_t reserved;
+	uint64_t rows_processed; /* #input rows consumed */
+	uint64_t rows_spilled;   /* #rows written to spill area */
+	uint64_t groups_produced; /* #groupby_result_t written to output */
+} groupby_job_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __ACTION_GROUPBY_H__ */
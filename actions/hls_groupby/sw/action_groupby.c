@@ -0,0 +1,219 @@
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Example to use the FPGA to do a hash group-by operation on a table
+ * of groupby_row_t resulting in COUNT/SUM/MIN/MAX per key.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <libsnap.h>
+#include <snap_internal.h>
+#include <snap_groupby.h>
+
+typedef struct gb_entry_s {
+	hashkey_t key;
+	unsigned int used;
+	uint64_t count;
+	uint64_t sum;
+	uint32_t min;
+	uint32_t max;
+} gb_entry_t;
+
+typedef struct gb_table_s {
+	gb_entry_t table[GROUPBY_HT_SIZE];
+	unsigned int groups;
+} gb_table_t;
+
+/* Keeps the groups between the jobs of one pass, like the card does */
+static gb_table_t gb_table;
+
+static int mmio_read32(struct snap_card *card,
+		       uint64_t offs, uint32_t *data)
+{
+	act_trace("  %s(%p, %llx, %x)\n", __func__, card,
+		  (long long)offs, *data);
+	return 0;
+}
+
+static void gb_init(gb_table_t *gb)
+{
+	unsigned int i;
+
+	for (i = 0; i < GROUPBY_HT_SIZE; i++)
+		gb->table[i].used = 0;
+	gb->groups = 0;
+}
+
+/*
+ * Add a row to its group. Returns -1 if the row starts a new group
+ * and the table cannot take it anymore, the row must be spilled.
+ */
+static int gb_update(gb_table_t *gb, groupby_row_t *row)
+{
+	unsigned int i;
+	unsigned int bin = gb_hash(row->key);
+
+	for (i = 0; i < GROUPBY_HT_SIZE; i++) {
+		gb_entry_t *entry = &gb->table[bin];
+
+		if (entry->used == 0) {
+			if (gb->groups == GROUPBY_HT_FILL)
+				return -1;	/* full, spill it */
+
+			hashkey_cpy(entry->key, row->key);
+			entry->used = 1;
+			entry->count = 1;
+			entry->sum = row->value;
+			entry->min = row->value;
+			entry->max = row->value;
+			gb->groups++;
+			return 0;
+		}
+
+		if (hashkey_cmp(entry->key, row->key) == 0) {
+			entry->count++;
+			entry->sum += row->value;
+			entry->min = MIN(entry->min, row->value);
+			entry->max = MAX(entry->max, row->value);
+			return 0;
+		}
+
+		bin = (bin + 1) % GROUPBY_HT_SIZE;	/* collision */
+	}
+	return -1;
+}
+
+static unsigned int gb_emit(gb_table_t *gb, groupby_result_t *out)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < GROUPBY_HT_SIZE; i++) {
+		gb_entry_t *entry = &gb->table[i];
+
+		if (entry->used == 0)
+			continue;
+
+		memset(&out[n], 0, sizeof(out[n]));
+		hashkey_cpy(out[n].key, entry->key);
+		out[n].count = entry->count;
+		out[n].sum = entry->sum;
+		out[n].min = entry->min;
+		out[n].max = entry->max;
+		n++;
+	}
+	return n;
+}
+
+static void print_job(struct groupby_job *j)
+{
+	printf("GroupBy Job\n");
+	printf("  input:  %016llx %d bytes %ld rows\n",
+	       (long long)j->input.addr, j->input.size,
+	       j->input.size/sizeof(groupby_row_t));
+	printf("  output: %016llx %d bytes %ld groups\n",
+	       (long long)j->output.addr, j->output.size,
+	       j->output.size/sizeof(groupby_result_t));
+	printf("  spill:  %016llx %d bytes %ld rows\n",
+	       (long long)j->spill.addr, j->spill.size,
+	       j->spill.size/sizeof(groupby_row_t));
+	printf("  flags:  %08x\n", j->flags);
+}
+
+static int action_main(struct snap_sim_action *action,
+		       void *job, unsigned int job_len __unused)
+{
+	struct groupby_job *gj = (struct groupby_job *)job;
+	groupby_row_t *in, *spill;
+	groupby_result_t *out;
+	unsigned int i, rows, spilled = 0, groups = 0;
+
+	print_job(gj);
+
+	in = (groupby_row_t *)gj->input.addr;
+	rows = gj->input.size/sizeof(groupby_row_t);
+	if (!in || rows > GROUPBY_ROWS_MAX) {
+		printf("  input rows = %d\n", rows);
+		goto err_out;
+	}
+
+	/* worst case every row needs to be spilled */
+	spill = (groupby_row_t *)gj->spill.addr;
+	if (!spill || gj->spill.size/sizeof(groupby_row_t) < rows) {
+		printf("  spill rows = %ld\n",
+		       gj->spill.size/sizeof(groupby_row_t));
+		goto err_out;
+	}
+
+	out = (groupby_result_t *)gj->output.addr;
+	if ((gj->flags & GROUPBY_FLAG_LAST) &&
+	    (!out || gj->output.size/sizeof(groupby_result_t) <
+	     GROUPBY_HT_FILL)) {
+		printf("  output groups = %ld\n",
+		       gj->output.size/sizeof(groupby_result_t));
+		goto err_out;
+	}
+
+	if (gj->flags & GROUPBY_FLAG_FIRST)
+		gb_init(&gb_table);
+
+	for (i = 0; i < rows; i++) {
+		if (gb_update(&gb_table, &in[i]) == 0)
+			continue;
+
+		memcpy(&spill[spilled], &in[i], sizeof(groupby_row_t));
+		spilled++;
+	}
+
+	if (gj->flags & GROUPBY_FLAG_LAST)
+		groups = gb_emit(&gb_table, out);
+
+	gj->rows_processed = rows;
+	gj->rows_spilled = spilled;
+	gj->groups_produced = groups;
+
+	action->job.retc = SNAP_RETC_SUCCESS;
+	return 0;
+
+ err_out:
+	action->job.retc = SNAP_RETC_FAILURE;
+	return -1;
+}
+
+static struct snap_sim_action action = {
+	.vendor_id = SNAP_VENDOR_ID_ANY,
+	.device_id = SNAP_DEVICE_ID_ANY,
+	.action_type = GROUPBY_ACTION_TYPE,
+
+	.job = { .retc = SNAP_RETC_FAILURE, },
+	.state = ACTION_IDLE,
+	.main = action_main,
+	.priv_data = NULL,	/* this is passed back as void *card */
+	.mmio_read32 = mmio_read32,
+
+	.next = NULL,
+};
+
+static void _init(void) __attribute__((constructor));
+
+static void _init(void)
+{
+	snap_action_register(&action);
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright 2017 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Example to use the FPGA to do a hash group-by operation on a table
+ * of groupby_row_t. The result is checked against, and timed versus,
+ * the same aggregation done on the host.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libsnap.h>
+#include <snap_tools.h>
+#include <snap_hls_if.h>
+#include <snap_groupby.h>
+
+int verbose_flag = 0;
+static const char *version = GIT_VERSION;
+
+static void rows_fill(groupby_row_t *rows, unsigned int nrows,
+		      unsigned int nkeys)
+{
+	unsigned int i;
+
+	memset(rows, 0, nrows * sizeof(groupby_row_t));
+	for (i = 0; i < nrows; i++) {
+		snprintf(rows[i].key, sizeof(rows[i].key), "group-%u",
+			 (unsigned int)rand() % nkeys);
+		rows[i].value = rand() % 1000;
+	}
+}
+
+/*
+ * Host implementation used as reference and for the benchmark: one
+ * open addressing table large enough for all groups, no spilling.
+ */
+static unsigned int host_groupby(groupby_row_t *rows, unsigned int nrows,
+				 groupby_result_t *res)
+{
+	unsigned int i, j, size = 1;
+	unsigned int nres = 0;
+	int *slot;
+
+	while (size < 2 * nrows)
+		size <<= 1;
+
+	slot = malloc(size * sizeof(*slot));
+	if (slot == NULL)
+		return 0;
+	memset(slot, 0xff, size * sizeof(*slot));
+
+	for (i = 0; i < nrows; i++) {
+		groupby_row_t *row = &rows[i];
+		uint32_t hashval = 2166136261u;
+		groupby_result_t *r;
+
+		for (j = 0; j < sizeof(hashkey_t) && row->key[j] != 0; j++)
+			hashval = (hashval ^ (unsigned char)row->key[j]) *
+				16777619u;
+
+		for (j = hashval & (size - 1); slot[j] != -1;
+		     j = (j + 1) & (size - 1))
+			if (hashkey_cmp(res[slot[j]].key, row->key) == 0)
+				break;
+
+		if (slot[j] == -1) {
+			slot[j] = nres;
+			r = &res[nres++];
+			memset(r, 0, sizeof(*r));
+			hashkey_cpy(r->key, row->key);
+			r->min = row->value;
+			r->max = row->value;
+		}
+		r = &res[slot[j]];
+		r->count++;
+		r->sum += row->value;
+		r->min = MIN(r->min, row->value);
+		r->max = MAX(r->max, row->value);
+	}
+
+	free(slot);
+	return nres;
+}
+
+static int result_cmp(const void *a, const void *b)
+{
+	const groupby_result_t *r1 = a, *r2 = b;
+
+	return hashkey_cmp(r1->key, r2->key);
+}
+
+static int result_verify(groupby_result_t *res, unsigned int nres,
+			 groupby_result_t *ref, unsigned int nref)
+{
+	unsigned int i;
+
+	if (nres != nref) {
+		fprintf(stderr, "err: %d groups, expected %d\n", nres, nref);
+		return -1;
+	}
+
+	qsort(res, nres, sizeof(*res), result_cmp);
+	qsort(ref, nref, sizeof(*ref), result_cmp);
+	for (i = 0; i < nres; i++) {
+		if (hashkey_cmp(res[i].key, ref[i].key) != 0 ||
+		    res[i].count != ref[i].count || res[i].sum != ref[i].sum ||
+		    res[i].min != ref[i].min || res[i].max != ref[i].max) {
+			fprintf(stderr, "err: group %d differs\n", i);
+			result_dump(&res[i], 1);
+			result_dump(&ref[i], 1);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void snap_prepare_groupby(struct snap_job *cjob,
+				 struct groupby_job *jin,
+				 struct groupby_job *jout,
+				 groupby_row_t *in, size_t in_size,
+				 groupby_result_t *out, size_t out_size,
+				 groupby_row_t *spill, size_t spill_size,
+				 uint32_t flags)
+{
+	snap_addr_set(&jin->input, in, in_size,
+		      SNAP_ADDRTYPE_HOST_DRAM,
+		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
+	snap_addr_set(&jin->output, out, out_size,
+		      SNAP_ADDRTYPE_HOST_DRAM,
+		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST);
+	snap_addr_set(&jin->spill, spill, spill_size,
+		      SNAP_ADDRTYPE_HOST_DRAM,
+		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST |
+		      SNAP_ADDRFLAG_END);
+
+	jin->flags = flags;
+	jin->reserved = 0;
+	jin->rows_processed = 0;
+	jin->rows_spilled = 0;
+	jin->groups_produced = 0;
+
+	snap_job_set(cjob, jin, sizeof(*jin), jout, sizeof(*jout));
+}
+
+/*
+ * Aggregation of the rows with the action. A pass feeds its input in
+ * jobs of at most GROUPBY_ROWS_MAX rows. The card closes up to
+ * GROUPBY_HT_FILL groups per pass and spills the rows of all other
+ * groups. Those are hash partitioned on the host, with a hash
+ * independent of gb_hash() and different on each level, into about
+ * GROUPBY_HT_FILL / 2 groups per partition, each partition is
+ * aggregated by a pass of its own. The groups among the spilled rows
+ * are estimated from the rows per group the pass has seen. So a row
+ * is spilled about log(groups) / log(GROUPBY_PARTS_MAX) times, not
+ * groups / GROUPBY_HT_FILL times.
+ */
+#define GROUPBY_PARTS_MAX 256
+
+struct gb_run {
+	struct snap_action *action;
+	unsigned int timeout;
+	groupby_row_t *scratch;		/* rows spilled by the pass */
+	groupby_result_t *page;
+	groupby_result_t *res;
+	unsigned int nres;
+	unsigned int passes;
+	unsigned long long spilled;	/* #rows spilled in total */
+};
+
+static int gb_pass(struct gb_run *run, groupby_row_t *in,
+		   unsigned int nrows, unsigned int *spilled,
+		   unsigned int *groups)
+{
+	int rc;
+	struct snap_job cjob;
+	struct groupby_job jin;
+	struct groupby_job jout;
+	unsigned int i, todo;
+	uint32_t flags;
+
+	*spilled = 0;
+	for (i = 0; i < nrows; i += todo) {
+		todo = MIN(nrows - i, (unsigned int)GROUPBY_ROWS_MAX);
+
+		flags = 0;
+		if (i == 0)
+			flags |= GROUPBY_FLAG_FIRST;
+		if (i + todo == nrows)
+			flags |= GROUPBY_FLAG_LAST;
+
+		snap_prepare_groupby(&cjob, &jin, &jout,
+				     &in[i], todo * sizeof(groupby_row_t),
+				     run->page, GROUPBY_HT_FILL *
+				     sizeof(groupby_result_t),
+				     &run->scratch[*spilled],
+				     todo * sizeof(groupby_row_t),
+				     flags);
+		if (verbose_flag) {
+			pr_info("Job Input:\n");
+			__hexdump(stderr, &jin, sizeof(jin));
+		}
+
+		rc = snap_action_sync_execute_job(run->action, &cjob,
+						  run->timeout);
+		if (rc != 0) {
+			fprintf(stderr, "err: job execution %d: %s!\n",
+				rc, strerror(errno));
+			return -1;
+		}
+		if (cjob.retc != SNAP_RETC_SUCCESS)  {
+			fprintf(stderr, "err: job retc %x!\n", cjob.retc);
+			return -1;
+		}
+		*spilled += jout.rows_spilled;
+	}
+
+	memcpy(&run->res[run->nres], run->page,
+	       jout.groups_produced * sizeof(groupby_result_t));
+	run->nres += jout.groups_produced;
+	*groups = jout.groups_produced;
+	run->passes++;
+	run->spilled += *spilled;
+
+	/* no progress would loop forever */
+	if (jout.groups_produced == 0 && *spilled != 0) {
+		fprintf(stderr, "err: no groups produced\n");
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned int gb_part(const hashkey_t key, unsigned int level,
+			    unsigned int parts)
+{
+	uint32_t hashval = 2166136261u ^ (level * 0x9e3779b9u);
+	unsigned int i;
+
+	for (i = 0; i < sizeof(hashkey_t) && key[i] != 0; i++)
+		hashval = (hashval ^ (unsigned char)key[i]) * 16777619u;
+
+	hashval ^= hashval >> 16;	/* fmix32 */
+	hashval *= 0x85ebca6bu;
+	hashval ^= hashval >> 13;
+	hashval *= 0xc2b2ae35u;
+	hashval ^= hashval >> 16;
+	return ((uint64_t)hashval * parts) >> 32;
+}
+
+/* Counting sort of the n rows of src into parts partitions of dst */
+static void gb_partition(groupby_row_t *src, unsigned int n,
+			 groupby_row_t *dst, unsigned int level,
+			 unsigned int parts, unsigned int *start)
+{
+	unsigned int i, p, next[GROUPBY_PARTS_MAX];
+
+	memset(start, 0, (parts + 1) * sizeof(*start));
+	for (i = 0; i < n; i++)
+		start[gb_part(src[i].key, level, parts) + 1]++;
+	for (p = 0; p < parts; p++) {
+		start[p + 1] += start[p];
+		next[p] = start[p];
+	}
+	for (i = 0; i < n; i++) {
+		p = gb_part(src[i].key, level, parts);
+		memcpy(&dst[next[p]++], &src[i], sizeof(groupby_row_t));
+	}
+}
+
+/*
+ * Aggregate nrows rows of in, partitions of the spilled rows go to
+ * part, which may be in itself: the pass is done with it by then.
+ * The partitions of a level are done depth first, so the scratch
+ * area of one pass is shared by all.
+ */
+static int gb_groupby(struct gb_run *run, groupby_row_t *in,
+		      unsigned int nrows, groupby_row_t *part,
+		      unsigned int level)
+{
+	int rc;
+	unsigned int p, parts, spilled, groups;
+	unsigned int start[GROUPBY_PARTS_MAX + 1];
+	unsigned long long est;
+
+	rc = gb_pass(run, in, nrows, &spilled, &groups);
+	if (rc != 0 || spilled == 0)
+		return rc;
+
+	est = (unsigned long long)spilled * groups / (nrows - spilled);
+	parts = MIN((est + GROUPBY_HT_FILL / 2 - 1) / (GROUPBY_HT_FILL / 2),
+		    (unsigned long long)GROUPBY_PARTS_MAX);
+	parts = MAX(parts, 1u);
+	gb_partition(run->scratch, spilled, part, level, parts, start);
+
+	for (p = 0; p < parts; p++) {
+		if (start[p + 1] == start[p])
+			continue;
+		rc = gb_groupby(run, &part[start[p]], start[p + 1] - start[p],
+				&part[start[p]], level + 1);
+		if (rc != 0)
+			return rc;
+	}
+	return 0;
+}
+
+/*
+ * Aggregate nrows rows with the action, spill[0] takes the rows
+ * spilled by a pass, spill[1] their partitions.
+ */
+static int action_groupby(struct snap_action *action, unsigned int timeout,
+			  groupby_row_t *rows, unsigned int nrows,
+			  groupby_row_t *spill[2], groupby_result_t *page,
+			  groupby_result_t *res, unsigned int *nres,
+			  unsigned int *passes, unsigned long long *spilled)
+{
+	int rc;
+	struct gb_run run;
+
+	memset(&run, 0, sizeof(run));
+	run.action = action;
+	run.timeout = timeout;
+	run.scratch = spill[0];
+	run.page = page;
+	run.res = res;
+
+	rc = gb_groupby(&run, rows, nrows, spill[1], 0);
+	*nres = run.nres;
+	*passes = run.passes;
+	*spilled = run.spilled;
+	return rc;
+}
+
+/**
+ * @brief	prints valid command line options
+ *
+ * @param prog	current program's name
+ */
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-h] [-v, --verbose] [-V, --version]\n"
+	       "  -C, --card <cardno> can be (0...3)\n"
+	       "  -t, --timeout <timeout>  Timefor for job completion. (default 10 sec)\n"
+	       "  -n, --rows <items>       Rows to aggregate.\n"
+	       "  -k, --keys <items>       Distinct keys in the rows.\n"
+	       "  -s, --seed <seed>        Random seed to enable recreation.\n"
+	       "  -r, --repeat <num>       Repeat the aggregation for the benchmark.\n"
+	       "  -I, --irq                Enable Interrupts\n"
+	       "\n"
+	       "Example:\n"
+	       "  snap_groupby -n 100000 -k 2000 -r 10\n"
+	       "\n",
+	       prog);
+}
+
+int main(int argc, char *argv[])
+{
+	int ch, rc = 0;
+	int card_no = 0;
+	struct snap_card *card = NULL;
+	struct snap_action *action = NULL;
+	char device[128];
+	unsigned int timeout = 10;
+	struct timeval etime, stime;
+	unsigned long long action_usec = 0, host_usec = 0;
+	unsigned int nrows = 10000;
+	unsigned int nkeys = 1000;
+	unsigned int seed = 1974;
+	unsigned int repeat = 1;
+	unsigned int i, nres = 0, nref = 0, passes = 0;
+	unsigned long long spilled = 0;
+	groupby_row_t *rows = NULL;
+	groupby_row_t *spill[2] = { NULL, NULL };
+	groupby_result_t *page = NULL, *res = NULL, *ref = NULL;
+	snap_action_flag_t action_irq = 0;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{ "card",	 required_argument, NULL, 'C' },
+			{ "timeout",	 required_argument, NULL, 't' },
+			{ "rows",	 required_argument, NULL, 'n' },
+			{ "keys",	 required_argument, NULL, 'k' },
+			{ "seed",	 required_argument, NULL, 's' },
+			{ "repeat",	 required_argument, NULL, 'r' },
+			{ "version",	 no_argument,	    NULL, 'V' },
+			{ "verbose",	 no_argument,	    NULL, 'v' },
+			{ "help",	 no_argument,	    NULL, 'h' },
+			{ "irq",	 no_argument,	    NULL, 'I' },
+			{ 0,		 no_argument,	    NULL, 0   },
+		};
+
+		ch = getopt_long(argc, argv,
+				 "C:t:n:k:s:r:VvhI",
+				 long_options, &option_index);
+		if (ch == -1)	/* all params processed ? */
+			break;
+
+		switch (ch) {
+		/* which card to use */
+		case 'C':
+			card_no = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 't':
+			timeout = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'n':
+			nrows = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'k':
+			nkeys = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 's':
+			seed = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'r':
+			repeat = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'V':
+			printf("%s\n", version);
+			exit(EXIT_SUCCESS);
+		case 'v':
+			verbose_flag++;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+			break;
+		case 'I':
+			action_irq = (SNAP_ACTION_DONE_IRQ | SNAP_ATTACH_IRQ);
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind != argc || nrows == 0 || nkeys == 0 || repeat == 0) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	srand(seed);
+
+	rows = snap_malloc(nrows * sizeof(groupby_row_t));
+	spill[0] = snap_malloc(nrows * sizeof(groupby_row_t));
+	spill[1] = snap_malloc(nrows * sizeof(groupby_row_t));
+	page = snap_malloc(GROUPBY_HT_FILL * sizeof(groupby_result_t));
+	res = malloc(nrows * sizeof(groupby_result_t));
+	ref = malloc(nrows * sizeof(groupby_result_t));
+	if (!rows || !spill[0] || !spill[1] || !page || !res || !ref) {
+		fprintf(stderr, "err: cannot allocate %d rows\n", nrows);
+		goto out_error;
+	}
+
+	rows_fill(rows, nrows, nkeys);
+
+	snprintf(device, sizeof(device)-1, "/dev/cxl/afu%d.0s", card_no);
+	card = snap_card_alloc_dev(device, SNAP_VENDOR_ID_IBM,
+				   SNAP_DEVICE_ID_SNAP);
+	if (card == NULL) {
+		fprintf(stderr, "err: failed to open card %u: %s\n",
+			card_no, strerror(errno));
+		goto out_error;
+	}
+
+	action = snap_attach_action(card, GROUPBY_ACTION_TYPE, action_irq, 60);
+	if (action == NULL) {
+		fprintf(stderr, "err: failed to attach action %u: %s\n",
+			card_no, strerror(errno));
+		goto out_error1;
+	}
+
+	for (i = 0; i < repeat; i++) {
+		gettimeofday(&stime, NULL);
+		rc = action_groupby(action, timeout, rows, nrows, spill, page,
+				    res, &nres, &passes, &spilled);
+		gettimeofday(&etime, NULL);
+		if (rc != 0)
+			goto out_error2;
+		action_usec += timediff_usec(&etime, &stime);
+
+		gettimeofday(&stime, NULL);
+		nref = host_groupby(rows, nrows, ref);
+		gettimeofday(&etime, NULL);
+		host_usec += timediff_usec(&etime, &stime);
+	}
+
+	if (verbose_flag)
+		result_dump(res, nres);
+
+	rc = result_verify(res, nres, ref, nref);
+	if (rc != 0)
+		goto out_error2;
+
+	fprintf(stderr, "GroupBy %d rows into %d groups, %d passes, "
+		"%lld rows spilled\n"
+		"  action: %lld usec %.0f rows/s\n"
+		"  host:   %lld usec %.0f rows/s\n",
+		nrows, nres, passes, spilled,
+		action_usec / repeat,
+		action_usec ? 1e6 * nrows * repeat / action_usec : 0.0,
+		host_usec / repeat,
+		host_usec ? 1e6 * nrows * repeat / host_usec : 0.0);
+
+	snap_detach_action(action);
+	snap_card_free(card);
+	__free(rows);
+	__free(spill[0]);
+	__free(spill[1]);
+	__free(page);
+	free(res);
+	free(ref);
+	exit(EXIT_SUCCESS);
+
+ out_error2:
+	snap_detach_action(action);
+ out_error1:
+	snap_card_free(card);
+ out_error:
+	__free(rows);
+	__free(spill[0]);
+	__free(spill[1]);
+	__free(page);
+	free(res);
+	free(ref);
+	exit(EXIT_FAILURE);
+}
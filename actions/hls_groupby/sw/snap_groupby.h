@@ -0,0 +1,61 @@
+#ifndef __SNAP_GROUPBY_H__
+#define __SNAP_GROUPBY_H__
+
+/*
+ * Copyright 2017, International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <libsnap.h>
+#include <action_groupby.h>
+
+static inline int hashkey_cmp(const hashkey_t s1, const hashkey_t s2)
+{
+	return strncmp(s1, s2, sizeof(hashkey_t));
+}
+
+static inline void hashkey_cpy(hashkey_t dst, const hashkey_t src)
+{
+	memcpy(dst, src, sizeof(hashkey_t));
+}
+
+/* Must match gb_hash() in hw/action_groupby_hls.cpp */
+static inline unsigned int gb_hash(const hashkey_t key)
+{
+	uint32_t hashval = 0;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(hashkey_t) && key[i] != 0; i++)
+		hashval = hashval * 31 + (unsigned char)key[i];
+
+	return hashval % GROUPBY_HT_SIZE;
+}
+
+static inline void result_dump(groupby_result_t *res, unsigned int res_idx)
+{
+	unsigned int i;
+
+	fprintf(stderr, "groupby_result_t result[] = {\n");
+	for (i = 0; i < res_idx; i++)
+		fprintf(stderr, "  { .key = \"%s\", .count = %lld, .sum = %lld, "
+			".min = %d, .max = %d } /* %d. */\n",
+			res[i].key, (long long)res[i].count,
+			(long long)res[i].sum, res[i].min, res[i].max, i);
+	fprintf(stderr, "}; /* res_idx=%d\n", res_idx);
+}
+
+#endif	/* __SNAP_GROUPBY_H__ */
@@ -0,0 +1,96 @@
+#!/bin/bash
+
+#
+# Copyright 2017 International Business Machines
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+verbose=0
+snap_card=0
+duration="NORMAL"
+
+function usage() {
+    echo "Usage:"
+    echo "  test_<action_type>.sh"
+    echo "    [-C <card>]        card to be used for the test"
+    echo "    [-t <trace_level>]"
+    echo "    [-duration SHORT/NORMAL/LONG] run tests"
+    echo
+}
+
+while getopts ":C:t:d:h" opt; do
+    case $opt in
+	C)
+	snap_card=$OPTARG;
+	;;
+	t)
+	export SNAP_TRACE=$OPTARG;
+	;;
+	d)
+	duration=$OPTARG;
+	;;
+	h)
+	usage;
+	exit 0;
+	;;
+	\?)
+	echo "Invalid option: -$OPTARG" >&2
+	;;
+    esac
+done
+
+export PATH=$PATH:../software/tools
+
+snap_peek --help > /dev/null || exit 1;
+snap_poke --help > /dev/null || exit 1;
+
+#### VERSION ##########################################################
+
+# [ -z "$STATE" ] && echo "Need to set STATE" && exit 1;
+
+if [ -z "$SNAP_CONFIG" ]; then
+	echo "CARD VERSION"
+	snap_peek -C ${snap_card} 0x0 || exit 1;
+	snap_peek -C ${snap_card} 0x8 || exit 1;
+	echo
+fi
+
+#### GROUPBY #########################################################
+
+export PATH=$PATH:./hls_groupby/sw
+
+echo "Doing snap_groupby ... "
+rm -f snap_groupby.log
+touch snap_groupby.log
+for rows in 1 2 100 383 384 385 1000 16384 16385 50000 ; do
+    for keys in 1 10 384 385 1000 5000 ; do
+	echo -n "  ${rows} rows ${keys} keys ... "
+	cmd="snap_groupby -C${snap_card} -n ${rows} -k ${keys} \
+			>> snap_groupby.log 2>&1"
+	echo "$cmd" >> snap_groupby.log
+	eval ${cmd}
+	if [ $? -ne 0 ]; then
+	    cat snap_groupby.log
+	    echo
+	    echo "cmd: ${cmd}"
+	    echo "failed"
+	    exit 1
+	fi
+	echo "ok"
+    done
+done
+
+rm -f *.bin *.bin *.out
+echo "Test OK"
+exit 0
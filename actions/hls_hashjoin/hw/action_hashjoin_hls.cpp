@@ -137,6 +137,8 @@ static void table1_cpy(table1_t *dst, table1_t *src)
 }
 
 #if defined(NO_SYNTH)
+hj_stats_t hj_stats;
+
 static inline void print_hex(table1_t *buf, size_t len)
 {
         unsigned char x;
@@ -148,7 +150,7 @@ static inline void print_hex(table1_t *buf, size_t len)
         fprintf(stderr, "}");
 }
 
-void ht_dump(hashtable_t *ht)
+void ht_dump(entry_t table[HT_SIZE])
 {
         unsigned short i, j;
 	static int printed = 0;
@@ -158,7 +160,7 @@ void ht_dump(hashtable_t *ht)
 
         fprintf(stderr, "hashtable = {\n");
         for (i = 0; i < HT_SIZE; i++) {
-                entry_t *entry = &ht->table[i];
+                entry_t *entry = &table[i];
 
                 if (!entry->used)
                         continue;
@@ -176,16 +178,16 @@ void ht_dump(hashtable_t *ht)
         fprintf(stderr, "};\n");
 }
 #else
-#  define ht_dump(ht)
+#  define ht_dump(table)
 #endif
 
-unsigned int ht_count(hashtable_t *ht)
+unsigned int ht_count(entry_t table[HT_SIZE])
 {
         unsigned int i, j;
         unsigned int count = 0;
 
         for (i = 0; i < HT_SIZE; i++) {
-                entry_t *entry = &ht->table[i];
+                entry_t *entry = &table[i];
 
                 if (!entry->used)
                         continue;
@@ -196,13 +198,13 @@ unsigned int ht_count(hashtable_t *ht)
         return count;
 }
 /* Create a new hashtable. */
-void ht_init(hashtable_t *ht)
+void ht_init(entry_t table[HT_SIZE])
 {
         unsigned int i;
 
         for (i = 0; i < HT_SIZE; i++) {
-/* #pragma HLS UNROLL*/
-                entry_t *entry = &ht->table[i];
+#pragma HLS UNROLL factor=HT_BANKS
+                entry_t *entry = &table[i];
                 entry->used = 0;
         }
 }
@@ -224,51 +226,60 @@ int ht_hash(hashkey_t key)
 }
 
 /**
- * Insert a key-value pair into a hash table.
- *
- * FIXME Review void *value and try to replace with hashdata_t ...
- *       failed on 1st try.
- *
+ * Linear probing, HT_BANKS neighbouring bins per step. The table is
+ * cyclically partitioned, so the bins compared in one step sit in
+ * different banks and can be read in the same cycle. Returns the
+ * first bin which is either unused or holds key, -1 if none is.
  */
-int ht_set(hashtable_t *ht, hashkey_t key,
-           table1_t *value)
+static int ht_probe(entry_t table[HT_SIZE], hashkey_t key)
 {
-        int rc;
-        unsigned int i;
-        unsigned int bin = 0;
+        unsigned int i, b;
+        unsigned int bin = ht_hash(key);
 
-        bin = ht_hash(key);
+ ht_probe_loop:
+        for (i = 0; i < HT_SIZE; i += HT_BANKS) {
+#pragma HLS PIPELINE
+                snap_bool_t hit[HT_BANKS];
 
-        /* search if entry exists already */
-        for (i = 0; i < HT_SIZE; i++) {
-/* #pragma HLS UNROLL */
-                table1_t *multi;
-                entry_t *entry = &ht->table[bin];
-
-                if (entry->used == 0) { /* hey unused, we can have it */
-                        hashkey_cpy(entry->key, key);
-                        multi = &entry->multi[entry->used];
-                        table1_cpy(multi, value);
-                        entry->used++;
-                        return 0;
+                HJ_STAT(ht_steps++);
+                for (b = 0; b < HT_BANKS; b++) {
+#pragma HLS UNROLL
+                        entry_t *entry = &table[(bin + i + b) % HT_SIZE];
+
+                        hit[b] = (entry->used == 0) ||
+                                (hashkey_cmp(key, entry->key) == 0);
                 }
+                for (b = 0; b < HT_BANKS; b++) {
+#pragma HLS UNROLL
+                        HJ_STAT(ht_bins++);
+                        if (hit[b])
+                                return (bin + i + b) % HT_SIZE;
+                }
+        }
+        return -1;
+}
 
-                rc = hashkey_cmp(key, entry->key);
-                if (rc == 0) {          /* insert new multi */
-                        if (entry->used == HT_MULTI)
-                                return -1;      /* does not fit */
+/**
+ * Insert a key-value pair into a hash table.
+ */
+int ht_set(entry_t table[HT_SIZE], hashkey_t key,
+           table1_t *value)
+{
+        int bin;
+        entry_t *entry;
 
-                        multi = &entry->multi[entry->used];
-                        table1_cpy(multi, value);
-                        entry->used++;
-                        return 0;
-                }
+        bin = ht_probe(table, key);
+        if (bin == -1)
+                return -1;      /* table full */
 
-                /* double hash because of collision */
-                if (rc != 0)            /* try next one - not smart */
-                        bin = (bin + 1) % HT_SIZE;
-        }
+        entry = &table[bin];
+        if (entry->used == 0)   /* hey unused, we can have it */
+                hashkey_cpy(entry->key, key);
+        else if (entry->used == HT_MULTI)
+                return -1;      /* does not fit */
 
+        table1_cpy(&entry->multi[entry->used], value);
+        entry->used++;
         return 0;
 }
 
@@ -276,36 +287,16 @@ int ht_set(hashtable_t *ht, hashkey_t key,
  * Retrieve an array of values matching the key from a hash table.
  * Return the index and not the pointer to entry_t, since HLS does
  * not like that.
- *
- * Non-optimal double hash implementation: pick the next free entry.
  */
-int ht_get(hashtable_t *ht, char *key)
+int ht_get(entry_t table[HT_SIZE], char *key)
 {
-        int rc;
-        unsigned int i;
-        unsigned int bin = 0;
-        entry_t *entry = NULL;
-
-        bin = ht_hash(key);
-
-        /* search if entry exists already */
-        for (i = 0; i < HT_SIZE; i++) {
-/* #pragma HLS UNROLL */
-                entry = &ht->table[bin];
+        int bin;
 
-                if (entry->used == 0)   /* key not there */
-                        return -1;
+        bin = ht_probe(table, key);
+        if (bin == -1 || table[bin].used == 0)
+                return -1;      /* key not there */
 
-                rc = hashkey_cmp(key, entry->key);
-                if (rc == 0)            /* good key was found */
-                        return bin;
-
-                /* double hash */
-                if (rc != 0)            /* try next one - not smart */
-                        bin = (bin + 1) % HT_SIZE;
-        }
-
-        return -1;
+        return bin;
 }
 
 #if defined(NO_SYNTH)
@@ -327,15 +318,18 @@ void table3_dump(table3_t *table3, unsigned int table3_idx)
 
 #if defined(CONFIG_HOSTSTYLE_ALGO)
 
-int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
-			t2_fifo_t *fifo2, unsigned int table2_used,
-			t3_fifo_t *fifo3, unsigned int *table3_used)
+void action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
+			 t2_fifo_t *fifo2, unsigned int table2_used,
+			 unsigned int *table2_done,
+			 t3_fifo_t *fifo3, eos_fifo_t *eos3,
+			 unsigned int table3_max)
 {
         unsigned int i, j;
 	table1_t t1;
-	static hashtable_t __hashtable;
-        hashtable_t *h = &__hashtable;
+	static entry_t h[HT_SIZE];
+#pragma HLS ARRAY_PARTITION variable=h cyclic factor=HT_BANKS dim=1
 	unsigned int table3_idx = 0;
+	unsigned int table2_idx = table2_used;
 
 	/* preserve hashtable if table1 is not passed */
 	if (table1_used)
@@ -366,11 +360,18 @@ int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
 #if defined(CONFIG_FIFO_DEBUG)
 		fprintf(stderr, "fifo2->read(%d, %s)\n", i, t2.name);
 #endif
+		if (table2_idx != table2_used)
+			continue;	/* page full, drain fifo2 */
+
                 bin = ht_get(h, t2.name);
                 if (bin == -1)
                         continue;       /* nothing found */
 
-                entry = &h->table[bin];
+                entry = &h[bin];
+		if (table3_idx + entry->used > table3_max) {
+			table2_idx = i;	/* resume here with next page */
+			continue;
+		}
 	multihash_entry_processing:
                 for (j = 0; j < entry->used; j++) {
 /* #pragma HLS UNROLL factor=8 */
@@ -381,6 +382,8 @@ int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
 			hashkey_cpy(t3.animal, t2.animal);
 			t3.age = m->age;
 			fifo3->write(t3);
+			eos3->write(0);
+			HJ_STAT(t3_entries++);
 #if defined(CONFIG_FIFO_DEBUG)
 			fprintf(stderr, "fifo3->write(%d, %d/%d, %s)\n",
 				table3_idx, i, j, t3.name);
@@ -389,8 +392,8 @@ int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
                 }
         }
 
-	*table3_used = table3_idx;
-	return 0;
+	eos3->write(1);
+	*table2_done = table2_idx;
 }
 
 #else
@@ -410,14 +413,17 @@ static void hashkey_zero(hashkey_t s)
  * to get the performance/optimizations better. But it is there as
  * way to try out different things.
  */
-int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
-			t2_fifo_t *fifo2, unsigned int table2_used,
-			t3_fifo_t *fifo3, unsigned int *table3_used)
+void action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
+			 t2_fifo_t *fifo2, unsigned int table2_used,
+			 unsigned int *table2_done,
+			 t3_fifo_t *fifo3, eos_fifo_t *eos3,
+			 unsigned int table3_max)
 {
         unsigned int i, j;
 	static table1_t t1[TABLE1_SIZE];
 	static unsigned int t1_idx = 0;
 	unsigned int table3_idx = 0;
+	unsigned int table2_idx = table2_used;
 
         /* do not use a hash phase */
 	if (t1_idx == 0) {
@@ -437,6 +443,14 @@ int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
 #if defined(CONFIG_FIFO_DEBUG)
 		fprintf(stderr, "fifo2->read(%d, %s)\n", i, t2.name);
 #endif
+		/* A t2 entry has at most TABLE3_PAGE_MIN matches */
+		if (table2_idx != table2_used)
+			continue;	/* page full, drain fifo2 */
+		if (table3_idx + TABLE3_PAGE_MIN > table3_max) {
+			table2_idx = i;	/* resume here with next page */
+			continue;
+		}
+
                 for (j = 0; j < TABLE1_SIZE; j++) {
 #pragma HLS UNROLL factor=8
 			table3_t t3;
@@ -446,6 +460,8 @@ int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
 				hashkey_cpy(t3.animal, t2.animal);
 				t3.age = t1[j].age;
 				fifo3->write(t3);
+				eos3->write(0);
+				HJ_STAT(t3_entries++);
 #if defined(CONFIG_FIFO_DEBUG)
 				fprintf(stderr, "fifo3->write(%d, %d/%d, %s)\n",
 					table3_idx, i, j, t3.name);
@@ -455,8 +471,8 @@ int action_hashjoin_hls(t1_fifo_t *fifo1, unsigned int table1_used,
 		}
         }
 
-	*table3_used = table3_idx;
-	return 0;
+	eos3->write(1);
+	*table2_done = table2_idx;
 }
 
 #endif /* CONFIG_HOSTSTYLE_ALGO */
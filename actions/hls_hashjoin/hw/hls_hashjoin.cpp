@@ -42,7 +42,7 @@ static void write_HJ_regs(action_reg *reg,
 	reg->Data.t1_processed = field1;
 	reg->Data.t2_processed = field2;
 	reg->Data.t3_produced  = field3;
-	reg->Data.checkpoint   = field4;
+	reg->Data.bloom_rejected = field4;
 }
 
 /*
@@ -102,6 +102,7 @@ static void read_table1(snap_membus_t *mem, unsigned int max_lines,
 
 		snap_4KiB_get(&buf, &b[1]);
 		t1.age = b[1](31, 0);
+		HJ_STAT(rd_lines += 2);
 
 		fifo1->write(t1);
 #if defined(CONFIG_FIFO_DEBUG)
@@ -129,6 +130,7 @@ static void read_table2(snap_membus_t *mem, unsigned int max_lines,
 
 		snap_4KiB_get(&buf, &b[1]);
 		copy_hashkey(b[1], t2.animal);
+		HJ_STAT(rd_lines += 2);
 
 		fifo2->write(t2);
 #if defined(CONFIG_FIFO_DEBUG)
@@ -137,17 +139,39 @@ static void read_table2(snap_membus_t *mem, unsigned int max_lines,
 	}
 }
 
+/*
+ * Both tables come through the same host memory port, so they are
+ * read by one dataflow process: table1 first, since the build phase
+ * needs it completely before table2 can be probed.
+ */
+static void read_tables(snap_membus_t *din_gmem,
+			snapu64_t t1_address, unsigned int t1_lines,
+			t1_fifo_t *fifo1, uint32_t t1_used,
+			snapu64_t t2_address, unsigned int t2_lines,
+			t2_fifo_t *fifo2, uint32_t t2_used)
+{
+	/* FIXME Just Host DDRAM for now */
+	read_table1(din_gmem + (t1_address >> ADDR_RIGHT_SHIFT),
+		    t1_lines, fifo1, t1_used);
+	read_table2(din_gmem + (t2_address >> ADDR_RIGHT_SHIFT),
+		    t2_lines, fifo2, t2_used);
+}
+
+/*
+ * The number of table3 entries is not known up front: the join process
+ * sends a 0 on eos3 for each entry and a 1 once it is done.
+ */
 static void write_table3(snap_membus_t *mem, unsigned int max_lines,
-			 t3_fifo_t *fifo3, uint32_t t3_used)
+			 t3_fifo_t *fifo3, eos_fifo_t *eos3,
+			 unsigned int *t3_used)
 {
-	unsigned int i;
+	unsigned int i = 0;
 	snap_4KiB_t buf;
 
 	snap_4KiB_winit(&buf, mem, max_lines);
 
-	/* extract data into target table3, or FIFO maybe? */
  write_table3_loop:
-	for (i = 0; i < t3_used; i++) {
+	while (eos3->read() == 0) {
 /* #pragma HLS PIPELINE */
 		snap_membus_t d[3];
 		table3_t t3 = fifo3->read();
@@ -164,11 +188,51 @@ static void write_table3(snap_membus_t *mem, unsigned int max_lines,
 		snap_4KiB_put(&buf, d[0]);
 		snap_4KiB_put(&buf, d[1]); 
 		snap_4KiB_put(&buf, d[2]);
+		HJ_STAT(wr_lines += 3);
+		i++;
 	}
 
 	/* FIXME Tryout for 0 entries ... */
 	snap_4KiB_flush(&buf);
+	*t3_used = i;
 }
+
+/*
+ * Reading, building/probing and writing overlap: table2 is fetched while
+ * the hashtable is built, and table3 lines go out while probing.
+ */
+static void hashjoin_dataflow(snap_membus_t *din_gmem,
+			      snap_membus_t *dout_gmem,
+			      snapu64_t T1_address, unsigned int T1_lines,
+			      unsigned int T1_items,
+			      snapu64_t T2_address, unsigned int T2_lines,
+			      unsigned int T2_items, unsigned int *T2_done,
+			      snapu64_t T3_address, unsigned int T3_lines,
+			      unsigned int T3_items, unsigned int *T3_used)
+{
+	t1_fifo_t t1_fifo;
+	t2_fifo_t t2_fifo;
+	t3_fifo_t t3_fifo;
+	eos_fifo_t eos_fifo;
+
+#pragma HLS DATAFLOW
+#pragma HLS stream variable=t1_fifo depth=32
+#pragma HLS stream variable=t2_fifo depth=32
+#pragma HLS stream variable=t3_fifo depth=32
+#pragma HLS stream variable=eos_fifo depth=32
+
+	read_tables(din_gmem, T1_address, T1_lines, &t1_fifo, T1_items,
+		    T2_address, T2_lines, &t2_fifo, T2_items);
+
+	action_hashjoin_hls(&t1_fifo, T1_items,
+			    &t2_fifo, T2_items, T2_done,
+			    &t3_fifo, &eos_fifo, T3_items);
+
+	/* FIXME Just Host DDRAM for now */
+	write_table3(dout_gmem + (T3_address >> ADDR_RIGHT_SHIFT),
+		     T3_lines, &t3_fifo, &eos_fifo, T3_used);
+}
+
 //-----------------------------------------------------------------------------
 //--- MAIN PROGRAM ------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -177,16 +241,9 @@ static void process_action(snap_membus_t *din_gmem,
 			   snap_membus_t *d_ddrmem,
 			   action_reg *Action_Register)
 {
-	snapu16_t i, j;
-	short rc;
-	snapu32_t ReturnCode = 0;
 	snapu64_t T1_address;
 	snapu64_t T2_address;
 	snapu64_t T3_address;
-	snapu64_t T3_produced;
-	snapu16_t T1_type;
-	snapu16_t T2_type;
-	snapu16_t T3_type;
 	snapu32_t T1_size;
 	snapu32_t T2_size;
 	snapu32_t T3_size;
@@ -194,59 +251,55 @@ static void process_action(snap_membus_t *din_gmem,
 	snapu32_t T2_lines;
 	snapu32_t T3_lines;
 	unsigned int T1_items = 0;
+	unsigned int T2_first = 0;
 	unsigned int T2_items = 0;
+	unsigned int T3_items = 0;
+	unsigned int __table2_idx = 0;
 	unsigned int __table3_idx = 0;
 
-//#pragma HLS DATAFLOW /* 3.5ns timing without this, 3.5n with it, ok ... */
-	t1_fifo_t t1_fifo;
-	t2_fifo_t t2_fifo;
-	t3_fifo_t t3_fifo;
-#pragma HLS stream variable=t1_fifo depth=32
-#pragma HLS stream variable=t2_fifo depth=32
-#pragma HLS stream variable=t3_fifo depth=32
-
 	// byte address received need to be aligned with port width
 	T1_address = Action_Register->Data.t1.addr;
-	T1_type    = Action_Register->Data.t1.type;
 	T1_size    = Action_Register->Data.t1.size;
 	T1_items   = T1_size / sizeof(table1_t);
 	T1_lines   = T1_size / sizeof(snap_membus_t);
 
 	T2_address = Action_Register->Data.t2.addr;
-	T2_type    = Action_Register->Data.t2.type;
 	T2_size    = Action_Register->Data.t2.size;
+	T2_first   = Action_Register->Data.t2_processed;
 	T2_items   = T2_size / sizeof(table2_t);
 	T2_lines   = T2_size / sizeof(snap_membus_t);
 
+	/* Resume where the previous job ran out of table3 page space */
+	if (T2_first > T2_items)
+		T2_first = T2_items;
+	T2_address += T2_first * sizeof(table2_t);
+	T2_items   -= T2_first;
+	T2_lines   -= T2_first * sizeof(table2_t) / sizeof(snap_membus_t);
+
 	T3_address = Action_Register->Data.t3.addr;
-	T3_type    = Action_Register->Data.t3.type;
 	T3_size    = Action_Register->Data.t3.size;
+	T3_items   = T3_size / sizeof(table3_t);
 	T3_lines   = T3_size / sizeof(snap_membus_t);
-	ReturnCode = SNAP_RETC_SUCCESS;
+
+	/* No bloom filter in hardware, see HASHJOIN_FLAG_BLOOM */
+	if (Action_Register->Data.flags & HASHJOIN_FLAG_BLOOM) {
+		write_HJ_regs(Action_Register, SNAP_RETC_FAILURE, 0,
+			      T2_first, 0, 0);
+		return;
+	}
 
 	fprintf(stderr, "t1: %016lx/%08x t2: %016lx/%08x t3: %016lx/%08x\n",
 		(long)T1_address, (int)T1_size,
 		(long)T2_address, (int)T2_size,
 		(long)T3_address, (int)T3_size);
 
-	/* FIXME Just Host DDRAM for now */
-	read_table1(din_gmem + (T1_address >> ADDR_RIGHT_SHIFT),
-		    T1_lines, &t1_fifo, T1_items);
-	read_table2(din_gmem + (T2_address >> ADDR_RIGHT_SHIFT),
-		    T2_lines, &t2_fifo, T2_items);
-
-	__table3_idx = 0;
-	rc = action_hashjoin_hls(&t1_fifo, T1_items,
-				 &t2_fifo, T2_items,
-				 &t3_fifo, &__table3_idx);
-	if (rc == 0) {
-		/* FIXME Just Host DDRAM for now */
-		write_table3(dout_gmem + (T3_address>>ADDR_RIGHT_SHIFT),
-			     T3_lines, &t3_fifo, __table3_idx);
-	} else
-		ReturnCode = SNAP_RETC_FAILURE;
-
-	write_HJ_regs(Action_Register, ReturnCode, 0, 0, __table3_idx, 0);
+	hashjoin_dataflow(din_gmem, dout_gmem,
+			  T1_address, T1_lines, T1_items,
+			  T2_address, T2_lines, T2_items, &__table2_idx,
+			  T3_address, T3_lines, T3_items, &__table3_idx);
+
+	write_HJ_regs(Action_Register, SNAP_RETC_SUCCESS, 0,
+		      T2_first + __table2_idx, __table3_idx, 0);
 }
 
 //--- TOP LEVEL MODULE ------------------------------------------------------------------
@@ -369,12 +422,93 @@ static table2_t table2[] = {
 
 /* worst case size */
 static table3_t table3[TABLE1_SIZE * TABLE2_SIZE * TABLE2_N];
+static table3_t table3_ref[TABLE1_SIZE * TABLE2_SIZE * TABLE2_N];
+static unsigned char table3_seen[TABLE1_SIZE * TABLE2_SIZE * TABLE2_N];
 static snap_membus_t din_gmem[MEMORY_LINES];    /* content is here */
 static snap_membus_t dout_gmem[MEMORY_LINES];   /* output goes here, empty */
 static snap_membus_t d_ddrmem[MEMORY_LINES];    /* card memory is empty */
 static action_reg Action_Register;
 static action_RO_config_reg Action_Config;
 
+/* Nested loop join as reference, independent of the hashtable code */
+static unsigned int table3_expect(void)
+{
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(table2) * TABLE2_N; i++) {
+		table2_t *t2 = &table2[i % ARRAY_SIZE(table2)];
+
+		for (j = 0; j < ARRAY_SIZE(table1); j++) {
+			if (strncmp(table1[j].name, t2->name,
+				    sizeof(hashkey_t)) != 0)
+				continue;
+			strncpy(table3_ref[n].name, t2->name, sizeof(hashkey_t));
+			strncpy(table3_ref[n].animal, t2->animal,
+				sizeof(hashkey_t));
+			table3_ref[n].age = table1[j].age;
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Every produced entry must match exactly one expected entry */
+static int table3_check(table3_t *t3, unsigned int t3_found,
+			unsigned int t3_expected)
+{
+	unsigned int i, j;
+
+	if (t3_found != t3_expected) {
+		fprintf(stderr, "err: found %d entries, expected %d\n",
+			t3_found, t3_expected);
+		return -1;
+	}
+	memset(table3_seen, 0, sizeof(table3_seen));
+	for (i = 0; i < t3_found; i++) {
+		for (j = 0; j < t3_expected; j++) {
+			if (table3_seen[j] ||
+			    t3[i].age != table3_ref[j].age ||
+			    strncmp(t3[i].name, table3_ref[j].name,
+				    sizeof(hashkey_t)) != 0 ||
+			    strncmp(t3[i].animal, table3_ref[j].animal,
+				    sizeof(hashkey_t)) != 0)
+				continue;
+			table3_seen[j] = 1;
+			break;
+		}
+		if (j == t3_expected) {
+			fprintf(stderr, "err: unexpected entry #%d "
+				"%s %s %d\n", i, t3[i].name,
+				t3[i].animal, t3[i].age);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Without DATAFLOW the stages run one after another. With it, reading
+ * table2 overlaps the build and writing overlaps the probe, so the
+ * slowest stage dominates. Fill and drain latencies are ignored.
+ */
+static void hj_stats_dump(void)
+{
+	unsigned long join = hj_stats.ht_steps + hj_stats.t3_entries;
+	unsigned long seq = hj_stats.rd_lines + join + hj_stats.wr_lines;
+	unsigned long df = max(max(hj_stats.rd_lines, join),
+			       hj_stats.wr_lines);
+
+	fprintf(stderr,
+		"Cycle estimate (II=1, %d hashtable banks):\n"
+		"  read:  %lu lines\n"
+		"  join:  %lu probe steps (%lu unbanked), %lu t3 entries\n"
+		"  write: %lu lines\n"
+		"  sequential: %lu cycles, dataflow: %lu cycles (%.1fx)\n",
+		HT_BANKS, hj_stats.rd_lines, hj_stats.ht_steps,
+		hj_stats.ht_bins, hj_stats.t3_entries, hj_stats.wr_lines,
+		seq, df, df ? (double)seq / df : 0.0);
+}
+
 /*
  * FIXME Algorithm is broken, since the ouput register region got removed and 
  * replaced by an read/write generatil register region.
@@ -436,24 +570,37 @@ int main(void)
 		unsigned int todo = MIN(table2_entries, TABLE2_SIZE);
 
 		Action_Register.Data.t2.size = todo * sizeof(table2_t);
-		
-		fprintf(stderr, "\nProcessing %d table2 entries ...\n", todo);
-		hls_action(din_gmem, dout_gmem, d_ddrmem, &Action_Register, &Action_Config);
+		Action_Register.Data.t2_processed = 0;
 
-		Action_Register.Data.t1.addr = 0; /* no need to process t1 */
-		Action_Register.Data.t1.size = 0;
-		Action_Register.Data.t2.addr += todo * sizeof(table2_t);
+		/* Smallest possible pages, to exercise the resume path */
+		while (Action_Register.Data.t2_processed < todo) {
+			Action_Register.Data.t3.size =
+				TABLE3_PAGE_MIN * sizeof(table3_t);
+
+			fprintf(stderr, "\nProcessing %d table2 entries "
+				"from %d ...\n", todo,
+				(int)Action_Register.Data.t2_processed);
+			hls_action(din_gmem, dout_gmem, d_ddrmem,
+				   &Action_Register, &Action_Config);
+
+			if (Action_Register.Control.Retc != SNAP_RETC_SUCCESS)
+				return 1;
 
-		t3_found = (int)Action_Register.Data.t3_produced;
-		t3_data = t3_found * sizeof(table3_t);
+			/* no need to process t1 */
+			Action_Register.Data.t1.addr = 0;
+			Action_Register.Data.t1.size = 0;
 
-		fprintf(stderr, "Found %d entries for table3 %d bytes\n",
-			t3_found, t3_data);
+			t3_found = (int)Action_Register.Data.t3_produced;
+			t3_data = t3_found * sizeof(table3_t);
 
-		Action_Register.Data.t3.addr += t3_data;
-		Action_Register.Data.t3.size -= t3_data;
+			fprintf(stderr, "Found %d entries for table3 %d bytes\n",
+				t3_found, t3_data);
+
+			Action_Register.Data.t3.addr += t3_data;
+			table3_found += t3_found;
+		}
+		Action_Register.Data.t2.addr += todo * sizeof(table2_t);
 
-		table3_found += t3_found;
 		table2_entries -= todo;
 		i++;
 
@@ -486,6 +633,12 @@ int main(void)
 	if (table3_found != 24 * TABLE2_N) {
 		return 1;
 	}
+	if (table3_check((table3_t *)((uint8_t *)dout_gmem + sizeof(table1) +
+				      TABLE2_N * sizeof(table2)),
+			 table3_found, table3_expect()) != 0)
+		return 1;
+
+	hj_stats_dump();
 
         return 0;
 }
@@ -32,6 +32,21 @@ extern "C" {
 #define HT_SIZE     (TABLE1_SIZE * 16) /* size of hashtable */
 #define HT_MULTI    (TABLE1_SIZE) /* multihash entries depends on table1 */
 
+/*
+ * t3 is an output page which is refilled job by job. It must be able
+ * to keep the fan-out of a single table2 entry.
+ */
+#define TABLE3_PAGE_MIN HT_MULTI
+
+/*
+ * hashjoin_job.flags
+ *
+ * The bloom filter is implemented by the software action only. The
+ * card action fails the job with SNAP_RETC_FAILURE if it is requested,
+ * instead of silently reporting 0 rejected entries.
+ */
+#define HASHJOIN_FLAG_BLOOM 0x00000001 /* pre-filter t2 with bloom filter */
+
 typedef char hashkey_t[64];
 typedef char hashdata_t[256];
 
@@ -73,9 +88,11 @@ typedef struct hashjoin_job {
 	struct snap_addr hashtable; /* CACHE: multihash table */
 
 	uint64_t t1_processed; /* #entries cached, repeat if not all */
-	uint64_t t2_processed; /* #entries processed, repeat if not all */
+	uint64_t t2_processed; /* IN: t2 entry to resume with,
+				  OUT: t2 entry to resume next job with */
 	uint64_t t3_produced;  /* #entries produced store them away */
-	uint64_t checkpoint;
+	uint32_t flags;        /* IN: HASHJOIN_FLAG_* */
+	uint32_t bloom_rejected; /* OUT: #t2 entries rejected by bloom filter */
 } hashjoin_job_t;
 
 #ifdef __cplusplus
@@ -230,6 +230,102 @@ static int ht_get(hashtable_t *ht, char *key)
 	return -1;
 }
 
+/*
+ * Blocked bloom filter in front of ht_get(). Each key selects a single
+ * 64 byte block and sets/tests BLOOM_K bits within it. A table2 entry
+ * without partner in table1 is therefore rejected by looking at one
+ * cache line, instead of walking the linear probing chain in the
+ * hashtable until an unused bin shows up.
+ */
+#define BLOOM_BLOCK_BITS	512	/* one 64 byte cache line */
+#define BLOOM_BITS_PER_KEY	16	/* ~0.1% false positives */
+#define BLOOM_K			8	/* bits set per key */
+#define BLOOM_MAX_BLOCKS	((TABLE1_SIZE * BLOOM_BITS_PER_KEY +	\
+				  BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS)
+
+typedef struct bloom_block_s {
+	uint64_t w[BLOOM_BLOCK_BITS / 64];
+} __attribute__((aligned(64))) bloom_block_t;
+
+typedef struct bloom_s {
+	unsigned int blocks;	/* blocks in use, sized to #keys */
+	bloom_block_t block[BLOOM_MAX_BLOCKS];
+} bloom_t;
+
+/* Built with the hashtable, used with HASHJOIN_FLAG_BLOOM */
+static bloom_t bloom_filter;
+
+/* FNV-1a, independent from ht_hash() which only sees the last bytes */
+static uint64_t bloom_hash(hashkey_t key)
+{
+	uint64_t hashval = 0xcbf29ce484222325ull;
+	unsigned int i;
+	unsigned len = hashkey_len(key);
+
+	for (i = 0; i < len; i++) {
+		hashval ^= (unsigned char)key[i];
+		hashval *= 0x100000001b3ull;
+	}
+	return hashval;
+}
+
+static bloom_block_t *bloom_block(bloom_t *b, uint64_t hashval)
+{
+	uint32_t mix = (hashval * 0x9e3779b97f4a7c15ull) >> 32;
+
+	return &b->block[mix % b->blocks];
+}
+
+/* Double hashing, h2 is odd, so the BLOOM_K bits are distinct */
+static unsigned int bloom_bit(uint64_t hashval, unsigned int i)
+{
+	uint32_t h1 = hashval;
+	uint32_t h2 = (hashval >> 32) | 1;
+
+	return (h1 + i * h2) & (BLOOM_BLOCK_BITS - 1);
+}
+
+static void bloom_init(bloom_t *b, unsigned int keys)
+{
+	b->blocks = (keys * BLOOM_BITS_PER_KEY + BLOOM_BLOCK_BITS - 1) /
+		BLOOM_BLOCK_BITS;
+	if (b->blocks == 0)
+		b->blocks = 1;
+	if (b->blocks > BLOOM_MAX_BLOCKS)
+		b->blocks = BLOOM_MAX_BLOCKS;
+
+	memset(b->block, 0, b->blocks * sizeof(bloom_block_t));
+}
+
+static void bloom_set(bloom_t *b, hashkey_t key)
+{
+	unsigned int i;
+	uint64_t hashval = bloom_hash(key);
+	bloom_block_t *blk = bloom_block(b, hashval);
+
+	for (i = 0; i < BLOOM_K; i++) {
+		unsigned int bit = bloom_bit(hashval, i);
+
+		blk->w[bit / 64] |= 1ull << (bit % 64);
+	}
+}
+
+/* Returns 0 if key is definitely not in the hashtable */
+static int bloom_test(bloom_t *b, hashkey_t key)
+{
+	unsigned int i;
+	uint64_t hashval = bloom_hash(key);
+	bloom_block_t *blk = bloom_block(b, hashval);
+	uint64_t miss = 0;
+
+	for (i = 0; i < BLOOM_K; i++) {
+		unsigned int bit = bloom_bit(hashval, i);
+
+		miss |= ~blk->w[bit / 64] & (1ull << (bit % 64));
+	}
+	return miss == 0;
+}
+
 static void table3_init(unsigned int *table3_idx)
 {
 	*table3_idx = 0;
@@ -274,36 +370,67 @@ static int table3_append(table3_t *table3, unsigned int *table3_idx,
  *   ((28, 'Alan'), ('Alan', 'Zombies'))
  *   ((28, 'Glory'), ('Glory', 'Buffy'))
  */
-static int hash_join(table1_t *table1, table2_t *table2, table3_t *table3,
-		     hashtable_t *h, unsigned int *table3_idx)
+/*
+ * Join table2 entries [*table2_idx, table2_items) into the output page
+ * table3, which can take table3_max entries. A table2 entry is only
+ * processed if all its matches fit into the page, *table2_idx returns
+ * where the next job must continue.
+ *
+ * The hashtable and the bloom filter are built from the table1_items
+ * entries of table1. Jobs without table1 entries keep them from the
+ * job which built them, like the HLS action does.
+ */
+static int hash_join(table1_t *table1, unsigned int table1_items,
+		     table2_t *table2, table3_t *table3,
+		     hashtable_t *h, unsigned int *table2_idx,
+		     unsigned int table2_items,
+		     unsigned int *table3_idx, unsigned int table3_max,
+		     bloom_t *bloom, unsigned int *bloom_rejected)
 {
 	unsigned int i, j;
+	unsigned int keys = 0;
 	table1_t *t1;
 
 	/* hash phase */
-	ht_init(h);
-	for (i = 0; i < TABLE1_SIZE; i++) {
+	if (table1_items) {
+		ht_init(h);
+		for (i = 0; i < table1_items; i++)
+			if (hashkey_cmp(table1[i].name, "") != 0)
+				keys++;
+		bloom_init(&bloom_filter, keys);
+	}
+	for (i = 0; i < table1_items; i++) {
 		t1 = &table1[i];
 
 		if (hashkey_cmp(t1->name, "") == 0)
 			continue;
 
 		ht_set(h, t1->name, t1);
+		bloom_set(&bloom_filter, t1->name);
 	}
 
 	/* ht_dump(h); */
 
 	table3_init(table3_idx);
-	for (i = 0; i < TABLE2_SIZE; i++) {
+	*bloom_rejected = 0;
+	for (i = *table2_idx; i < table2_items; i++) {
 		int bin;
 		entry_t *entry;
 		table2_t *t2 = &table2[i];
 
+		if (bloom && !bloom_test(bloom, t2->name)) {
+			*bloom_rejected = *bloom_rejected + 1;
+			continue;	/* cannot be in the hashtable */
+		}
+
 		bin = ht_get(h, t2->name);
 		if (bin == -1)
 			continue;	/* nothing found */
 
 		entry = &h->table[bin];
+		if (*table3_idx + entry->used > table3_max)
+			break;		/* page full, resume here */
+
 		for (j = 0; j < entry->used; j++) {
 			table1_t *m = &entry->multi[j];
 
@@ -311,6 +438,7 @@ static int hash_join(table1_t *table1, table2_t *table2, table3_t *table3,
 				      t2->name, t2->animal, m->age);
 		}
 	}
+	*table2_idx = i;
 	return 0;
 }
 
@@ -329,7 +457,7 @@ static void print_job(struct hashjoin_job *j)
 	printf("  h:  %016llx %d bytes %ld entries\n",
 	       (long long)j->hashtable.addr, j->hashtable.size,
 	       j->hashtable.size/sizeof(entry_t));
-
+	printf("  flags: %08x\n", j->flags);
 }
 
 static int action_main(struct snap_sim_action *action,
@@ -341,28 +469,39 @@ static int action_main(struct snap_sim_action *action,
 	table2_t *t2;
 	table3_t *t3;
 	hashtable_t *h;
-	unsigned int table3_idx = 0;
+	unsigned int table1_items, table2_idx, table2_items;
+	unsigned int table3_idx = 0, table3_max;
+	unsigned int bloom_rejected = 0;
 
 	print_job(hj);
 
 	t1 = (table1_t *)hj->t1.addr;
-	if (!t1 || hj->t1.size/sizeof(table1_t) > TABLE1_SIZE) {
+	table1_items = hj->t1.size/sizeof(table1_t);
+	if ((!t1 && table1_items) || table1_items > TABLE1_SIZE) {
 		printf("  t1.size/sizeof(table1_t) = %ld entries\n",
 		       hj->t1.size/sizeof(table1_t));
 		goto err_out;
 	}
 
 	t2 = (table2_t *)hj->t2.addr;
-	if (!t2 || hj->t2.size/sizeof(table2_t) > TABLE2_SIZE) {
-		printf("  t2.size/sizeof(table2_t) = %ld entries\n",
-		       hj->t2.size/sizeof(table2_t));
+	table2_items = hj->t2.size/sizeof(table2_t);
+	if (!t2 || table2_items > TABLE2_SIZE) {
+		printf("  t2.size/sizeof(table2_t) = %d entries\n",
+		       table2_items);
+		goto err_out;
+	}
+
+	table2_idx = hj->t2_processed;
+	if (table2_idx > table2_items) {
+		printf("  t2_processed = %d entries\n", table2_idx);
 		goto err_out;
 	}
 
 	t3 = (table3_t *)hj->t3.addr;
-	if (!t3 || hj->t3.size/sizeof(table3_t) > TABLE3_SIZE) {
-		printf("  t3.size/sizeof(table3_t) = %ld entries\n",
-		       hj->t3.size/sizeof(table3_t));
+	table3_max = hj->t3.size/sizeof(table3_t);
+	if (!t3 || table3_max < TABLE3_PAGE_MIN || table3_max > TABLE3_SIZE) {
+		printf("  t3.size/sizeof(table3_t) = %d entries\n",
+		       table3_max);
 		goto err_out;
 	}
 
@@ -373,8 +512,13 @@ static int action_main(struct snap_sim_action *action,
 		goto err_out;
 	}
 
-	rc = hash_join(t1, t2, t3, h, &table3_idx);
+	rc = hash_join(t1, table1_items, t2, t3, h, &table2_idx, table2_items,
+		       &table3_idx, table3_max,
+		       (hj->flags & HASHJOIN_FLAG_BLOOM) ? &bloom_filter : NULL,
+		       &bloom_rejected);
+	hj->t2_processed = table2_idx;
 	hj->t3_produced = table3_idx;
+	hj->bloom_rejected = bloom_rejected;
 
 	if (rc == 0) {
 		action->job.retc = SNAP_RETC_SUCCESS;
@@ -21,6 +21,7 @@
  */
 
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -29,12 +30,14 @@
 #include <malloc.h>
 #include <endian.h>
 #include <asm/byteorder.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
 #include <libsnap.h>
 #include <snap_tools.h>
+#include <snap_hls_if.h>
 #include <snap_s_regs.h>
 #include <snap_hashjoin.h>
 
@@ -61,9 +64,169 @@ static table1_t t1[TABLE1_SIZE] __attribute__((aligned(HASHJOIN_ALIGN)));
  * PCIe bus to the card.
  */
 static table2_t t2[TABLE2_SIZE] __attribute__((aligned(HASHJOIN_ALIGN)));
-static table3_t t3[TABLE3_SIZE] __attribute__((aligned(64))); /* large++ */
 static hashtable_t hashtable __attribute__((aligned(64)));
 
+/*
+ * Join results flow through a ring of T3_PAGES reusable output pages
+ * instead of one table3 sized for the worst case fan-out
+ * TABLE1_SIZE * TABLE2_SIZE. Each job fills one page, which is handed
+ * to the drain thread once the job is done. The drain thread calls the
+ * drain callback on the pages in order, while the next job produces
+ * into the other page. A page is reused only after it is drained.
+ */
+#define T3_PAGES		2
+#define T3_PAGE_ENTRIES		256	/* 48 KiB per page */
+
+typedef int (*t3_drain_t)(table3_t *t3, unsigned int t3_entries,
+			  void *priv);
+
+struct t3_sink {
+	table3_t *page[T3_PAGES];
+	unsigned int filled[T3_PAGES];	/* #entries to drain, 0: free */
+	unsigned int page_entries;
+	unsigned int next;		/* page for the next job */
+	unsigned int next_drain;	/* page for the drain thread */
+	t3_drain_t drain;
+	void *priv;
+	unsigned long long produced;	/* #entries drained in total */
+	unsigned long long drain_usec;	/* time spent in drain */
+
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int running;
+	int stop;
+	int rc;				/* 1st drain error */
+};
+
+static void *t3_sink_worker(void *arg)
+{
+	struct t3_sink *sink = arg;
+	unsigned int d;
+	int rc;
+	struct timeval stime, etime;
+
+	pthread_mutex_lock(&sink->lock);
+	while (1) {
+		d = sink->next_drain;
+		if (sink->filled[d] == 0) {
+			if (sink->stop)
+				break;
+			pthread_cond_wait(&sink->cond, &sink->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&sink->lock);
+
+		gettimeofday(&stime, NULL);
+		rc = sink->drain(sink->page[d], sink->filled[d], sink->priv);
+		gettimeofday(&etime, NULL);
+
+		pthread_mutex_lock(&sink->lock);
+		sink->drain_usec += timediff_usec(&etime, &stime);
+		if (rc != 0 && sink->rc == 0)
+			sink->rc = rc;
+		sink->filled[d] = 0;
+		sink->next_drain = (d + 1) % T3_PAGES;
+		pthread_cond_broadcast(&sink->cond);
+	}
+	pthread_mutex_unlock(&sink->lock);
+	return NULL;
+}
+
+static int t3_sink_init(struct t3_sink *sink, unsigned int page_entries,
+			t3_drain_t drain, void *priv)
+{
+	unsigned int i;
+
+	memset(sink, 0, sizeof(*sink));
+	sink->page_entries = page_entries;
+	sink->drain = drain;
+	sink->priv = priv;
+	pthread_mutex_init(&sink->lock, NULL);
+	pthread_cond_init(&sink->cond, NULL);
+
+	for (i = 0; i < T3_PAGES; i++) {
+		sink->page[i] = snap_malloc(page_entries * sizeof(table3_t));
+		if (sink->page[i] == NULL)
+			return -ENOMEM;
+	}
+	if (pthread_create(&sink->worker, NULL, t3_sink_worker, sink) != 0)
+		return -EAGAIN;
+	sink->running = 1;
+	return 0;
+}
+
+/* Wait until every page is drained, returns the 1st drain error */
+static int t3_sink_flush(struct t3_sink *sink)
+{
+	unsigned int i;
+	int rc;
+
+	pthread_mutex_lock(&sink->lock);
+	for (i = 0; i < T3_PAGES; i++)
+		while (sink->filled[i] != 0)
+			pthread_cond_wait(&sink->cond, &sink->lock);
+	rc = sink->rc;
+	pthread_mutex_unlock(&sink->lock);
+	return rc;
+}
+
+static void t3_sink_free(struct t3_sink *sink)
+{
+	unsigned int i;
+
+	if (sink->running) {
+		pthread_mutex_lock(&sink->lock);
+		sink->stop = 1;
+		pthread_cond_broadcast(&sink->cond);
+		pthread_mutex_unlock(&sink->lock);
+		pthread_join(sink->worker, NULL);
+		sink->running = 0;
+	}
+	for (i = 0; i < T3_PAGES; i++) {
+		__free(sink->page[i]);
+		sink->page[i] = NULL;
+	}
+	pthread_cond_destroy(&sink->cond);
+	pthread_mutex_destroy(&sink->lock);
+}
+
+/* Wait until the page for the next job is drained */
+static table3_t *t3_sink_get(struct t3_sink *sink)
+{
+	pthread_mutex_lock(&sink->lock);
+	while (sink->filled[sink->next] != 0)
+		pthread_cond_wait(&sink->cond, &sink->lock);
+	pthread_mutex_unlock(&sink->lock);
+	return sink->page[sink->next];
+}
+
+/* Pass the page of the last job to the drain thread */
+static int t3_sink_put(struct t3_sink *sink, unsigned int t3_entries)
+{
+	int rc;
+
+	pthread_mutex_lock(&sink->lock);
+	if (t3_entries != 0) {
+		sink->filled[sink->next] = t3_entries;
+		sink->next = (sink->next + 1) % T3_PAGES;
+		pthread_cond_broadcast(&sink->cond);
+	}
+	sink->produced += t3_entries;
+	rc = sink->rc;
+	pthread_mutex_unlock(&sink->lock);
+	return rc;
+}
+
+/* Default consumer: dump the results if requested */
+static int t3_drain_dump(table3_t *t3, unsigned int t3_entries,
+			 void *priv __attribute__((unused)))
+{
+	if (verbose_flag)
+		table3_dump(t3, t3_entries);
+	return 0;
+}
+
 static const char *get_name(void)
 {
 	const char *names[] = { "Jonah", "Alan", "Allen", "Glory", "Frank", "Bruno",
@@ -111,6 +274,109 @@ static void table2_fill(table2_t *t2, unsigned int t2_entries)
 	}
 }
 
+/*
+ * Benchmark data: table1 gets distinct keys, table2 entries find their
+ * partner with a probability of match percent. Partners are picked
+ * uniformly or with a Zipf skew from the table1 keys. The own random
+ * generator keeps the tables identical for the same seed, independent
+ * of the libc in use.
+ */
+struct hj_gen {
+	uint64_t state;		/* xorshift64* */
+	unsigned int keys;	/* #distinct keys in table1 */
+	unsigned int match;	/* percentage of t2 entries with partner */
+	double *cdf;		/* Zipf distribution, NULL for uniform */
+};
+
+static uint64_t gen_rand(struct hj_gen *g)
+{
+	g->state ^= g->state >> 12;
+	g->state ^= g->state << 25;
+	g->state ^= g->state >> 27;
+	return g->state * 2685821657736338717ull;
+}
+
+static int gen_init(struct hj_gen *g, unsigned int seed, unsigned int keys,
+		    double zipf, unsigned int match)
+{
+	unsigned int i;
+	double sum = 0.0;
+
+	g->state = 0x9e3779b97f4a7c15ull ^ seed;
+	g->keys = keys;
+	g->match = match;
+	g->cdf = NULL;
+	if (zipf <= 0.0 || keys == 0)
+		return 0;
+
+	g->cdf = malloc(keys * sizeof(double));
+	if (g->cdf == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < keys; i++) {
+		sum += 1.0 / pow(i + 1, zipf);
+		g->cdf[i] = sum;
+	}
+	for (i = 0; i < keys; i++)
+		g->cdf[i] /= sum;
+	return 0;
+}
+
+static void gen_free(struct hj_gen *g)
+{
+	free(g->cdf);
+	g->cdf = NULL;
+}
+
+static unsigned int gen_key(struct hj_gen *g)
+{
+	unsigned int lo = 0, hi = g->keys - 1;
+	double u;
+
+	if (g->cdf == NULL)
+		return gen_rand(g) % g->keys;
+
+	/* 1st key with cdf >= u */
+	u = (gen_rand(g) >> 11) * (1.0 / 9007199254740992.0);
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (g->cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void gen_table1(struct hj_gen *g, table1_t *t1, unsigned int t1_entries)
+{
+	unsigned int i;
+
+	memset(t1, 0, t1_entries * sizeof(table1_t));
+	for (i = 0; i < t1_entries; i++) {
+		snprintf(t1[i].name, sizeof(t1[i].name), "key-%u", i);
+		t1[i].age = gen_rand(g) % 100;
+	}
+}
+
+static void gen_table2(struct hj_gen *g, table2_t *t2, unsigned int t2_entries)
+{
+	unsigned int i;
+
+	memset(t2, 0, t2_entries * sizeof(table2_t));
+	for (i = 0; i < t2_entries; i++) {
+		if (g->keys && gen_rand(g) % 100 < g->match)
+			snprintf(t2[i].name, sizeof(t2[i].name), "key-%u",
+				 gen_key(g));
+		else
+			snprintf(t2[i].name, sizeof(t2[i].name), "miss-%u",
+				 (unsigned int)gen_rand(g));
+		snprintf(t2[i].animal, sizeof(t2[i].animal), "animal-%u",
+			 (unsigned int)(gen_rand(g) % 1000));
+	}
+}
+
 static inline
 ssize_t file_size(const char *fname)
 {
@@ -157,8 +423,10 @@ static void snap_prepare_hashjoin(struct snap_job *cjob,
 				  struct hashjoin_job *jout,
 				  const table1_t *t1, ssize_t t1_size,
 				  const table2_t *t2, size_t t2_size,
+				  unsigned int t2_processed,
 				  table3_t *t3, size_t t3_size,
-				  hashtable_t *h, size_t h_size)
+				  hashtable_t *h, size_t h_size,
+				  uint32_t flags)
 {
 	snap_addr_set(&jin->t1, t1, t1_size,
 		      SNAP_ADDRTYPE_HOST_DRAM,
@@ -177,12 +445,200 @@ static void snap_prepare_hashjoin(struct snap_job *cjob,
 		      SNAP_ADDRFLAG_END);
 
 	jin->t1_processed = 0;
-	jin->t2_processed = 0;
+	jin->t2_processed = t2_processed;
 	jin->t3_produced = 0;
+	jin->flags = flags;
+	jin->bloom_rejected = 0;
 
 	snap_job_set(cjob, jin, sizeof(*jin), jout, sizeof(*jout));
 }
 
+/*
+ * Join t2_entries of table2 against the hashtable, t1 is only passed
+ * with the first job. Without table2 entries one job just builds the
+ * hashtable. Jobs are repeated until every table2 entry got its page
+ * space, results are passed on to the sink.
+ */
+static int hashjoin_chunk(struct snap_action *action, unsigned int timeout,
+			  const table1_t *t1, unsigned int t1_entries,
+			  const table2_t *t2, unsigned int t2_entries,
+			  struct t3_sink *sink, uint32_t flags,
+			  unsigned long long *t2_rejected)
+{
+	int rc;
+	struct snap_job cjob;
+	struct hashjoin_job jin;
+	struct hashjoin_job jout;
+	unsigned int t2_done = 0;
+	table3_t *t3;
+
+	do {
+		t3 = t3_sink_get(sink);
+		snap_prepare_hashjoin(&cjob, &jin, &jout,
+				      t1, t1_entries * sizeof(table1_t),
+				      t2, t2_entries * sizeof(table2_t),
+				      t2_done,
+				      t3, sink->page_entries * sizeof(table3_t),
+				      &hashtable, sizeof(hashtable),
+				      flags);
+		if (verbose_flag) {
+			pr_info("Job Input:\n");
+			__hexdump(stderr, &jin, sizeof(jin));
+		}
+
+		rc = snap_action_sync_execute_job(action, &cjob, timeout);
+		if (rc != 0) {
+			fprintf(stderr, "err: job execution %d: %s!\n", rc,
+				strerror(errno));
+			return -1;
+		}
+		if (cjob.retc != SNAP_RETC_SUCCESS)  {
+			fprintf(stderr, "err: job retc %x!\n", cjob.retc);
+			return -1;
+		}
+		if ((t2_entries && jout.t2_processed <= t2_done) ||
+		    jout.t2_processed > t2_entries ||
+		    jout.t3_produced > sink->page_entries) {
+			fprintf(stderr, "err: no progress t2: %lld t3: %lld\n",
+				(long long)jout.t2_processed,
+				(long long)jout.t3_produced);
+			return -1;
+		}
+
+		rc = t3_sink_put(sink, jout.t3_produced);
+		if (rc != 0)
+			return rc;
+
+		*t2_rejected += jout.bloom_rejected;
+		t2_done = jout.t2_processed;
+		t1_entries = 0; /* no need to process this twice,
+				   ht stores the values */
+	} while (t2_done < t2_entries);
+
+	return 0;
+}
+
+/* Benchmark consumer: touch every result, sum up the ages */
+static int t3_drain_sum(table3_t *t3, unsigned int t3_entries, void *priv)
+{
+	unsigned int i;
+	unsigned long long *sum = priv;
+
+	for (i = 0; i < t3_entries; i++)
+		*sum += t3[i].age;
+	return 0;
+}
+
+/*
+ * Run the join runs times on generated data and report the time
+ * spent per phase: generating table2 on the host, building the
+ * hashtable, probing table2 and draining the table3 pages.
+ *
+ * The action tables bound what this measures: the build side is at
+ * most TABLE1_SIZE keys, Zipf skew and cardinality apply to the probe
+ * side only, and table2 is fed in jobs of TABLE2_SIZE entries. The
+ * numbers are per-job throughput of these small tables, not the
+ * throughput of a join at scale.
+ */
+static int hashjoin_bench(struct snap_action *action, unsigned int timeout,
+			  unsigned int t1_entries,
+			  unsigned long long t2_entries,
+			  unsigned int seed, double zipf, unsigned int match,
+			  unsigned int page_entries, uint32_t flags,
+			  unsigned int runs)
+{
+	int rc = 0;
+	unsigned int r;
+	struct hj_gen gen;
+	struct t3_sink sink;
+	struct timeval t0, t1_, t2_;
+	unsigned long long gen_usec = 0, build_usec = 0, probe_usec = 0;
+	unsigned long long drain_usec, t3_entries = 0, t2_rejected = 0;
+	unsigned long long t3_sum = 0;
+	double bytes, probe_sec;
+
+	gen.cdf = NULL;
+	rc = t3_sink_init(&sink, page_entries, t3_drain_sum, &t3_sum);
+	if (rc != 0) {
+		fprintf(stderr, "err: cannot allocate table3 pages\n");
+		goto out;
+	}
+
+	for (r = 0; r < runs; r++) {
+		unsigned long long todo = t2_entries;
+
+		rc = gen_init(&gen, seed, t1_entries, zipf, match);
+		if (rc != 0)
+			goto out;
+
+		gen_table1(&gen, t1, t1_entries);
+		sink.produced = 0;
+
+		gettimeofday(&t0, NULL);
+		rc = hashjoin_chunk(action, timeout, t1, t1_entries,
+				    t2, 0, &sink, flags, &t2_rejected);
+		gettimeofday(&t1_, NULL);
+		build_usec += timediff_usec(&t1_, &t0);
+		if (rc != 0)
+			goto out;
+
+		while (todo != 0) {
+			unsigned int t2_tocopy = MIN(ARRAY_SIZE(t2),
+						     (size_t)todo);
+
+			gettimeofday(&t0, NULL);
+			gen_table2(&gen, t2, t2_tocopy);
+			gettimeofday(&t1_, NULL);
+			rc = hashjoin_chunk(action, timeout, t1, 0,
+					    t2, t2_tocopy, &sink, flags,
+					    &t2_rejected);
+			gettimeofday(&t2_, NULL);
+			if (rc != 0)
+				goto out;
+
+			gen_usec += timediff_usec(&t1_, &t0);
+			probe_usec += timediff_usec(&t2_, &t1_);
+			todo -= t2_tocopy;
+		}
+		rc = t3_sink_flush(&sink);
+		if (rc != 0)
+			goto out;
+		t3_entries += sink.produced;
+		gen_free(&gen);
+	}
+
+	/* table3 pages are drained by the drain thread while probing */
+	drain_usec = sink.drain_usec;
+
+	probe_sec = probe_usec / 1e6;
+	bytes = (double)runs * t2_entries * sizeof(table2_t) +
+		(double)t3_entries * sizeof(table3_t);
+
+	fprintf(stderr, "HashJoin benchmark: t1 %u t2 %llu entries "
+		"zipf %.2f match %u%% seed %u, %u runs\n"
+		"  bounded by the action tables: t1 <= %d keys, "
+		"t2 in jobs of %d entries\n"
+		"  gen:   %10lld usec\n"
+		"  build: %10lld usec\n"
+		"  probe: %10lld usec %.0f rows/s %.1f MiB/s\n"
+		"  drain: %10lld usec, overlapped with probe\n"
+		"  t3:    %10lld entries, age sum %lld\n",
+		t1_entries, t2_entries, zipf, match, seed, runs,
+		TABLE1_SIZE, TABLE2_SIZE,
+		gen_usec / runs, build_usec / runs, probe_usec / runs,
+		probe_sec ? runs * t2_entries / probe_sec : 0.0,
+		probe_sec ? bytes / probe_sec / (1024 * 1024) : 0.0,
+		drain_usec / runs, t3_entries / runs, t3_sum / runs);
+
+	if (flags & HASHJOIN_FLAG_BLOOM)
+		fprintf(stderr, "  bloom: %10lld t2 entries rejected\n",
+			t2_rejected / runs);
+ out:
+	gen_free(&gen);
+	t3_sink_free(&sink);
+	return rc;
+}
+
 /**
  * @brief	prints valid command line options
  *
@@ -197,11 +653,21 @@ static void usage(const char *prog)
 	       "  -T, --t2-entries <items> Entries in table2.\n"
 	       "  -s, --seed <seed>        Random seed to enable recreation.\n"
 	       "  -I, --irq                Enable Interrupts\n"
+	       "  -B, --bloom              Pre-filter table2 with a bloom filter.\n"
+	       "                           Software action only, the card fails the job.\n"
+	       "  -P, --page-entries <items> Entries per table3 output page.\n"
+	       "  -b, --bench <runs>       Benchmark on generated data. The build side is\n"
+	       "                           at most %d keys (-Q), table2 goes in jobs of\n"
+	       "                           %d entries, so this measures per-job throughput\n"
+	       "                           of these action tables, not a join at scale.\n"
+	       "  -z, --zipf <s>           Zipf skew of table2 keys. (default 0, uniform)\n"
+	       "  -m, --match <percent>    table2 entries with partner. (default 50)\n"
 	       "\n"
 	       "Example:\n"
 	       "  snap_hashjoin ...\n"
+	       "  snap_hashjoin -b 3 -Q 32 -T 1000000 -z 1.1 -m 10 -B\n"
 	       "\n",
-	       prog);
+	       prog, TABLE1_SIZE, TABLE2_SIZE);
 }
 
 /**
@@ -214,16 +680,21 @@ int main(int argc, char *argv[])
 	struct snap_card *card = NULL;
 	struct snap_action *action = NULL;
 	char device[128];
-	struct snap_job cjob;
-	struct hashjoin_job jin;
-	struct hashjoin_job jout;
 	unsigned int timeout = 10;
 	struct timeval etime, stime;
 	int exit_code = EXIT_SUCCESS;
 	unsigned int t1_entries = 25;
-	unsigned int t2_entries = 23;
+	unsigned long long t2_entries = 23;
 	unsigned int t2_tocopy = 0;
+	unsigned int page_entries = T3_PAGE_ENTRIES;
+	struct t3_sink sink;
 	unsigned int seed = 1974;
+	uint32_t flags = 0;
+	unsigned long long t2_probed = 0;
+	unsigned long long t2_rejected = 0;
+	unsigned int bench_runs = 0;
+	double zipf = 0.0;
+	unsigned int match = 50;
 	snap_action_flag_t action_irq = 0;
 
 	while (1) {
@@ -238,11 +709,16 @@ int main(int argc, char *argv[])
 			{ "verbose",	 no_argument,	    NULL, 'v' },
 			{ "help",	 no_argument,	    NULL, 'h' },
 			{ "irq",	 no_argument,	    NULL, 'I' },
+			{ "bloom",	 no_argument,	    NULL, 'B' },
+			{ "page-entries", required_argument, NULL, 'P' },
+			{ "bench",	 required_argument, NULL, 'b' },
+			{ "zipf",	 required_argument, NULL, 'z' },
+			{ "match",	 required_argument, NULL, 'm' },
 			{ 0,		 no_argument,	    NULL, 0   },
 		};
 
 		ch = getopt_long(argc, argv,
-				 "s:Q:T:C:t:VvhI",
+				 "s:Q:T:C:t:P:b:z:m:VvhIB",
 				 long_options, &option_index);
 		if (ch == -1)	/* all params processed ? */
 			break;
@@ -259,7 +735,7 @@ int main(int argc, char *argv[])
 			t1_entries = strtol(optarg, (char **)NULL, 0);
 			break;
 		case 'T':
-			t2_entries = strtol(optarg, (char **)NULL, 0);
+			t2_entries = strtoull(optarg, (char **)NULL, 0);
 			break;
 		case 's':
 			seed = strtol(optarg, (char **)NULL, 0);
@@ -277,6 +753,21 @@ int main(int argc, char *argv[])
 		case 'I':
 			action_irq = (SNAP_ACTION_DONE_IRQ | SNAP_ATTACH_IRQ);
 			break;
+		case 'B':
+			flags |= HASHJOIN_FLAG_BLOOM;
+			break;
+		case 'P':
+			page_entries = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'b':
+			bench_runs = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'z':
+			zipf = strtod(optarg, (char **)NULL);
+			break;
+		case 'm':
+			match = strtol(optarg, (char **)NULL, 0);
+			break;
 		default:
 			usage(argv[0]);
 			exit(EXIT_FAILURE);
@@ -315,55 +806,78 @@ int main(int argc, char *argv[])
 		goto out_error;
 	}
 
+	if (page_entries < TABLE3_PAGE_MIN || page_entries > TABLE3_SIZE) {
+		fprintf(stderr, "err: page entries must be %d..%d\n",
+			TABLE3_PAGE_MIN, TABLE3_SIZE);
+		goto out_error2;
+	}
+
+	if (bench_runs) {
+		rc = hashjoin_bench(action, timeout, t1_entries, t2_entries,
+				    seed, zipf, MIN(match, 100u),
+				    page_entries, flags, bench_runs);
+		if (rc != 0)
+			goto out_error2;
+
+		snap_detach_action(action);
+		snap_card_free(card);
+		exit(exit_code);
+	}
+
+	rc = t3_sink_init(&sink, page_entries, t3_drain_dump, NULL);
+	if (rc != 0) {
+		fprintf(stderr, "err: cannot allocate table3 pages\n");
+		goto out_error3;
+	}
+
 	table1_fill(t1, t1_entries);
 	if (verbose_flag)
 		table1_dump(t1, t1_entries);
 
 	gettimeofday(&stime, NULL);
 	while (t2_entries != 0) {
-		t2_tocopy = MIN(ARRAY_SIZE(t2), t2_entries);
+		t2_tocopy = MIN(ARRAY_SIZE(t2), (size_t)t2_entries);
 
 		table2_fill(t2, t2_tocopy);
-		snap_prepare_hashjoin(&cjob, &jin, &jout,
-				      t1, t1_entries * sizeof(table1_t),
-				      t2, t2_tocopy * sizeof(table2_t),
-				      t3, sizeof(t3),
-				      &hashtable, sizeof(hashtable));
-		if (verbose_flag) {
-			pr_info("Job Input:\n");
-			__hexdump(stderr, &jin, sizeof(jin));
+		if (verbose_flag)
 			table2_dump(t2, t2_tocopy);
-		}
-
-		rc = snap_action_sync_execute_job(action, &cjob, timeout);
-		if (rc != 0) {
-			fprintf(stderr, "err: job execution %d: %s!\n", rc,
-				strerror(errno));
-			goto out_error2;
-		}
-		if (cjob.retc != SNAP_RETC_SUCCESS)  {
-			fprintf(stderr, "err: job retc %x!\n", cjob.retc);
-			goto out_error2;
-		}
 
-		if (verbose_flag)
-			table3_dump(t3, jout.t3_produced);
+		rc = hashjoin_chunk(action, timeout, t1, t1_entries,
+				    t2, t2_tocopy, &sink, flags,
+				    &t2_rejected);
+		if (rc != 0)
+			goto out_error3;
 
 		t1_entries = 0; /* no need to process this twice,
 				   ht stores the values */
+		t2_probed += t2_tocopy;
 		t2_entries -= t2_tocopy;
 	}
+	rc = t3_sink_flush(&sink);
+	if (rc != 0)
+		goto out_error3;
 	snap_detach_action((void*)action);
 	gettimeofday(&etime, NULL);
 
 	fprintf(stderr, "ReturnCode: %x\n"
-		"HashJoin took %lld usec\n", cjob.retc,
+		"HashJoin took %lld usec\n", SNAP_RETC_SUCCESS,
 		(long long)timediff_usec(&etime, &stime));
+	fprintf(stderr, "HashJoin produced %lld table3 entries\n",
+		sink.produced);
+
+	if ((flags & HASHJOIN_FLAG_BLOOM) && t2_probed)
+		fprintf(stderr, "Bloom filter: %lld of %lld t2 entries "
+			"rejected, hit rate %.1f%%\n",
+			t2_rejected, t2_probed,
+			100.0 * (t2_probed - t2_rejected) / t2_probed);
 
+	t3_sink_free(&sink);
 	snap_detach_action(action);
 	snap_card_free(card);
 	exit(exit_code);
 
+ out_error3:
+	t3_sink_free(&sink);
  out_error2:
 	snap_detach_action(action);
  out_error1:
@@ -89,6 +89,40 @@ for t2_entries in `seq 1 128` 512 666 888 999 1024 2048 2049 5015 7007 8088 1231
     echo "ok"
 done
 
+echo "Doing snap_hashjoin with small table3 pages ... "
+for page_entries in 32 33 100 ; do
+    echo -n "  ${page_entries} entries per T3 page ... "
+    cmd="snap_hashjoin -C${snap_card} -Q 32 -T 2049 -P ${page_entries} -v \
+			>> snap_hashjoin.log 2>&1"
+    echo "$cmd" >> snap_hashjoin.log
+    eval ${cmd}
+    if [ $? -ne 0 ]; then
+	cat snap_hashjoin.log
+	echo
+	echo "cmd: ${cmd}"
+	echo "failed"
+	exit 1
+    fi
+    echo "ok"
+done
+
+echo "Doing snap_hashjoin benchmark on generated data ... "
+for zipf in 0 0.8 1.2 ; do
+    echo -n "  zipf ${zipf} ... "
+    cmd="snap_hashjoin -C${snap_card} -b 1 -Q 32 -T 10000 -z ${zipf} -m 20 -B \
+			>> snap_hashjoin.log 2>&1"
+    echo "$cmd" >> snap_hashjoin.log
+    eval ${cmd}
+    if [ $? -ne 0 ]; then
+	cat snap_hashjoin.log
+	echo
+	echo "cmd: ${cmd}"
+	echo "failed"
+	exit 1
+    fi
+    echo "ok"
+done
+
 rm -f *.bin *.bin *.out
 echo "Test OK"
 exit 0
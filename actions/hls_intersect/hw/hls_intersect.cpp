@@ -8,9 +8,9 @@
  *        https://en.wikipedia.org/wiki/Hash_table
  *
  * 2) Sort both source tables, and then do intersection
- *  Use bubble_sort and bottom-up merge sort
- *      https://en.wikipedia.org/wiki/Bubble_sort
- *      https://en.wikipedia.org/wiki/Merge_sort
+ *  Use bitonic sorting networks and a multi-way merge tree
+ *      https://en.wikipedia.org/wiki/Bitonic_sorter
+ *      https://en.wikipedia.org/wiki/K-way_merge_algorithm
  * 
  * Wikipedia's pages are based on "CC BY-SA 3.0"
  * Creative Commons Attribution-ShareAlike License 3.0
@@ -53,8 +53,10 @@ using namespace std;
 // V1.5 : 05/26/2017 : Refine Sort for the small block. Split cpp files.
 // V1.6 : 06/21/2017 : USE ARRAY_PARITION to provide parallel sorting. 
 //                     Use #ifdef to compile hash method and sort method.
+// V1.7 : 10/19/2026 : Bitonic networks for the local sort, on chip merge of the
+//                     engines and MERGE_WAYS way merge passes in DDR.
 //--------------------------------------------------------------------------------------------
-#define HW_RELEASE_LEVEL       0x00000016
+#define HW_RELEASE_LEVEL       0x00000017
 
 snapu32_t read_bulk ( snap_membus_t *src_mem,
         snapu64_t      byte_address,
@@ -193,56 +195,70 @@ static short compare_gt (ele_t a, ele_t b)
 /////////////////////////////////////////////////////
 //   Sort Method
 /////////////////////////////////////////////////////
-
-static void bubble_sort (ele_t *buf)
+//
+// Descending order. Each engine sorts NUM_SORT elements with a bitonic
+// network, one network stage per cycle. The NUM_ENGINES sorted buffers
+// are merged on chip into a run of RUN_ELES elements in DDR_SORT_SPACE.
+// Then each pass merges MERGE_WAYS runs into one, so a table of n
+// elements takes log(n / RUN_ELES) / log(MERGE_WAYS) passes over DDR.
+
+static void bitonic_sort (ele_t buf[NUM_SORT])
 {
+#pragma HLS INLINE
+    short i, j, k, l;
+    ele_t a, b;
 
-	ele_t temp;
-	short i, j;
-	for (i = 0; i < NUM_SORT - 1; i++) {
-		for (j = 0; j < NUM_SORT - i -1; j++) {
-            // If the later is bigger, swap
-            // Desending order
-			if(compare_gt(buf[j+1], buf[j]) == 1) {
-				temp = buf[j];
-				buf[j] = buf[j+1];
-				buf[j+1] = temp;
-			}
-		}
-	}
+bs_stage: for (k = 2; k <= NUM_SORT; k = k * 2) {
+        for (j = k / 2; j > 0; j = j / 2) {
+#pragma HLS PIPELINE
+bs_cmp:     for (i = 0; i < NUM_SORT; i++) {
+#pragma HLS UNROLL
+                l = i ^ j;
+                if (l > i) {
+                    a = buf[i];
+                    b = buf[l];
+                    // Blocks with (i & k) == 0 go down, the others up
+                    if (((i & k) == 0) == (compare_gt(b, a) == 1)) {
+                        buf[i] = b;
+                        buf[l] = a;
+                    }
+                }
+            }
+        }
+    }
 }
 
-
-
-void bottomup_merge(snap_membus_t * ddr_mem, snapu64_t A_addr, snapu64_t B_addr, 
-        snapu32_t low, snapu32_t mid, snapu32_t end)
+// Index of the greatest valid head, by a tree of comparators
+template <int W>
+static short merge_select (ele_t head[W], snap_bool_t valid[W])
 {
-    // merge [low, mid-1][mid, end-1]
-    // Read from A, save in B
-    ele_t val_i;
-    ele_t val_j;
-
-	snapu32_t i = low;
-    snapu32_t j = mid;
-	snapu32_t k = low;
-
-    short cmp_gt;
-
-bm_loop: for (k = low; k < end; k++) {
-        read_single(ddr_mem, A_addr + i * ELE_BYTES, &val_i);
-        read_single(ddr_mem, A_addr + j * ELE_BYTES, &val_j);
-        cmp_gt =  compare_gt(val_i, val_j);
-        //Desending order
-		if(i < mid && (j >= end || cmp_gt == 1)) {
-            write_single(ddr_mem, B_addr + k * ELE_BYTES, val_i ); 
-		//	B[k] = A[i];
-			i = i+1;
-		} else {
-            write_single(ddr_mem, B_addr + k * ELE_BYTES, val_j); 
-		//	B[k] = A[j];
-			j = j+1;
-		}
-	}
+#pragma HLS INLINE
+    ele_t v[W];
+    snap_bool_t ok[W];
+    short idx[W];
+    short i, n;
+#pragma HLS ARRAY_PARTITION variable=v complete
+#pragma HLS ARRAY_PARTITION variable=ok complete
+#pragma HLS ARRAY_PARTITION variable=idx complete
+
+    for (i = 0; i < W; i++) {
+#pragma HLS UNROLL
+        v[i] = head[i];
+        ok[i] = valid[i];
+        idx[i] = i;
+    }
+ms_level: for (n = W / 2; n > 0; n = n / 2) {
+#pragma HLS UNROLL
+        for (i = 0; i < n; i++) {
+#pragma HLS UNROLL
+            if (ok[i + n] && (!ok[i] || compare_gt(v[i + n], v[i]) == 1)) {
+                v[i] = v[i + n];
+                ok[i] = 1;
+                idx[i] = idx[i + n];
+            }
+        }
+    }
+    return idx[0];
 }
 
 void init_paddings (snap_membus_t * ddr_mem,snapu64_t ddr_addr, snapu32_t offset_w, snapu32_t table_size)
@@ -264,8 +280,8 @@ void local_sort (snap_membus_t * ddr_mem, snapu64_t ddr_addr, snapu32_t table_si
 
     snapu32_t block_groups = num/(NUM_SORT * NUM_ENGINES);
     offset_w = block_groups * NUM_ENGINES * ONE_BUF_SIZE;
-    snapu32_t jjj, kkk; 
-    
+    snapu32_t jjj, kkk, ooo;
+
 
     if (offset_w < table_size)
     {
@@ -275,7 +291,13 @@ void local_sort (snap_membus_t * ddr_mem, snapu64_t ddr_addr, snapu32_t table_si
 
 
     ele_t local_bufs[NUM_ENGINES][NUM_SORT];
-#pragma HLS ARRAY_PARTITION variable=local_bufs complete dim=1
+#pragma HLS ARRAY_PARTITION variable=local_bufs complete dim=0
+    ele_t head[NUM_ENGINES];
+    snap_bool_t valid[NUM_ENGINES];
+    short pos[NUM_ENGINES];
+    ele_t out_buf[MERGE_BURST];
+    short w, o;
+
     for (jjj = 0; jjj < block_groups; jjj++) {
 
 lsr_loop: for (kkk = 0; kkk < NUM_ENGINES; kkk ++)
@@ -287,36 +309,114 @@ lsr_loop: for (kkk = 0; kkk < NUM_ENGINES; kkk ++)
         for (kkk = 0; kkk < NUM_ENGINES; kkk ++)
         {
             #pragma HLS UNROLL
-            bubble_sort(local_bufs[kkk]);
+            bitonic_sort(local_bufs[kkk]);
+            pos[kkk] = 0;
         }
 
-lsw_loop: for (kkk = 0; kkk < NUM_ENGINES; kkk ++)
+        // Merge the engines into one run
+        offset = jjj * RUN_ELES * ELE_BYTES;
+        o = 0;
+lsm_loop: for (ooo = 0; ooo < RUN_ELES; ooo++)
         {
-            offset = jjj * NUM_ENGINES * ONE_BUF_SIZE + kkk * ONE_BUF_SIZE;
-            write_bulk(ddr_mem, (DDR_SORT_SPACE + offset), ONE_BUF_SIZE, local_bufs[kkk]);
+#pragma HLS PIPELINE
+            for (kkk = 0; kkk < NUM_ENGINES; kkk ++)
+            {
+                #pragma HLS UNROLL
+                valid[kkk] = pos[kkk] < NUM_SORT;
+                head[kkk] = local_bufs[kkk][valid[kkk] ? pos[kkk] : 0];
+            }
+            w = merge_select<NUM_ENGINES>(head, valid);
+            out_buf[o++] = head[w];
+            pos[w]++;
+            if (o == MERGE_BURST) {
+                write_bulk(ddr_mem, DDR_SORT_SPACE + offset, MERGE_BURST * ELE_BYTES, out_buf);
+                offset += MERGE_BURST * ELE_BYTES;
+                o = 0;
+            }
         }
     }
 }
 
+// Merges the runs of width elements from low on, from A_addr to B_addr.
+//
+// Each way has a ring of two bursts. A round first refills, with one
+// burst read each, the ways which have a free burst and more of their
+// run in DDR. Then a pipelined loop emits up to MERGE_BURST elements,
+// which are written out in one burst. After a refill a way holds at
+// least MERGE_BURST elements or the rest of its run, so it cannot run
+// dry inside the emit loop, which never waits for DDR.
+#define MERGE_RING (2 * MERGE_BURST)
+
+void merge_runs (snap_membus_t * ddr_mem, snapu64_t A_addr, snapu64_t B_addr,
+        snapu32_t low, snapu32_t width, snapu32_t num)
+{
+    ele_t ring[MERGE_WAYS][MERGE_RING];
+#pragma HLS ARRAY_PARTITION variable=ring complete dim=1
+    ele_t head[MERGE_WAYS];
+    snap_bool_t valid[MERGE_WAYS];
+    snapu32_t next[MERGE_WAYS], end[MERGE_WAYS], rd[MERGE_WAYS], wr[MERGE_WAYS];
+#pragma HLS ARRAY_PARTITION variable=rd complete
+#pragma HLS ARRAY_PARTITION variable=wr complete
+    ele_t out_buf[MERGE_BURST];
+    snapu32_t k, last, n, e;
+    snapu64_t out_addr = B_addr + low * ELE_BYTES;
+    short w, o;
+
+    for (w = 0; w < MERGE_WAYS; w++) {
+#pragma HLS UNROLL
+        next[w] = MIN((snapu32_t)(low + w * width), num);
+        end[w] = MIN((snapu32_t)(next[w] + width), num);
+        rd[w] = 0;
+        wr[w] = 0;
+    }
+    last = end[MERGE_WAYS - 1];
+
+mr_round: for (k = low; k < last; k += e) {
+        // Prefetch: a burst into each free half of a ring
+mr_refill: for (w = 0; w < MERGE_WAYS; w++) {
+            if (wr[w] - rd[w] <= MERGE_BURST && next[w] < end[w]) {
+                n = MIN((snapu32_t)(end[w] - next[w]), (snapu32_t)MERGE_BURST);
+                read_bulk(ddr_mem, A_addr + next[w] * ELE_BYTES, n * ELE_BYTES,
+                        &ring[w][wr[w] % MERGE_RING]);
+                next[w] += n;
+                wr[w] += n;
+            }
+        }
+
+        // Select and emit, one element per cycle
+        e = MIN((snapu32_t)(last - k), (snapu32_t)MERGE_BURST);
+mr_emit: for (o = 0; o < e; o++) {
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_TRIPCOUNT max=MERGE_BURST
+            for (w = 0; w < MERGE_WAYS; w++) {
+#pragma HLS UNROLL
+                valid[w] = rd[w] != wr[w];
+                head[w] = ring[w][rd[w] % MERGE_RING];
+            }
+            w = merge_select<MERGE_WAYS>(head, valid);
+            out_buf[o] = head[w];
+            rd[w]++;
+        }
+        write_bulk(ddr_mem, out_addr, e * ELE_BYTES, out_buf);
+        out_addr += e * ELE_BYTES;
+    }
+}
+
 void merge_sort (snap_membus_t * ddr_mem, snapu64_t ddr_addr, snapu32_t table_size )
 {
-    //After local buffer sorting, the sorted data is in DDR_SORT_SPACE 
-    //second round. Merge
+    //After local sorting, the runs of RUN_ELES are in DDR_SORT_SPACE
+    //Then merge passes
     ap_uint<1> dir = 0;
-	snapu32_t width, low, mid, end;
+    snapu32_t width, low;
     snapu32_t num = table_size/ELE_BYTES;
-    for (width = NUM_SORT; width < num; width = width*2)
+    for (width = RUN_ELES; width < num; width = width * MERGE_WAYS)
     {
-        for (low = 0; low < num; low = low + width*2)
+        for (low = 0; low < num; low = low + width * MERGE_WAYS)
         {
-            mid = MIN((snapu32_t)(low + width), num);
-            end = MIN((snapu32_t)(low + width*2), num);
-
             if(dir == 0)
-                bottomup_merge(ddr_mem, DDR_SORT_SPACE, ddr_addr, low, mid, end);
+                merge_runs(ddr_mem, DDR_SORT_SPACE, ddr_addr, low, width, num);
             else
-                bottomup_merge(ddr_mem, ddr_addr, DDR_SORT_SPACE, low, mid, end);
-
+                merge_runs(ddr_mem, ddr_addr, DDR_SORT_SPACE, low, width, num);
         }
         dir = dir ^ 1;
     }
@@ -640,6 +740,11 @@ void hls_action(snap_membus_t  *din_gmem,
     }
     else if(Action_Register->Data.step == 3)
     {
+        if(Action_Register->Data.operation != INTERSECT_OP)
+        {
+            Action_Register->Control.Retc = SNAP_RETC_FAILURE;
+            return;
+        }
  //       if(Action_Register->Data.method == HASH_METHOD)
  //       {
 #ifdef USE_HASH
@@ -688,3 +793,166 @@ void hls_action(snap_membus_t  *din_gmem,
     return;
 }
 
+
+//-----------------------------------------------------------------------------
+//--- TESTBENCH ---------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+#ifdef NO_SYNTH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// DDR model up to the end of the sort space, pages are backed when touched
+#define TB_DDR_SIZE (DDR_SORT_SPACE + MAX_TABLE_SIZE)
+
+// The order of compare_gt(): 64 bytes as a little endian number, descending
+static int tb_cmp_desc(const void *a, const void *b)
+{
+    const unsigned char *x = (const unsigned char *)a;
+    const unsigned char *y = (const unsigned char *)b;
+    int i;
+
+    for (i = ELE_BYTES - 1; i >= 0; i--)
+        if (x[i] != y[i])
+            return x[i] > y[i] ? -1 : 1;
+    return 0;
+}
+
+// Rows of a few letters out of four, so there are duplicates
+static void tb_fill(unsigned char *rows, unsigned int n, unsigned int letters)
+{
+    unsigned int i, j;
+
+    memset(rows, 0, (size_t)n * ELE_BYTES);
+    for (i = 0; i < n; i++)
+        for (j = 0; j < letters; j++)
+            rows[(size_t)i * ELE_BYTES + j] = 'a' + rand() % 4;
+}
+
+// Sorts a table of n rows on the card and against qsort()
+static int tb_sort(snap_membus_t *ddr, unsigned int n, unsigned int letters)
+{
+    unsigned char *table = (unsigned char *)ddr;
+    unsigned char *ref = (unsigned char *)malloc((size_t)n * ELE_BYTES);
+    int rc = 0;
+
+    tb_fill(table, n, letters);
+    memcpy(ref, table, (size_t)n * ELE_BYTES);
+    qsort(ref, n, ELE_BYTES, tb_cmp_desc);
+
+    local_sort(ddr, 0, n * ELE_BYTES);
+    merge_sort(ddr, 0, n * ELE_BYTES);
+    if (memcmp(table, ref, (size_t)n * ELE_BYTES) != 0) {
+        fprintf(stderr, " ==> SORT FAILURE, %u rows <==\n", n);
+        rc = 1;
+    }
+    free(ref);
+    return rc;
+}
+
+// Step 3 with SORT_METHOD against the merge of two qsort()ed tables
+static int tb_intersect(snap_membus_t *ddr, unsigned int n1, unsigned int n2,
+        unsigned int letters)
+{
+    unsigned char *t1 = (unsigned char *)ddr;
+    unsigned char *t2 = t1 + MAX_TABLE_SIZE;
+    unsigned char *res = t1 + 2 * MAX_TABLE_SIZE;
+    unsigned char *r1 = (unsigned char *)malloc((size_t)n1 * ELE_BYTES);
+    unsigned char *r2 = (unsigned char *)malloc((size_t)n2 * ELE_BYTES);
+    unsigned char *ref = (unsigned char *)malloc((size_t)MIN(n1, n2) * ELE_BYTES);
+    unsigned int i = 0, j = 0, n3 = 0;
+    action_reg act_reg;
+    action_RO_config_reg Action_Config;
+    int c, rc = 0;
+
+    tb_fill(t1, n1, letters);
+    tb_fill(t2, n2, letters);
+    memcpy(r1, t1, (size_t)n1 * ELE_BYTES);
+    memcpy(r2, t2, (size_t)n2 * ELE_BYTES);
+    qsort(r1, n1, ELE_BYTES, tb_cmp_desc);
+    qsort(r2, n2, ELE_BYTES, tb_cmp_desc);
+    while (i < n1 && j < n2) {
+        c = tb_cmp_desc(r1 + (size_t)i * ELE_BYTES, r2 + (size_t)j * ELE_BYTES);
+        if (c == 0) {
+            memcpy(ref + (size_t)n3++ * ELE_BYTES, r1 + (size_t)i * ELE_BYTES, ELE_BYTES);
+            i++;
+            j++;
+        } else if (c < 0)
+            i++;
+        else
+            j++;
+    }
+
+    memset((void *)&act_reg, 0, sizeof(act_reg));
+    act_reg.Control.flags = 0x1;
+    act_reg.Data.src_tables_ddr0.addr = 0;
+    act_reg.Data.src_tables_ddr0.size = n1 * ELE_BYTES;
+    act_reg.Data.src_tables_ddr1.addr = MAX_TABLE_SIZE;
+    act_reg.Data.src_tables_ddr1.size = n2 * ELE_BYTES;
+    act_reg.Data.result_table.addr = 2 * MAX_TABLE_SIZE;
+    act_reg.Data.step = 3;
+    act_reg.Data.method = SORT_METHOD;
+    hls_action(NULL, NULL, ddr, &act_reg, &Action_Config);
+
+    if (act_reg.Control.Retc != SNAP_RETC_SUCCESS ||
+            act_reg.Data.result_table.size != n3 * ELE_BYTES ||
+            memcmp(res, ref, (size_t)n3 * ELE_BYTES) != 0) {
+        fprintf(stderr, " ==> INTERSECT FAILURE, %u x %u rows: %u of %u <==\n",
+                n1, n2, (unsigned int)act_reg.Data.result_table.size / ELE_BYTES, n3);
+        rc = 1;
+    }
+    free(r1);
+    free(r2);
+    free(ref);
+    return rc;
+}
+
+int main(void)
+{
+    static const unsigned int sizes[] = {
+        1, 5, NUM_SORT, RUN_ELES - 1, RUN_ELES, RUN_ELES + 1, 1000,
+        RUN_ELES * MERGE_WAYS, RUN_ELES * MERGE_WAYS + 3,
+    };
+    snap_membus_t *ddr;
+    action_reg act_reg;
+    action_RO_config_reg Action_Config;
+    unsigned int i;
+    int rc = 0;
+
+    ddr = (snap_membus_t *)mmap(NULL, TB_DDR_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ddr == MAP_FAILED) {
+        fprintf(stderr, " ==> NO MEMORY FOR THE DDR MODEL <==\n");
+        return 1;
+    }
+
+    /* Query ACTION_TYPE ... */
+    act_reg.Control.flags = 0x0;
+    hls_action(NULL, NULL, ddr, &act_reg, &Action_Config);
+    fprintf(stderr,
+            "ACTION_TYPE:   %08x\n"
+            "RELEASE_LEVEL: %08x\n"
+            "RETC:          %04x\n",
+            (unsigned int)Action_Config.action_type,
+            (unsigned int)Action_Config.release_level,
+            (unsigned int)act_reg.Control.Retc);
+
+    srand(1);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        rc |= tb_sort(ddr, sizes[i], 3);
+        rc |= tb_sort(ddr, sizes[i], 12);
+    }
+    rc |= tb_sort(ddr, RUN_ELES * MERGE_WAYS * MERGE_WAYS + 5, 8);   // 3 passes
+    rc |= tb_intersect(ddr, 1000, 3000, 5);
+    rc |= tb_intersect(ddr, 20000, 300, 6);
+    rc |= tb_intersect(ddr, 5000, 5000, 3);
+
+    if (rc == 0)
+        printf(" ==> SORT AND INTERSECT OK <==\n");
+    munmap(ddr, TB_DDR_SIZE);
+    return rc;
+}
+
+#endif /* NO_SYNTH */
@@ -27,6 +27,7 @@ extern "C" {
 
 #define END_SIGN 0xFFFFFFFF
 #define NUM_TABLES  2
+#define MAX_NUM_TABLES 16
 #define MAX_TABLE_SIZE (uint64_t)(1<<30)
 
 #define HT_ENTRY_NUM_EXP 24
@@ -35,13 +36,66 @@ extern "C" {
 #define DIRECT_METHOD 0
 #define HASH_METHOD 1
 #define SORT_METHOD 2
+#define SEARCH_METHOD 3 /* sort the smaller table, search the rows of the other */
+#define AUTO_METHOD 4   /* the cheapest for the table sizes, SW only */
 
+/*
+ * Cost model of AUTO_METHOD, in ns and bytes. snap_intersect -A
+ * measures it on synthetic tables and saves it as a profile file,
+ * $SNAP_INTERSECT_PROFILE or ~/.snap_intersect_profile. AUTO_METHOD
+ * reads it once, without one it uses built-in defaults.
+ */
+typedef struct intersect_cost {
+    double direct;      /* per row pair compared */
+    double hash_build;  /* per row put into the hash table */
+    double hash_probe;  /* per row looked up in it */
+    double hash_miss;   /* more per row if the table is not cached */
+    double cache;       /* bytes of a cached hash table */
+    double sort;        /* per row sorted and merged */
+    double sort_miss;   /* more per row if the sort is not cached */
+    double sort_cache;  /* bytes of a cached sort, rows and items */
+    double search;      /* per row searched and halving step */
+} intersect_cost_t;
 
+/*
+ * The cost model is measured on distinct rows. Repeated values make
+ * HASH cheaper, it keeps one slot per value, and SORT dearer, a long
+ * run of equal rows is sorted again on each further 8 bytes of the
+ * value. intersect_duplicates() estimates both from samples, NULL
+ * stands for distinct rows.
+ */
+typedef struct intersect_dups {
+    double build;   /* share of the smaller table repeating a value */
+    double ties;    /* more 8 byte sort keys per row of both tables */
+} intersect_dups_t;
+
+/*
+ * Set operation of the job. Duplicated rows count like in a multiset:
+ * a row which is c1 times in table 1 and c2 times in table 2 is
+ * min(c1, c2) times in the intersection, max(c1, c2) times in the union,
+ * c1 - c2 times in the difference and |c1 - c2| times in the symmetric
+ * difference. With OP_COUNT_ONLY no rows are written, only counted.
+ * Only the software does more than INTERSECT_OP.
+ */
+#define INTERSECT_OP   0
+#define UNION_OP       1
+#define DIFF_OP        2    /* rows of table 1 not in table 2 */
+#define SYMDIFF_OP     3
+#define OP_MASK        0x00ff
+#define OP_COUNT_ONLY  0x8000
+
+
+/*
+ * A job carries NUM_TABLES tables. The K-way intersection of up to
+ * MAX_NUM_TABLES tables, run_sw_intersection_k(), is software only and
+ * gets its tables directly from the host, not through a job.
+ */
 typedef struct intersect_job {
 	struct snap_addr src_tables_host[NUM_TABLES];	 /* input tables */
 	struct snap_addr src_tables_ddr[NUM_TABLES];	 /* input tables */
 	struct snap_addr result_table;             /* output table */
-    uint32_t step;
+    uint16_t step;
+    uint16_t operation;
     uint32_t method;
 } intersect_job_t;
 
@@ -51,6 +105,83 @@ typedef unsigned int ptr_t;
 void copyvalue(value_t dst, value_t src);
 int cmpvalue(const value_t src1, const value_t src2);
 uint32_t run_sw_intersection(int method, value_t * table1, uint32_t n1, value_t* table2, uint32_t n2, value_t * result_array);
+uint32_t run_sw_intersection_k(int method, value_t *tables[], uint32_t nums[], uint32_t k, value_t *result_array);
+uint64_t value_hash(const value_t v);
+
+/*
+ * intersect_selectivity() estimates from samples which share of the
+ * smaller table is in the larger one, intersect_auto_method() picks
+ * the method of the lowest intersect_cost_estimate() with the cost
+ * model in use. intersect_cost_set() replaces it.
+ */
+const char *intersect_cost_file(void);
+int intersect_cost_load(const char *fname, intersect_cost_t *cost);
+int intersect_cost_save(const char *fname, const intersect_cost_t *cost);
+void intersect_cost_set(const intersect_cost_t *cost);
+double intersect_cost_estimate(int method, uint32_t n1, uint32_t n2, double selectivity,
+        const intersect_dups_t *dups);
+int intersect_auto_method(uint32_t n1, uint32_t n2, double selectivity,
+        const intersect_dups_t *dups);
+double intersect_selectivity(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2);
+void intersect_duplicates(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2,
+        intersect_dups_t *dups);
+
+/*
+ * Result rows of run_sw_setop() go out in pages of max rows. A full
+ * page is passed to flush() and then reused, so is the last partial
+ * one at the end. rows NULL counts only. rc keeps the first error of
+ * flush(), no rows are written after it.
+ */
+typedef struct intersect_sink {
+    value_t *rows;
+    uint32_t max;
+    uint32_t n;
+    int (*flush)(value_t *rows, uint32_t n, void *priv);
+    void *priv;
+    int rc;
+} intersect_sink_t;
+
+uint32_t run_sw_setop(int method, int operation, value_t *table1, uint32_t n1, value_t *table2, uint32_t n2, intersect_sink_t *sink);
+/*
+ * Integer set of 32 or 64 bit IDs, for ID tables which need no value_t
+ * rows. Like a roaring bitmap the IDs are grouped by their upper 48
+ * bits into containers of the lower 16 bits. A container of up to
+ * INTSET_ARRAY_MAX values is a sorted uint16_t array, a denser one a
+ * bitmap of INTSET_BITMAP_WORDS. Only the software does integer sets.
+ */
+#define INTSET_ARRAY_MAX    4096
+#define INTSET_BITMAP_WORDS (65536 / 64)
+#define INTSET_ARRAY        0
+#define INTSET_BITMAP       1
+
+typedef struct intset_container {
+    uint64_t key;       /* id >> 16 */
+    uint32_t card;      /* values in the container */
+    uint32_t type;
+    void *data;         /* uint16_t[card] or uint64_t[INTSET_BITMAP_WORDS] */
+} intset_container_t;
+
+typedef struct intset {
+    uint64_t card;
+    uint64_t n;         /* containers, in ascending key order */
+    intset_container_t *c;
+} intset_t;
+
+/*
+ * intset_build() takes n IDs of width 4 or 8 bytes in any order,
+ * duplicates are dropped. intset_intersect() returns the size of the
+ * intersection and with result != NULL stores it as a new set there,
+ * NULL if that failed. intset_ids() writes the IDs in ascending order.
+ */
+intset_t *intset_build(const void *ids, uint64_t n, unsigned int width);
+uint64_t intset_intersect(const intset_t *a, const intset_t *b, intset_t **result);
+uint64_t intset_ids(const intset_t *s, void *ids, unsigned int width);
+uint64_t intset_bytes(const intset_t *s);
+void intset_free(intset_t *s);
+
+uint32_t intersect_hash_mt(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2, value_t result_array[], unsigned int nthreads);
+uint32_t intersect_hash_chained(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2, value_t result_array[]);
+uint32_t intersect_sort_qsort(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2, value_t result_array[]);
 
 struct entry_t
 {
@@ -43,6 +43,9 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
+#include <float.h>
+#include <pthread.h>
 #include <endian.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -120,29 +123,339 @@ static uint32_t intersect_direct(value_t table1[], uint32_t n1,
 {
     // a straight forward way to do intersection.
     // we can compare the speed with following intersect() function.
+    // A matched row of table2 is taken, so duplicates count like in
+    // the other methods.
     uint32_t i,j;
     uint32_t n3;
+    uint8_t *taken = calloc(MAX(n2, 1u), sizeof(*taken));
 
+    if (!taken) {
+        fprintf(stderr, "ERROR: taken malloc failed.\n");
+        return 0;
+    }
     n3 = 0; //number of result_array entries
 
     for ( i = 0; i < n1; i++)
     {
         for (j = 0; j < n2; j++)
         {
-            if(cmpvalue(table1[i], table2[j]) == 0)
+            if(!taken[j] && cmpvalue(table1[i], table2[j]) == 0)
             {
                 copyvalue(result_array[n3], table2[j]);
+                taken[j] = 1;
                 n3++;
                 break;
             }
         }
     }
+    free(taken);
     return n3;
 }
 
 //////////////////////////////////////////////////////////////////
 //   Intersect Method: Hash
 //////////////////////////////////////////////////////////////////
+
+/*
+ * 64 bit fingerprint of a value over the bytes up to its '\0', the
+ * part cmpvalue() looks at. It is never 0, which marks empty slots.
+ */
+uint64_t value_hash(const value_t v)
+{
+    size_t len = strnlen(v, sizeof(value_t));
+    uint64_t h = len * 0x9e3779b97f4a7c15ull;
+    uint64_t w;
+    size_t i;
+
+    for (i = 0; i < len; i += sizeof(w)) {
+        w = 0;
+        memcpy(&w, v + i, MIN(sizeof(w), len - i));
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 32;
+    return h ? h : 1;
+}
+
+/*
+ * Open addressing with linear probing. All slots come from one arena,
+ * which is freed in one go. A slot holds one distinct value of the
+ * build rows: a tag from its fingerprint, its first build row and how
+ * many build rows have it. The rows stay where they are, the full
+ * values are compared only if the tags match. A match takes one of the
+ * rows left, so duplicates intersect like in the sort method, and a
+ * probe ends at the slot of its value however many duplicates there
+ * are. The table is at most half full.
+ */
+struct ht_slot {
+    uint32_t tag;   // high fingerprint bits, never 0, 0: empty
+    uint32_t pos;   // first build row with the value + 1
+    uint32_t count; // build rows with the value
+    uint32_t left;  // of these not taken yet
+};
+
+struct ht_arena {
+    struct ht_slot *slot;
+    uint64_t mask;
+    value_t *table;
+    const uint32_t *rows;   // build rows of table, NULL: all in order
+};
+
+#define HT_ROW(ht, pos) ((ht)->rows ? (ht)->rows[pos] : (pos))
+#define HT_TAG(fp)      ((uint32_t)((fp) >> 32) | 1)
+#define HT_THREADS_MAX  128u
+#define HT_MT_MIN_ROWS  (1u << 16)  // smaller tables are done by one thread
+#define HT_MT_THREAD_ROWS (1u << 14)
+
+static int ht_alloc(struct ht_arena *ht, value_t table[],
+        const uint32_t rows[], uint32_t n)
+{
+    uint64_t size = 16;
+
+    while (size < 2 * (uint64_t)n)
+        size <<= 1;
+    ht->mask = size - 1;
+    ht->table = table;
+    ht->rows = rows;
+
+    ht->slot = calloc(size, sizeof(*ht->slot));
+    if (!ht->slot) {
+        fprintf(stderr, "ERROR: hash table malloc failed.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// The slot of value v with fingerprint fp, or the empty slot ending its probe
+static struct ht_slot *ht_find(struct ht_arena *ht, const value_t v,
+        uint64_t fp)
+{
+    uint32_t tag = HT_TAG(fp);
+    uint64_t k;
+    struct ht_slot *slot;
+
+    for (k = fp & ht->mask; ; k = (k + 1) & ht->mask) {
+        slot = &ht->slot[k];
+        if (slot->tag == 0 || (slot->tag == tag &&
+                    cmpvalue(v, ht->table[HT_ROW(ht, slot->pos - 1)]) == 0))
+            return slot;
+    }
+}
+
+static int ht_build(struct ht_arena *ht, value_t table[],
+        const uint32_t rows[], uint32_t n)
+{
+    struct ht_slot *slot;
+    uint64_t fp;
+    uint32_t i;
+
+    if (ht_alloc(ht, table, rows, n) != 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        fp = value_hash(table[HT_ROW(ht, i)]);
+        slot = ht_find(ht, table[HT_ROW(ht, i)], fp);
+        if (slot->tag == 0) {
+            slot->tag = HT_TAG(fp);
+            slot->pos = i + 1;
+        }
+        slot->count++;
+        slot->left++;
+    }
+    return 0;
+}
+
+// Takes a build row equal to v which is left, NULL if there is none
+static struct ht_slot *ht_take(struct ht_arena *ht, const value_t v)
+{
+    struct ht_slot *slot = ht_find(ht, v, value_hash(v));
+
+    if (slot->left == 0)
+        return NULL;
+    slot->left--;
+    return slot;
+}
+
+static uint32_t intersect_hash(value_t table1[], uint32_t n1,
+        value_t table2[], uint32_t n2,
+        value_t result_array[] )
+{
+    struct ht_arena ht;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t i, n3 = 0, ns = MIN(n1, n2);
+
+    // both tables large, each thread with HT_MT_THREAD_ROWS of the smaller
+    if (nthreads > 1 && ns >= HT_MT_MIN_ROWS)
+        return intersect_hash_mt(table1, n1, table2, n2, result_array,
+                MIN((unsigned long)nthreads, ns / HT_MT_THREAD_ROWS));
+    if (ht_build(&ht, table1, NULL, n1) != 0)
+        return 0;
+
+    for (i = 0; i < n2; i++) {
+        if (ht_take(&ht, table2[i])) {
+            copyvalue(result_array[n3], table2[i]);
+            n3++;
+        }
+    }
+    free(ht.slot);
+    return n3;
+}
+
+/*
+ * Multi-threaded build and probe without locks. The table is sized up
+ * front and each build thread inserts a slice of the build rows. A new
+ * value claims an empty slot by CAS on its tag, then publishes its row
+ * in pos, which a thread with the same tag waits for before it compares
+ * values. Rows of a value already in the table only add to its counts.
+ * Once all are joined, each probe thread matches a slice of the probe
+ * rows, taking a build row by CAS on left of the value's slot, and
+ * lists the probe rows it matched in its part of hits[]. The lists are
+ * then copied to the result, each at its offset.
+ */
+struct ht_part {
+    struct ht_arena *ht;
+    value_t *table;     // build or probe rows
+    uint32_t lo, hi;
+    uint32_t *hits;     // probe rows matched, room for hi - lo
+    uint32_t n_hits;
+    value_t *result;    // where the hits go
+};
+
+static void *ht_build_part(void *arg)
+{
+    struct ht_part *p = arg;
+    struct ht_slot *slot = p->ht->slot;
+    uint64_t mask = p->ht->mask, fp, k;
+    uint32_t i, tag, cur, pos;
+
+    for (i = p->lo; i < p->hi; i++) {
+        fp = value_hash(p->table[i]);
+        tag = HT_TAG(fp);
+        for (k = fp & mask; ; k = (k + 1) & mask) {
+            cur = __atomic_load_n(&slot[k].tag, __ATOMIC_ACQUIRE);
+            if (cur == 0 && __atomic_compare_exchange_n(&slot[k].tag, &cur,
+                        tag, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&slot[k].pos, i + 1, __ATOMIC_RELEASE);
+                break;
+            }
+            if (cur != tag)
+                continue;
+            while ((pos = __atomic_load_n(&slot[k].pos,
+                            __ATOMIC_ACQUIRE)) == 0)
+                ;   // the claiming thread is about to publish it
+            if (cmpvalue(p->table[i], p->table[pos - 1]) == 0)
+                break;
+        }
+        __atomic_fetch_add(&slot[k].count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&slot[k].left, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void *ht_probe_part(void *arg)
+{
+    struct ht_part *p = arg;
+    struct ht_slot *slot;
+    uint32_t i, left;
+
+    p->n_hits = 0;
+    for (i = p->lo; i < p->hi; i++) {
+        slot = ht_find(p->ht, p->table[i], value_hash(p->table[i]));
+        left = __atomic_load_n(&slot->left, __ATOMIC_RELAXED);
+        while (left != 0) {
+            if (__atomic_compare_exchange_n(&slot->left, &left, left - 1,
+                        0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                p->hits[p->n_hits++] = i;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *ht_copy_part(void *arg)
+{
+    struct ht_part *p = arg;
+    uint32_t i;
+
+    for (i = 0; i < p->n_hits; i++)
+        copyvalue(p->result[i], p->table[p->hits[i]]);
+    return NULL;
+}
+
+static void ht_run(void *(*fn)(void *), struct ht_part *part,
+        unsigned int nthreads)
+{
+    pthread_t tid[HT_THREADS_MAX];
+    unsigned int t, started = 0;
+
+    for (t = 1; t < nthreads; t++, started++)
+        if (pthread_create(&tid[t], NULL, fn, &part[t]) != 0)
+            break;
+    fn(&part[0]);
+    for (t = started + 1; t < nthreads; t++)   // did not start
+        fn(&part[t]);
+    for (t = 1; t <= started; t++)
+        pthread_join(tid[t], NULL);
+}
+
+static void ht_slices(struct ht_part *part, unsigned int nthreads,
+        value_t table[], uint32_t n)
+{
+    unsigned int t;
+
+    for (t = 0; t < nthreads; t++) {
+        part[t].table = table;
+        part[t].lo = (uint64_t)n * t / nthreads;
+        part[t].hi = (uint64_t)n * (t + 1) / nthreads;
+    }
+}
+
+uint32_t intersect_hash_mt(value_t table1[], uint32_t n1,
+        value_t table2[], uint32_t n2, value_t result_array[],
+        unsigned int nthreads)
+{
+    struct ht_part part[HT_THREADS_MAX];
+    struct ht_arena ht;
+    uint32_t *hits, n3 = 0;
+    unsigned int t;
+
+    nthreads = MIN(MAX(nthreads, 1u), HT_THREADS_MAX);
+    if (ht_alloc(&ht, table1, NULL, n1) != 0)
+        return 0;
+    hits = malloc(MAX(n2, 1u) * sizeof(*hits));
+    if (!hits) {
+        fprintf(stderr, "ERROR: hash table malloc failed.\n");
+        free(ht.slot);
+        return 0;
+    }
+    for (t = 0; t < nthreads; t++)
+        part[t].ht = &ht;
+
+    ht_slices(part, nthreads, table1, n1);
+    ht_run(ht_build_part, part, nthreads);
+
+    ht_slices(part, nthreads, table2, n2);
+    for (t = 0; t < nthreads; t++)
+        part[t].hits = hits + part[t].lo;
+    ht_run(ht_probe_part, part, nthreads);
+
+    for (t = 0; t < nthreads; t++) {
+        part[t].result = result_array + n3;
+        n3 += part[t].n_hits;
+    }
+    ht_run(ht_copy_part, part, nthreads);
+
+    free(ht.slot);
+    free(hits);
+    return n3;
+}
+
+/*
+ * Chained table of malloc'ed entries, hashing all bytes of a value.
+ */
 static uint32_t ht_hash(value_t key)
 {
     uint64_t hashval = 0;
@@ -167,9 +480,12 @@ static uint32_t ht_hash(value_t key)
 //   ......
 //
 // When there are many entries having the same key, they will link in a list.
+//
+// This was the HASH_METHOD before the open addressing table above, it is
+// kept as the reference for snap_intersect -b.
 
 
-static uint32_t intersect_hash(value_t table1[], uint32_t n1,
+uint32_t intersect_hash_chained(value_t table1[], uint32_t n1,
         value_t table2[], uint32_t n2,
         value_t result_array[] )
 {
@@ -234,10 +550,331 @@ static uint32_t intersect_hash(value_t table1[], uint32_t n1,
 //////////////////////////////////////////////////////////////////
 //   Intersect Method: Sort
 //////////////////////////////////////////////////////////////////
+
+/*
+ * The rows are not moved. A radix sort orders (key, row) items, where
+ * key holds 8 bytes of the value from off on, big endian, so the key
+ * order is the cmpvalue() order. exact tells that the value ends within
+ * these bytes, then equal keys mean equal values. Runs of equal keys
+ * which are not exact are sorted again on the next 8 bytes.
+ */
+struct sort_item {
+    uint64_t key;
+    uint32_t row;
+    uint32_t exact;
+};
+
+#define SORT_KEY_BYTES      8
+#define SORT_THREADS_MAX    16u
+#define SORT_MT_MIN_ITEMS   (1 << 16)   // fewer items are sorted by one thread
+#define SORT_TIES_RADIX     64          // shorter runs of ties are sorted by insertion
+
+// cmpvalue() compares plain chars, flip the sign bit if they are signed
+#define SORT_CHAR_FLIP      ((char)-1 < 0 ? 0x80 : 0x00)
+
+static void sort_key(struct sort_item *item, const value_t v, size_t off)
+{
+    uint64_t key = 0;
+    size_t i;
+    uint8_t c = 0;
+
+    item->exact = 0;
+    for (i = off; i < off + SORT_KEY_BYTES; i++) {
+        if (!item->exact) {
+            c = i < sizeof(value_t) ? (uint8_t)v[i] : 0;
+            item->exact = (c == 0);
+        }
+        key = key << 8 | (uint8_t)(c ^ SORT_CHAR_FLIP);
+    }
+    item->key = key;
+}
+
+// Order of the rows of two items with keys from the start of the value
+static inline int sort_item_cmp(const struct sort_item *a, value_t ta[],
+        const struct sort_item *b, value_t tb[])
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    if (a->exact)
+        return 0;
+    return cmpvalue(ta[a->row], tb[b->row]);
+}
+
+struct radix_part {
+    struct sort_item *src, *dst;
+    size_t lo, hi;
+    unsigned int shift;
+    size_t count[256];
+};
+
+static void *radix_count(void *arg)
+{
+    struct radix_part *p = arg;
+    size_t i;
+
+    memset(p->count, 0, sizeof(p->count));
+    for (i = p->lo; i < p->hi; i++)
+        p->count[(p->src[i].key >> p->shift) & 0xff]++;
+    return NULL;
+}
+
+// count[] holds the first destination of each digit
+static void *radix_scatter(void *arg)
+{
+    struct radix_part *p = arg;
+    size_t i;
+
+    for (i = p->lo; i < p->hi; i++)
+        p->dst[p->count[(p->src[i].key >> p->shift) & 0xff]++] = p->src[i];
+    return NULL;
+}
+
+static void radix_run(void *(*fn)(void *), struct radix_part *part,
+        unsigned int nthreads)
+{
+    pthread_t tid[SORT_THREADS_MAX];
+    unsigned int t, started = 0;
+
+    for (t = 1; t < nthreads; t++, started++)
+        if (pthread_create(&tid[t], NULL, fn, &part[t]) != 0)
+            break;
+    fn(&part[0]);
+    for (t = started + 1; t < nthreads; t++)   // did not start
+        fn(&part[t]);
+    for (t = 1; t <= started; t++)
+        pthread_join(tid[t], NULL);
+}
+
+/*
+ * LSD radix sort of n items on key, a byte per pass. A thread counts
+ * and scatters its slice of the items. Passes on a byte which is the
+ * same in all keys are skipped. tmp has room for n items.
+ */
+static void radix_sort(struct sort_item *items, struct sort_item *tmp,
+        size_t n, unsigned int nthreads)
+{
+    struct radix_part part[SORT_THREADS_MAX];
+    struct sort_item *src = items, *dst = tmp, *swap;
+    unsigned int shift, t;
+    size_t d, pos;
+
+    if (n < SORT_MT_MIN_ITEMS)
+        nthreads = 1;
+    nthreads = MIN(MAX(nthreads, 1u), SORT_THREADS_MAX);
+
+    for (shift = 0; shift < 64; shift += 8) {
+        for (t = 0; t < nthreads; t++) {
+            part[t].src = src;
+            part[t].dst = dst;
+            part[t].lo = n * t / nthreads;
+            part[t].hi = n * (t + 1) / nthreads;
+            part[t].shift = shift;
+        }
+        radix_run(radix_count, part, nthreads);
+
+        d = (src[0].key >> shift) & 0xff;
+        for (pos = 0, t = 0; t < nthreads; t++)
+            pos += part[t].count[d];
+        if (pos == n)
+            continue;
+
+        for (pos = 0, d = 0; d < 256; d++)
+            for (t = 0; t < nthreads; t++) {
+                size_t c = part[t].count[d];
+                part[t].count[d] = pos;
+                pos += c;
+            }
+        radix_run(radix_scatter, part, nthreads);
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != items)
+        memcpy(items, src, n * sizeof(*items));
+}
+
+// Sorts the runs of equal, not exact keys on the next bytes
+/*
+ * A short run of equal keys is cheaper to sort by insertion on the
+ * whole values than with the 8 passes of a radix sort on the next key.
+ * The items keep their keys, which are equal anyway.
+ */
+static void sort_ties_short(value_t table[], struct sort_item *items,
+        size_t n)
+{
+    struct sort_item item;
+    size_t i, j;
+
+    for (i = 1; i < n; i++) {
+        item = items[i];
+        for (j = i; j > 0 &&
+                cmpvalue(table[items[j - 1].row], table[item.row]) > 0; j--)
+            items[j] = items[j - 1];
+        items[j] = item;
+    }
+}
+
+static void sort_ties(value_t table[], struct sort_item *items,
+        struct sort_item *tmp, size_t n, size_t off, unsigned int nthreads)
+{
+    size_t lo, hi, i;
+
+    if (off + SORT_KEY_BYTES >= sizeof(value_t))
+        return;
+
+    for (lo = 0; lo < n; lo = hi) {
+        for (hi = lo + 1; hi < n && items[hi].key == items[lo].key; hi++)
+            ;
+        if (hi - lo < 2 || items[lo].exact)
+            continue;
+        if (hi - lo < SORT_TIES_RADIX) {
+            sort_ties_short(table, items + lo, hi - lo);
+            continue;
+        }
+
+        for (i = lo; i < hi; i++)
+            sort_key(&items[i], table[items[i].row], off + SORT_KEY_BYTES);
+        radix_sort(items + lo, tmp, hi - lo, nthreads);
+        sort_ties(table, items + lo, tmp, hi - lo, off + SORT_KEY_BYTES,
+                nthreads);
+        for (i = lo; i < hi; i++)
+            sort_key(&items[i], table[items[i].row], off);
+    }
+}
+
+static void sort_table(value_t table[], uint32_t n, struct sort_item *items,
+        struct sort_item *tmp, unsigned int nthreads)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        sort_key(&items[i], table[i], 0);
+        items[i].row = i;
+    }
+    radix_sort(items, tmp, n, nthreads);
+    sort_ties(table, items, tmp, n, 0, nthreads);
+}
+
+/*
+ * Branchless merge of two sorted item lists, unless one is much
+ * shorter. Then each of its items gallops through the longer one.
+ * The items of s1 found in s2 go to out in order, out may be s1.
+ */
+#define SORT_GALLOP_RATIO   32
+
+// First l[j] >= x from l[j] on, nl if none
+static uint32_t gallop(value_t tl[], const struct sort_item *l, uint32_t j,
+        uint32_t nl, value_t tx[], const struct sort_item *x)
+{
+    uint32_t lo, hi, mid, step = 1;
+
+    if (j >= nl || sort_item_cmp(&l[j], tl, x, tx) >= 0)
+        return j;
+
+    // l[lo] < x, find the first l[hi] >= x
+    lo = j;
+    while (lo + step < nl && sort_item_cmp(&l[lo + step], tl, x, tx) < 0) {
+        lo += step;
+        step <<= 1;
+    }
+    hi = MIN(lo + step, nl);
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (sort_item_cmp(&l[mid], tl, x, tx) < 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return hi;
+}
+
+static uint32_t merge_items(value_t table1[], const struct sort_item *s1,
+        uint32_t n1, value_t table2[], const struct sort_item *s2,
+        uint32_t n2, struct sort_item *out)
+{
+    uint32_t i = 0, j = 0, n3 = 0;
+    uint64_t a, b;
+    int c;
+
+    if ((uint64_t)n1 * SORT_GALLOP_RATIO < n2) {
+        for (i = 0; i < n1; i++) {
+            j = gallop(table2, s2, j, n2, table1, &s1[i]);
+            if (j == n2)
+                break;
+            if (sort_item_cmp(&s1[i], table1, &s2[j], table2) == 0) {
+                out[n3++] = s1[i];
+                j++;
+            }
+        }
+        return n3;
+    }
+    if ((uint64_t)n2 * SORT_GALLOP_RATIO < n1) {
+        for (j = 0; j < n2; j++) {
+            i = gallop(table1, s1, i, n1, table2, &s2[j]);
+            if (i == n1)
+                break;
+            if (sort_item_cmp(&s1[i], table1, &s2[j], table2) == 0)
+                out[n3++] = s1[i++];
+        }
+        return n3;
+    }
+
+    while (i < n1 && j < n2) {
+        a = s1[i].key;
+        b = s2[j].key;
+        if (a == b) {
+            c = s1[i].exact ? 0 : cmpvalue(table1[s1[i].row], table2[s2[j].row]);
+            if (c == 0) {
+                out[n3++] = s1[i];
+                i++;
+                j++;
+                continue;
+            }
+            a = c > 0;
+            b = c < 0;
+        }
+        i += a < b;
+        j += b < a;
+    }
+    return n3;
+}
+
 static uint32_t intersect_sort( value_t table1[], uint32_t n1,
         value_t table2[], uint32_t n2,
         value_t result_array[] )
 {
+    struct sort_item *s1, *s2, *tmp;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t i, n3 = 0;
+
+    s1 = malloc(((size_t)n1 + n2 + MAX(n1, n2)) * sizeof(*s1));
+    if (!s1) {
+        fprintf(stderr, "ERROR: sort items malloc failed.\n");
+        return 0;
+    }
+    s2 = s1 + n1;
+    tmp = s2 + n2;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    sort_table(table1, n1, s1, tmp, nthreads);
+    sort_table(table2, n2, s2, tmp, nthreads);
+    n3 = merge_items(table2, s2, n2, table1, s1, n1, s2);
+    for (i = 0; i < n3; i++)
+        copyvalue(result_array[i], table2[s2[i].row]);
+    free(s1);
+    return n3;
+}
+
+/*
+ * qsort() of the rows and a merge. This was the SORT_METHOD before the
+ * radix sort above, it is kept as the reference for snap_intersect -b.
+ * It sorts the tables in place.
+ */
+uint32_t intersect_sort_qsort( value_t table1[], uint32_t n1,
+        value_t table2[], uint32_t n2,
+        value_t result_array[] )
+{
 
     uint32_t n3 = 0;
     uint32_t i, j;
@@ -265,6 +902,341 @@ static uint32_t intersect_sort( value_t table1[], uint32_t n1,
     return n3;
 }
 
+//////////////////////////////////////////////////////////////////
+//   Intersect Method: Search
+//////////////////////////////////////////////////////////////////
+
+/*
+ * Only the smaller table ts is sorted, each row of the larger one
+ * gallops from the start to its equal rows. used[] counts the taken
+ * ones at the first of them, so duplicates keep the lower count.
+ */
+static uint32_t intersect_search(value_t ts[], uint32_t ns,
+        value_t tl[], uint32_t nl, value_t result_array[])
+{
+    struct sort_item *items, probe;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t *used, i, p, q, n3 = 0;
+
+    if (ns == 0)
+        return 0;
+    items = malloc(2 * (size_t)ns * sizeof(*items));
+    used = calloc(ns, sizeof(*used));
+    if (!items || !used) {
+        fprintf(stderr, "ERROR: sort items malloc failed.\n");
+        free(items);
+        free(used);
+        return 0;
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    sort_table(ts, ns, items, items + ns, nthreads);
+
+    for (i = 0; i < nl; i++) {
+        sort_key(&probe, tl[i], 0);
+        probe.row = i;
+        p = gallop(ts, items, 0, ns, tl, &probe);
+        q = p + (p < ns ? used[p] : 0);
+        if (q < ns && sort_item_cmp(&items[q], ts, &probe, tl) == 0) {
+            used[p]++;
+            copyvalue(result_array[n3], tl[i]);
+            n3++;
+        }
+    }
+    free(used);
+    free(items);
+    return n3;
+}
+
+//////////////////////////////////////////////////////////////////
+//   Cost Model
+//////////////////////////////////////////////////////////////////
+
+#define COST_PROFILE        ".snap_intersect_profile"
+#define SEL_SAMPLE_BUILD    1024u
+#define SEL_SAMPLE_PROBE    8192u
+
+// Measured with snap_intersect -A on a 2.x GHz x86 server
+static intersect_cost_t cost_model = {
+    .direct     = 1.7,
+    .hash_build = 60.0,
+    .hash_probe = 46.0,
+    .hash_miss  = 165.0,
+    .cache      = 2 * 1024 * 1024,
+    .sort       = 40.0,
+    .sort_miss  = 80.0,
+    .sort_cache = 16 * 1024 * 1024,
+    .search     = 8.0,
+};
+static pthread_once_t cost_once = PTHREAD_ONCE_INIT;
+
+static const struct {
+    const char *name;
+    size_t offs;
+} cost_keys[] = {
+    { "direct",     offsetof(intersect_cost_t, direct) },
+    { "hash_build", offsetof(intersect_cost_t, hash_build) },
+    { "hash_probe", offsetof(intersect_cost_t, hash_probe) },
+    { "hash_miss",  offsetof(intersect_cost_t, hash_miss) },
+    { "cache",      offsetof(intersect_cost_t, cache) },
+    { "sort",       offsetof(intersect_cost_t, sort) },
+    { "sort_miss",  offsetof(intersect_cost_t, sort_miss) },
+    { "sort_cache", offsetof(intersect_cost_t, sort_cache) },
+    { "search",     offsetof(intersect_cost_t, search) },
+};
+
+#define COST_KEYS (sizeof(cost_keys) / sizeof(cost_keys[0]))
+
+const char *intersect_cost_file(void)
+{
+    static char fname[256];
+    const char *env = getenv("SNAP_INTERSECT_PROFILE");
+    const char *home = getenv("HOME");
+
+    if (env)
+        return env;
+    snprintf(fname, sizeof(fname), "%s/%s", home ? home : ".", COST_PROFILE);
+    return fname;
+}
+
+// Lines of "<key> <ns>", '#' comments. Missing keys keep their value.
+int intersect_cost_load(const char *fname, intersect_cost_t *cost)
+{
+    char line[128], key[64];
+    double ns;
+    unsigned int k;
+    FILE *fp;
+
+    fp = fopen(fname, "r");
+    if (!fp)
+        return -ENOENT;
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || sscanf(line, "%63s %lf", key, &ns) != 2 ||
+                ns <= 0.0)
+            continue;
+        for (k = 0; k < COST_KEYS; k++)
+            if (strcmp(key, cost_keys[k].name) == 0)
+                *(double *)((char *)cost + cost_keys[k].offs) = ns;
+    }
+    fclose(fp);
+    return 0;
+}
+
+int intersect_cost_save(const char *fname, const intersect_cost_t *cost)
+{
+    unsigned int k;
+    FILE *fp;
+    int rc = 0;
+
+    fp = fopen(fname, "w");
+    if (!fp) {
+        fprintf(stderr, "ERROR: cannot write %s: %s\n", fname, strerror(errno));
+        return -EIO;
+    }
+    fprintf(fp, "# snap_intersect cost model, ns\n");
+    for (k = 0; k < COST_KEYS; k++)
+        fprintf(fp, "%s %.4f\n", cost_keys[k].name,
+                *(const double *)((const char *)cost + cost_keys[k].offs));
+    if (fclose(fp) != 0)
+        rc = -EIO;
+    return rc;
+}
+
+static void cost_init(void)
+{
+    intersect_cost_load(intersect_cost_file(), &cost_model);
+}
+
+void intersect_cost_set(const intersect_cost_t *cost)
+{
+    pthread_once(&cost_once, cost_init);
+    cost_model = *cost;
+}
+
+// Share of random accesses to bytes which miss a cache of size bytes
+static double miss_share(double cache, double bytes)
+{
+    return bytes > cache ? 1.0 - cache / bytes : 0.0;
+}
+
+/*
+ * Sorting reads the rows and moves their items between two arrays.
+ * Each further key of tied rows costs about as much as the first.
+ */
+static double sort_cost(const intersect_cost_t *c, double rows, double ties)
+{
+    double bytes = rows * (sizeof(value_t) + 2 * sizeof(struct sort_item));
+
+    return (c->sort + miss_share(c->sort_cache, bytes) * c->sort_miss) *
+        rows * (1.0 + ties);
+}
+
+double intersect_cost_estimate(int method, uint32_t n1, uint32_t n2, double selectivity,
+        const intersect_dups_t *dups)
+{
+    const intersect_cost_t *c = &cost_model;
+    double ns = MIN(n1, n2), nl = MAX(n1, n2), miss;
+    double ties = dups ? dups->ties : 0.0;
+    double values = dups ? MAX(ns * (1.0 - dups->build), 1.0) : ns;
+    uint64_t slots = 16;
+
+    pthread_once(&cost_once, cost_init);
+    switch (method) {
+        case DIRECT_METHOD:
+            // a match ends the scan of table 2 half way on average
+            return c->direct * n1 * n2 *
+                (1.0 - 0.5 * selectivity * ns / MAX(n1, 1u));
+        case HASH_METHOD:
+            // a cache line per value at most, they are spread out
+            while (slots < 2 * ns)
+                slots <<= 1;
+            miss = miss_share(c->cache, MIN(slots * sizeof(struct ht_slot),
+                        values * 64));
+            return (c->hash_build + miss * c->hash_miss) * ns +
+                (c->hash_probe + miss * c->hash_miss) * nl;
+        case SORT_METHOD:
+            return sort_cost(c, ns + nl, ties);
+        case SEARCH_METHOD:
+            // halving steps of a search, no libm for log2()
+            return sort_cost(c, ns, ties) + c->search * nl *
+                (64 - __builtin_clzll((uint64_t)ns | 1));
+    }
+    return DBL_MAX;
+}
+
+int intersect_auto_method(uint32_t n1, uint32_t n2, double selectivity,
+        const intersect_dups_t *dups)
+{
+    int method, best = HASH_METHOD;
+    double cost, best_cost = DBL_MAX;
+
+    for (method = DIRECT_METHOD; method <= SEARCH_METHOD; method++) {
+        cost = intersect_cost_estimate(method, n1, n2, selectivity, dups);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = method;
+        }
+    }
+    return best;
+}
+
+static int fp_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Evenly spaced rows of the smaller table are fingerprinted, then as
+ * many of the larger one looked up. With k of ns rows sampled, a hit
+ * rate h of the m probes says h * nl * ns / k rows are in both.
+ */
+double intersect_selectivity(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2)
+{
+    uint64_t fp[SEL_SAMPLE_BUILD], h;
+    value_t *ts = table1, *tl = table2;
+    uint32_t ns = n1, nl = n2, k, m, i, hits = 0;
+
+    if (n2 < n1) {
+        ts = table2;
+        ns = n2;
+        tl = table1;
+        nl = n1;
+    }
+    k = MIN(ns, SEL_SAMPLE_BUILD);
+    m = MIN(nl, SEL_SAMPLE_PROBE);
+    if (k == 0)
+        return 0.0;
+
+    for (i = 0; i < k; i++)
+        fp[i] = value_hash(ts[(uint64_t)i * ns / k]);
+    qsort(fp, k, sizeof(fp[0]), fp_cmp);
+    for (i = 0; i < m; i++) {
+        h = value_hash(tl[(uint64_t)i * nl / m]);
+        hits += bsearch(&h, fp, k, sizeof(fp[0]), fp_cmp) != NULL;
+    }
+    return MIN((double)hits * nl / ((double)m * k), 1.0);
+}
+
+struct dup_fp {
+    uint64_t h;
+    uint32_t row;
+};
+
+static int dup_fp_cmp(const void *a, const void *b)
+{
+    return fp_cmp(&((const struct dup_fp *)a)->h, &((const struct dup_fp *)b)->h);
+}
+
+/*
+ * A value sampled c times of k rows stands for about c * n / k rows.
+ * *repeat is the share of the sample repeating a value sampled before,
+ * *ties the further sort keys per row of the runs which are too long
+ * for sort_ties_short(), up to the end of the value.
+ */
+static void dup_sample(value_t table[], uint32_t n, double *repeat, double *ties)
+{
+    struct dup_fp fp[SEL_SAMPLE_BUILD];
+    uint32_t k = MIN(n, SEL_SAMPLE_BUILD), i, j;
+    size_t len;
+
+    *repeat = 0.0;
+    *ties = 0.0;
+    if (k < 2)
+        return;
+
+    for (i = 0; i < k; i++) {
+        fp[i].row = (uint64_t)i * n / k;
+        fp[i].h = value_hash(table[fp[i].row]);
+    }
+    qsort(fp, k, sizeof(fp[0]), dup_fp_cmp);
+    for (i = 0; i < k; i = j) {
+        for (j = i + 1; j < k && fp[j].h == fp[i].h; j++)
+            ;
+        if (j - i < 2)
+            continue;
+        *repeat += j - i - 1;
+        if ((uint64_t)(j - i) * n / k < SORT_TIES_RADIX)
+            continue;
+        len = strnlen(table[fp[i].row], sizeof(value_t));
+        *ties += (double)(j - i) *
+            (MIN(len, sizeof(value_t) - 1) / SORT_KEY_BYTES);
+    }
+    *repeat /= k;
+    *ties /= k;
+}
+
+void intersect_duplicates(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2,
+        intersect_dups_t *dups)
+{
+    double repeat1, ties1, repeat2, ties2;
+
+    dup_sample(table1, n1, &repeat1, &ties1);
+    dup_sample(table2, n2, &repeat2, &ties2);
+    dups->build = n1 <= n2 ? repeat1 : repeat2;
+    dups->ties = n1 + n2 ?
+        (ties1 * n1 + ties2 * n2) / ((double)n1 + n2) : 0.0;
+}
+
+/*
+ * The selectivity only matters to DIRECT_METHOD, so it is estimated
+ * only if that one can win, which needs small tables. Duplicates are
+ * always sampled, they turn hash against sort.
+ */
+static int auto_method(value_t table1[], uint32_t n1, value_t table2[], uint32_t n2)
+{
+    intersect_dups_t dups;
+    int method;
+
+    intersect_duplicates(table1, n1, table2, n2, &dups);
+    method = intersect_auto_method(n1, n2, 1.0, &dups);
+    if (method == DIRECT_METHOD)
+        method = intersect_auto_method(n1, n2,
+                intersect_selectivity(table1, n1, table2, n2), &dups);
+    return method;
+}
+
 //////////////////////////////////////////////////////////////////
 //   Intersect Overall
 //////////////////////////////////////////////////////////////////
@@ -273,6 +1245,10 @@ uint32_t run_sw_intersection(int method, value_t *table1, uint32_t n1, value_t *
 {
     printf("SW intersection, method = %d, table1 (%p) num is %d, table2 (%p) num is %d, out (%p) \n",
             method, table1, n1, table2, n2, result_array);
+    if (method == AUTO_METHOD) {
+        method = auto_method(table1, n1, table2, n2);
+        printf("SW intersection, auto method = %d\n", method);
+    }
     if(method == DIRECT_METHOD)
         return intersect_direct(table1, n1, table2, n2, result_array);
     else if (method == HASH_METHOD) {
@@ -283,11 +1259,397 @@ uint32_t run_sw_intersection(int method, value_t *table1, uint32_t n1, value_t *
     }
     else if (method == SORT_METHOD)
         return intersect_sort (table1, n1, table2, n2, result_array);
+    else if (method == SEARCH_METHOD) {
+        if (n1 <= n2)
+            return intersect_search (table1, n1, table2, n2, result_array);
+        else
+            return intersect_search (table2, n2, table1, n1, result_array);
+    }
     else
         return 0;
 }
 
 
+//////////////////////////////////////////////////////////////////
+//   K-way Intersection
+//////////////////////////////////////////////////////////////////
+
+/*
+ * The rows of the smallest table are the candidates. The other tables
+ * follow by size and each keeps the candidates it holds, so the set
+ * only shrinks and no rows are copied until the end. An empty set ends
+ * the loop. Duplicates keep the lowest count, like with two tables.
+ */
+static uint32_t filter_direct(value_t ts[], uint32_t cand[], uint32_t n,
+        value_t table[], uint32_t nt)
+{
+    uint8_t *taken = calloc(MAX(nt, 1u), sizeof(*taken));
+    uint32_t i, j, o = 0;
+
+    if (!taken) {
+        fprintf(stderr, "ERROR: taken malloc failed.\n");
+        return 0;
+    }
+    for (i = 0; i < n; i++)
+        for (j = 0; j < nt; j++)
+            if (!taken[j] && cmpvalue(ts[cand[i]], table[j]) == 0) {
+                taken[j] = 1;
+                cand[o++] = cand[i];
+                break;
+            }
+    free(taken);
+    return o;
+}
+
+static uint32_t filter_hash(value_t ts[], uint32_t cand[], uint32_t n,
+        value_t table[], uint32_t nt)
+{
+    struct ht_arena ht;
+    uint64_t k;
+    uint32_t i, o = 0;
+
+    if (ht_build(&ht, ts, cand, n) != 0)
+        return 0;
+
+    for (i = 0; i < nt; i++)
+        ht_take(&ht, table[i]);
+
+    /*
+     * As many candidates of a value stay as were taken. The slots refer
+     * to rows of ts from here on, cand is compacted below.
+     */
+    for (k = 0; k <= ht.mask; k++) {
+        if (ht.slot[k].tag == 0)
+            continue;
+        ht.slot[k].left = ht.slot[k].count - ht.slot[k].left;
+        ht.slot[k].pos = cand[ht.slot[k].pos - 1] + 1;
+    }
+    ht.rows = NULL;
+    for (i = 0; i < n; i++)
+        if (ht_take(&ht, ts[cand[i]]))
+            cand[o++] = cand[i];
+
+    free(ht.slot);
+    return o;
+}
+
+static uint32_t intersect_k_sort(value_t *tables[], uint32_t nums[],
+        const uint32_t order[], uint32_t k, uint32_t cand[])
+{
+    struct sort_item *items, *next, *tmp;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t s = order[0], n = nums[order[0]], t, i;
+    size_t nmax = nums[order[k - 1]];
+
+    items = malloc((n + 2 * nmax) * sizeof(*items));
+    if (!items) {
+        fprintf(stderr, "ERROR: sort items malloc failed.\n");
+        return 0;
+    }
+    next = items + n;
+    tmp = next + nmax;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    sort_table(tables[s], n, items, tmp, nthreads);
+    for (t = 1; t < k && n; t++) {
+        sort_table(tables[order[t]], nums[order[t]], next, tmp, nthreads);
+        n = merge_items(tables[s], items, n, tables[order[t]], next,
+                nums[order[t]], items);
+    }
+    for (i = 0; i < n; i++)
+        cand[i] = items[i].row;
+    free(items);
+    return n;
+}
+
+// The smallest table stays sorted, the rows of the others search it
+static uint32_t intersect_k_search(value_t *tables[], uint32_t nums[],
+        const uint32_t order[], uint32_t k, uint32_t cand[])
+{
+    struct sort_item *items, probe;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    value_t *ts = tables[order[0]], *tl;
+    uint32_t n = nums[order[0]], *used, t, i, o, p, q;
+    uint8_t *keep;
+
+    items = malloc(2 * (size_t)n * sizeof(*items));
+    used = malloc(n * sizeof(*used));
+    keep = malloc(n * sizeof(*keep));
+    if (!items || !used || !keep) {
+        fprintf(stderr, "ERROR: sort items malloc failed.\n");
+        n = 0;
+        goto out;
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    sort_table(ts, n, items, items + n, nthreads);
+
+    for (t = 1; t < k && n; t++) {
+        tl = tables[order[t]];
+        memset(used, 0, n * sizeof(*used));
+        memset(keep, 0, n * sizeof(*keep));
+        for (i = 0; i < nums[order[t]]; i++) {
+            sort_key(&probe, tl[i], 0);
+            probe.row = i;
+            p = gallop(ts, items, 0, n, tl, &probe);
+            q = p + (p < n ? used[p] : 0);
+            if (q < n && sort_item_cmp(&items[q], ts, &probe, tl) == 0) {
+                used[p]++;
+                keep[q] = 1;
+            }
+        }
+        for (o = 0, i = 0; i < n; i++)
+            if (keep[i])
+                items[o++] = items[i];
+        n = o;
+    }
+    for (i = 0; i < n; i++)
+        cand[i] = items[i].row;
+ out:
+    free(items);
+    free(used);
+    free(keep);
+    return n;
+}
+
+uint32_t run_sw_intersection_k(int method, value_t *tables[], uint32_t nums[], uint32_t k, value_t *result_array)
+{
+    uint32_t order[MAX_NUM_TABLES], *cand;
+    uint32_t i, t, n, s;
+    uint64_t rest = 0;
+
+    printf("SW intersection, method = %d, %u tables, out (%p) \n",
+            method, k, result_array);
+    if (k == 0 || k > MAX_NUM_TABLES || method < DIRECT_METHOD ||
+            method > AUTO_METHOD)
+        return 0;
+
+    // smallest first
+    for (t = 0; t < k; t++) {
+        for (i = t; i > 0 && nums[order[i - 1]] > nums[t]; i--)
+            order[i] = order[i - 1];
+        order[i] = t;
+    }
+    s = order[0];
+    n = nums[s];
+    if (n == 0)
+        return 0;
+    if (method == AUTO_METHOD) {
+        intersect_dups_t dups;
+
+        // the largest table samples the duplicates of the rest
+        for (t = 1; t < k; t++)
+            rest += nums[order[t]];
+        intersect_duplicates(tables[s], n, tables[order[k - 1]],
+                nums[order[k - 1]], &dups);
+        method = intersect_auto_method(n, MIN(rest, (uint64_t)UINT32_MAX), 1.0,
+                &dups);
+        printf("SW intersection, auto method = %d\n", method);
+    }
+
+    cand = malloc(n * sizeof(*cand));
+    if (!cand) {
+        fprintf(stderr, "ERROR: candidate malloc failed.\n");
+        return 0;
+    }
+    if (method == SORT_METHOD)
+        n = intersect_k_sort(tables, nums, order, k, cand);
+    else if (method == SEARCH_METHOD)
+        n = intersect_k_search(tables, nums, order, k, cand);
+    else {
+        for (i = 0; i < n; i++)
+            cand[i] = i;
+        for (t = 1; t < k && n; t++) {
+            if (method == HASH_METHOD)
+                n = filter_hash(tables[s], cand, n, tables[order[t]], nums[order[t]]);
+            else
+                n = filter_direct(tables[s], cand, n, tables[order[t]], nums[order[t]]);
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        copyvalue(result_array[i], tables[s][cand[i]]);
+    free(cand);
+    return n;
+}
+
+
+//////////////////////////////////////////////////////////////////
+//   Set Operations
+//////////////////////////////////////////////////////////////////
+
+// Which rows an operation keeps: in both tables, only in one of them
+#define SETOP_BOTH  0x1
+#define SETOP_ONLY1 0x2
+#define SETOP_ONLY2 0x4
+
+static const int setop_keep[] = {
+    [INTERSECT_OP] = SETOP_BOTH,
+    [UNION_OP]     = SETOP_BOTH | SETOP_ONLY1 | SETOP_ONLY2,
+    [DIFF_OP]      = SETOP_ONLY1,
+    [SYMDIFF_OP]   = SETOP_ONLY1 | SETOP_ONLY2,
+};
+
+static void sink_put(intersect_sink_t *sink, value_t v)
+{
+    if (!sink->rows || sink->rc)
+        return;
+    copyvalue(sink->rows[sink->n], v);
+    if (++sink->n == sink->max) {
+        sink->rc = sink->flush(sink->rows, sink->n, sink->priv);
+        sink->n = 0;
+    }
+}
+
+/*
+ * The smaller table is hashed. A probe row which takes a build row is
+ * in both tables, else it is only in its own one. The build rows not
+ * taken at the end are only in theirs.
+ */
+static uint32_t setop_hash(int keep, value_t table1[], uint32_t n1,
+        value_t table2[], uint32_t n2, intersect_sink_t *sink)
+{
+    value_t *tb = table1, *tp = table2;
+    uint32_t nb = n1, np = n2, i, n3 = 0;
+    int only_b = SETOP_ONLY1, only_p = SETOP_ONLY2;
+    struct ht_arena ht;
+    struct ht_slot *slot;
+    uint64_t k;
+
+    if (n2 < n1) {
+        tb = table2;
+        nb = n2;
+        tp = table1;
+        np = n1;
+        only_b = SETOP_ONLY2;
+        only_p = SETOP_ONLY1;
+    }
+    if (ht_build(&ht, tb, NULL, nb) != 0)
+        return 0;
+
+    for (i = 0; i < np; i++) {
+        slot = ht_take(&ht, tp[i]);
+        if (slot && (keep & SETOP_BOTH)) {
+            n3++;
+            sink_put(sink, tp == table2 ? tp[i] : tb[slot->pos - 1]);
+        } else if (!slot && (keep & only_p)) {
+            n3++;
+            sink_put(sink, tp[i]);
+        }
+    }
+    if (keep & only_b) {
+        for (k = 0; k <= ht.mask; k++) {
+            slot = &ht.slot[k];
+            for (; slot->left != 0; slot->left--) {
+                n3++;
+                sink_put(sink, tb[slot->pos - 1]);
+            }
+        }
+    }
+    free(ht.slot);
+    return n3;
+}
+
+// One walk over both sorted tables, the intersection alone may gallop
+static uint32_t setop_sort(int keep, value_t table1[], uint32_t n1,
+        value_t table2[], uint32_t n2, intersect_sink_t *sink)
+{
+    struct sort_item *s1, *s2, *tmp;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t i = 0, j = 0, n3 = 0;
+    int c;
+
+    s1 = malloc(((size_t)n1 + n2 + MAX(n1, n2)) * sizeof(*s1));
+    if (!s1) {
+        fprintf(stderr, "ERROR: sort items malloc failed.\n");
+        return 0;
+    }
+    s2 = s1 + n1;
+    tmp = s2 + n2;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    sort_table(table1, n1, s1, tmp, nthreads);
+    sort_table(table2, n2, s2, tmp, nthreads);
+
+    if (keep == SETOP_BOTH) {
+        n3 = merge_items(table2, s2, n2, table1, s1, n1, s2);
+        for (i = 0; i < n3; i++)
+            sink_put(sink, table2[s2[i].row]);
+        free(s1);
+        return n3;
+    }
+
+    while (i < n1 || j < n2) {
+        if (i == n1)
+            c = 1;
+        else if (j == n2)
+            c = -1;
+        else
+            c = sort_item_cmp(&s1[i], table1, &s2[j], table2);
+
+        if (c == 0) {
+            if (keep & SETOP_BOTH) {
+                n3++;
+                sink_put(sink, table2[s2[j].row]);
+            }
+            i++;
+            j++;
+        } else if (c < 0) {
+            if (keep & SETOP_ONLY1) {
+                n3++;
+                sink_put(sink, table1[s1[i].row]);
+            }
+            i++;
+        } else {
+            if (keep & SETOP_ONLY2) {
+                n3++;
+                sink_put(sink, table2[s2[j].row]);
+            }
+            j++;
+        }
+    }
+    free(s1);
+    return n3;
+}
+
+uint32_t run_sw_setop(int method, int operation, value_t *table1, uint32_t n1, value_t *table2, uint32_t n2, intersect_sink_t *sink)
+{
+    intersect_sink_t count_only = { NULL, 0, 0, NULL, NULL, 0 };
+    int op = operation & OP_MASK;
+    uint32_t n3;
+
+    printf("SW set operation %d%s, method = %d, table1 (%p) num is %d, table2 (%p) num is %d\n",
+            op, (operation & OP_COUNT_ONLY) ? " count only" : "",
+            method, table1, n1, table2, n2);
+    if (method == AUTO_METHOD) {
+        intersect_dups_t dups;
+
+        intersect_duplicates(table1, n1, table2, n2, &dups);
+        method = intersect_cost_estimate(HASH_METHOD, n1, n2, 1.0, &dups) <=
+            intersect_cost_estimate(SORT_METHOD, n1, n2, 1.0, &dups) ?
+            HASH_METHOD : SORT_METHOD;
+    }
+    if (op > SYMDIFF_OP || (method != HASH_METHOD && method != SORT_METHOD)) {
+        fprintf(stderr, "ERROR: set operation %d with method %d.\n", op, method);
+        return 0;
+    }
+    if ((operation & OP_COUNT_ONLY) || !sink)
+        sink = &count_only;
+
+    if (method == HASH_METHOD)
+        n3 = setop_hash(setop_keep[op], table1, n1, table2, n2, sink);
+    else
+        n3 = setop_sort(setop_keep[op], table1, n1, table2, n2, sink);
+
+    if (sink->rows && sink->n && !sink->rc)
+        sink->rc = sink->flush(sink->rows, sink->n, sink->priv);
+    sink->n = 0;
+    return n3;
+}
+
+
 //////////////////////////////////////////////
 //     SNAP SW Action wrapper. Do nothing.
 //////////////////////////////////////////////
@@ -0,0 +1,487 @@
+/*
+ * Copyright 2017 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Set operations on tables larger than memory.
+ *
+ * Both input files are hash partitioned into spill files. Equal rows
+ * land in the same partition of both tables, so each partition pair
+ * is a small set operation of its own, which runs in memory with
+ * run_sw_setop(). There are enough partitions for a pair to fit into
+ * the memory budget of a thread, as far as the open file limit allows
+ * one pass. Skewed keys or that limit can still leave pairs too large,
+ * so each pair is checked and an oversized one is partitioned again,
+ * with a hash of the next level, up to EXT_MAX_LEVELS. The threads
+ * take the pairs one by one and append their result pages to the
+ * output file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <snap_tools.h>
+#include <snap_intersect.h>
+
+#define EXT_MAX_PARTS   1024
+#define EXT_MAX_LEVELS  4       /* partitioning passes over a row */
+#define EXT_FDS_KEPT    16      /* of RLIMIT_NOFILE, not for partitions */
+#define EXT_MAX_THREADS 64u
+#define EXT_MEM_FACTOR  3       /* rows, sort items or hash slots, page */
+#define EXT_READ_ROWS   1024
+#define EXT_PAGE_ROWS   4096
+
+/* A partition pair, the spill files t0.<id> and t1.<id> */
+struct ext_pair {
+    unsigned int id;
+    unsigned int level;         /* of the hash which made it */
+    uint64_t bytes;             /* of both files */
+};
+
+struct ext_run {
+    const struct intersect_ext *ext;
+    char dir[PATH_MAX - 64];     /* room for the spill file names */
+    unsigned int parts;         /* spill file ids handed out */
+    unsigned int fanout;        /* partitions of one pass */
+    uint64_t per_pair;          /* bytes of a pair in memory */
+    struct ext_pair *pair;      /* the pairs to join */
+    unsigned int n_pairs, max_pairs;
+    FILE *out;
+
+    pthread_mutex_t lock;       /* everything below */
+    unsigned int next;          /* next partition pair */
+    unsigned int done;
+    uint64_t done_bytes;
+    uint64_t result_rows;
+    int rc;
+};
+
+/*
+ * The high bits, the low ones index the hash table of a pair. Each
+ * level mixes them anew, so the rows of a pair spread out again.
+ */
+static inline unsigned int part_of(const value_t v, unsigned int parts,
+        unsigned int level)
+{
+    uint64_t h = value_hash(v);
+
+    if (level) {
+        h ^= level * 0x9e3779b97f4a7c15ull;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+    }
+    return ((h >> 32) * parts) >> 32;
+}
+
+static void part_name(const struct ext_run *run, unsigned int t,
+        unsigned int p, char *name, size_t len)
+{
+    snprintf(name, len, "%s/t%u.%04u", run->dir, t, p);
+}
+
+static double mb_per_s(uint64_t bytes, long long usec)
+{
+    return usec ? (double)bytes / usec : 0.0;
+}
+
+/*
+ * Spreads the rows of fname over the parts spill files of table t from
+ * id first on, by the hash of level.
+ */
+static int ext_partition(struct ext_run *run, const char *fname,
+        unsigned int t, unsigned int first, unsigned int parts,
+        unsigned int level, uint64_t *rows)
+{
+    FILE *in, *part[EXT_MAX_PARTS];
+    value_t buf[EXT_READ_ROWS];
+    char name[PATH_MAX];
+    size_t n, i;
+    unsigned int p, opened;
+    int rc = 0;
+
+    in = fopen(fname, "rb");
+    if (!in) {
+        fprintf(stderr, "err: cannot open %s: %s\n", fname, strerror(errno));
+        return -ENOENT;
+    }
+    for (opened = 0; opened < parts; opened++) {
+        part_name(run, t, first + opened, name, sizeof(name));
+        part[opened] = fopen(name, "wb");
+        if (!part[opened]) {
+            fprintf(stderr, "err: cannot create %s: %s\n", name, strerror(errno));
+            rc = -EIO;
+            goto out;
+        }
+    }
+
+    *rows = 0;
+    while ((n = fread(buf, sizeof(value_t), EXT_READ_ROWS, in)) > 0) {
+        for (i = 0; i < n; i++) {
+            buf[i][sizeof(value_t)-1] = '\0';
+            p = part_of(buf[i], parts, level);
+            if (fwrite(buf[i], sizeof(value_t), 1, part[p]) != 1) {
+                fprintf(stderr, "err: cannot write partition %u: %s\n",
+                        p, strerror(errno));
+                rc = -EIO;
+                goto out;
+            }
+        }
+        *rows += n;
+    }
+    if (ferror(in)) {
+        fprintf(stderr, "err: cannot read %s: %s\n", fname, strerror(errno));
+        rc = -EIO;
+    }
+ out:
+    while (opened--)
+        if (fclose(part[opened]) != 0 && rc == 0)
+            rc = -EIO;
+    fclose(in);
+    return rc;
+}
+
+static uint64_t file_bytes(const char *name)
+{
+    struct stat st;
+
+    return stat(name, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// Partitions of one pass, such that their files stay below RLIMIT_NOFILE
+static unsigned int ext_fanout(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY)
+        return EXT_MAX_PARTS;
+    if (rl.rlim_cur <= EXT_FDS_KEPT + 2)
+        return 2;
+    return MIN(rl.rlim_cur - EXT_FDS_KEPT, (rlim_t)EXT_MAX_PARTS);
+}
+
+static int ext_add_pair(struct ext_run *run, unsigned int id,
+        unsigned int level)
+{
+    struct ext_pair *pair;
+    char name[PATH_MAX];
+    unsigned int t;
+
+    if (run->n_pairs == run->max_pairs) {
+        run->max_pairs = run->max_pairs ? 2 * run->max_pairs : 256;
+        pair = realloc(run->pair, run->max_pairs * sizeof(*pair));
+        if (!pair)
+            return -ENOMEM;
+        run->pair = pair;
+    }
+    pair = &run->pair[run->n_pairs++];
+    pair->id = id;
+    pair->level = level;
+    pair->bytes = 0;
+    for (t = 0; t < NUM_TABLES; t++) {
+        part_name(run, t, id, name, sizeof(name));
+        pair->bytes += file_bytes(name);
+    }
+    return 0;
+}
+
+/*
+ * Partitions each pair which does not fit into per_pair bytes again,
+ * with the hash of its next level, and checks the new pairs the same
+ * way. A pair whose rows all stay together is not split any further.
+ * Empty pairs are dropped. Returns the pairs split in *split.
+ */
+static int ext_split(struct ext_run *run, unsigned int *split)
+{
+    struct ext_pair pair;
+    char name[PATH_MAX];
+    unsigned int i = 0, t, p, parts;
+    uint64_t rows;
+    int rc;
+
+    *split = 0;
+    while (i < run->n_pairs) {
+        pair = run->pair[i];
+        if (pair.bytes != 0 && (pair.bytes <= run->per_pair ||
+                    pair.level + 1 >= EXT_MAX_LEVELS)) {
+            i++;
+            continue;
+        }
+
+        if (pair.bytes != 0) {
+            // half the budget per new pair, hashing does not split evenly
+            parts = MIN(MAX(2 * pair.bytes / run->per_pair + 1, (uint64_t)2),
+                    (uint64_t)run->fanout);
+            for (t = 0; t < NUM_TABLES; t++) {
+                part_name(run, t, pair.id, name, sizeof(name));
+                rc = ext_partition(run, name, t, run->parts, parts,
+                        pair.level + 1, &rows);
+                if (rc)
+                    return rc;
+            }
+            for (p = 0; p < parts; p++) {
+                rc = ext_add_pair(run, run->parts + p, pair.level + 1);
+                if (rc)
+                    return rc;
+                // all rows hashed alike twice, they are one value
+                if (run->pair[run->n_pairs - 1].bytes == pair.bytes)
+                    run->pair[run->n_pairs - 1].level = EXT_MAX_LEVELS;
+            }
+            if (verbose_flag)
+                printf("partition %u: %llu KiB split into %u at level %u\n",
+                        pair.id, (long long)(pair.bytes >> 10), parts,
+                        pair.level + 1);
+            run->parts += parts;
+            (*split)++;
+        }
+        for (t = 0; t < NUM_TABLES; t++) {
+            part_name(run, t, pair.id, name, sizeof(name));
+            unlink(name);
+        }
+        run->pair[i] = run->pair[--run->n_pairs];
+    }
+    return 0;
+}
+
+/* Reads a spill file and removes it, *rows is NULL if it is empty */
+static int ext_load(const char *name, value_t **rows, uint32_t *n)
+{
+    struct stat st;
+    FILE *fp;
+    int rc = 0;
+
+    *rows = NULL;
+    *n = 0;
+    if (stat(name, &st) != 0)
+        return -ENOENT;
+    if (st.st_size > 0) {
+        *n = st.st_size / sizeof(value_t);
+        *rows = malloc((size_t)*n * sizeof(value_t));
+        fp = fopen(name, "rb");
+        if (!*rows || !fp ||
+                fread(*rows, sizeof(value_t), *n, fp) != *n) {
+            fprintf(stderr, "err: cannot load %s: %s\n", name, strerror(errno));
+            rc = -EIO;
+        }
+        if (fp)
+            fclose(fp);
+    }
+    unlink(name);
+    return rc;
+}
+
+static int ext_flush(value_t *rows, uint32_t n, void *priv)
+{
+    struct ext_run *run = priv;
+    uint32_t i;
+    int rc = 0;
+
+    for (i = 0; i < n; i++)
+        rows[i][sizeof(value_t)-1] = '\n';
+    pthread_mutex_lock(&run->lock);
+    if (fwrite(rows, sizeof(value_t), n, run->out) != n) {
+        fprintf(stderr, "err: cannot write result: %s\n", strerror(errno));
+        rc = -EIO;
+    }
+    pthread_mutex_unlock(&run->lock);
+    return rc;
+}
+
+static void *ext_worker(void *arg)
+{
+    struct ext_run *run = arg;
+    value_t *tables[NUM_TABLES];
+    uint32_t nums[NUM_TABLES], n3;
+    char name[PATH_MAX];
+    intersect_sink_t sink = { NULL, EXT_PAGE_ROWS, 0, ext_flush, run, 0 };
+    unsigned int i, p, t;
+    int rc;
+
+    if (run->out) {
+        sink.rows = malloc(EXT_PAGE_ROWS * sizeof(value_t));
+        if (!sink.rows) {
+            pthread_mutex_lock(&run->lock);
+            run->rc = -ENOMEM;
+            pthread_mutex_unlock(&run->lock);
+            return NULL;
+        }
+    }
+
+    while (1) {
+        pthread_mutex_lock(&run->lock);
+        i = run->rc ? run->n_pairs : run->next++;
+        pthread_mutex_unlock(&run->lock);
+        if (i >= run->n_pairs)
+            break;
+        p = run->pair[i].id;
+
+        rc = 0;
+        for (t = 0; t < NUM_TABLES; t++) {
+            part_name(run, t, p, name, sizeof(name));
+            rc |= ext_load(name, &tables[t], &nums[t]);
+        }
+        n3 = 0;
+        if (rc == 0)
+            n3 = run_sw_setop(run->ext->method, run->ext->operation,
+                    tables[0], nums[0], tables[1], nums[1], &sink);
+        for (t = 0; t < NUM_TABLES; t++)
+            free(tables[t]);
+
+        pthread_mutex_lock(&run->lock);
+        if (rc || sink.rc)
+            run->rc = rc ? rc : sink.rc;
+        run->done++;
+        run->done_bytes += ((uint64_t)nums[0] + nums[1]) * sizeof(value_t);
+        run->result_rows += n3;
+        if (verbose_flag)
+            printf("partition %u (%u/%u): %u x %u rows, %u result rows\n",
+                    p, run->done, run->n_pairs, nums[0], nums[1], n3);
+        pthread_mutex_unlock(&run->lock);
+    }
+    free(sink.rows);
+    return NULL;
+}
+
+int intersect_external(const struct intersect_ext *ext)
+{
+    struct ext_run run;
+    pthread_t tid[EXT_MAX_THREADS];
+    struct timeval stime, etime;
+    uint64_t memory = ext->memory, in_bytes = 0, rows[NUM_TABLES], per_pair;
+    long long usec;
+    const char *tmp;
+    char name[PATH_MAX];
+    unsigned int threads, t, p, started, split, big = 0;
+    uint64_t big_bytes = 0;
+    ssize_t size;
+    int rc;
+
+    memset(&run, 0, sizeof(run));
+    run.ext = ext;
+    pthread_mutex_init(&run.lock, NULL);
+    threads = MIN(MAX(ext->threads, 1u), EXT_MAX_THREADS);
+
+    for (t = 0; t < NUM_TABLES; t++) {
+        size = __file_size(ext->input[t]);
+        if (size < 0)
+            return -ENOENT;
+        in_bytes += size;
+    }
+    if (memory == 0)
+        memory = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+    per_pair = MAX(memory / threads / EXT_MEM_FACTOR, (uint64_t)sizeof(value_t));
+    run.per_pair = per_pair;
+    run.fanout = ext_fanout();
+    run.parts = MIN(MAX((in_bytes + per_pair - 1) / per_pair, (uint64_t)1),
+            (uint64_t)run.fanout);
+
+    tmp = ext->spill_dir ? ext->spill_dir : getenv("TMPDIR");
+    snprintf(run.dir, sizeof(run.dir), "%s/snap_intersect.XXXXXX",
+            tmp ? tmp : "/tmp");
+    if (!mkdtemp(run.dir)) {
+        fprintf(stderr, "err: cannot create spill directory %s: %s\n",
+                run.dir, strerror(errno));
+        return -EIO;
+    }
+    printf("External: %llu MiB input, %u partitions, %u threads, "
+            "%llu MiB memory, spill to %s\n",
+            (long long)(in_bytes >> 20), run.parts, threads,
+            (long long)(memory >> 20), run.dir);
+
+    // Partition
+    for (t = 0; t < NUM_TABLES; t++) {
+        gettimeofday(&stime, NULL);
+        rc = ext_partition(&run, ext->input[t], t, 0, run.parts, 0,
+                &rows[t]);
+        gettimeofday(&etime, NULL);
+        if (rc)
+            goto out;
+        usec = timediff_usec(&etime, &stime);
+        printf("Partitioned %s: %llu rows in %lld usec, %.1f MB/s\n",
+                ext->input[t], (long long)rows[t], usec,
+                mb_per_s(rows[t] * sizeof(value_t), usec));
+    }
+
+    // Partition the pairs which turned out too large again
+    for (p = 0; p < run.parts; p++) {
+        rc = ext_add_pair(&run, p, 0);
+        if (rc)
+            goto out;
+    }
+    gettimeofday(&stime, NULL);
+    rc = ext_split(&run, &split);
+    gettimeofday(&etime, NULL);
+    if (rc)
+        goto out;
+    if (split)
+        printf("Re-partitioned %u oversized pairs in %lld usec, "
+                "%u pairs\n", split,
+                (long long)timediff_usec(&etime, &stime), run.n_pairs);
+    for (p = 0; p < run.n_pairs; p++) {
+        if (run.pair[p].bytes > per_pair) {
+            big++;
+            big_bytes = MAX(big_bytes, run.pair[p].bytes);
+        }
+    }
+    if (big)
+        fprintf(stderr, "warning: %u partition pairs of up to %llu KiB "
+                "exceed the memory per thread\n",
+                big, (long long)(big_bytes >> 10));
+
+    // Set operation of the partition pairs
+    if (ext->output && !(ext->operation & OP_COUNT_ONLY)) {
+        run.out = fopen(ext->output, "wb");
+        if (!run.out) {
+            fprintf(stderr, "err: cannot open %s: %s\n",
+                    ext->output, strerror(errno));
+            rc = -EIO;
+            goto out;
+        }
+    }
+    gettimeofday(&stime, NULL);
+    for (started = 1; started < threads; started++)
+        if (pthread_create(&tid[started], NULL, ext_worker, &run) != 0)
+            break;
+    ext_worker(&run);
+    for (t = 1; t < started; t++)
+        pthread_join(tid[t], NULL);
+    gettimeofday(&etime, NULL);
+    usec = timediff_usec(&etime, &stime);
+    if (run.out && fclose(run.out) != 0 && run.rc == 0)
+        run.rc = -EIO;
+
+    rc = run.rc;
+    printf("Joined %u partition pairs: %llu result rows in %lld usec, %.1f MB/s\n",
+            run.done, (long long)run.result_rows, usec,
+            mb_per_s(run.done_bytes, usec));
+ out:
+    for (p = 0; p < run.parts; p++)
+        for (t = 0; t < NUM_TABLES; t++) {
+            part_name(&run, t, p, name, sizeof(name));
+            unlink(name);
+        }
+    rmdir(run.dir);
+    free(run.pair);
+    pthread_mutex_destroy(&run.lock);
+    return rc;
+}
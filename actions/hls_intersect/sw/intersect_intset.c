@@ -0,0 +1,432 @@
+/*
+ * Copyright 2017 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Integer sets for ID intersections.
+ *
+ * A set is a list of containers sorted by the upper 48 bits of the
+ * IDs, each holding the lower 16 bits of its IDs either as a sorted
+ * uint16_t array or as a 64 Kbit bitmap, whichever is smaller. So a
+ * 32 bit ID takes at most 2 bytes instead of a 64 byte value_t row.
+ * The intersection walks the containers of both sets once and
+ * intersects the pairs with the same key by their kind: arrays are
+ * merged, or galloped over if one is much shorter, array values are
+ * looked up in a bitmap and two bitmaps are ANDed word by word.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <snap_tools.h>
+#include <action_intersect.h>
+
+#define INTSET_GALLOP_RATIO 32
+#define INTSET_BITMAP_BYTES (INTSET_BITMAP_WORDS * sizeof(uint64_t))
+
+// LSD radix sort, skipping the bytes all IDs have in common
+static uint64_t *ids_sort(uint64_t *v, uint64_t *tmp, uint64_t n)
+{
+    uint64_t count[256], pos, c, i, *t;
+    unsigned int shift, b;
+
+    for (shift = 0; shift < 64 && n; shift += 8) {
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < n; i++)
+            count[(v[i] >> shift) & 0xff]++;
+        if (count[(v[0] >> shift) & 0xff] == n)
+            continue;
+        for (pos = 0, b = 0; b < 256; b++) {
+            c = count[b];
+            count[b] = pos;
+            pos += c;
+        }
+        for (i = 0; i < n; i++)
+            tmp[count[(v[i] >> shift) & 0xff]++] = v[i];
+        t = v;
+        v = tmp;
+        tmp = t;
+    }
+    return v;
+}
+
+// Container of the sorted IDs v[0..n) with key v[0] >> 16
+static int container_fill(intset_container_t *c, const uint64_t *v, uint64_t n)
+{
+    uint16_t *array;
+    uint64_t *bitmap, i;
+    uint32_t card = 0;
+
+    c->key = v[0] >> 16;
+    for (i = 0; i < n; i++)
+        card += i == 0 || v[i] != v[i - 1];
+    c->card = card;
+
+    if (card > INTSET_ARRAY_MAX) {
+        c->type = INTSET_BITMAP;
+        c->data = bitmap = calloc(INTSET_BITMAP_WORDS, sizeof(uint64_t));
+        if (!bitmap)
+            return -1;
+        for (i = 0; i < n; i++)
+            bitmap[(v[i] & 0xffff) >> 6] |= 1ull << (v[i] & 63);
+    } else {
+        c->type = INTSET_ARRAY;
+        c->data = array = malloc(card * sizeof(uint16_t));
+        if (!array)
+            return -1;
+        for (card = 0, i = 0; i < n; i++)
+            if (i == 0 || v[i] != v[i - 1])
+                array[card++] = v[i] & 0xffff;
+    }
+    return 0;
+}
+
+intset_t *intset_build(const void *ids, uint64_t n, unsigned int width)
+{
+    const uint32_t *ids32 = ids;
+    const uint64_t *ids64 = ids;
+    uint64_t *buf, *v, i, j, keys = 0;
+    intset_t *s;
+
+    if (width != sizeof(uint32_t) && width != sizeof(uint64_t)) {
+        fprintf(stderr, "ERROR: IDs of %u bytes.\n", width);
+        return NULL;
+    }
+    s = calloc(1, sizeof(*s));
+    buf = malloc(2 * MAX(n, 1ull) * sizeof(uint64_t));
+    if (!s || !buf)
+        goto out_error;
+
+    for (i = 0; i < n; i++)
+        buf[i] = width == sizeof(uint32_t) ? ids32[i] : ids64[i];
+    v = ids_sort(buf, buf + n, n);
+
+    for (i = 0; i < n; i++)
+        keys += i == 0 || (v[i] >> 16) != (v[i - 1] >> 16);
+    s->c = calloc(MAX(keys, 1ull), sizeof(*s->c));
+    if (!s->c)
+        goto out_error;
+
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && (v[j] >> 16) == (v[i] >> 16); j++)
+            ;
+        if (container_fill(&s->c[s->n++], v + i, j - i) != 0)
+            goto out_error;
+        s->card += s->c[s->n - 1].card;
+    }
+    free(buf);
+    return s;
+
+ out_error:
+    fprintf(stderr, "ERROR: intset of %llu IDs malloc failed.\n",
+            (unsigned long long)n);
+    free(buf);
+    intset_free(s);
+    return NULL;
+}
+
+void intset_free(intset_t *s)
+{
+    uint64_t i;
+
+    if (!s)
+        return;
+    for (i = 0; s->c && i < s->n; i++)
+        free(s->c[i].data);
+    free(s->c);
+    free(s);
+}
+
+uint64_t intset_bytes(const intset_t *s)
+{
+    uint64_t i, bytes = sizeof(*s) + s->n * sizeof(*s->c);
+
+    for (i = 0; i < s->n; i++)
+        bytes += s->c[i].type == INTSET_BITMAP ? INTSET_BITMAP_BYTES :
+            s->c[i].card * sizeof(uint16_t);
+    return bytes;
+}
+
+uint64_t intset_ids(const intset_t *s, void *ids, unsigned int width)
+{
+    uint32_t *ids32 = ids;
+    uint64_t *ids64 = ids;
+    const intset_container_t *c;
+    const uint16_t *array;
+    const uint64_t *bitmap;
+    uint64_t i, w, bits, id, n = 0;
+    uint32_t j;
+
+    for (i = 0; i < s->n; i++) {
+        c = &s->c[i];
+        if (c->type == INTSET_ARRAY) {
+            array = c->data;
+            for (j = 0; j < c->card; j++) {
+                id = c->key << 16 | array[j];
+                if (width == sizeof(uint32_t))
+                    ids32[n++] = id;
+                else
+                    ids64[n++] = id;
+            }
+            continue;
+        }
+        bitmap = c->data;
+        for (w = 0; w < INTSET_BITMAP_WORDS; w++) {
+            for (bits = bitmap[w]; bits; bits &= bits - 1) {
+                id = c->key << 16 | w << 6 | __builtin_ctzll(bits);
+                if (width == sizeof(uint32_t))
+                    ids32[n++] = id;
+                else
+                    ids64[n++] = id;
+            }
+        }
+    }
+    return n;
+}
+
+//////////////////////////////////////////////////////////////////
+//   Container pair kernels, out NULL counts only
+//////////////////////////////////////////////////////////////////
+
+static uint32_t array_merge(const uint16_t *a, uint32_t na,
+        const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+
+    while (i < na && j < nb) {
+        if (a[i] < b[j])
+            i++;
+        else if (a[i] > b[j])
+            j++;
+        else {
+            if (out)
+                out[n] = a[i];
+            n++;
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+// Each value of the short array a gallops ahead in the long one b
+static uint32_t array_gallop(const uint16_t *a, uint32_t na,
+        const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i, j = 0, n = 0, lo, hi, mid, step;
+
+    for (i = 0; i < na && j < nb; i++) {
+        if (b[j] < a[i]) {
+            for (lo = j, step = 1; j + step < nb && b[j + step] < a[i];
+                    step <<= 1)
+                lo = j + step;
+            hi = MIN(j + step, nb);
+            for (lo++; lo < hi; ) {
+                mid = lo + (hi - lo) / 2;
+                if (b[mid] < a[i])
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            j = lo;
+        }
+        if (j < nb && b[j] == a[i]) {
+            if (out)
+                out[n] = a[i];
+            n++;
+            j++;
+        }
+    }
+    return n;
+}
+
+static uint32_t array_bitmap(const uint16_t *a, uint32_t na,
+        const uint64_t *bitmap, uint16_t *out)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < na; i++) {
+        if (!((bitmap[a[i] >> 6] >> (a[i] & 63)) & 1))
+            continue;
+        if (out)
+            out[n] = a[i];
+        n++;
+    }
+    return n;
+}
+
+static uint32_t bitmap_bitmap(const uint64_t *a, const uint64_t *b,
+        uint64_t *out)
+{
+    uint32_t w, n = 0;
+    uint64_t bits;
+
+    for (w = 0; w < INTSET_BITMAP_WORDS; w++) {
+        bits = a[w] & b[w];
+        if (out)
+            out[w] = bits;
+        n += __builtin_popcountll(bits);
+    }
+    return n;
+}
+
+// A bitmap of up to INTSET_ARRAY_MAX values goes back into an array
+static int bitmap_shrink(intset_container_t *c)
+{
+    uint64_t *bitmap = c->data, bits;
+    uint16_t *array;
+    uint32_t w, n = 0;
+
+    array = malloc(MAX(c->card, 1u) * sizeof(uint16_t));
+    if (!array)
+        return -1;
+    for (w = 0; w < INTSET_BITMAP_WORDS; w++)
+        for (bits = bitmap[w]; bits; bits &= bits - 1)
+            array[n++] = w << 6 | __builtin_ctzll(bits);
+    free(bitmap);
+    c->data = array;
+    c->type = INTSET_ARRAY;
+    return 0;
+}
+
+/*
+ * Intersects the containers a and b of the same key into r, which is
+ * allocated if r->data is to be filled. Returns the size.
+ */
+static uint32_t container_and(const intset_container_t *a,
+        const intset_container_t *b, intset_container_t *r)
+{
+    const intset_container_t *t;
+    uint32_t n;
+
+    if (a->type == INTSET_BITMAP && b->type == INTSET_BITMAP) {
+        if (!r)
+            return bitmap_bitmap(a->data, b->data, NULL);
+        r->type = INTSET_BITMAP;
+        r->data = malloc(INTSET_BITMAP_BYTES);
+        if (!r->data)
+            return 0;
+        n = r->card = bitmap_bitmap(a->data, b->data, r->data);
+        if (n <= INTSET_ARRAY_MAX && bitmap_shrink(r) != 0) {
+            free(r->data);
+            r->data = NULL;
+            return 0;
+        }
+        return n;
+    }
+
+    // a is the (shorter) array
+    if (a->type == INTSET_BITMAP || (b->type == INTSET_ARRAY &&
+                b->card < a->card)) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    if (r) {
+        r->type = INTSET_ARRAY;
+        r->data = malloc(MAX(a->card, 1u) * sizeof(uint16_t));
+        if (!r->data)
+            return 0;
+    }
+    if (b->type == INTSET_BITMAP)
+        n = array_bitmap(a->data, a->card, b->data, r ? r->data : NULL);
+    else if ((uint64_t)a->card * INTSET_GALLOP_RATIO < b->card)
+        n = array_gallop(a->data, a->card, b->data, b->card,
+                r ? r->data : NULL);
+    else
+        n = array_merge(a->data, a->card, b->data, b->card,
+                r ? r->data : NULL);
+    if (r)
+        r->card = n;
+    return n;
+}
+
+// First container from j on with a key of at least key
+static uint64_t key_seek(const intset_container_t *c, uint64_t n,
+        uint64_t j, uint64_t key)
+{
+    uint64_t lo, hi, mid, step;
+
+    if (j >= n || c[j].key >= key)
+        return j;
+    for (lo = j, step = 1; j + step < n && c[j + step].key < key; step <<= 1)
+        lo = j + step;
+    hi = MIN(j + step, n);
+    for (lo++; lo < hi; ) {
+        mid = lo + (hi - lo) / 2;
+        if (c[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+uint64_t intset_intersect(const intset_t *a, const intset_t *b, intset_t **result)
+{
+    const intset_t *t;
+    intset_t *r = NULL;
+    intset_container_t *rc;
+    uint64_t i, j = 0, card = 0;
+    uint32_t n;
+
+    // Walk the set with fewer containers, seek in the other one
+    if (b->n < a->n) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    if (result) {
+        *result = NULL;
+        r = calloc(1, sizeof(*r));
+        if (r)
+            r->c = calloc(MAX(a->n, 1ull), sizeof(*r->c));
+        if (!r || !r->c) {
+            fprintf(stderr, "ERROR: intset result malloc failed.\n");
+            intset_free(r);
+            return 0;
+        }
+    }
+
+    for (i = 0; i < a->n && j < b->n; i++) {
+        j = key_seek(b->c, b->n, j, a->c[i].key);
+        if (j == b->n || b->c[j].key != a->c[i].key)
+            continue;
+        rc = r ? &r->c[r->n] : NULL;
+        n = container_and(&a->c[i], &b->c[j], rc);
+        if (rc && !rc->data) {
+            fprintf(stderr, "ERROR: intset container malloc failed.\n");
+            intset_free(r);
+            return 0;
+        }
+        card += n;
+        if (!rc)
+            continue;
+        if (n == 0) {
+            free(rc->data);
+            rc->data = NULL;
+            continue;
+        }
+        rc->key = a->c[i].key;
+        r->n++;
+    }
+    if (r) {
+        r->card = card;
+        *result = r;
+    }
+    return card;
+}
@@ -38,13 +38,16 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
 #include <malloc.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
 #include <snap_tools.h>
 #include <action_intersect.h>
+#include <snap_intersect.h>
 #include <libsnap.h>
 #include <snap_s_regs.h>
 
@@ -65,21 +68,50 @@ static void usage(const char *prog)
             "----------------------------------------------\n"
             "  -i, --input1    <file1.txt> input file 1.\n"
             "  -j, --input2    <file2.txt> input file 2.\n"
+            "                              Further -i or -j add tables, up to %d.\n"
             "  -o, --output   <result.txt> output file.\n"
             "----------------------------------------------\n"
             "  -n, --num      <int>      How many elements in the table for random generated array.\n"
             "  -l, --len      <int>      length of the random string.\n"
+            "  -k, --tables   <int>      How many random tables, only SW does more than 2.\n"
             "  -s, --software            Use software approach.\n"
-            "  -m, --method   <0/1/2>    0: compare one by one (Slow, and only in SW).\n"
+            "  -m, --method   <0-4>      0: compare one by one (Slow, and only in SW).\n"
             "                            1: Use Hash table\n"
             "                            2: Use Sort and merge\n"
+            "                            3: Sort the smaller table, search it (SW).\n"
+            "                            4: Auto, the cheapest by the cost model (SW).\n"
+            "  -p, --operation <0-3>     0: intersection, 1: union, 2: difference\n"
+            "                            (table 1 - table 2), 3: symmetric difference.\n"
+            "                            Only SW does more than 0, with methods 1, 2, 4.\n"
+            "  -c, --count               Count the result rows, write none (SW).\n"
             "  -I, --irq                 Enable Interrupts\n"
+            "  -b, --bench               Time the SW methods on random tables\n"
+            "                            of -n rows with -l letters.\n"
+            "  -O, --overlap  <percent>  With -b: distinct rows, this share of\n"
+            "                            table 2 also in table 1.\n"
+            "  -A, --calibrate           Measure the cost model of method 4 and save\n"
+            "                            it to $SNAP_INTERSECT_PROFILE or\n"
+            "                            ~/.snap_intersect_profile.\n"
+            "----------------------------------------------\n"
+            "  -x, --external            SW operation of two input files which need\n"
+            "                            not fit into memory, through spill files.\n"
+            "  -M, --memory   <bytes>    Memory to use, KiB/MiB/GiB (default half the RAM).\n"
+            "  -D, --spill-dir <dir>     Directory for the spill files (default $TMPDIR).\n"
+            "  -T, --threads  <int>      Partition pairs processed in parallel.\n"
+            "                            With -b: time the hash method on 1 to\n"
+            "                            this many threads.\n"
+            "----------------------------------------------\n"
+            "  -u, --ids      <4/8>      Intersect integer IDs of 4 or 8 bytes in SW:\n"
+            "                            the input files hold binary IDs in host byte\n"
+            "                            order, or -k random tables of -n IDs are used.\n"
+            "                            The result is written the same way.\n"
+            "                            With -b the integer sets are timed against rows.\n"
             "\n"
             "Example:\n"
             "HW:  sudo ./snap_intersect ...\n"
             "SW:  SNAP_CONFIG=1 ./snap_intersect -s ...\n"
             "\n",
-            prog);
+            prog, MAX_NUM_TABLES);
 }
 
 static void snap_prepare_intersect(struct snap_job *cjob,
@@ -87,6 +119,7 @@ static void snap_prepare_intersect(struct snap_job *cjob,
         intersect_job_t *ijob_o,
         uint32_t step,
         uint32_t method,
+        uint32_t operation,
 
         value_t * input_addrs_host[],
         uint32_t input_sizes[],
@@ -166,6 +199,7 @@ static void snap_prepare_intersect(struct snap_job *cjob,
                 SNAP_ADDRFLAG_END);
     }
     ijob_i->step = step;
+    ijob_i->operation = operation;
     ijob_i->method = method;
     snap_job_set(cjob, ijob_i, sizeof(*ijob_i),
             ijob_o, sizeof(*ijob_o));
@@ -196,6 +230,52 @@ static int gen_random_table(value_t table[], uint32_t num,uint32_t len)
 
 }
 
+/*
+ * Two tables of distinct rows: len random letters and a row number in
+ * OVERLAP_ID_LETTERS letters. overlap percent of the rows of table 2,
+ * at most n1, are copies of table 1 rows, so exactly that many rows
+ * are in common. Table 2 is shuffled.
+ */
+#define OVERLAP_ID_LETTERS 7    // 26^7 rows
+
+static void gen_row(value_t row, uint64_t id, uint32_t len)
+{
+    uint32_t j;
+
+    memset(row, 0, sizeof(value_t));
+    for (j = 0; j < len; j++)
+        row[j] = (char)(rand() % 26 + 97);
+    for (j = 0; j < OVERLAP_ID_LETTERS; j++, id /= 26)
+        row[len + j] = (char)(id % 26 + 97);
+}
+
+static int gen_overlap_tables(value_t t1[], uint32_t n1, value_t t2[],
+        uint32_t n2, uint32_t overlap, uint32_t len)
+{
+    uint32_t i, j, c = MIN((uint64_t)n2 * MIN(overlap, 100u) / 100, n1);
+    value_t tmp;
+
+    if (len + OVERLAP_ID_LETTERS >= sizeof(value_t)) {
+        printf(" Error length when generating overlapping tables.\n");
+        return -1;
+    }
+    for (i = 0; i < n1; i++)
+        gen_row(t1[i], i, len);
+    for (i = 0; i < n2; i++) {
+        if (i < c)
+            copyvalue(t2[i], t1[(uint64_t)i * n1 / c]);
+        else
+            gen_row(t2[i], (uint64_t)n1 + i, len);
+    }
+    for (i = n2; i > 1; i--) {
+        j = rand() % i;
+        copyvalue(tmp, t2[i - 1]);
+        copyvalue(t2[i - 1], t2[j]);
+        copyvalue(t2[j], tmp);
+    }
+    return 0;
+}
+
 static void dump_table(value_t* table, uint32_t num)
 {
     uint32_t i;
@@ -206,6 +286,32 @@ static void dump_table(value_t* table, uint32_t num)
     printf("\n");
 }
 
+/*
+ * Set operation results are written page by page, in the format of the
+ * -o file, or printed with -v.
+ */
+#define RESULT_PAGE_ROWS 4096
+
+static int write_page(value_t *rows, uint32_t n, void *priv)
+{
+    FILE *fp = priv;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!fp) {
+            if (verbose_flag)
+                printf("%s;\n", rows[i]);
+            continue;
+        }
+        rows[i][sizeof(value_t)-1] = '\n';
+    }
+    if (fp && fwrite(rows, sizeof(value_t), n, fp) != n) {
+        fprintf(stderr, "err: cannot write result page: %s\n", strerror(errno));
+        return -EIO;
+    }
+    return 0;
+}
+
 static int run_one_step(struct snap_action *action,
         struct snap_job *cjob,
         unsigned long timeout,
@@ -228,6 +334,661 @@ static int run_one_step(struct snap_action *action,
     return rc;
 }
 
+typedef uint32_t (*bench_fn_t)(value_t *table1, uint32_t n1,
+        value_t *table2, uint32_t n2, value_t *result_array);
+
+static uint32_t bench_hash(value_t *table1, uint32_t n1,
+        value_t *table2, uint32_t n2, value_t *result_array)
+{
+    return run_sw_intersection(HASH_METHOD, table1, n1, table2, n2, result_array);
+}
+
+static uint32_t bench_sort(value_t *table1, uint32_t n1,
+        value_t *table2, uint32_t n2, value_t *result_array)
+{
+    return run_sw_intersection(SORT_METHOD, table1, n1, table2, n2, result_array);
+}
+
+static uint32_t bench_search(value_t *table1, uint32_t n1,
+        value_t *table2, uint32_t n2, value_t *result_array)
+{
+    return run_sw_intersection(SEARCH_METHOD, table1, n1, table2, n2, result_array);
+}
+
+static uint32_t bench_auto(value_t *table1, uint32_t n1,
+        value_t *table2, uint32_t n2, value_t *result_array)
+{
+    return run_sw_intersection(AUTO_METHOD, table1, n1, table2, n2, result_array);
+}
+
+/*
+ * The methods as they are against what they replaced. The chained
+ * hash table matches a duplicated row more than once, so its result
+ * size is not checked, and it walks all duplicates of a row, so it is
+ * left out on the duplicate heavy tables. qsort sorts the tables in
+ * place, it runs last.
+ */
+static const struct {
+    const char *name;
+    bench_fn_t fn;
+    int checked;
+    int dups;       // runs on duplicate heavy tables
+} bench_methods[] = {
+    { "chained hash", intersect_hash_chained, 0, 0 },
+    { "arena hash",   bench_hash,             1, 1 },
+    { "radix sort",   bench_sort,             1, 1 },
+    { "search",       bench_search,           1, 1 },
+    { "auto",         bench_auto,             1, 1 },
+    { "qsort",        intersect_sort_qsort,   1, 1 },
+};
+
+#define BENCH_METHODS  (sizeof(bench_methods) / sizeof(bench_methods[0]))
+#define BENCH_SKEW     100  // the second run has a table of num / BENCH_SKEW rows
+#define BENCH_DUPS_LEN 1    // the third run has 26 values, each many times
+
+static int bench_one(value_t *t1, uint32_t n1, value_t *t2, uint32_t n2,
+        uint32_t len, int overlap, value_t *result)
+{
+    int dups = len == BENCH_DUPS_LEN && overlap < 0;
+    struct timeval etime, stime;
+    long long usec[BENCH_METHODS];
+    uint32_t n3[BENCH_METHODS], m, ref = 0;
+    int rc = 0;
+
+    if (overlap >= 0) {
+        if (gen_overlap_tables(t1, n1, t2, n2, overlap, len))
+            return -1;
+    } else if (gen_random_table(t1, n1, len) || gen_random_table(t2, n2, len))
+        return -1;
+
+    for (m = 0; m < BENCH_METHODS; m++) {
+        usec[m] = -1;
+        n3[m] = 0;
+        if (dups && !bench_methods[m].dups)
+            continue;
+        gettimeofday(&stime, NULL);
+        n3[m] = bench_methods[m].fn(t1, n1, t2, n2, result);
+        gettimeofday(&etime, NULL);
+        usec[m] = timediff_usec(&etime, &stime);
+        if (bench_methods[m].checked && !ref)
+            ref = m;
+    }
+
+    printf("%u x %u rows, %u letters, %u rows in common\n",
+            n1, n2, len, n3[ref]);
+    for (m = 0; m < BENCH_METHODS; m++) {
+        if (usec[m] < 0) {
+            printf("  %-14s    skipped, duplicates\n", bench_methods[m].name);
+            continue;
+        }
+        printf("  %-14s %10lld usec %10u rows\n",
+                bench_methods[m].name, usec[m], n3[m]);
+        if (bench_methods[m].checked && n3[m] != n3[ref]) {
+            fprintf(stderr, "err: %s found %u rows, %s %u\n",
+                    bench_methods[m].name, n3[m],
+                    bench_methods[ref].name, n3[ref]);
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+/*
+ * Scaling of the lock-free hash method from one thread to max_threads,
+ * doubling, on the tables of the last bench_one.
+ */
+static int bench_threads(value_t *t1, uint32_t n1, value_t *t2, uint32_t n2,
+        unsigned int max_threads, value_t *result)
+{
+    struct timeval etime, stime;
+    long long usec, usec_1 = 0;
+    uint32_t n3, n3_1 = 0;
+    unsigned int t;
+
+    printf("%u x %u rows, hash build and probe on 1 to %u threads\n",
+            n1, n2, max_threads);
+    for (t = 1; ; t = MIN(2 * t, max_threads)) {
+        gettimeofday(&stime, NULL);
+        n3 = intersect_hash_mt(t1, n1, t2, n2, result, t);
+        gettimeofday(&etime, NULL);
+        usec = MAX(timediff_usec(&etime, &stime), 1ll);
+        if (t == 1) {
+            usec_1 = usec;
+            n3_1 = n3;
+        }
+        printf("  %3u threads %10lld usec %6.2fx speedup %5.0f%% efficiency %10u rows\n",
+                t, usec, (double)usec_1 / usec,
+                100.0 * usec_1 / usec / t, n3);
+        if (n3 != n3_1) {
+            fprintf(stderr, "err: %u threads found %u rows, 1 thread %u\n",
+                    t, n3, n3_1);
+            return -1;
+        }
+        if (t == max_threads)
+            break;
+    }
+    return 0;
+}
+
+/*
+ * K tables shrink linearly from num rows to num / ratio rows, largest
+ * first. The K-way intersection is timed against chaining two table
+ * runs through host buffers in the given order.
+ */
+static const uint32_t bench_ratios[] = { 1, 10, 100 };
+
+static uint32_t bench_chain(int method, value_t *tables[], uint32_t nums[],
+        uint32_t k, value_t *buf[2])
+{
+    uint32_t t, n, cur = 0;
+
+    n = run_sw_intersection(method, tables[0], nums[0], tables[1], nums[1], buf[0]);
+    for (t = 2; t < k; t++, cur ^= 1)
+        n = run_sw_intersection(method, buf[cur], n, tables[t], nums[t], buf[cur ^ 1]);
+    if (cur)
+        memcpy(buf[0], buf[1], n * sizeof(value_t));
+    return n;
+}
+
+static int bench_kway(uint32_t num, uint32_t len, uint32_t k)
+{
+    static const int methods[] = { HASH_METHOD, SORT_METHOD };
+    uint32_t page_size = sysconf(_SC_PAGESIZE);
+    value_t *tables[MAX_NUM_TABLES] = { NULL }, *buf[2], *result;
+    uint32_t nums[MAX_NUM_TABLES], r, t, m, n_chain, n_kway;
+    struct timeval etime, stime;
+    long long usec_chain, usec_kway;
+    int rc = -1;
+
+    buf[0] = memalign(page_size, (size_t)num * sizeof(value_t));
+    buf[1] = memalign(page_size, (size_t)num * sizeof(value_t));
+    result = memalign(page_size, (size_t)num * sizeof(value_t));
+    if (!buf[0] || !buf[1] || !result)
+        goto out;
+    for (t = 0; t < k; t++) {
+        tables[t] = memalign(page_size, (size_t)num * sizeof(value_t));
+        if (!tables[t])
+            goto out;
+    }
+
+    for (r = 0; r < sizeof(bench_ratios) / sizeof(bench_ratios[0]); r++) {
+        for (t = 0; t < k; t++) {
+            nums[t] = num - (uint64_t)(num - num / bench_ratios[r]) * t / (k - 1);
+            nums[t] = MAX(nums[t], 1u);
+            if (gen_random_table(tables[t], nums[t], len))
+                goto out;
+        }
+
+        printf("%u tables of %u to %u rows, %u letters\n",
+                k, nums[0], nums[k - 1], len);
+        for (m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+            gettimeofday(&stime, NULL);
+            n_chain = bench_chain(methods[m], tables, nums, k, buf);
+            gettimeofday(&etime, NULL);
+            usec_chain = timediff_usec(&etime, &stime);
+
+            gettimeofday(&stime, NULL);
+            n_kway = run_sw_intersection_k(methods[m], tables, nums, k, result);
+            gettimeofday(&etime, NULL);
+            usec_kway = timediff_usec(&etime, &stime);
+
+            printf("  method %d  chained %10lld usec  k-way %10lld usec  %u rows\n",
+                    methods[m], usec_chain, usec_kway, n_kway);
+            if (n_chain != n_kway) {
+                fprintf(stderr, "err: method %d k-way found %u rows, chained %u\n",
+                        methods[m], n_kway, n_chain);
+                goto out;
+            }
+        }
+    }
+    rc = 0;
+ out:
+    for (t = 0; t < k; t++)
+        __free(tables[t]);
+    __free(buf[0]);
+    __free(buf[1]);
+    __free(result);
+    return rc;
+}
+
+/*
+ * Times the SW methods on random tables of num rows with len letters,
+ * once with two tables of num rows and once with a small second table.
+ * Without overlap, a third run has two tables of num rows of a single
+ * letter, which are nearly all duplicates.
+ * With overlap >= 0 the tables have distinct rows, overlap percent of
+ * table 2 in common. With more than two tables it times the K-way
+ * intersection. With threads > 1 it adds the thread scaling of the hash
+ * method on two tables of num rows.
+ */
+static int intersect_bench(uint32_t num, uint32_t len, uint32_t k, int overlap,
+        unsigned int threads)
+{
+    uint32_t page_size = sysconf(_SC_PAGESIZE);
+    value_t *t1, *t2, *result;
+    int rc = -1;
+
+    if (k > NUM_TABLES)
+        return bench_kway(num, len, k);
+
+    t1 = memalign(page_size, (size_t)num * sizeof(value_t));
+    t2 = memalign(page_size, (size_t)num * sizeof(value_t));
+    result = memalign(page_size, (size_t)num * sizeof(value_t));
+    if (!t1 || !t2 || !result)
+        goto out;
+
+    rc = bench_one(t1, num, t2, num, len, overlap, result);
+    if (threads > 1)
+        rc |= bench_threads(t1, num, t2, num, threads, result);
+    rc |= bench_one(t1, num, t2, MAX(num / BENCH_SKEW, 1u), len, overlap, result);
+    if (overlap < 0 && len != BENCH_DUPS_LEN)
+        rc |= bench_one(t1, num, t2, num, BENCH_DUPS_LEN, -1, result);
+ out:
+    __free(t1);
+    __free(t2);
+    __free(result);
+    return rc;
+}
+
+/*
+ * Calibration of the AUTO_METHOD cost model on tables of distinct
+ * rows, half of the smaller one in common. Each constant comes from
+ * the best of CALIB_RUNS runs of its method. Hash build and probe
+ * come from a table which fits the L2 cache against itself and a
+ * large one, sort from two tables which fit. The miss costs come from
+ * two large tables, the sort cache size from a mid pair, search after
+ * sort. The model is saved to
+ * intersect_cost_file() and then checked on a few shapes.
+ */
+#define CALIB_ROWS        (1u << 20)
+#define CALIB_DIRECT_ROWS 2048u
+#define CALIB_SKEW        64u
+#define CALIB_RUNS        3
+#define CALIB_LEN         16
+#define CALIB_OVERLAP     50
+#define CALIB_CACHE       (2 * 1024 * 1024)    // without a L2 size
+#define CALIB_SORT_BYTES  (sizeof(value_t) + 32)  // row and two sort items
+
+static double calib_ns(int method, value_t *t1, uint32_t n1,
+        value_t *t2, uint32_t n2, value_t *result)
+{
+    struct timeval etime, stime;
+    long long usec, best = -1;
+    int r;
+
+    if (gen_overlap_tables(t1, n1, t2, n2, CALIB_OVERLAP, CALIB_LEN))
+        return -1.0;
+    for (r = 0; r < CALIB_RUNS; r++) {
+        gettimeofday(&stime, NULL);
+        run_sw_intersection(method, t1, n1, t2, n2, result);
+        gettimeofday(&etime, NULL);
+        usec = timediff_usec(&etime, &stime);
+        if (best < 0 || usec < best)
+            best = usec;
+    }
+    return best * 1000.0;
+}
+
+/*
+ * Sets the constant *field of cost, so that the model estimates t for
+ * the run, from its estimates with *field at 0 and at 1 ns.
+ */
+static void calib_fit(intersect_cost_t *cost, double *field, int method,
+        uint32_t n1, uint32_t n2, double t)
+{
+    double e0, e1;
+
+    *field = 0.0;
+    intersect_cost_set(cost);
+    e0 = intersect_cost_estimate(method, n1, n2, CALIB_OVERLAP / 100.0, NULL);
+    *field = 1.0;
+    intersect_cost_set(cost);
+    e1 = intersect_cost_estimate(method, n1, n2, CALIB_OVERLAP / 100.0, NULL);
+    *field = e1 > e0 ? MAX((t - e0) / (e1 - e0), 0.0) : 0.0;
+    intersect_cost_set(cost);
+}
+
+static const char *method_names[] = {
+    [DIRECT_METHOD] = "direct",
+    [HASH_METHOD]   = "hash",
+    [SORT_METHOD]   = "sort",
+    [SEARCH_METHOD] = "search",
+};
+
+// num rows, unless that is too few, and the shapes up to CALIB_ROWS
+static int intersect_calibrate(uint32_t num)
+{
+    static const uint32_t shapes[][2] = {
+        { 16, 16 }, { 256, 256 }, { 64, 1 << 16 }, { 1 << 16, 1 << 16 },
+        { 256, 1 << 20 }, { 1 << 14, 1 << 20 }, { 1 << 20, 1 << 20 },
+    };
+    uint32_t page_size = sysconf(_SC_PAGESIZE);
+    uint32_t n = num >= CALIB_DIRECT_ROWS * CALIB_SKEW ? num : CALIB_ROWS;
+    uint32_t ns = n / CALIB_SKEW, rows = MAX(n, CALIB_ROWS);
+    double t_small, t_mid, t, c, e, err = 0, ns_t[SEARCH_METHOD + 1];
+    value_t *t1, *t2, *result;
+    intersect_cost_t cost, fit, best_fit;
+    const char *fname = intersect_cost_file();
+    long cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    uint32_t i, n1, n2, nc;
+    int m, best, pick, rc = -1;
+
+    t1 = memalign(page_size, (size_t)rows * sizeof(value_t));
+    t2 = memalign(page_size, (size_t)rows * sizeof(value_t));
+    result = memalign(page_size, (size_t)rows * sizeof(value_t));
+    if (!t1 || !t2 || !result)
+        goto out;
+
+    printf("Calibrating on %u rows ...\n", n);
+    memset(&cost, 0, sizeof(cost));
+    cost.cache = cache > 0 ? cache : CALIB_CACHE;
+
+    t = calib_ns(DIRECT_METHOD, t1, CALIB_DIRECT_ROWS, t2, CALIB_DIRECT_ROWS, result);
+    calib_fit(&cost, &cost.direct, DIRECT_METHOD, CALIB_DIRECT_ROWS,
+            CALIB_DIRECT_ROWS, t);
+
+    // build and probe solve the cached pairs, the misses the large one
+    nc = cost.cache / 64;   // at most half of the cache in 16 byte slots
+    t_small = calib_ns(HASH_METHOD, t1, nc, t2, nc, result);
+    t = calib_ns(HASH_METHOD, t1, nc, t2, n, result);
+    cost.hash_probe = MAX((t - t_small) / (n - nc), 0.1);
+    cost.hash_build = MAX(t_small / nc - cost.hash_probe, 0.1);
+    t = calib_ns(HASH_METHOD, t1, n, t2, n, result);
+    calib_fit(&cost, &cost.hash_miss, HASH_METHOD, n, n, t);
+
+    // the sort cache is the power of 2 which predicts a mid sort best
+    nc = cost.cache / (2 * CALIB_SORT_BYTES);
+    cost.sort_cache = cost.cache;
+    t = calib_ns(SORT_METHOD, t1, nc, t2, nc, result);
+    calib_fit(&cost, &cost.sort, SORT_METHOD, nc, nc, t);
+    t_mid = calib_ns(SORT_METHOD, t1, n / 8, t2, n / 8, result);
+    t = calib_ns(SORT_METHOD, t1, n, t2, n, result);
+    for (c = cost.cache; c <= 2.0 * n * CALIB_SORT_BYTES; c *= 2) {
+        fit = cost;
+        fit.sort_cache = c;
+        calib_fit(&fit, &fit.sort_miss, SORT_METHOD, n, n, t);
+        e = intersect_cost_estimate(SORT_METHOD, n / 8, n / 8, 0.0, NULL) - t_mid;
+        if (c == cost.cache || e * e < err) {
+            err = e * e;
+            best_fit = fit;
+        }
+    }
+    cost = best_fit;
+
+    t = calib_ns(SEARCH_METHOD, t1, ns, t2, n, result);
+    calib_fit(&cost, &cost.search, SEARCH_METHOD, ns, n, t);
+    if (t < 0 || cost.direct <= 0 || cost.sort <= 0)
+        goto out;
+
+    printf("Cost model in ns: direct %.4f, hash build %.2f probe %.2f "
+            "miss %.2f beyond %.0f KiB, sort %.2f miss %.2f beyond %.0f KiB, "
+            "search %.2f\n", cost.direct, cost.hash_build, cost.hash_probe,
+            cost.hash_miss, cost.cache / 1024, cost.sort, cost.sort_miss,
+            cost.sort_cache / 1024, cost.search);
+    if (intersect_cost_save(fname, &cost) != 0)
+        goto out;
+    printf("Saved to %s\n", fname);
+
+    printf("%10s %10s  %8s %8s %8s %8s  best     auto     auto/best\n",
+            "rows 1", "rows 2", "direct", "hash", "sort", "search");
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        n1 = shapes[i][0];
+        n2 = shapes[i][1];
+        for (m = DIRECT_METHOD; m <= SEARCH_METHOD; m++)
+            ns_t[m] = m == DIRECT_METHOD && (uint64_t)n1 * n2 > (1ull << 28) ?
+                -1.0 : calib_ns(m, t1, n1, t2, n2, result);
+        pick = intersect_auto_method(n1, n2, CALIB_OVERLAP / 100.0, NULL);
+        best = HASH_METHOD;
+        printf("%10u %10u ", n1, n2);
+        for (m = DIRECT_METHOD; m <= SEARCH_METHOD; m++) {
+            if (ns_t[m] < 0) {
+                printf(" %8s", "-");
+                continue;
+            }
+            printf(" %8.0f", ns_t[m] / 1000.0);
+            if (ns_t[m] < ns_t[best])
+                best = m;
+        }
+        printf("  %-8s %-8s %5.2f\n", method_names[best], method_names[pick],
+                ns_t[pick] / ns_t[best]);
+    }
+    printf("(usec, best of %d runs)\n", CALIB_RUNS);
+    rc = 0;
+ out:
+    __free(t1);
+    __free(t2);
+    __free(result);
+    return rc;
+}
+
+/*
+ * Integer set mode, -u: the inputs are binary files of 4 or 8 byte IDs
+ * in host byte order, the output is written the same way.
+ */
+#define IDS_MULT 0x9e3779b97f4a7c15ull  // odd, scatters i * IDS_MULT
+
+static void *read_ids(const char *fname, unsigned int width, uint64_t *n)
+{
+    ssize_t size = __file_size(fname);
+    void *ids;
+
+    if (size < 0)
+        return NULL;
+    *n = size / width;
+    ids = malloc(MAX(*n, 1ull) * width);
+    if (!ids)
+        return NULL;
+    if (*n && __file_read(fname, ids, *n * width) < 0) {
+        free(ids);
+        return NULL;
+    }
+    fprintf(stdout, "reading %llu IDs from %s\n", (long long)*n, fname);
+    return ids;
+}
+
+static inline void put_id(void *ids, uint64_t i, unsigned int width,
+        uint64_t id)
+{
+    if (width == sizeof(uint32_t))
+        ((uint32_t *)ids)[i] = id;
+    else
+        ((uint64_t *)ids)[i] = id;
+}
+
+static inline uint64_t get_id(const void *ids, uint64_t i, unsigned int width)
+{
+    return width == sizeof(uint32_t) ? ((const uint32_t *)ids)[i] :
+        ((const uint64_t *)ids)[i];
+}
+
+/*
+ * num IDs (first + i) * mult. IDS_MULT scatters them over the ID
+ * range, being odd it keeps them distinct. 2 or 3 keeps them dense.
+ */
+static void *gen_ids(uint64_t first, uint64_t num, uint64_t mult,
+        unsigned int width)
+{
+    void *ids = malloc(MAX(num, 1ull) * width);
+    uint64_t i;
+
+    for (i = 0; ids && i < num; i++)
+        put_id(ids, i, width, (first + i) * mult);
+    return ids;
+}
+
+/*
+ * Intersects the ID tables, fewest IDs first. Without input files
+ * there are num_tables random tables of num IDs, each one shifted by
+ * num / (2 * num_tables) against the previous one.
+ */
+static int intersect_ids(const char *input[], uint32_t num_inputs,
+        uint32_t num_tables, uint32_t num, unsigned int width,
+        const char *output, int count_only)
+{
+    intset_t *sets[MAX_NUM_TABLES] = { NULL }, *r = NULL, *next;
+    uint64_t n, card = 0, bytes = 0, in_bytes = 0;
+    struct timeval etime, stime;
+    uint32_t t, u, order[MAX_NUM_TABLES];
+    void *ids;
+    int rc = -1;
+
+    gettimeofday(&stime, NULL);
+    for (t = 0; t < num_tables; t++) {
+        if (num_inputs) {
+            ids = read_ids(input[t], width, &n);
+        } else {
+            n = num;
+            ids = gen_ids((uint64_t)t * num / (2 * num_tables), n,
+                    IDS_MULT, width);
+        }
+        if (!ids)
+            goto out;
+        sets[t] = intset_build(ids, n, width);
+        free(ids);
+        if (!sets[t])
+            goto out;
+        in_bytes += n * width;
+        bytes += intset_bytes(sets[t]);
+        order[t] = t;
+        for (u = t; u > 0 && sets[order[u - 1]]->card > sets[t]->card; u--)
+            order[u] = order[u - 1];
+        order[u] = t;
+    }
+    gettimeofday(&etime, NULL);
+    printf("Built %u integer sets: %llu bytes of IDs in %llu bytes, %lld usec\n",
+            num_tables, (long long)in_bytes, (long long)bytes,
+            (long long)timediff_usec(&etime, &stime));
+
+    gettimeofday(&stime, NULL);
+    for (t = 1; t < num_tables; t++) {
+        if (t == num_tables - 1 && (count_only || !output)) {
+            card = intset_intersect(r ? r : sets[order[0]], sets[order[t]], NULL);
+            break;
+        }
+        card = intset_intersect(r ? r : sets[order[0]], sets[order[t]], &next);
+        if (!next)
+            goto out;
+        intset_free(r);
+        r = next;
+    }
+    gettimeofday(&etime, NULL);
+    printf("SW: result_num = %llu, intersection took %lld usec\n",
+            (long long)card, (long long)timediff_usec(&etime, &stime));
+
+    rc = 0;
+    if (r && output) {
+        ids = malloc(MAX(r->card, 1ull) * width);
+        if (!ids) {
+            rc = -1;
+            goto out;
+        }
+        n = intset_ids(r, ids, width);
+        printf("Writing %llu IDs to %s\n", (long long)n, output);
+        if (n)
+            rc = __file_write(output, ids, n * width) < 0 ? -1 : 0;
+        free(ids);
+    }
+ out:
+    intset_free(r);
+    for (t = 0; t < num_tables; t++)
+        intset_free(sets[t]);
+    return rc;
+}
+
+/*
+ * The integer sets against value_t rows of the same IDs in decimal,
+ * once dense and once scattered over the whole ID range.
+ */
+static int bench_ids_one(const char *name, void *ids[NUM_TABLES],
+        uint64_t nums[NUM_TABLES], unsigned int width)
+{
+    uint32_t page_size = sysconf(_SC_PAGESIZE);
+    value_t *tables[NUM_TABLES] = { NULL }, *result = NULL;
+    intset_t *sets[NUM_TABLES] = { NULL };
+    struct timeval etime, stime;
+    long long usec_build, usec_set, usec_rows;
+    uint64_t i, card, set_bytes = 0;
+    uint32_t t, n3;
+    int rc = -1;
+
+    gettimeofday(&stime, NULL);
+    for (t = 0; t < NUM_TABLES; t++) {
+        sets[t] = intset_build(ids[t], nums[t], width);
+        if (!sets[t])
+            goto out;
+        set_bytes += intset_bytes(sets[t]);
+    }
+    gettimeofday(&etime, NULL);
+    usec_build = timediff_usec(&etime, &stime);
+
+    gettimeofday(&stime, NULL);
+    card = intset_intersect(sets[0], sets[1], NULL);
+    gettimeofday(&etime, NULL);
+    usec_set = timediff_usec(&etime, &stime);
+
+    for (t = 0; t < NUM_TABLES; t++) {
+        tables[t] = memalign(page_size, nums[t] * sizeof(value_t));
+        if (!tables[t])
+            goto out;
+        for (i = 0; i < nums[t]; i++)
+            snprintf(tables[t][i], sizeof(value_t), "%llu",
+                    (unsigned long long)get_id(ids[t], i, width));
+    }
+    result = memalign(page_size, MIN(nums[0], nums[1]) * sizeof(value_t));
+    if (!result)
+        goto out;
+    gettimeofday(&stime, NULL);
+    n3 = run_sw_intersection(HASH_METHOD, tables[0], nums[0], tables[1], nums[1], result);
+    gettimeofday(&etime, NULL);
+    usec_rows = timediff_usec(&etime, &stime);
+
+    printf("%s: %llu x %llu IDs of %u bytes, %llu in common\n"
+            "  integer sets %10llu bytes %10lld usec (build %lld usec)\n"
+            "  value_t rows %10llu bytes %10lld usec\n",
+            name, (long long)nums[0], (long long)nums[1], width,
+            (long long)card, (long long)set_bytes, usec_set, usec_build,
+            (long long)((nums[0] + nums[1]) * sizeof(value_t)), usec_rows);
+    if (n3 != card) {
+        fprintf(stderr, "err: integer sets found %llu IDs, value_t rows %u\n",
+                (long long)card, n3);
+        goto out;
+    }
+    rc = 0;
+ out:
+    for (t = 0; t < NUM_TABLES; t++) {
+        intset_free(sets[t]);
+        __free(tables[t]);
+    }
+    __free(result);
+    return rc;
+}
+
+static int bench_ids(uint32_t num, unsigned int width)
+{
+    void *ids[NUM_TABLES];
+    uint64_t nums[NUM_TABLES] = { num, 2 * (uint64_t)num / 3 };
+    int rc = -1;
+
+    // Dense: the multiples of 2 and of 3 below 2 * num
+    ids[0] = gen_ids(0, nums[0], 2, width);
+    ids[1] = gen_ids(0, nums[1], 3, width);
+    if (ids[0] && ids[1])
+        rc = bench_ids_one("dense", ids, nums, width);
+    free(ids[0]);
+    free(ids[1]);
+    if (rc)
+        return rc;
+
+    // Sparse: scattered over the ID range, half of them in common
+    nums[1] = num;
+    ids[0] = gen_ids(0, num, IDS_MULT, width);
+    ids[1] = gen_ids(num / 2, num, IDS_MULT, width);
+    rc = ids[0] && ids[1] ? bench_ids_one("sparse", ids, nums, width) : -1;
+    free(ids[0]);
+    free(ids[1]);
+    return rc;
+}
+
 /**
  * Read accelerator specific registers. Must be called as root!
  */
@@ -250,8 +1011,11 @@ int main(int argc, char *argv[])
     //Function specific
     //long long time_us;
     intersect_job_t ijob_i, ijob_o;
-    value_t * src_tables[NUM_TABLES];
-    uint32_t  src_sizes[NUM_TABLES];
+    value_t * src_tables[MAX_NUM_TABLES];
+    uint32_t  src_sizes[MAX_NUM_TABLES];
+    uint32_t  src_nums[MAX_NUM_TABLES];
+    uint32_t num_tables = NUM_TABLES;
+    uint32_t num_inputs = 0;
     FILE *fp;
 
     value_t * result_table = NULL;
@@ -267,12 +1031,25 @@ int main(int argc, char *argv[])
     uint32_t len = 1;
     //Several global variables.
     uint32_t method = HASH_METHOD;
+    uint32_t operation = INTERSECT_OP;
+    intersect_sink_t sink = { NULL, RESULT_PAGE_ROWS, 0, write_page, NULL, 0 };
+    FILE *fp_out = NULL;
     uint32_t sw = 0;
-    const char *input[NUM_TABLES];
-    for(i = 0; i < NUM_TABLES; i++)
+    int bench = 0;
+    int overlap = -1;
+    int calibrate = 0;
+    int external = 0;
+    unsigned int id_width = 0;
+    struct intersect_ext ext;
+    const char *input[MAX_NUM_TABLES];
+    for(i = 0; i < MAX_NUM_TABLES; i++) {
         input[i] = NULL;
+        src_tables[i] = NULL;
+    }
     const char *output = NULL;
 
+    memset(&ext, 0, sizeof(ext));
+    ext.threads = 1;
     while (1) {
         int option_index = 0;
         static struct option long_options[] = {
@@ -282,18 +1059,29 @@ int main(int argc, char *argv[])
             { "output",	 required_argument, NULL, 'o' },
             { "num",	 required_argument, NULL, 'n' },
             { "len",	 required_argument, NULL, 'l' },
+            { "tables",	 required_argument, NULL, 'k' },
             { "method",	 required_argument, NULL, 'm' },
+            { "operation", required_argument, NULL, 'p' },
+            { "count",	 no_argument,	    NULL, 'c' },
             { "software",required_argument, NULL, 's' },
             { "timeout", required_argument, NULL, 't' },
             { "version", no_argument,	    NULL, 'V' },
             { "verbose", no_argument,	    NULL, 'v' },
             { "irq",     no_argument,	    NULL, 'I' },
+            { "bench",   no_argument,	    NULL, 'b' },
+            { "overlap", required_argument, NULL, 'O' },
+            { "calibrate", no_argument,	    NULL, 'A' },
+            { "external", no_argument,	    NULL, 'x' },
+            { "memory",	 required_argument, NULL, 'M' },
+            { "spill-dir", required_argument, NULL, 'D' },
+            { "threads", required_argument, NULL, 'T' },
+            { "ids",	 required_argument, NULL, 'u' },
             { "help",	 no_argument,	    NULL, 'h' },
             { 0,		 no_argument,	    NULL, 0   },
         };
 
         ch = getopt_long(argc, argv,
-                "C:i:j:o:m:n:l:t:VIvhs",
+                "C:i:j:o:m:n:l:k:p:t:M:D:T:u:O:VIvhsbcxA",
                 long_options, &option_index);
         if (ch == -1)
             break;
@@ -303,10 +1091,13 @@ int main(int argc, char *argv[])
                 card_no = strtol(optarg, (char **)NULL, 0);
                 break;
             case 'i':
-                input[0] = optarg;
-                break;
             case 'j':
-                input[1] = optarg;
+                if (num_inputs == MAX_NUM_TABLES) {
+                    fprintf(stderr, "err: more than %d input files\n",
+                            MAX_NUM_TABLES);
+                    exit(EXIT_FAILURE);
+                }
+                input[num_inputs++] = optarg;
                 break;
             case 'o':
                 output = optarg;
@@ -317,15 +1108,49 @@ int main(int argc, char *argv[])
             case 'l':
                 len = __str_to_num(optarg);
                 break;
+            case 'k':
+                num_tables = strtol(optarg, (char **)NULL, 0);
+                break;
             case 't':
                 timeout = strtol(optarg, (char **)NULL, 0);
                 break;
             case 'm':
                 method = strtol(optarg, (char **)NULL, 0);
                 break;
+            case 'p':
+                operation = (operation & ~OP_MASK) |
+                    (strtol(optarg, (char **)NULL, 0) & OP_MASK);
+                break;
+            case 'c':
+                operation |= OP_COUNT_ONLY;
+                break;
             case 's':
                 sw = 1;
                 break;
+            case 'b':
+                bench = 1;
+                break;
+            case 'O':
+                overlap = strtol(optarg, (char **)NULL, 0);
+                break;
+            case 'A':
+                calibrate = 1;
+                break;
+            case 'x':
+                external = 1;
+                break;
+            case 'M':
+                ext.memory = __str_to_num(optarg);
+                break;
+            case 'D':
+                ext.spill_dir = optarg;
+                break;
+            case 'T':
+                ext.threads = strtol(optarg, (char **)NULL, 0);
+                break;
+            case 'u':
+                id_width = strtol(optarg, (char **)NULL, 0);
+                break;
                 /* service */
             case 'V':
                 printf("%s\n", version);
@@ -351,11 +1176,74 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    if (num_inputs)
+        num_tables = num_inputs;
+    if (num_tables < NUM_TABLES || num_tables > MAX_NUM_TABLES) {
+        fprintf(stderr, "err: %u tables, need %d to %d\n",
+                num_tables, NUM_TABLES, MAX_NUM_TABLES);
+        exit(EXIT_FAILURE);
+    }
+    if (calibrate)
+        exit(intersect_calibrate(num) ? EXIT_FAILURE : EXIT_SUCCESS);
+    if (method > AUTO_METHOD) {
+        fprintf(stderr, "err: method %u, need 0 to %d\n", method, AUTO_METHOD);
+        exit(EXIT_FAILURE);
+    }
+    if (external) {
+        if (num_inputs != NUM_TABLES ||
+                (operation & OP_MASK) > SYMDIFF_OP ||
+                (method != HASH_METHOD && method != SORT_METHOD &&
+                 method != AUTO_METHOD)) {
+            fprintf(stderr, "err: -x needs two input files and method 1, 2 or 4\n");
+            exit(EXIT_FAILURE);
+        }
+        ext.input[0] = input[0];
+        ext.input[1] = input[1];
+        ext.output = output;
+        ext.method = method;
+        ext.operation = operation;
+        exit(intersect_external(&ext) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    if (id_width) {
+        if ((id_width != sizeof(uint32_t) && id_width != sizeof(uint64_t)) ||
+                (operation & OP_MASK) != INTERSECT_OP) {
+            fprintf(stderr, "err: -u needs 4 or 8 byte IDs and operation 0\n");
+            exit(EXIT_FAILURE);
+        }
+        if (bench)
+            rc = bench_ids(num, id_width);
+        else
+            rc = intersect_ids(input, num_inputs, num_tables, num, id_width,
+                    output, operation & OP_COUNT_ONLY);
+        exit(rc ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    if (operation != INTERSECT_OP && (!sw || num_tables != NUM_TABLES ||
+                (operation & OP_MASK) > SYMDIFF_OP ||
+                (method != HASH_METHOD && method != SORT_METHOD &&
+                 method != AUTO_METHOD))) {
+        fprintf(stderr, "err: operation %d and -c need -s, two tables and method 1, 2 or 4\n",
+                operation & OP_MASK);
+        exit(EXIT_FAILURE);
+    }
+    if (!sw && !bench && num_tables != NUM_TABLES) {
+        fprintf(stderr, "err: HW intersects %d tables, use -s for more\n",
+                NUM_TABLES);
+        exit(EXIT_FAILURE);
+    }
+    if (!sw && !bench && method > SORT_METHOD) {
+        fprintf(stderr, "err: methods 3 and 4 are SW only, use -s\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (bench)
+        exit(intersect_bench(num, len, num_tables, overlap, ext.threads) ? EXIT_FAILURE : EXIT_SUCCESS);
+
 
     //Create Input tables
-    if (input[0] == NULL || input[1] == NULL) {
+    if (num_inputs == 0) {
         //Randomly generate the Table data
-        for (i = 0; i < NUM_TABLES; i++) {
+        min_num = num;
+        for (i = 0; i < num_tables; i++) {
             src_sizes[i] = num*sizeof(value_t); //All tables are of same size.
             src_tables[i] = memalign (page_size, src_sizes[i]);
             if(!src_tables[i])
@@ -373,10 +1261,10 @@ int main(int argc, char *argv[])
     }
     else {
 
-        int filesize[2];
+        int filesize[MAX_NUM_TABLES];
         uint32_t j;
 
-        for (i = 0; i < NUM_TABLES; i++) {
+        for (i = 0; i < num_tables; i++) {
             filesize[i] = __file_size(input[i]);
             if (filesize[i] < 0)
                 goto out_error;
@@ -440,7 +1328,7 @@ int main(int argc, char *argv[])
     //------------------------------------
     printf("Start Step1 (Copy source data from Host to DDR) ..............\n");
     snap_prepare_intersect(&cjob, &ijob_i, &ijob_o,
-            1, method, src_tables, src_sizes,result_table,99);
+            1, method, operation, src_tables, src_sizes,result_table,99);
 
     rc |= run_one_step(action, &cjob, timeout, 1);
     if (rc != 0)
@@ -450,7 +1338,7 @@ int main(int argc, char *argv[])
         //------------------------------------
         printf("Start Step2 (Copy source data from DDR to Host) ..............\n");
         snap_prepare_intersect(&cjob, &ijob_i, &ijob_o,
-                2, method, src_tables, src_sizes,result_table,99);
+                2, method, operation, src_tables, src_sizes,result_table,99);
 
         rc |= run_one_step(action, &cjob, timeout, 2);
         if (rc != 0)
@@ -459,8 +1347,39 @@ int main(int argc, char *argv[])
         //------------------------------------
         printf("Start Step4 (Do interesction by software) ..............\n");
         gettimeofday(&stime, NULL);
-        result_num = run_sw_intersection (method, src_tables[0], src_sizes[0]/sizeof(value_t),
-                src_tables[1], src_sizes[1]/sizeof(value_t), result_table);
+        if (operation != INTERSECT_OP) {
+            if (output != NULL && !(operation & OP_COUNT_ONLY)) {
+                fp_out = fopen(output, "w");
+                if (!fp_out) {
+                    fprintf(stderr, "err: cannot open %s: %s\n",
+                            output, strerror(errno));
+                    goto out_error2;
+                }
+            }
+            sink.rows = memalign(page_size, RESULT_PAGE_ROWS * sizeof(value_t));
+            sink.priv = fp_out;
+            if (!sink.rows) {
+                if (fp_out)
+                    fclose(fp_out);
+                goto out_error2;
+            }
+            result_num = run_sw_setop (method, operation, src_tables[0], src_sizes[0]/sizeof(value_t),
+                    src_tables[1], src_sizes[1]/sizeof(value_t), &sink);
+            __free(sink.rows);
+            if (fp_out)
+                fclose(fp_out);
+            if (sink.rc)
+                goto out_error2;
+        }
+        else if (num_tables == NUM_TABLES)
+            result_num = run_sw_intersection (method, src_tables[0], src_sizes[0]/sizeof(value_t),
+                    src_tables[1], src_sizes[1]/sizeof(value_t), result_table);
+        else {
+            for (i = 0; i < num_tables; i++)
+                src_nums[i] = src_sizes[i]/sizeof(value_t);
+            result_num = run_sw_intersection_k (method, src_tables, src_nums,
+                    num_tables, result_table);
+        }
         gettimeofday(&etime, NULL);
         fprintf(stdout, "Step 4 took %lld usec\n", (long long)timediff_usec(&etime, &stime));
         printf("SW: result_num = %d\n", result_num);
@@ -472,7 +1391,7 @@ int main(int argc, char *argv[])
         //------------------------------------
         printf("Start Step3 (Do intersection in DDR) ..............\n");
         snap_prepare_intersect(&cjob, &ijob_i, &ijob_o,
-                3, method, src_tables, src_sizes, result_table, 99);
+                3, method, operation, src_tables, src_sizes, result_table, 99);
 
         rc |= run_one_step(action, &cjob, timeout, 3);
         if (rc != 0)
@@ -486,14 +1405,18 @@ int main(int argc, char *argv[])
         //------------------------------------
         printf("Start Step5 (Copy result from DDR to Host) ..............\n");
         snap_prepare_intersect(&cjob, &ijob_i, &ijob_o,
-                5, method, src_tables, src_sizes, result_table, result_num * sizeof(value_t));
+                5, method, operation, src_tables, src_sizes, result_table, result_num * sizeof(value_t));
 
         rc |= run_one_step(action, &cjob, timeout, 5);
         if (rc != 0)
             goto out_error2;
     }
 
-    if(output != NULL) {
+    if (operation != INTERSECT_OP) {
+        // Written page by page above
+        printf("\n");
+    }
+    else if(output != NULL) {
         printf("Writing intersection result %d lines to %s\n",
                 (int)result_num, output);
 
@@ -518,7 +1441,7 @@ int main(int argc, char *argv[])
     snap_detach_action(action);
     snap_card_free(card);
 
-    for(i = 0; i < NUM_TABLES; i++)
+    for(i = 0; i < MAX_NUM_TABLES; i++)
         __free(src_tables[i]);
     __free(result_table);
 
@@ -529,7 +1452,7 @@ out_error2:
 out_error1:
     snap_card_free(card);
 out_error:
-    for(i = 0; i < NUM_TABLES; i++)
+    for(i = 0; i < MAX_NUM_TABLES; i++)
         __free(src_tables[i]);
     __free(result_table);
 
@@ -0,0 +1,39 @@
+#ifndef __SNAP_INTERSECT_H__
+#define __SNAP_INTERSECT_H__
+
+/*
+ * Copyright 2017 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <action_intersect.h>
+
+/*
+ * External set operation of two table files which need not fit into
+ * memory. The files hold 64 byte rows like the -i/-j inputs.
+ */
+struct intersect_ext {
+    const char *input[NUM_TABLES];
+    const char *output;         /* NULL: count only */
+    const char *spill_dir;      /* NULL: $TMPDIR or /tmp */
+    uint64_t memory;            /* for the partition pairs, 0: half the RAM */
+    unsigned int threads;
+    int method;                 /* HASH_METHOD or SORT_METHOD */
+    int operation;
+};
+
+int intersect_external(const struct intersect_ext *ext);
+
+#endif	/* __SNAP_INTERSECT_H__ */
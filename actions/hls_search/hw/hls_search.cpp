@@ -215,46 +215,122 @@ static void x_mbus_to_word(snap_membus_t *buffer, char *text)
 /*******************************************************/
 /********* STREAMING SEARCH ****************************/
 /*******************************************************/
+/*
+ * The text streams in one bus word per cycle. A window holds the last
+ * PATTERN_SIZE - 1 bytes of the previous word in front of the current
+ * one, so each of the STRM_LANES byte lanes checks the match ending at
+ * its byte against the whole pattern in parallel. The pattern is right
+ * aligned in the comparator, which keeps all window indices constant:
+ * lane l compares window[l + j] with pattern byte j where care[j] is set.
+ */
+#define STRM_LANES	BPERDW
+#define STRM_WINDOW	(PATTERN_SIZE - 1 + STRM_LANES)
+
+typedef ap_uint<STRM_LANES> strm_hits_t;
 
-static void strm_search_proc(const char pattern[PATTERN_SIZE], 
-	const int PatternSize, int TextSize,
-        hls::stream<char> &txt_stream_in, 
-	hls::stream<long> &pos_stream_out,
-        unsigned int &count)
+static strm_hits_t strm_match_word(const char pattern[PATTERN_SIZE],
+				   const ap_uint<PATTERN_SIZE> care,
+				   const char window[STRM_WINDOW])
 {
-	snap_bool_t cmp;
-    char curr_char;
-    char cache[PATTERN_SIZE];
-    unsigned int idx;
-    long position;
+#pragma HLS INLINE
+	strm_hits_t hits = 0;
 
-#pragma HLS INLINE // Into a DATAFLOW region
+	lane_loop: for (int l = 0; l < STRM_LANES; l++) {
+#pragma HLS UNROLL
+		snap_bool_t cmp = 1;
 
-    search_loop:for(int idx = 0; idx < TEXT_SIZE; idx++)
-    {
-#pragma HLS PIPELINE
-    	if(idx < TextSize) {
-            curr_char = txt_stream_in.read();
-
-            cmp = 1;
-            cmp_loop:for(int j = 0; j < PATTERN_SIZE; j++) {
-            	if ( j < PatternSize ) {
-            	    // shifting cache with new value as last one
-            	    cache[j] = (j < PatternSize-1) ? cache[j + 1] : curr_char;
-                    cmp &= (cache[j] == pattern[j]) ? 1 : 0;
-            	}
-            }
-            // don't take care of cmp if cache not filled
-            count = (idx < PatternSize - 1) ? 0 : count + (unsigned int)cmp;
- 	    // send  position or -1
-            position = (cmp == 1) ? idx - (PatternSize -1) : -1;
-
-            pos_stream_out.write(position); //pos_stream_out << position;
-    	}
-    	else
-    		break;
-    }
+		cmp_loop: for (int j = 0; j < PATTERN_SIZE; j++) {
+#pragma HLS UNROLL
+			if (care[j])
+				cmp &= (window[l + j] == pattern[j]) ? 1 : 0;
+		}
+		hits[l] = cmp;
+	}
+	return hits;
+}
+
+static unsigned int strm_popcount(strm_hits_t hits)
+{
+#pragma HLS INLINE
+	unsigned int n = 0;
+
+	pop_loop: for (int l = 0; l < STRM_LANES; l++) {
+#pragma HLS UNROLL
+		n += hits[l] ? 1 : 0;
+	}
+	return n;
+}
 
+static void strm_read_text(snap_membus_t *din_gmem,
+			   snap_membus_t *d_ddrmem,
+			   snapu16_t memory_type,
+			   snapu64_t input_address,
+			   unsigned int nb_words,
+			   hls::stream<snap_membus_t> &txt_stream_in)
+{
+	rd_text_in: for (unsigned int i = 0; i < TEXT_SIZE / BPERDW; i++) {
+#pragma HLS PIPELINE II=1
+		if (i >= nb_words)
+			break;
+		if (memory_type == SNAP_ADDRTYPE_HOST_DRAM)
+			txt_stream_in.write((din_gmem + input_address)[i]);
+		else
+			txt_stream_in.write((d_ddrmem + input_address)[i]);
+	}
+}
+
+static void strm_search_proc(const char pattern[PATTERN_SIZE],
+	const ap_uint<PATTERN_SIZE> care,
+	const int PatternSize, const unsigned int TextSize,
+	hls::stream<snap_membus_t> &txt_stream_in,
+	unsigned int &count)
+{
+	char carry[PATTERN_SIZE - 1];
+	char window[STRM_WINDOW];
+	snap_membus_t word;
+	strm_hits_t hits, valid;
+	unsigned int nb_words = (TextSize + BPERDW - 1) / BPERDW;
+	unsigned int end;
+#pragma HLS ARRAY_PARTITION variable=carry complete
+#pragma HLS ARRAY_PARTITION variable=window complete
+
+	count = 0;
+	carry_init: for (int k = 0; k < PATTERN_SIZE - 1; k++) {
+#pragma HLS UNROLL
+		carry[k] = 0;
+	}
+
+	search_loop: for (unsigned int w = 0; w < TEXT_SIZE / BPERDW; w++) {
+#pragma HLS PIPELINE II=1
+		if (w >= nb_words)
+			break;
+		word = txt_stream_in.read();
+
+		win_carry: for (int k = 0; k < PATTERN_SIZE - 1; k++) {
+#pragma HLS UNROLL
+			window[k] = carry[k];
+		}
+		win_word: for (int k = 0; k < STRM_LANES; k++) {
+#pragma HLS UNROLL
+			window[PATTERN_SIZE - 1 + k] = word(8 * k + 7, 8 * k);
+		}
+
+		hits = strm_match_word(pattern, care, window);
+
+		// only matches lying completely inside the text count
+		valid_loop: for (int l = 0; l < STRM_LANES; l++) {
+#pragma HLS UNROLL
+			end = w * BPERDW + l;
+			valid[l] = (end >= (unsigned int)(PatternSize - 1) &&
+				    end < TextSize) ? 1 : 0;
+		}
+		count += strm_popcount(hits & valid);
+
+		next_carry: for (int k = 0; k < PATTERN_SIZE - 1; k++) {
+#pragma HLS UNROLL
+			carry[k] = window[STRM_LANES + k];
+		}
+	}
 }
 
 static void strm_search(snap_membus_t *din_gmem,
@@ -264,119 +340,49 @@ static void strm_search(snap_membus_t *din_gmem,
                            const char Pattern[PATTERN_SIZE],
                            const int PatternSize)
 {
-
-
-  // VARIABLES
-  snapu32_t search_size;
-  snapu32_t TextSize;
-  snapu32_t nb_blocks_to_process;
-  short rc = 0;
-
   snapu64_t   InputAddress;
   snapu32_t   InputSize;
   snapu16_t   InputType;
-  snapu64_t   OutputAddress;
-
-  snapu64_t   rd_address_text_offset;
-  snapu64_t   wr_address_text_offset;
-
-  snap_membus_t  TextBuffer[1];   // 4KB =>64 words of 64B
-  char  Text[BPERDW];
-
-  snapu32_t nb_of_occurrences = 0;
-  snapu16_t Method;
-  snap_membus_t PositionBuffer[1];
-  unsigned int pos_nb;
-  unsigned long position;
   unsigned int count = 0;
+  char  AlignedPattern[PATTERN_SIZE];
+  ap_uint<PATTERN_SIZE> care = 0;
 
 #pragma HLS DATAFLOW
 #pragma HLS INLINE region // bring loops in sub-functions to this DATAFLOW region
 
-
   // byte address received need to be aligned with port width
   InputAddress = Action_Register->Data.ddr_text1.addr;
   InputSize    = Action_Register->Data.ddr_text1.size;
   InputType    = Action_Register->Data.ddr_text1.type;
 
-  hls::stream<char> txt_stream_in("txt_stream_in");
-  hls::stream<long>  pos_stream_out("pos_stream_out");
-  char current_char;
-  long pos_idx = 0;
-
-  snap_membus_t tmp;
-
+  hls::stream<snap_membus_t> txt_stream_in("txt_stream_in");
+#pragma HLS STREAM variable=txt_stream_in depth=64
 
+  // right align the pattern in the comparator
+  align_loop: for (int j = 0; j < PATTERN_SIZE; j++) {
+#pragma HLS UNROLL
+	  AlignedPattern[j] = (j >= PATTERN_SIZE - PatternSize) ?
+		  Pattern[j - (PATTERN_SIZE - PatternSize)] : 0;
+	  care[j] = (j >= PATTERN_SIZE - PatternSize) ? 1 : 0;
+  }
 
   // *************
   // read text in
   // *************
-
-  rd_address_text_offset = 0x0;
-
-  rd_text_in: for(unsigned int i=0; i < TEXT_SIZE/sizeof(snap_membus_t); i++)
-  {
-//#pragma HLS PIPELINE -- DON'T SET THIS PIPELINE HERE OR NO DATA WILL BE READ!
-	  if(i < (InputSize/sizeof(snap_membus_t))+1)
-	  {
-         read_single_word_of_data_from_mem(din_gmem, d_ddrmem, InputType,
-                  (InputAddress >> ADDR_RIGHT_SHIFT) + rd_address_text_offset,
-                  TextBuffer);
-
-          tmp = TextBuffer[0];
-          wr_strm_in:for (unsigned int k = 0; k < sizeof(snap_membus_t); k++)
-          {
-#pragma HLS PIPELINE
-                  //Text[k] = tmp(7, 0);
-                  txt_stream_in.write( tmp(7, 0) ); //txt_stream_in << current_char;
-                  tmp = tmp >> 8;
-                  //current_char = Text[k];
-                  //txt_stream_in.write(current_char); //txt_stream_in << current_char;
-          }
-      rd_address_text_offset++;
-	  }
-	  else
-		  break;
-
-  }
+  strm_read_text(din_gmem, d_ddrmem, InputType,
+		 InputAddress >> ADDR_RIGHT_SHIFT,
+		 (InputSize + BPERDW - 1) / BPERDW, txt_stream_in);
 
   // **************
   // process search
   // *************
-    strm_search_proc(Pattern, PatternSize, InputSize, 
-		txt_stream_in, pos_stream_out, count);
-
-
-   // **************
-   // process output
-   // *************
-
-	printf("strm_count %d\n", count);
-	// set a global variable to report the result
-	global_count += count;
-	// Get the stream of positions and build an array
-	pos_nb = 0;
-	wr_address_text_offset = 0;
-	PositionBuffer[0] = 0x0;
-
-	rd_strm_out: for (unsigned int i=0; i< InputSize; i++) {
-#pragma HLS PIPELINE
-		   pos_idx = pos_stream_out.read();  //pos_stream_out >> position;
-		   if (pos_idx != -1)
-		   {
-			position = (unsigned long) pos_idx;
-			printf("strm_position n: %d - found at: %d\n", pos_nb, pos_idx);
-			PositionBuffer[0] = (PositionBuffer[0] << 2*sizeof(position)) + position;
-			pos_nb ++;
-			if(pos_nb%32 == 0) // 32 x 2*8 = 512 bits =
-			{
-				   wr_address_text_offset++;
-			}
-		   }
-	}
-
-	 Action_Register->Data.nb_of_occurrences = (snapu32_t) count;
+  strm_search_proc(AlignedPattern, care, PatternSize, InputSize,
+		   txt_stream_in, count);
 
+  printf("strm_count %d\n", count);
+  // set a global variable to report the result
+  global_count += count;
+  Action_Register->Data.nb_of_occurrences = (snapu32_t) count;
 }
 //--------------------------------------------------------------------------------------------
 //--- MAIN PROGRAM FOR STREAMING -------------------------------------------------------------
@@ -407,8 +413,9 @@ static snapu32_t process_action_strm(snap_membus_t *din_gmem,
 
 
   mbus_to_word(PatternBuffer[0], Pattern); // convert buffer to char
+  if (PatternSize == 0 || PatternSize > PATTERN_SIZE) rc = 1;
 
-  if (Action_Register->Data.ddr_text1.size < TEXT_SIZE)
+  if (rc == 0 && Action_Register->Data.ddr_text1.size < TEXT_SIZE)
 	  strm_search(din_gmem, dout_gmem, d_ddrmem, 
 		      Action_Register, Pattern, PatternSize);
 
@@ -639,6 +646,130 @@ static snapu32_t process_action(snap_membus_t *din_gmem,
 }
 
 
+//--------------------------------------------------------------------------------------------
+//--- STEP 6 : UPLOAD OVERLAPPED WITH SEARCH -------------------------------------------------
+//--------------------------------------------------------------------------------------------
+/*
+ * Three processes of one DATAFLOW region, connected by streams. Each
+ * m_axi port is accessed by exactly one of them: pipe_host_read reads
+ * the next chunk from host memory, pipe_ddr_access writes it into its
+ * DDR slot on the write channel while it reads the current chunk from
+ * the other slot on the read channel, and pipe_search searches the
+ * current chunk block by block like process_action(). The two slots
+ * never overlap, so the DDR read and write need no ordering.
+ */
+#define PIPE_SLOT_WORDS	(DDR_PIPE_SLOT / BPERDW)
+
+static void pipe_host_read(snap_membus_t *din_gmem,
+			   snapu64_t src_word, snapu32_t up_words,
+			   hls::stream<snap_membus_t> &up_stream)
+{
+	ph_loop: for (snapu32_t w = 0; w < up_words; w++) {
+#pragma HLS LOOP_TRIPCOUNT max=PIPE_SLOT_WORDS
+#pragma HLS PIPELINE II=1
+		up_stream.write((din_gmem + src_word)[w]);
+	}
+}
+
+static void pipe_ddr_access(snap_membus_t *d_ddrmem,
+			    hls::stream<snap_membus_t> &up_stream,
+			    snapu64_t dst_word, snapu32_t up_words,
+			    snapu64_t txt_word, snapu32_t txt_words,
+			    hls::stream<snap_membus_t> &txt_stream)
+{
+	snapu32_t n = (up_words > txt_words) ? up_words : txt_words;
+
+	pd_loop: for (snapu32_t w = 0; w < n; w++) {
+#pragma HLS LOOP_TRIPCOUNT max=PIPE_SLOT_WORDS
+#pragma HLS PIPELINE II=1
+#pragma HLS DEPENDENCE variable=d_ddrmem inter false
+		if (w < up_words)
+			(d_ddrmem + dst_word)[w] = up_stream.read();
+		if (w < txt_words)
+			txt_stream.write((d_ddrmem + txt_word)[w]);
+	}
+}
+
+static void pipe_search(snapu16_t Method, char Pattern[PATTERN_SIZE],
+			snapu32_t PatternSize, snapu32_t txt_size,
+			hls::stream<snap_membus_t> &txt_stream,
+			unsigned int &count)
+{
+	snap_membus_t TextBuffer[MAX_NB_OF_WORDS_READ];
+	char Text[MAX_NB_OF_BYTES_READ];
+	snapu32_t search_size, words;
+
+	count = 0;
+	ps_block: while (txt_size > 0) {
+#pragma HLS LOOP_TRIPCOUNT max=(DDR_PIPE_SLOT / MAX_NB_OF_BYTES_READ)
+		search_size = MIN(txt_size, (snapu32_t) MAX_NB_OF_BYTES_READ);
+		words = (search_size + BPERDW - 1) / BPERDW;
+		ps_read: for (snapu32_t k = 0; k < words; k++) {
+#pragma HLS LOOP_TRIPCOUNT max=MAX_NB_OF_WORDS_READ
+#pragma HLS PIPELINE II=1
+			TextBuffer[k] = txt_stream.read();
+		}
+		x_mbus_to_word(TextBuffer, Text); /* convert buffer to char*/
+		count += search(Method, Pattern, PatternSize, Text,
+				search_size);
+		txt_size -= search_size;
+	}
+}
+
+static void pipe_upload_search(snap_membus_t *din_gmem,
+			       snap_membus_t *d_ddrmem,
+			       snapu64_t src_addr, snapu32_t up_size,
+			       snapu64_t dst_addr,
+			       snapu64_t txt_addr, snapu32_t txt_size,
+			       snapu16_t Method, char Pattern[PATTERN_SIZE],
+			       snapu32_t PatternSize, unsigned int &count)
+{
+#pragma HLS DATAFLOW
+	hls::stream<snap_membus_t> up_stream("up_stream");
+	hls::stream<snap_membus_t> txt_stream("txt_stream");
+#pragma HLS STREAM variable=up_stream depth=64
+#pragma HLS STREAM variable=txt_stream depth=MAX_NB_OF_WORDS_READ
+
+	pipe_host_read(din_gmem, src_addr >> ADDR_RIGHT_SHIFT,
+		       (up_size + BPERDW - 1) / BPERDW, up_stream);
+	pipe_ddr_access(d_ddrmem, up_stream, dst_addr >> ADDR_RIGHT_SHIFT,
+			(up_size + BPERDW - 1) / BPERDW,
+			txt_addr >> ADDR_RIGHT_SHIFT,
+			(txt_size + BPERDW - 1) / BPERDW, txt_stream);
+	pipe_search(Method, Pattern, PatternSize, txt_size, txt_stream,
+		    count);
+}
+
+static snapu32_t process_action_pipe(snap_membus_t *din_gmem,
+				     snap_membus_t *d_ddrmem,
+				     action_reg *Action_Register)
+{
+	snap_membus_t PatternBuffer[1];
+	char Pattern[PATTERN_SIZE];
+	snapu32_t PatternSize = Action_Register->Data.src_pattern.size;
+	snapu32_t txt_size = Action_Register->Data.ddr_text1.size;
+	unsigned int count = 0;
+
+	// the pattern is read before the region, which owns din_gmem
+	read_single_word_of_data_from_mem(din_gmem, d_ddrmem,
+		Action_Register->Data.src_pattern.type,
+		Action_Register->Data.src_pattern.addr >> ADDR_RIGHT_SHIFT,
+		PatternBuffer);
+	mbus_to_word(PatternBuffer[0], Pattern); // convert buffer to char
+	if (PatternSize > PATTERN_SIZE)
+		txt_size = 0;
+
+	pipe_upload_search(din_gmem, d_ddrmem,
+			   Action_Register->Data.src_text1.addr,
+			   Action_Register->Data.src_text1.size,
+			   DDR_PIPE_OTHER(Action_Register->Data.ddr_text1.addr),
+			   Action_Register->Data.ddr_text1.addr, txt_size,
+			   Action_Register->Data.method, Pattern, PatternSize,
+			   count);
+	return (snapu32_t) count;
+}
+
+
 //--- TOP LEVEL MODULE ------------------------------------------------------------------
 void hls_action(snap_membus_t *din_gmem, 
 		snap_membus_t  *dout_gmem,
@@ -668,7 +799,7 @@ void hls_action(snap_membus_t *din_gmem,
 #pragma HLS INTERFACE s_axilite port=Action_Register bundle=ctrl_reg	offset=0x100 
 #pragma HLS INTERFACE s_axilite port=return bundle=ctrl_reg
 
-	snapu32_t result;
+	snapu32_t result = 0;
 	// Hardcoded numbers
   	/* test used to exit the action if no parameter has been set.
   	 * Used for the discovery phase of the cards */
@@ -711,6 +842,11 @@ void hls_action(snap_membus_t *din_gmem,
 
     		break;
     	case 3: // HW : search processing
+                if (Action_Register->Data.method > KMP_method) {
+                    /* AC_method and later are only available on the host */
+                    Action_Register->Control.Retc = SNAP_RETC_FAILURE;
+                    return;
+                }
 #ifdef STREAMING_METHOD
     		if(Action_Register->Data.method == STRM_method)
                     result = process_action_strm(din_gmem, dout_gmem, d_ddrmem, 
@@ -721,6 +857,14 @@ void hls_action(snap_membus_t *din_gmem,
 					Action_Register);
     		break;
 
+    	case 6: // HW : upload the next chunk, search the current one
+                if (Action_Register->Data.method > KMP_method) {
+                    Action_Register->Control.Retc = SNAP_RETC_FAILURE;
+                    return;
+                }
+            result = process_action_pipe(din_gmem, d_ddrmem, Action_Register);
+    		break;
+
 /* Reporting positions of pattern - Case not yet implemented
     	case 5: // HW : copy result array from DDR to Host
             //Copy Result from DDR to Host. // position is on 64 bits
@@ -750,6 +894,8 @@ void hls_action(snap_membus_t *din_gmem,
 
 #ifdef NO_SYNTH
 
+#include <stdlib.h>
+
 // Cast a char* word (64B) to a word for output port (512b)
 static snap_membus_t word_to_mbus(word_t text)
 {
@@ -764,6 +910,111 @@ static snap_membus_t word_to_mbus(word_t text)
         return mem;
 }
 
+#ifdef STREAMING_METHOD
+/*
+ * STRM_method against a plain KMP count over random text. Text sizes go
+ * up to TB_STRM_WORDS bus words, patterns have 1..64 bytes and are taken
+ * from the text or random, over small alphabets for many overlapping
+ * matches and matches across bus words.
+ */
+#define TB_STRM_RUNS	200
+#define TB_STRM_WORDS	511		/* the pattern goes into the last word */
+
+static unsigned int tb_kmp_count(char *pat, int M, const char *txt, int N)
+{
+    int KMP_table[PATTERN_SIZE + 1];
+    int i = 0, j = 0;
+    unsigned int count = 0;
+
+    preprocess_KMP_table(pat, M, KMP_table);
+    while (j < N) {
+        while (i > -1 && pat[i] != txt[j])
+            i = KMP_table[i];
+        i++;
+        j++;
+        if (i >= M) {
+            count++;
+            i = KMP_table[i];
+        }
+    }
+    return count;
+}
+
+static int tb_strm_random(snap_membus_t *din_gmem,
+                          snap_membus_t *dout_gmem,
+                          snap_membus_t *d_ddrmem,
+                          action_RO_config_reg *Action_Config)
+{
+    static char text[TB_STRM_WORDS * BPERDW];
+    char pat[PATTERN_SIZE + 1];
+    word_t word_tmp;
+    action_reg Action_Register;
+    unsigned int run, n, w, size, psize, alpha, expected, failed = 0;
+
+    srand(42);
+    for (run = 0; run < TB_STRM_RUNS; run++) {
+        alpha = (run % 3 == 0) ? 2 : (run % 3 == 1) ? 4 : 26;
+        size = 1 + rand() % sizeof(text);
+        for (n = 0; n < size; n++)
+            text[n] = 'a' + rand() % alpha;
+
+        memset(pat, 0, sizeof(pat));
+        psize = 1 + rand() % PATTERN_SIZE;
+        if ((run & 1) && psize <= size)
+            memcpy(pat, text + rand() % (size - psize + 1), psize);
+        else
+            for (n = 0; n < psize; n++)
+                pat[n] = 'a' + rand() % alpha;
+
+        for (w = 0; w * BPERDW < size; w++) {
+            memset(word_tmp, 0, sizeof(word_tmp));
+            memcpy(word_tmp, text + w * BPERDW,
+                   MIN(size - w * BPERDW, (unsigned int)BPERDW));
+            din_gmem[w] = word_to_mbus(word_tmp);
+        }
+        memcpy(word_tmp, pat, BPERDW);
+        din_gmem[TB_STRM_WORDS] = word_to_mbus(word_tmp);
+
+        memset((void *)&Action_Register, 0, sizeof(Action_Register));
+        Action_Register.Data.src_text1.addr = 0;
+        Action_Register.Data.src_text1.size = size;
+        Action_Register.Data.src_text1.type = SNAP_ADDRTYPE_HOST_DRAM;
+        Action_Register.Data.ddr_text1.addr = 0;
+        Action_Register.Data.ddr_text1.size = size;
+        Action_Register.Data.ddr_text1.type = SNAP_ADDRTYPE_CARD_DRAM;
+        Action_Register.Data.src_pattern.addr = TB_STRM_WORDS * BPERDW;
+        Action_Register.Data.src_pattern.size = psize;
+        Action_Register.Data.src_pattern.type = SNAP_ADDRTYPE_HOST_DRAM;
+        Action_Register.Data.method = STRM_method;
+        Action_Register.Control.flags = 0x1;
+
+        Action_Register.Data.step = 1;
+        hls_action(din_gmem, dout_gmem, d_ddrmem, &Action_Register,
+                   Action_Config);
+        Action_Register.Data.step = 3;
+        hls_action(din_gmem, dout_gmem, d_ddrmem, &Action_Register,
+                   Action_Config);
+
+        expected = tb_kmp_count(pat, psize, text, size);
+        if (Action_Register.Control.Retc == SNAP_RETC_FAILURE ||
+            Action_Register.Data.nb_of_occurrences != expected) {
+            printf("STRM run %u: text %u bytes, pattern \"%s\": "
+                   "%u occurrences, KMP %u\n", run, size, pat,
+                   (unsigned int)Action_Register.Data.nb_of_occurrences,
+                   expected);
+            failed++;
+        }
+    }
+    printf("STRM random test: %u of %u runs OK", TB_STRM_RUNS - failed,
+           TB_STRM_RUNS);
+    if (failed == 0)
+        printf(" => Test OK\n=============================\n");
+    else
+        printf(" => Test failed !!\n=============================\n");
+    return failed ? 1 : 0;
+}
+#endif
+
 int main(void)
 {
     int rc = 0;
@@ -784,6 +1035,12 @@ int main(void)
     int c;
     int k=0, m=0;
 
+#ifdef STREAMING_METHOD
+    // HW : STRM_method against KMP over random text, needs no sample file
+    if (tb_strm_random(din_gmem, dout_gmem, d_ddrmem, &Action_Config) != 0)
+	    rc = 1;
+#endif
+
     /* snap_search123.txt can be put in hardware/action_examples/hls_search directory
      * and contain the following
 123456789_123456789_123456789
@@ -880,6 +1137,28 @@ int main(void)
     else
     	printf(" => Test failed : Expected 18 !!\n============================= \n");
 
+    // HW : step 6 region, upload behind the text while searching it
+    printf("--Step 6--HW : upload overlapped with search--");
+    {
+        char pat[PATTERN_SIZE];
+        unsigned int count6 = 0;
+        snapu32_t size6 = Action_Register.Data.src_text1.size;
+
+        mbus_to_word(din_gmem[0], pat);
+        pipe_upload_search(din_gmem, d_ddrmem, 0, size6, 256 * BPERDW,
+                           0, size6, NAIVE_method, pat, 3, count6);
+        for (i = 0; i < (size6 + BPERDW - 1) / BPERDW; i++)
+            if (d_ddrmem[256 + i] != din_gmem[i])
+                break;
+        if (count6 == 18 && i == (size6 + BPERDW - 1) / BPERDW)
+            printf("OK\n");
+        else {
+            printf("failed: %u occurrences, %u words uploaded\n",
+                   count6, i);
+            rc = 1;
+        }
+    }
+
 /* Positions reported - not yet implemented
     // HW : copy result array from DDR to Host
     Action_Register.Data.step = 5;
@@ -902,7 +1181,7 @@ int main(void)
 	    return 1;
     }
 
-    return 0;
+    return rc;
 }
 
 #endif
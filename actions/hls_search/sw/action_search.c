@@ -23,8 +23,14 @@
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <snap_tools.h>
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#endif
 
 #include <libsnap.h>
 #include <snap_internal.h>
@@ -68,11 +74,12 @@ void preprocess_KMP_table(char *Pattern, int PatternSize, int KMP_table[])
           KMP_table[i] = j;
    }
 }
-int KMP_search(char *Pattern, int PatternSize, char *Text, int TextSize)
+int KMP_search_pos(char *Pattern, int PatternSize, char *Text, int TextSize,
+		   uint64_t *offs, unsigned int offs_max)
 {
    int i, j;
    /*FIXME Pattern is currently hardware limited to 64 Bytes */
-   int KMP_table[64];
+   int KMP_table[64 + 1];
    int count;
 
    preprocess_KMP_table(Pattern, PatternSize, KMP_table);
@@ -88,16 +95,23 @@ int KMP_search(char *Pattern, int PatternSize, char *Text, int TextSize)
       {
          i = KMP_table[i];
          //printf("Found pattern at index %d\n", j-i-PatternSize);
+         if ((unsigned int)count < offs_max)
+            offs[count] = j - PatternSize;
          count++;
       }
    }
    return count;
 }
+int KMP_search(char *Pattern, int PatternSize, char *Text, int TextSize)
+{
+   return KMP_search_pos(Pattern, PatternSize, Text, TextSize, NULL, 0);
+}
 // Naive / Brute Force Searching algorithm
 // based on D. E. Knuth, J. H. Morris, Jr., and V. R. Pratt, i
 // Fast pattern matching in strings", SIAM J. Computing 6 (1977), 323--350
 //
-int Naive_search(char *Pattern, int PatternSize, char *Text, int TextSize)
+int Naive_search_pos(char *Pattern, int PatternSize, char *Text, int TextSize,
+		     uint64_t *offs, unsigned int offs_max)
 {
    int i, j;
    int count=0;
@@ -106,48 +120,1045 @@ int Naive_search(char *Pattern, int PatternSize, char *Text, int TextSize)
       for (i = 0; i < PatternSize && Pattern[i] == Text[i + j]; ++i);
       if (i >= PatternSize)
       {
+           if ((unsigned int)count < offs_max)
+                offs[count] = j;
            count++;
            //printf("Pattern found at index %d \n", j);
       }
    }
    return count;
 }
+int Naive_search(char *Pattern, int PatternSize, char *Text, int TextSize)
+{
+   return Naive_search_pos(Pattern, PatternSize, Text, TextSize, NULL, 0);
+}
+// First/last byte filter search
+// based on W. Mula, "SIMD-friendly algorithms for substring searching"
+//
+// Compare the first pattern byte against a block of text positions and
+// the last pattern byte against the same block shifted by PatternSize-1.
+// Only positions where both match are verified with memcmp(). All
+// variants count overlapping matches like KMP_search().
+//
+static inline int simd_verify(const char *Pattern, int PatternSize,
+			      const char *Text)
+{
+	/* first and last byte are known to match */
+	return PatternSize <= 2 ||
+		memcmp(Text + 1, Pattern + 1, PatternSize - 2) == 0;
+}
+
+static inline void simd_found(int *count, int pos,
+			      uint64_t *offs, unsigned int offs_max)
+{
+	if ((unsigned int)*count < offs_max)
+		offs[*count] = pos;
+	(*count)++;
+}
+
+static int simd_search_tail(const char *Pattern, int PatternSize,
+			    const char *Text, int TextSize, int i,
+			    int count, uint64_t *offs, unsigned int offs_max)
+{
+	for (; i <= TextSize - PatternSize; i++)
+		if (Text[i] == Pattern[0] &&
+		    Text[i + PatternSize - 1] == Pattern[PatternSize - 1] &&
+		    simd_verify(Pattern, PatternSize, Text + i))
+			simd_found(&count, i, offs, offs_max);
+	return count;
+}
+
+#define SWAR_LO7	0x7f7f7f7f7f7f7f7full
+#define SWAR_ONES	0x0101010101010101ull
+
+/* Exact per-byte equality, high bit of each byte set where x == b */
+static inline uint64_t swar_eq(uint64_t x, uint64_t b)
+{
+	uint64_t v = x ^ b;
+
+	return ~(((v & SWAR_LO7) + SWAR_LO7) | v | SWAR_LO7);
+}
+
+static inline int swar_first(uint64_t mask)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_ctzll(mask) / 8;
+#else
+	return __builtin_clzll(mask) / 8;
+#endif
+}
+
+static inline uint64_t swar_clear(uint64_t mask, int byte)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return mask & ~(0x80ull << (byte * 8));
+#else
+	return mask & ~(0x80ull << ((7 - byte) * 8));
+#endif
+}
+
+/* Portable version, 8 text positions per step in a 64-bit register */
+static int simd_search_swar(const char *Pattern, int PatternSize,
+			    const char *Text, int TextSize,
+			    uint64_t *offs, unsigned int offs_max)
+{
+	uint64_t first = SWAR_ONES * (uint8_t)Pattern[0];
+	uint64_t last = SWAR_ONES * (uint8_t)Pattern[PatternSize - 1];
+	int i, count = 0;
+
+	for (i = 0; i + PatternSize - 1 + 8 <= TextSize; i += 8) {
+		uint64_t bf, bl, mask;
+
+		memcpy(&bf, Text + i, sizeof(bf));
+		memcpy(&bl, Text + i + PatternSize - 1, sizeof(bl));
+		mask = swar_eq(bf, first) & swar_eq(bl, last);
+		while (mask) {
+			int k = swar_first(mask);
+
+			if (simd_verify(Pattern, PatternSize, Text + i + k))
+				simd_found(&count, i + k, offs, offs_max);
+			mask = swar_clear(mask, k);
+		}
+	}
+	return simd_search_tail(Pattern, PatternSize, Text, TextSize, i,
+				count, offs, offs_max);
+}
+
+#if defined(__x86_64__)
+/* SSE2 is part of x86-64, so this needs no runtime check */
+static int simd_search_sse2(const char *Pattern, int PatternSize,
+			    const char *Text, int TextSize,
+			    uint64_t *offs, unsigned int offs_max)
+{
+	const __m128i first = _mm_set1_epi8(Pattern[0]);
+	const __m128i last = _mm_set1_epi8(Pattern[PatternSize - 1]);
+	int i, count = 0;
+
+	for (i = 0; i + PatternSize - 1 + 16 <= TextSize; i += 16) {
+		__m128i bf = _mm_loadu_si128((const __m128i *)(Text + i));
+		__m128i bl = _mm_loadu_si128((const __m128i *)
+					     (Text + i + PatternSize - 1));
+		unsigned int mask = _mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(first, bf),
+				      _mm_cmpeq_epi8(last, bl)));
+
+		while (mask) {
+			int k = __builtin_ctz(mask);
+
+			if (simd_verify(Pattern, PatternSize, Text + i + k))
+				simd_found(&count, i + k, offs, offs_max);
+			mask &= mask - 1;
+		}
+	}
+	return simd_search_tail(Pattern, PatternSize, Text, TextSize, i,
+				count, offs, offs_max);
+}
+
+__attribute__((target("avx2")))
+static int simd_search_avx2(const char *Pattern, int PatternSize,
+			    const char *Text, int TextSize,
+			    uint64_t *offs, unsigned int offs_max)
+{
+	const __m256i first = _mm256_set1_epi8(Pattern[0]);
+	const __m256i last = _mm256_set1_epi8(Pattern[PatternSize - 1]);
+	int i, count = 0;
+
+	for (i = 0; i + PatternSize - 1 + 32 <= TextSize; i += 32) {
+		__m256i bf = _mm256_loadu_si256((const __m256i *)(Text + i));
+		__m256i bl = _mm256_loadu_si256((const __m256i *)
+						(Text + i + PatternSize - 1));
+		unsigned int mask = _mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(first, bf),
+					 _mm256_cmpeq_epi8(last, bl)));
+
+		while (mask) {
+			int k = __builtin_ctz(mask);
+
+			if (simd_verify(Pattern, PatternSize, Text + i + k))
+				simd_found(&count, i + k, offs, offs_max);
+			mask &= mask - 1;
+		}
+	}
+	return simd_search_tail(Pattern, PatternSize, Text, TextSize, i,
+				count, offs, offs_max);
+}
+
+static int cpu_has_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static int cpu_any(void)
+{
+	return 1;
+}
+
+/* Best first, SIMD_search() picks the first supported one */
+const struct simd_search_impl simd_search_impls[] = {
+#if defined(__x86_64__)
+	{ "avx2", simd_search_avx2, cpu_has_avx2 },
+	{ "sse2", simd_search_sse2, cpu_any },
+#endif
+	{ "swar", simd_search_swar, cpu_any },
+	{ NULL, NULL, NULL },
+};
+
+const struct simd_search_impl *simd_search_best(void)
+{
+	static const struct simd_search_impl *best = NULL;
+	const struct simd_search_impl *impl;
+
+	if (best)
+		return best;
+	for (impl = simd_search_impls; impl->name; impl++)
+		if (impl->supported())
+			break;
+	best = impl;
+	return best;
+}
+
+int SIMD_search_pos(char *Pattern, int PatternSize, char *Text, int TextSize,
+		    uint64_t *offs, unsigned int offs_max)
+{
+	if (PatternSize <= 0 || PatternSize > TextSize)
+		return 0;
+	return simd_search_best()->search(Pattern, PatternSize,
+					  Text, TextSize, offs, offs_max);
+}
+
+int SIMD_search(char *Pattern, int PatternSize, char *Text, int TextSize)
+{
+	return SIMD_search_pos(Pattern, PatternSize, Text, TextSize, NULL, 0);
+}
+
+// Shift-And with k mismatches
+// based on R. Baeza-Yates and G. H. Gonnet, "A new approach to text
+// searching", CACM 35 (1992), 74--82
+//
+// Bit i of R[d] tells that the first i+1 pattern bytes match the text
+// ending at j with at most d mismatches. With nocase the byte masks hold
+// both ASCII cases.
+//
+static void search_fold_masks(const char *Pattern, int PatternSize,
+			      int nocase, uint64_t mask[256])
+{
+	int i;
+
+	memset(mask, 0, 256 * sizeof(*mask));
+	for (i = 0; i < PatternSize; i++) {
+		uint8_t c = Pattern[i];
+
+		mask[c] |= 1ull << i;
+		if (nocase) {
+			mask[tolower(c)] |= 1ull << i;
+			mask[toupper(c)] |= 1ull << i;
+		}
+	}
+}
+
+int ShiftAnd_search_pos(char *Pattern, int PatternSize, char *Text,
+			int TextSize, unsigned int k, int nocase,
+			uint64_t *offs, unsigned int offs_max)
+{
+	uint64_t mask[256], R[SEARCH_K_MAX + 1], b, old, prev;
+	uint64_t hit = 1ull << (PatternSize - 1);
+	unsigned int d;
+	int j, count = 0;
+
+	if (PatternSize <= 0 || PatternSize > 64 || k >= (unsigned int)PatternSize)
+		return 0;
+
+	search_fold_masks(Pattern, PatternSize, nocase, mask);
+	memset(R, 0, sizeof(R));
+	for (j = 0; j < TextSize; j++) {
+		b = mask[(uint8_t)Text[j]];
+		prev = R[0];
+		R[0] = ((R[0] << 1) | 1) & b;
+		for (d = 1; d <= k; d++) {
+			old = R[d];
+			R[d] = (((old << 1) | 1) & b) | (prev << 1) | 1;
+			prev = old;
+		}
+		if (R[k] & hit) {
+			if ((unsigned int)count < offs_max)
+				offs[count] = j - PatternSize + 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+// Bit-vector edit distance search
+// based on G. Myers, "A fast bit-vector algorithm for approximate string
+// matching based on dynamic programming", JACM 46 (1999), 395--415
+//
+// Pv/Mv hold the +1/-1 vertical deltas of the current DP column, score
+// is its last cell: the edit distance of the pattern to the best text
+// substring ending at j. Offsets are match ends, like REGEX_method.
+//
+int Myers_search_pos(char *Pattern, int PatternSize, char *Text,
+		     int TextSize, unsigned int k, int nocase,
+		     uint64_t *offs, unsigned int offs_max)
+{
+	uint64_t peq[256], Pv = ~0ull, Mv = 0, Eq, Xv, Xh, Ph, Mh;
+	uint64_t hb = 1ull << (PatternSize - 1);
+	unsigned int score = PatternSize;
+	int j, count = 0;
+
+	if (PatternSize <= 0 || PatternSize > 64 || k >= (unsigned int)PatternSize)
+		return 0;
+
+	search_fold_masks(Pattern, PatternSize, nocase, peq);
+	for (j = 0; j < TextSize; j++) {
+		Eq = peq[(uint8_t)Text[j]];
+		Xv = Eq | Mv;
+		Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+		Ph = Mv | ~(Xh | Pv);
+		Mh = Pv & Xh;
+		score += (Ph & hb) ? 1 : 0;
+		score -= (Mh & hb) ? 1 : 0;
+		Ph <<= 1;	/* row 0 stays 0, a match may start anywhere */
+		Mh <<= 1;
+		Pv = Mh | ~(Xv | Ph);
+		Mv = Ph & Xv;
+		if (score <= k) {
+			if ((unsigned int)count < offs_max)
+				offs[count] = j + 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+// Aho-Corasick multi-pattern search
+// based on A. V. Aho and M. J. Corasick, "Efficient string matching:
+// an aid to bibliographic search", CACM 18 (1975), 333--340
+//
+// The automaton is a complete DFA over byte classes, see search_dfa_t.
+// Transitions hold row offsets, so the inner loop is a single table
+// lookup per byte and only branches when a state reports matches.
+//
+unsigned int AC_search(const search_dfa_t *dfa, const char *Text,
+		       unsigned int TextSize, uint32_t *counts,
+		       search_match_t *match, unsigned int match_max)
+{
+	const uint32_t *trans = search_dfa_trans(dfa);
+	const uint32_t *out_idx = search_dfa_out_idx(dfa);
+	const uint32_t *out = search_dfa_out(dfa);
+	const uint32_t *pat_len = search_dfa_pat_len(dfa);
+	const uint8_t *classmap = dfa->classmap;
+	uint32_t s, row = 0;
+	unsigned int i, k, found = 0;
+
+	for (i = 0; i < TextSize; i++) {
+		s = trans[row + classmap[(uint8_t)Text[i]]];
+		row = s & ~SEARCH_DFA_MATCH;
+		if (!(s & SEARCH_DFA_MATCH))
+			continue;
+
+		s = row / dfa->n_classes;
+		for (k = out_idx[s]; k < out_idx[s + 1]; k++) {
+			uint32_t id = out[k];
+
+			if (counts)
+				counts[id]++;
+			if (found < match_max) {
+				match[found].offset = i + 1 - pat_len[id];
+				match[found].pattern = id;
+				match[found].reserved = 0;
+			}
+			found++;
+		}
+	}
+	return found;
+}
+
+/*
+ * Runs the AC_method: result holds the per pattern counts followed by
+ * as many match records as fit. Returns the total number of matches.
+ */
+unsigned int run_sw_ac_search(const search_dfa_t *dfa,
+			      char *Text, unsigned int TextSize,
+			      void *result, unsigned int result_size)
+{
+	uint32_t *counts = (uint32_t *)result;
+	search_match_t *match;
+	unsigned int match_max, count;
+	size_t counts_size = SEARCH_AC_COUNTS_SIZE(dfa->n_patterns);
+	struct timeval etime, stime;
+
+	memset(counts, 0, counts_size);
+	match = (search_match_t *)((uint8_t *)result + counts_size);
+	match_max = (result_size - counts_size) / sizeof(*match);
+
+	gettimeofday(&stime, NULL);
+	count = AC_search(dfa, Text, TextSize, counts, match, match_max);
+	gettimeofday(&etime, NULL);
+
+	fprintf(stdout, "SW AC run step took %lld usec\n",
+		(long long)timediff_usec(&etime, &stime));
+	printf("%d patterns - text size %d - rc = %d \n",
+	       dfa->n_patterns, TextSize, count);
+
+	return count;
+}
+
+/*
+ * BATCH_method: one AC pass for the whole query table. A match bumps
+ * the count of its query and goes to the query's offset page while
+ * there is room, so the first page_items offsets are kept in text
+ * order. Returns the total number of matches.
+ */
+unsigned int AC_search_pages(const search_dfa_t *dfa, const char *Text,
+			     unsigned int TextSize, search_batch_result_t *res,
+			     uint64_t *pages, unsigned int page_items)
+{
+	const uint32_t *trans = search_dfa_trans(dfa);
+	const uint32_t *out_idx = search_dfa_out_idx(dfa);
+	const uint32_t *out = search_dfa_out(dfa);
+	const uint32_t *pat_len = search_dfa_pat_len(dfa);
+	const uint8_t *classmap = dfa->classmap;
+	uint32_t s, row = 0;
+	unsigned int i, k, found = 0;
+
+	for (i = 0; i < TextSize; i++) {
+		s = trans[row + classmap[(uint8_t)Text[i]]];
+		row = s & ~SEARCH_DFA_MATCH;
+		if (!(s & SEARCH_DFA_MATCH))
+			continue;
+
+		s = row / dfa->n_classes;
+		for (k = out_idx[s]; k < out_idx[s + 1]; k++) {
+			search_batch_result_t *r = &res[out[k]];
+
+			if (r->n_offs < page_items)
+				pages[(uint64_t)out[k] * page_items +
+				      r->n_offs++] = i + 1 - pat_len[out[k]];
+			r->count++;
+			found++;
+		}
+	}
+	return found;
+}
+
+/*
+ * Runs the BATCH_method: sets up the per query descriptors and pages
+ * in result, then scans the text once.
+ */
+unsigned int run_sw_batch_search(const search_batch_t *batch,
+				 char *Text, unsigned int TextSize,
+				 void *result, unsigned int result_size)
+{
+	search_batch_result_t *res = (search_batch_result_t *)result;
+	unsigned int q, count, n = batch->n_queries;
+	size_t res_size = n * sizeof(*res);
+	struct timeval etime, stime;
+
+	memset(result, 0, MIN((size_t)result_size,
+			      SEARCH_BATCH_RESULT_SIZE(n, batch->page_items)));
+	for (q = 0; q < n; q++)
+		res[q].page = res_size +
+			(uint64_t)q * batch->page_items * sizeof(uint64_t);
+
+	gettimeofday(&stime, NULL);
+	count = AC_search_pages(search_batch_dfa(batch), Text, TextSize, res,
+				(uint64_t *)((uint8_t *)result + res_size),
+				batch->page_items);
+	gettimeofday(&etime, NULL);
+
+	fprintf(stdout, "SW batch run step took %lld usec\n",
+		(long long)timediff_usec(&etime, &stime));
+	printf("%d queries - text size %d - rc = %d \n", n, TextSize, count);
+
+	return count;
+}
+
+/*
+ * REGEX_method. The DFA costs one table lookup per byte, a match only
+ * adds its end offset to the count. Offsets beyond offs_max go to a
+ * spill slot, so the loop has no data dependent branch.
+ */
+static unsigned int re_dfa_search(const search_re_t *re, const uint8_t *Text,
+				  unsigned long TextSize, uint64_t *offs,
+				  unsigned int offs_max)
+{
+	const uint32_t *trans = search_re_trans(re);
+	const uint8_t *classmap = re->classmap;
+	unsigned int eol = (re->flags & SEARCH_RE_EOL) ? 1 : 0;
+	unsigned int found = 0;
+	unsigned long i = 0;
+	uint64_t spill;
+	uint32_t s, row = 0;
+
+	if ((re->flags & SEARCH_RE_PREFIX) && !(re->flags & SEARCH_RE_BOL)) {
+		/* skip to the next literal while no match is under way */
+		while (i < TextSize) {
+			if (row == 0) {
+				const uint8_t *p = memmem(Text + i,
+						TextSize - i, re->literal,
+						re->lit_len);
+				if (p == NULL)
+					break;
+				i = p - Text;
+			}
+			s = trans[row + classmap[Text[i]]];
+			row = s & ~SEARCH_DFA_MATCH;
+			*(found < offs_max ? &offs[found] : &spill) =
+				i + 1 - eol;
+			found += s >> 31;
+			i++;
+		}
+	} else {
+		for (i = 0; i < TextSize; i++) {
+			s = trans[row + classmap[Text[i]]];
+			row = s & ~SEARCH_DFA_MATCH;
+			*(found < offs_max ? &offs[found] : &spill) =
+				i + 1 - eol;
+			found += s >> 31;
+		}
+	}
+
+	/* $ also matches at the end of the text */
+	if (eol && (trans[row + classmap['\n']] & SEARCH_DFA_MATCH)) {
+		if (found < offs_max)
+			offs[found] = TextSize;
+		found++;
+	}
+	return found;
+}
+
+/* NFA simulation, all threads advance together one byte at a time */
+struct re_vm {
+	const search_re_nfa_t *nfa;
+	const uint8_t *sets;
+	uint32_t *mark, gen;
+	uint32_t *stack;
+	int matched;
+};
+
+static void re_vm_add(struct re_vm *vm, uint32_t *list, unsigned int *n,
+		      uint32_t s)
+{
+	unsigned int sp = 0;
+
+	vm->stack[sp++] = s;
+	while (sp) {
+		s = vm->stack[--sp];
+		if (vm->mark[s] == vm->gen)
+			continue;
+		vm->mark[s] = vm->gen;
+		if (vm->nfa[s].op == SEARCH_RE_OP_SPLIT) {
+			vm->stack[sp++] = vm->nfa[s].out1;
+			vm->stack[sp++] = vm->nfa[s].out;
+		} else {
+			if (vm->nfa[s].op == SEARCH_RE_OP_MATCH)
+				vm->matched = 1;
+			list[(*n)++] = s;
+		}
+	}
+}
+
+/* Matches within one line, which holds no \n */
+static unsigned int re_vm_line(const search_re_t *re, struct re_vm *vm,
+			       uint32_t *cur, uint32_t *next,
+			       const uint8_t *Line, unsigned long LineSize,
+			       unsigned long base, uint64_t *offs,
+			       unsigned int offs_max, unsigned int found)
+{
+	unsigned int n_cur = 0, n_next, k;
+	unsigned long j;
+	uint32_t *tmp;
+
+	vm->gen++;
+	re_vm_add(vm, cur, &n_cur, re->nfa_start);
+	for (j = 0; j < LineSize && n_cur; j++) {
+		vm->gen++;
+		vm->matched = 0;
+		n_next = 0;
+		for (k = 0; k < n_cur; k++) {
+			const search_re_nfa_t *st = &vm->nfa[cur[k]];
+
+			if (st->op == SEARCH_RE_OP_SET &&
+			    search_re_set_has(vm->sets + st->set * 32,
+					      Line[j]))
+				re_vm_add(vm, next, &n_next, st->out);
+		}
+		if (vm->matched && (!(re->flags & SEARCH_RE_EOL) ||
+				    j + 1 == LineSize)) {
+			if (found < offs_max)
+				offs[found] = base + j + 1;
+			found++;
+		}
+		if (!(re->flags & SEARCH_RE_BOL))
+			re_vm_add(vm, next, &n_next, re->nfa_start);
+		tmp = cur, cur = next, next = tmp;
+		n_cur = n_next;
+	}
+	return found;
+}
+
+/* DFA too large: the NFA only runs on lines holding the literal */
+static unsigned int re_nfa_search(const search_re_t *re, const uint8_t *Text,
+				  unsigned long TextSize, uint64_t *offs,
+				  unsigned int offs_max)
+{
+	struct re_vm vm;
+	uint32_t *cur, *next;
+	const uint8_t *p, *ls, *le;
+	unsigned long pos = 0;
+	unsigned int found = 0;
+
+	vm.nfa = search_re_nfa(re);
+	vm.sets = search_re_sets(re);
+	vm.gen = 0;
+	vm.mark = calloc(re->n_nfa, sizeof(*vm.mark));
+	vm.stack = malloc(2 * re->n_nfa * sizeof(*vm.stack));
+	cur = malloc(re->n_nfa * sizeof(*cur));
+	next = malloc(re->n_nfa * sizeof(*next));
+	if (vm.mark == NULL || vm.stack == NULL || cur == NULL ||
+	    next == NULL)
+		goto out;
+
+	while (pos < TextSize) {
+		p = memmem(Text + pos, TextSize - pos, re->literal,
+			   re->lit_len);
+		if (p == NULL)
+			break;
+		for (ls = p; ls > Text + pos && ls[-1] != '\n'; ls--)
+			;
+		le = memchr(p, '\n', Text + TextSize - p);
+		if (le == NULL)
+			le = Text + TextSize;
+		found = re_vm_line(re, &vm, cur, next, ls, le - ls,
+				   ls - Text, offs, offs_max, found);
+		pos = le - Text + 1;
+	}
+ out:
+	free(vm.mark);
+	free(vm.stack);
+	free(cur);
+	free(next);
+	return found;
+}
+
+unsigned int RE_search(const search_re_t *re, const char *Text,
+		       unsigned long TextSize, uint64_t *offs,
+		       unsigned int offs_max)
+{
+	if (re->flags & SEARCH_RE_NFA)
+		return re_nfa_search(re, (const uint8_t *)Text, TextSize,
+				     offs, offs_max);
+	return re_dfa_search(re, (const uint8_t *)Text, TextSize,
+			     offs, offs_max);
+}
+
+unsigned int run_sw_re_search(const search_re_t *re, char *Text,
+			      unsigned long TextSize, uint64_t *offs,
+			      unsigned int offs_max)
+{
+	unsigned int count;
+	long long usec;
+	struct timeval etime, stime;
+
+	gettimeofday(&stime, NULL);
+	count = RE_search(re, Text, TextSize, offs, offs_max);
+	gettimeofday(&etime, NULL);
+
+	usec = timediff_usec(&etime, &stime);
+	fprintf(stdout, "SW REGEX run step took %lld usec (%s, %u states, "
+		"%lu table bytes)\n", usec,
+		(re->flags & SEARCH_RE_NFA) ? "NFA" : "DFA",
+		(re->flags & SEARCH_RE_NFA) ? re->n_nfa : re->n_states,
+		(unsigned long)re->size - sizeof(*re));
+	printf("text size %ld - rc = %d - %.3f Mmatches/s %.1f MB/s\n",
+	       TextSize, count, usec ? (double)count / usec : 0.0,
+	       usec ? (double)TextSize / usec : 0.0);
+	return count;
+}
+
 unsigned int run_sw_search(unsigned int Method,
            char *Pattern, unsigned int PatternSize,
-           char *Text, unsigned int TextSize)
+           char *Text, unsigned long TextSize,
+           unsigned int threads, uint64_t *offs, unsigned int offs_max)
 {
-        int count;
+        unsigned long long count;
 
         struct timeval etime, stime;
 
-        count = 0;
- 	gettimeofday(&stime, NULL);
-
-        switch (Method) {
+        switch (Method & SEARCH_METHOD_MASK) {
         case(1):
 		printf("======== SW Naive method ========\n");
-                count = Naive_search (Pattern, PatternSize, Text, TextSize);
                 break;
         case(2):
 	        printf("========= SW KMP method =========\n");
-                count = KMP_search(Pattern, PatternSize, Text, TextSize);
+                break;
+        case(4):
+	        printf("======= SW SIMD method (%s) ======\n",
+		       simd_search_best()->name);
+                break;
+        case(6):
+	        printf("=== SW Shift-And method (k=%u%s) ===\n",
+		       SEARCH_K(Method),
+		       (Method & SEARCH_NOCASE) ? ", nocase" : "");
+                break;
+        case(7):
+	        printf("==== SW Myers method (k=%u%s) ====\n",
+		       SEARCH_K(Method),
+		       (Method & SEARCH_NOCASE) ? ", nocase" : "");
                 break;
         default:
 	        printf("=== SW Default Naive method ===\n");;
-                count = Naive_search(Pattern, PatternSize, Text, TextSize);
                 break;
         }
 
+ 	gettimeofday(&stime, NULL);
+        /* match ends depend on all text before, no chunks */
+        if ((Method & SEARCH_METHOD_MASK) == MYERS_method) {
+                count = Myers_search_pos(Pattern, PatternSize, Text,
+                                         TextSize, SEARCH_K(Method),
+                                         Method & SEARCH_NOCASE,
+                                         offs, offs_max);
+                threads = 1;
+        } else
+                count = search_mt(Method, Pattern, PatternSize, Text,
+                                  TextSize, threads, offs, offs_max);
         gettimeofday(&etime, NULL);
-        fprintf(stdout, "SW run step took %lld usec\n",
-                 (long long)timediff_usec(&etime, &stime));
+        fprintf(stdout, "SW run step took %lld usec (%u threads)\n",
+                 (long long)timediff_usec(&etime, &stime), threads);
 
-        printf("pattern size %d - text size %d - rc = %d \n", PatternSize, TextSize, count);
+        printf("pattern size %d - text size %ld - rc = %lld \n",
+               PatternSize, TextSize, count);
 
 
         return (unsigned int) count;
 }
 
+/*
+ * Parallel search: the text is cut into chunks, each chunk owns the
+ * match start positions [start, start + len) and is searched with
+ * PatternSize - 1 bytes of the next chunk appended. Every match thus
+ * starts in exactly one chunk, and concatenating the chunk offsets in
+ * chunk order gives the sorted offsets without duplicates.
+ *
+ * A worker searches its chunk in windows and keeps the offsets in a
+ * buffer of its own, which it doubles when a window finds more than
+ * fit. Only that window is searched again, by the worker.
+ */
+#define SEARCH_CHUNK_MIN	(1024 * 1024)	/* text bytes per chunk */
+#define SEARCH_CHUNK_MAX	(1024 * 1024 * 1024) /* int sized methods */
+#define SEARCH_CHUNKS_PER_THREAD 4		/* for load balancing */
+#define SEARCH_CHUNK_WINDOW	(64 * 1024)	/* bytes searched at once */
+#define SEARCH_CHUNK_OFFS	4096		/* 1st offsets buffer */
+
+struct search_chunk {
+	unsigned long start;		/* first position owned */
+	unsigned long len;		/* positions owned */
+	unsigned int size;		/* bytes to search incl. overlap */
+	unsigned long long count;
+	uint64_t *offs;			/* text positions found */
+	unsigned int n_offs;
+	unsigned int offs_cap;
+};
+
+struct search_mt {
+	unsigned int method;
+	char *pattern;
+	int pattern_size;
+	char *text;
+	unsigned int offs_max;		/* offsets kept per chunk at most */
+	struct search_chunk *chunk;
+	unsigned int chunks;
+	unsigned int next;		/* next chunk to take */
+};
+
+static int search_pos(unsigned int Method, char *Pattern, int PatternSize,
+		      char *Text, int TextSize,
+		      uint64_t *offs, unsigned int offs_max)
+{
+	switch (Method & SEARCH_METHOD_MASK) {
+	case KMP_method:
+		return KMP_search_pos(Pattern, PatternSize, Text, TextSize,
+				      offs, offs_max);
+	case SHIFTAND_method:
+		return ShiftAnd_search_pos(Pattern, PatternSize, Text, TextSize,
+					   SEARCH_K(Method),
+					   Method & SEARCH_NOCASE,
+					   offs, offs_max);
+	case SIMD_method:
+		return SIMD_search_pos(Pattern, PatternSize, Text, TextSize,
+				       offs, offs_max);
+	default:
+		return Naive_search_pos(Pattern, PatternSize, Text, TextSize,
+					offs, offs_max);
+	}
+}
+
+/* Room for want more offsets, as much as there is if realloc fails */
+static unsigned int chunk_offs_room(struct search_chunk *ch,
+				    unsigned int want)
+{
+	unsigned int cap;
+	uint64_t *offs;
+
+	if (ch->offs_cap - ch->n_offs >= want)
+		return want;
+
+	cap = MAX(ch->offs_cap ? ch->offs_cap * 2 : SEARCH_CHUNK_OFFS,
+		  ch->n_offs + want);
+	offs = realloc(ch->offs, (size_t)cap * sizeof(*offs));
+	if (offs != NULL) {
+		ch->offs = offs;
+		ch->offs_cap = cap;
+	}
+	return MIN(want, ch->offs_cap - ch->n_offs);
+}
+
+static void search_chunk(struct search_mt *mt, struct search_chunk *ch)
+{
+	unsigned long pos, win, size;
+	unsigned int i, n, keep, room;
+	char *text = mt->text + ch->start;
+
+	for (pos = 0; pos < ch->len; pos += win) {
+		keep = mt->offs_max - ch->n_offs;
+		win = keep ? MIN(ch->len - pos,
+				 (unsigned long)SEARCH_CHUNK_WINDOW) :
+			ch->len - pos;	/* count only, in one go */
+		size = MIN(ch->size - pos, win + mt->pattern_size - 1);
+		room = MIN(keep, ch->offs_cap - ch->n_offs);
+
+		n = search_pos(mt->method, mt->pattern, mt->pattern_size,
+			       text + pos, size, ch->offs + ch->n_offs, room);
+		if (n > room && room < keep) {
+			room = chunk_offs_room(ch, MIN(n, keep));
+			n = search_pos(mt->method, mt->pattern,
+				       mt->pattern_size, text + pos, size,
+				       ch->offs + ch->n_offs, room);
+		}
+
+		ch->count += n;
+		n = MIN(n, room);
+		for (i = 0; i < n; i++)
+			ch->offs[ch->n_offs + i] += ch->start + pos;
+		ch->n_offs += n;
+	}
+}
+
+static void *search_worker(void *arg)
+{
+	struct search_mt *mt = (struct search_mt *)arg;
+	unsigned int c;
+
+	while ((c = __sync_fetch_and_add(&mt->next, 1)) < mt->chunks)
+		search_chunk(mt, &mt->chunk[c]);
+	return NULL;
+}
+
+unsigned long long search_mt(unsigned int Method,
+			     char *Pattern, unsigned int PatternSize,
+			     char *Text, unsigned long TextSize,
+			     unsigned int threads,
+			     uint64_t *offs, unsigned int offs_max)
+{
+	struct search_mt mt;
+	pthread_t *tid;
+	unsigned long len, end;
+	unsigned long long count = 0;
+	unsigned int c, i, t, n, o = 0;
+
+	if (PatternSize == 0 || PatternSize > TextSize)
+		return 0;
+
+	threads = MAX(threads, 1u);
+	mt.chunks = MIN((unsigned long)threads * SEARCH_CHUNKS_PER_THREAD,
+			(TextSize + SEARCH_CHUNK_MIN - 1) / SEARCH_CHUNK_MIN);
+	mt.chunks = MAX((unsigned long)mt.chunks,
+			(TextSize + SEARCH_CHUNK_MAX - 1) / SEARCH_CHUNK_MAX);
+	len = (TextSize + mt.chunks - 1) / mt.chunks;
+
+	mt.method = Method;
+	mt.pattern = Pattern;
+	mt.pattern_size = PatternSize;
+	mt.text = Text;
+	mt.offs_max = offs_max;
+	mt.next = 0;
+	mt.chunk = calloc(mt.chunks, sizeof(*mt.chunk));
+	tid = calloc(threads, sizeof(*tid));
+	if (mt.chunk == NULL || tid == NULL) {
+		free(mt.chunk);
+		free(tid);
+		return 0;
+	}
+
+	for (c = 0; c < mt.chunks; c++) {
+		mt.chunk[c].start = MIN(TextSize, c * len);
+		mt.chunk[c].len = MIN(TextSize - PatternSize + 1, (c + 1) * len)
+			- MIN(TextSize - PatternSize + 1, c * len);
+		end = MIN(TextSize, (c + 1) * len + PatternSize - 1);
+		mt.chunk[c].size = end - mt.chunk[c].start;
+	}
+
+	/* the calling thread is worker 0 */
+	for (t = 1; t < threads; t++)
+		if (pthread_create(&tid[t], NULL, search_worker, &mt) != 0)
+			break;
+	search_worker(&mt);
+	for (i = 1; i < t; i++)
+		pthread_join(tid[i], NULL);
+
+	for (c = 0; c < mt.chunks; c++) {
+		struct search_chunk *ch = &mt.chunk[c];
+
+		if (o < offs_max) {
+			n = MIN(ch->n_offs, offs_max - o);
+			memcpy(offs + o, ch->offs, n * sizeof(*offs));
+			o += n;
+		}
+		count += ch->count;
+		free(ch->offs);
+	}
+
+	free(tid);
+	free(mt.chunk);
+	return count;
+}
+
+/*
+ * Fill one result page with the offsets of the first offs_max matches.
+ * The text is searched in windows, so a full page stops the scan early.
+ * *resume is the text position right behind the last recorded match if
+ * more matches follow, 0 if the text is done.
+ */
+#define SEARCH_PAGE_WINDOW	(256 * 1024)
+
+/* The action paths search on all CPUs, like the host -s flow can */
+static unsigned int search_threads(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+static unsigned int search_page(unsigned int Method,
+				char *Pattern, unsigned int PatternSize,
+				char *Text, unsigned long TextSize,
+				uint64_t *offs, unsigned int offs_max,
+				unsigned long *resume)
+{
+	unsigned long pos, win, size;
+	unsigned int i, n, found = 0;
+	unsigned int threads = search_threads();
+	struct timeval etime, stime;
+
+	*resume = 0;
+	gettimeofday(&stime, NULL);
+	for (pos = 0; pos < TextSize; pos += win) {
+		/* a chunk for each thread */
+		win = MIN(TextSize - pos,
+			  MAX((unsigned long)SEARCH_PAGE_WINDOW,
+			      (unsigned long)threads * SEARCH_CHUNK_MIN));
+		size = MIN(TextSize - pos, win + PatternSize - 1);
+
+		n = search_mt(Method, Pattern, PatternSize, Text + pos, size,
+			      threads, offs + found, offs_max - found);
+		for (i = found; i < MIN(found + n, offs_max); i++)
+			offs[i] += pos;
+		if (n > offs_max - found) {
+			found = offs_max;
+			*resume = offs[offs_max - 1] + 1;
+			break;
+		}
+		found += n;
+	}
+	gettimeofday(&etime, NULL);
+
+	printf("SW page took %lld usec: %u offsets, resume at %lu\n",
+	       (long long)timediff_usec(&etime, &stime), found, *resume);
+	return found;
+}
+
+/*
+ * Step 6 needs card DRAM contents to survive from one job to the next,
+ * so the simulation keeps the two text slots in host memory. The upload
+ * of the next chunk runs in its own thread while the current chunk is
+ * searched, as the card would do it.
+ */
+static struct sim_ddr_slot {
+	uint8_t *buf;
+	unsigned long size;
+} sim_ddr[2];
+
+struct pipe_upload {
+	void *dst;
+	const void *src;
+	unsigned long size;
+};
+
+static void *pipe_upload(void *arg)
+{
+	struct pipe_upload *up = (struct pipe_upload *)arg;
+
+	memcpy(up->dst, up->src, up->size);
+	return NULL;
+}
+
+static int search_pipe(struct search_job *js, unsigned int Method,
+		       char *Pattern, unsigned int PatternSize,
+		       uint64_t *offs, unsigned int offs_max)
+{
+	uint64_t addr = js->ddr_text1.addr;
+	unsigned long slot, pos, resume;
+	struct sim_ddr_slot *cur, *next;
+	struct pipe_upload up;
+	pthread_t tid;
+	int threaded = 0;
+
+	if (addr < DDR_TEXT_START || DDR_PIPE_SLOT_NR(addr) > 1 ||
+	    js->src_text1.size > DDR_PIPE_SLOT)
+		return -1;
+
+	slot = DDR_PIPE_SLOT_NR(addr);
+	pos = addr - DDR_PIPE_SLOT_ADDR(slot);
+	cur = &sim_ddr[slot];
+	next = &sim_ddr[slot ^ 1];
+	if (js->ddr_text1.size != 0 && pos + js->ddr_text1.size > cur->size)
+		return -1;
+
+	if (js->src_text1.size != 0) {
+		if (js->src_text1.size > next->size) {
+			uint8_t *buf = realloc(next->buf, js->src_text1.size);
+
+			if (buf == NULL)
+				return -1;
+			next->buf = buf;
+		}
+		next->size = js->src_text1.size;
+
+		up.dst = next->buf;
+		up.src = (void *)(unsigned long)js->src_text1.addr;
+		up.size = js->src_text1.size;
+		threaded = pthread_create(&tid, NULL, pipe_upload, &up) == 0;
+		if (!threaded)
+			pipe_upload(&up);
+	}
+
+	if (js->ddr_text1.size != 0 && offs_max != 0) {
+		js->nb_of_occurrences = search_page(Method, Pattern,
+				PatternSize, (char *)cur->buf + pos,
+				js->ddr_text1.size, offs, offs_max, &resume);
+		if (resume)
+			js->next_input_addr = addr + resume;
+	} else if (js->ddr_text1.size != 0)
+		js->nb_of_occurrences = run_sw_search(Method, Pattern,
+				PatternSize, (char *)cur->buf + pos,
+				js->ddr_text1.size, search_threads(), NULL, 0);
+
+	if (threaded)
+		pthread_join(tid, NULL);
+	return 0;
+}
+
 static void __trace_addr(const char *name, struct snap_addr *a)
 {
 	act_trace("  %-12s: %012llx %08x %04x %04x\n",
@@ -160,6 +1171,8 @@ static int action_main(struct snap_sim_action *action,
 	struct search_job *js = (struct search_job *)job;
 	char *needle, *haystack;
 	unsigned int needle_len, haystack_len, method;
+	uint64_t *offs = NULL;
+	unsigned int offs_max = 0;
 
 	act_trace("%s(%p, %p, %d) SEARCH\n", __func__, action, job, job_len);
 	__trace_addr("src_text1",   &js->src_text1);
@@ -168,8 +1181,11 @@ static int action_main(struct snap_sim_action *action,
 	__trace_addr("src_result",  &js->src_result);
 	__trace_addr("ddr_result",  &js->ddr_result);
 
-	if (js->src_result.addr != 0 && js->src_result.type == SNAP_ADDRTYPE_HOST_DRAM)
+	if (js->src_result.addr != 0 && js->src_result.type == SNAP_ADDRTYPE_HOST_DRAM) {
 		memset((uint8_t *)js->src_result.addr, 0, js->src_result.size);
+		offs = (uint64_t *)(unsigned long)js->src_result.addr;
+		offs_max = js->src_result.size / sizeof(uint64_t);
+	}
 
 	haystack = (char *)(unsigned long)js->src_text1.addr;
 	haystack_len = js->src_text1.size;
@@ -178,10 +1194,111 @@ static int action_main(struct snap_sim_action *action,
 	needle_len = js->src_pattern.size;
 
 	method =  js->method;
+	js->next_input_addr = 0;
+
+	/* k and case folding only exist for the approximate methods */
+	if ((method & ~SEARCH_METHOD_MASK) != 0 ||
+	    (method & SEARCH_METHOD_MASK) == SHIFTAND_method ||
+	    (method & SEARCH_METHOD_MASK) == MYERS_method) {
+		if (((method & SEARCH_METHOD_MASK) != SHIFTAND_method &&
+		     (method & SEARCH_METHOD_MASK) != MYERS_method) ||
+		    needle_len == 0 || needle_len > 64 ||
+		    SEARCH_K(method) >= needle_len) {
+			action->job.retc = SNAP_RETC_FAILURE;
+			return 0;
+		}
+	}
+
+	if (js->step == 3 && method == AC_method) {
+		const search_dfa_t *dfa = (const search_dfa_t *)needle;
+
+		if (needle_len < sizeof(*dfa) ||
+		    dfa->magic != SEARCH_DFA_MAGIC ||
+		    dfa->size > needle_len ||
+		    js->src_result.size <
+		    SEARCH_AC_COUNTS_SIZE(dfa->n_patterns)) {
+			action->job.retc = SNAP_RETC_FAILURE;
+			return 0;
+		}
+		js->nb_of_occurrences = run_sw_ac_search(dfa, haystack,
+				haystack_len,
+				(void *)(unsigned long)js->src_result.addr,
+				js->src_result.size);
+	} else if (js->step == 3 && method == BATCH_method) {
+		const search_batch_t *batch = (const search_batch_t *)needle;
+		const search_dfa_t *dfa = search_batch_dfa(batch);
+
+		if (needle_len < sizeof(*batch) ||
+		    batch->magic != SEARCH_BATCH_MAGIC ||
+		    batch->size > needle_len ||
+		    batch->n_queries == 0 ||
+		    batch->n_queries > SEARCH_BATCH_MAX ||
+		    (uint64_t)batch->dfa_offset + sizeof(*dfa) > batch->size ||
+		    dfa->magic != SEARCH_DFA_MAGIC ||
+		    dfa->size > batch->size - batch->dfa_offset ||
+		    dfa->n_patterns != batch->n_queries ||
+		    js->src_result.size <
+		    SEARCH_BATCH_RESULT_SIZE((uint64_t)batch->n_queries,
+					     batch->page_items)) {
+			action->job.retc = SNAP_RETC_FAILURE;
+			return 0;
+		}
+		js->nb_of_occurrences = run_sw_batch_search(batch, haystack,
+				haystack_len,
+				(void *)(unsigned long)js->src_result.addr,
+				js->src_result.size);
+	} else if (js->step == 3 && method == REGEX_method) {
+		const search_re_t *re = (const search_re_t *)needle;
+
+		if (needle_len < sizeof(*re) ||
+		    re->magic != SEARCH_RE_MAGIC ||
+		    re->size > needle_len ||
+		    (size_t)((const uint8_t *)search_re_sets(re) -
+			     (const uint8_t *)re) + re->n_sets * 32 >
+		    re->size) {
+			action->job.retc = SNAP_RETC_FAILURE;
+			return 0;
+		}
+		js->nb_of_occurrences = run_sw_re_search(re, haystack,
+				haystack_len, offs, offs_max);
+		/* no paging, see REGEX_method */
+		if (offs_max != 0 && js->nb_of_occurrences > offs_max) {
+			action->job.retc = SNAP_RETC_FAILURE;
+			return 0;
+		}
+	} else if (js->step == 3 &&
+		   (method & SEARCH_METHOD_MASK) == MYERS_method) {
+		js->nb_of_occurrences = run_sw_search(method, needle,
+				needle_len, haystack, haystack_len, 1,
+				offs, offs_max);
+		/* no paging, see MYERS_method */
+		if (offs_max != 0 && js->nb_of_occurrences > offs_max) {
+			action->job.retc = SNAP_RETC_FAILURE;
+			return 0;
+		}
+	} else if (js->step == 3 && offs_max != 0) {
+		unsigned long resume;
 
-        if (js->step == 3) 
+		js->nb_of_occurrences = search_page(method, needle, needle_len,
+						    haystack, haystack_len,
+						    offs, offs_max, &resume);
+		if (resume)
+			js->next_input_addr = js->ddr_text1.addr + resume;
+	} else if (js->step == 3)	/* count only */
 		js->nb_of_occurrences = run_sw_search(method, (char *)needle, needle_len,
-                                        (char *)haystack, haystack_len);
+                                        (char *)haystack, haystack_len,
+                                        search_threads(), NULL, 0);
+	else if (js->step == 6) {
+		js->nb_of_occurrences = 0;
+		if (method == AC_method || method == REGEX_method ||
+		    method == BATCH_method ||
+		    (method & SEARCH_METHOD_MASK) == MYERS_method ||
+		    search_pipe(js, method, needle, needle_len,
+				offs, offs_max) != 0) {
+			action->job.retc = SNAP_RETC_FAILURE;
+			return 0;
+		}
+	}
 
 	action->job.retc = SNAP_RETC_SUCCESS;
 
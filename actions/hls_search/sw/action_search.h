@@ -31,11 +31,31 @@ extern "C" {
 #define DDR_TEXT_START       (1024 * 1024)
 #define DDR_OFFS_START (512 * 1024 * 1024)
 
+/*
+ * Step 6 pipelines a chunked text through two DDR text slots. It
+ * searches ddr_text1, which lies in one slot, like step 3 and within
+ * the same job copies src_text1 to the start of the other slot. The
+ * host queues the upload of chunk k+1 with the search of chunk k, so
+ * the transfer overlaps the search. A size of 0 skips either part.
+ */
+#define DDR_PIPE_SLOT        (128 * 1024 * 1024)
+#define DDR_PIPE_SLOT_NR(a)  (((a) - DDR_TEXT_START) / DDR_PIPE_SLOT)
+#define DDR_PIPE_SLOT_ADDR(n) (DDR_TEXT_START + (n) * DDR_PIPE_SLOT)
+#define DDR_PIPE_OTHER(a)    DDR_PIPE_SLOT_ADDR(DDR_PIPE_SLOT_NR(a) ^ 1)
+
 /*
  * Action_Register is a 992 bits/124 Bytes made of a 16 Bytes header and a 108
  * bytes data field. To keep the address at the right location, Data should
  * always be 108 bytes.
  */
+/*
+ * Step 3 returns match offsets in pages: src_result holds up to
+ * src_result.size / 8 offsets, relative to the start of the searched
+ * text, and nb_of_occurrences is the number stored. If more matches
+ * follow, next_input_addr is the ddr_text1 address to restart the
+ * search at, otherwise it is 0. A src_result size of 0 selects count
+ * only: no offsets are written and nb_of_occurrences is the total.
+ */
 typedef struct search_job {
         struct snap_addr src_text1;     /* input text in HOST: 128 bits*/
         struct snap_addr src_pattern;   /* input pattern in HOST: 128 bits*/
@@ -53,8 +73,152 @@ typedef enum {
         STRM_method   = 0x0,
         NAIVE_method  = 0x1,
         KMP_method    = 0x2,
+        AC_method     = 0x3, /* multi-pattern, host/simulation only */
+        SIMD_method   = 0x4, /* first/last byte filter, host/simulation only */
+        REGEX_method  = 0x5, /* regular expression, host/simulation only */
+        SHIFTAND_method = 0x6, /* k mismatches, host/simulation only */
+        MYERS_method  = 0x7, /* edit distance up to k, host/simulation only */
+        BATCH_method  = 0x8, /* query table, one scan, host/simulation only */
 } search_method_t;
 
+/*
+ * SHIFTAND_method and MYERS_method take k and SEARCH_NOCASE in the
+ * upper bits of method. Shift-And reports the start of each pattern
+ * long window with at most k mismatches, Myers the end offset of each
+ * text position where a substring within edit distance k ends. Myers
+ * has no result paging. Both need k < pattern size <= 64.
+ */
+#define SEARCH_METHOD_MASK	0x00ff
+#define SEARCH_K_SHIFT		8
+#define SEARCH_K_MAX		63
+#define SEARCH_NOCASE		0x8000	/* fold ASCII case */
+#define SEARCH_K(m)		(((m) >> SEARCH_K_SHIFT) & SEARCH_K_MAX)
+#define SEARCH_METHOD(m, k, flags) \
+	((m) | ((k) << SEARCH_K_SHIFT) | (flags))
+
+/*
+ * AC_method: src_pattern holds a search_dfa image compiled on the host
+ * from the whole pattern set. src_result receives one uint32_t count per
+ * pattern, padded to 8 bytes, followed by search_match records.
+ * nb_of_occurrences is the total number of matches, also if not all of
+ * the records fitted into src_result.
+ */
+#define SEARCH_DFA_MAGIC	0x41434446	/* "ACDF" */
+#define SEARCH_DFA_MATCH	0x80000000	/* target state reports matches */
+
+typedef struct search_dfa {
+        uint32_t magic;
+        uint32_t n_states;
+        uint32_t n_classes;     /* byte classes, at most 256 */
+        uint32_t n_patterns;
+        uint32_t n_out;         /* entries in the output list */
+        uint32_t size;          /* image size in bytes */
+        uint8_t classmap[256];  /* byte to class */
+        /*
+         * Followed by uint32_t arrays:
+         *   trans[n_states * n_classes]  next state row offset | MATCH
+         *   out_idx[n_states + 1]        output list range per state
+         *   out[n_out]                   pattern ids, longest first
+         *   pat_len[n_patterns]
+         */
+} search_dfa_t;
+
+typedef struct search_match {
+        uint64_t offset;        /* start of the match in the text */
+        uint32_t pattern;       /* index in the pattern set */
+        uint32_t reserved;
+} search_match_t;
+
+#define SEARCH_AC_COUNTS_SIZE(n) ((((n) * sizeof(uint32_t)) + 7) & ~7ul)
+
+/*
+ * BATCH_method: src_pattern holds a search_batch table of up to
+ * SEARCH_BATCH_MAX queries with their pattern bytes and the AC
+ * automaton of the set, so the text is scanned once for all queries.
+ * src_result receives one search_batch_result per query, followed by
+ * a page of page_items offsets per query. count is the number of
+ * matches of the query, n_offs how many of the first ones are in its
+ * page. nb_of_occurrences is the total over all queries.
+ */
+#define SEARCH_BATCH_MAGIC	0x42415443	/* "BATC" */
+#define SEARCH_BATCH_MAX	4096
+
+typedef struct search_batch_query {
+        uint32_t offset;        /* pattern bytes, from the table start */
+        uint32_t len;
+} search_batch_query_t;
+
+typedef struct search_batch {
+        uint32_t magic;
+        uint32_t n_queries;
+        uint32_t page_items;    /* offsets per query page, 0: count only */
+        uint32_t dfa_offset;    /* search_dfa image, from the table start */
+        uint32_t size;          /* table size in bytes */
+        uint32_t reserved;
+        /*
+         * Followed by:
+         *   query[n_queries]   search_batch_query_t
+         *   pattern bytes
+         *   search_dfa image, 8 byte aligned
+         */
+} search_batch_t;
+
+typedef struct search_batch_result {
+        uint32_t count;         /* matches of the query */
+        uint32_t n_offs;        /* offsets in its page */
+        uint64_t page;          /* byte offset of the page in src_result */
+} search_batch_result_t;
+
+#define SEARCH_BATCH_RESULT_SIZE(n, items) \
+	((n) * (sizeof(search_batch_result_t) + (items) * sizeof(uint64_t)))
+
+/*
+ * REGEX_method: src_pattern holds a search_re image compiled on the host.
+ * Normally this is a minimized DFA over byte classes, run with one table
+ * lookup per text byte. If the DFA grows beyond the state limit, the
+ * image carries the NFA instead and the search only runs it on the lines
+ * holding the required literal. src_result receives the end offset of
+ * each match, nb_of_occurrences is the total; there is no paging.
+ */
+#define SEARCH_RE_MAGIC		0x52454446	/* "REDF" */
+#define SEARCH_RE_BOL		0x1	/* ^: match at line starts only */
+#define SEARCH_RE_EOL		0x2	/* $: match at line ends only */
+#define SEARCH_RE_NFA		0x4	/* NFA on literal prefiltered lines */
+#define SEARCH_RE_PREFIX	0x8	/* every match starts with literal */
+#define SEARCH_RE_LIT_MAX	64
+
+typedef struct search_re {
+        uint32_t magic;
+        uint32_t flags;
+        uint32_t n_states;      /* DFA states, 0 with SEARCH_RE_NFA */
+        uint32_t n_classes;
+        uint32_t n_nfa;         /* NFA states, with SEARCH_RE_NFA */
+        uint32_t n_sets;        /* byte sets of the NFA */
+        uint32_t nfa_start;
+        uint32_t lit_len;       /* required literal, 0: none */
+        uint32_t size;          /* image size in bytes */
+        uint32_t reserved;
+        uint8_t classmap[256];  /* byte to class */
+        uint8_t literal[SEARCH_RE_LIT_MAX];
+        /*
+         * Followed by:
+         *   trans[n_states * n_classes]  uint32_t, next row offset | MATCH
+         *   nfa[n_nfa]                   search_re_nfa_t
+         *   sets[n_sets][32]             byte bitmaps
+         */
+} search_re_t;
+
+#define SEARCH_RE_OP_SET	0	/* consume a byte of set, go to out */
+#define SEARCH_RE_OP_SPLIT	1	/* go to out and out1 */
+#define SEARCH_RE_OP_MATCH	2
+
+typedef struct search_re_nfa {
+        uint16_t op;
+        uint16_t set;
+        uint32_t out;
+        uint32_t out1;
+} search_re_nfa_t;
+
 #ifdef __cplusplus
 }
 #endif
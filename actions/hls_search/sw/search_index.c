@@ -0,0 +1,322 @@
+/*
+ * Copyright 2017 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Trigram index over a resident text, to narrow repeated searches down
+ * to the blocks that can hold a match.
+ *
+ * The text is cut into SEARCH_INDEX_BLOCK byte blocks. A block lists
+ * every trigram starting in it or in the SEARCH_INDEX_OVERLAP bytes
+ * behind it, so all trigrams of a match of up to 64 bytes are listed
+ * by the block the match starts in. Per trigram the block numbers are
+ * stored as delta varints. Only trigrams which occur get an entry in
+ * the sorted key directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <snap_tools.h>
+#include <snap_search.h>
+
+#define INDEX_KEYS	(1 << 24)	/* all trigrams */
+#define INDEX_NONE	0xffffffff
+
+static inline uint32_t trigram(const uint8_t *p)
+{
+	return p[0] << 16 | p[1] << 8 | p[2];
+}
+
+static inline unsigned int varint_len(uint32_t v)
+{
+	unsigned int n = 1;
+
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+static inline uint8_t *varint_put(uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static inline const uint8_t *varint_get(const uint8_t *p, uint32_t *v)
+{
+	unsigned int shift = 0;
+
+	*v = 0;
+	do {
+		*v |= (uint32_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	return p;
+}
+
+/* FNV-1a, tells if an index file still belongs to the text */
+uint64_t search_index_hash(const uint8_t *text, size_t size)
+{
+	uint64_t h = 14695981039346656037ull;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		h = (h ^ text[i]) * 1099511628211ull;
+	return h;
+}
+
+/* Trigram positions covered by block b */
+static void block_range(size_t size, uint32_t b, size_t *start, size_t *end)
+{
+	*start = (size_t)b * SEARCH_INDEX_BLOCK;
+	*end = MIN(*start + SEARCH_INDEX_BLOCK + SEARCH_INDEX_OVERLAP,
+		   size - 2);
+}
+
+struct search_index *search_index_build(const uint8_t *text, size_t size)
+{
+	struct search_index *ix = NULL;
+	uint32_t *last, *cursor, *keys, *offs;
+	uint32_t b, k, n_blocks, n_keys = 0;
+	size_t i, start, end, total = 0;
+	uint8_t *post;
+
+	n_blocks = (size + SEARCH_INDEX_BLOCK - 1) / SEARCH_INDEX_BLOCK;
+	last = malloc(INDEX_KEYS * sizeof(*last));
+	cursor = calloc(INDEX_KEYS, sizeof(*cursor));
+	if (last == NULL || cursor == NULL)
+		goto out;
+
+	/* pass 1: posting bytes per trigram */
+	memset(last, 0xff, INDEX_KEYS * sizeof(*last));
+	for (b = 0; size >= 3 && b < n_blocks; b++) {
+		block_range(size, b, &start, &end);
+		for (i = start; i < end; i++) {
+			k = trigram(text + i);
+			if (last[k] == b)
+				continue;
+			/* first block absolute, then deltas */
+			cursor[k] += varint_len(last[k] == INDEX_NONE ?
+						b : b - last[k]);
+			last[k] = b;
+		}
+	}
+	for (k = 0; k < INDEX_KEYS; k++) {
+		n_keys += cursor[k] != 0;
+		total += cursor[k];
+	}
+	if (total > 0xffffffffull)
+		goto out;
+
+	ix = malloc(sizeof(*ix) + (2 * n_keys + 1) * sizeof(uint32_t) +
+		    total);
+	if (ix == NULL)
+		goto out;
+	ix->magic = SEARCH_INDEX_MAGIC;
+	ix->block_size = SEARCH_INDEX_BLOCK;
+	ix->n_blocks = n_blocks;
+	ix->n_keys = n_keys;
+	ix->text_size = size;
+	ix->text_hash = search_index_hash(text, size);
+	ix->size = sizeof(*ix) + (2 * n_keys + 1) * sizeof(uint32_t) + total;
+
+	/* directory, cursor becomes the write offset per trigram */
+	keys = search_index_keys(ix);
+	offs = search_index_offs(ix);
+	for (total = 0, n_keys = 0, k = 0; k < INDEX_KEYS; k++) {
+		if (cursor[k] == 0)
+			continue;
+		keys[n_keys] = k;
+		offs[n_keys++] = total;
+		b = cursor[k];
+		cursor[k] = total;
+		total += b;
+	}
+	offs[n_keys] = total;
+
+	/* pass 2: the postings */
+	post = (uint8_t *)search_index_postings(ix);
+	memset(last, 0xff, INDEX_KEYS * sizeof(*last));
+	for (b = 0; size >= 3 && b < n_blocks; b++) {
+		block_range(size, b, &start, &end);
+		for (i = start; i < end; i++) {
+			k = trigram(text + i);
+			if (last[k] == b)
+				continue;
+			cursor[k] = varint_put(post + cursor[k],
+					       last[k] == INDEX_NONE ?
+					       b : b - last[k]) - post;
+			last[k] = b;
+		}
+	}
+ out:
+	free(last);
+	free(cursor);
+	return ix;
+}
+
+int search_index_save(const struct search_index *ix, const char *fname)
+{
+	FILE *fp;
+	int rc = 0;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "err: Cannot open file %s: %s\n",
+			fname, strerror(errno));
+		return -ENODEV;
+	}
+	if (fwrite(ix, ix->size, 1, fp) != 1) {
+		fprintf(stderr, "err: Cannot write to %s: %s\n",
+			fname, strerror(errno));
+		rc = -EIO;
+	}
+	fclose(fp);
+	return rc;
+}
+
+/* NULL if there is no index file or it belongs to another text */
+struct search_index *search_index_load(const char *fname,
+				       const uint8_t *text, size_t size)
+{
+	struct search_index hdr, *ix;
+	FILE *fp;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL)
+		return NULL;
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != SEARCH_INDEX_MAGIC ||
+	    hdr.block_size != SEARCH_INDEX_BLOCK ||
+	    hdr.text_size != size ||
+	    hdr.size < sizeof(hdr) + (2 * (uint64_t)hdr.n_keys + 1) * 4 ||
+	    hdr.text_hash != search_index_hash(text, size)) {
+		fclose(fp);
+		return NULL;
+	}
+
+	ix = malloc(hdr.size);
+	if (ix == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+	memcpy(ix, &hdr, sizeof(hdr));
+	if (fread(ix + 1, hdr.size - sizeof(hdr), 1, fp) != 1) {
+		free(ix);
+		ix = NULL;
+	}
+	fclose(fp);
+	return ix;
+}
+
+/* Posting list of trigram k, returns its byte size, 0 if none */
+static size_t index_list(const struct search_index *ix, uint32_t k,
+			 const uint8_t **list)
+{
+	const uint32_t *keys = search_index_keys(ix);
+	const uint32_t *offs = search_index_offs(ix);
+	uint32_t lo = 0, hi = ix->n_keys, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (keys[mid] < k)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == ix->n_keys || keys[lo] != k)
+		return 0;
+	*list = search_index_postings(ix) + offs[lo];
+	return offs[lo + 1] - offs[lo];
+}
+
+struct index_term {
+	const uint8_t *list;
+	size_t len;
+};
+
+static int term_cmp(const void *a, const void *b)
+{
+	const struct index_term *x = a, *y = b;
+
+	return x->len < y->len ? -1 : x->len > y->len;
+}
+
+/*
+ * Blocks which hold all trigrams of the pattern, in ascending order in
+ * blocks[], which has room for ix->n_blocks entries. Returns how many.
+ * Patterns shorter than a trigram select all blocks.
+ */
+uint32_t search_index_query(const struct search_index *ix,
+			    const char *pattern, unsigned int psize,
+			    uint32_t *blocks)
+{
+	struct index_term term[SEARCH_INDEX_OVERLAP + 1];
+	unsigned int n_terms = 0, i, t;
+	const uint8_t *p, *end;
+	uint32_t n, o, b, delta;
+
+	if (psize < 3 || psize > SEARCH_INDEX_OVERLAP + 3) {
+		for (b = 0; b < ix->n_blocks; b++)
+			blocks[b] = b;
+		return ix->n_blocks;
+	}
+
+	for (i = 0; i + 3 <= psize; i++) {
+		uint32_t k = trigram((const uint8_t *)pattern + i);
+
+		for (t = 0; t < i; t++)	/* repeated trigram */
+			if (trigram((const uint8_t *)pattern + t) == k)
+				break;
+		if (t < i)
+			continue;
+		term[n_terms].len = index_list(ix, k, &term[n_terms].list);
+		if (term[n_terms].len == 0)
+			return 0;
+		n_terms++;
+	}
+	qsort(term, n_terms, sizeof(*term), term_cmp);
+
+	/* the shortest list, then intersect with the longer ones */
+	for (n = 0, b = 0, p = term[0].list, end = p + term[0].len; p < end; ) {
+		p = varint_get(p, &delta);
+		b += delta;
+		blocks[n++] = b;
+	}
+	for (t = 1; t < n_terms && n; t++) {
+		p = term[t].list;
+		end = p + term[t].len;
+		for (o = 0, i = 0, b = 0; i < n && p < end; ) {
+			p = varint_get(p, &delta);
+			b += delta;
+			while (i < n && blocks[i] < b)
+				i++;
+			if (i < n && blocks[i] == b)
+				blocks[o++] = blocks[i++];
+		}
+		n = o;
+	}
+	return n;
+}
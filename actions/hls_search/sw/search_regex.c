@@ -0,0 +1,1051 @@
+/*
+ * Copyright 2017 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Regular expression compiler for the REGEX_method.
+ *
+ * Supported are literals, escapes (\d \w \s and their negations, \n \t
+ * \r \f \v \xHH), ".", bracket classes, grouping, alternation, the
+ * repetitions * + ? {m} {m,} {m,n} and the anchors ^ and $ at the start
+ * and the end of the expression. The expression is parsed into a tree,
+ * turned into a Thompson NFA and that into a DFA by subset construction
+ * over byte classes. The DFA is minimized by partition refinement. If it
+ * needs more than max_states states, the image carries the NFA and the
+ * longest literal every match has to contain instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <snap_tools.h>
+#include <snap_search.h>
+
+#define RE_NODE_SET	0
+#define RE_NODE_CAT	1
+#define RE_NODE_ALT	2
+#define RE_NODE_REP	3
+#define RE_NODE_EMPTY	4
+
+#define RE_REP_MAX	255		/* largest bound in {m,n} */
+#define RE_NFA_MAX	16384		/* NFA states */
+#define RE_TABLE_MAX	(64 * 1024 * 1024) /* DFA table bytes */
+
+struct re_node {
+	int op;
+	int a, b;		/* children, set index for RE_NODE_SET */
+	int min, max;		/* RE_NODE_REP, max -1 is unbounded */
+};
+
+struct re_parser {
+	const char *p;
+	const char *err;
+	struct re_node *node;
+	unsigned int n_node, max_node;
+	uint8_t (*set)[32];
+	unsigned int n_set, max_set;
+};
+
+struct re_nfa {
+	search_re_nfa_t *st;
+	unsigned int n, max;
+};
+
+static inline void set_add(uint8_t *set, unsigned int c)
+{
+	set[c >> 3] |= 1 << (c & 7);
+}
+
+static void set_range(uint8_t *set, unsigned int lo, unsigned int hi)
+{
+	for (; lo <= hi; lo++)
+		set_add(set, lo);
+}
+
+static void set_invert(uint8_t *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < 32; i++)
+		set[i] = ~set[i];
+}
+
+/* The only byte of a set, -1 if it holds none or more */
+static int set_single(const uint8_t *set)
+{
+	unsigned int c;
+	int single = -1;
+
+	for (c = 0; c < 256; c++) {
+		if (!search_re_set_has(set, c))
+			continue;
+		if (single >= 0)
+			return -1;
+		single = c;
+	}
+	return single;
+}
+
+static int re_new_set(struct re_parser *ps)
+{
+	if (ps->n_set == ps->max_set) {
+		unsigned int max = ps->max_set ? 2 * ps->max_set : 16;
+		void *set = realloc(ps->set, max * sizeof(*ps->set));
+
+		if (set == NULL || max > 0xffff) {
+			ps->err = "too many byte sets";
+			return -1;
+		}
+		ps->set = set;
+		ps->max_set = max;
+	}
+	memset(ps->set[ps->n_set], 0, sizeof(ps->set[0]));
+	return ps->n_set++;
+}
+
+static int re_new_node(struct re_parser *ps, int op, int a, int b)
+{
+	struct re_node *n;
+
+	if (ps->n_node == ps->max_node) {
+		unsigned int max = ps->max_node ? 2 * ps->max_node : 64;
+		void *node = realloc(ps->node, max * sizeof(*ps->node));
+
+		if (node == NULL) {
+			ps->err = "out of memory";
+			return -1;
+		}
+		ps->node = node;
+		ps->max_node = max;
+	}
+	n = &ps->node[ps->n_node];
+	n->op = op;
+	n->a = a;
+	n->b = b;
+	n->min = n->max = 0;
+	return ps->n_node++;
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Adds the bytes of the escape sequence behind a backslash to set */
+static int re_parse_escape(struct re_parser *ps, uint8_t *set)
+{
+	uint8_t tmp[32];
+	int hi, lo;
+	char c = *ps->p++;
+
+	memset(tmp, 0, sizeof(tmp));
+	switch (c) {
+	case 'd':
+	case 'D':
+		set_range(tmp, '0', '9');
+		break;
+	case 'w':
+	case 'W':
+		set_range(tmp, 'a', 'z');
+		set_range(tmp, 'A', 'Z');
+		set_range(tmp, '0', '9');
+		set_add(tmp, '_');
+		break;
+	case 's':
+	case 'S':
+		set_add(tmp, ' ');
+		set_range(tmp, '\t', '\r');	/* \t \n \v \f \r */
+		break;
+	case 'n':
+		set_add(tmp, '\n');
+		break;
+	case 't':
+		set_add(tmp, '\t');
+		break;
+	case 'r':
+		set_add(tmp, '\r');
+		break;
+	case 'f':
+		set_add(tmp, '\f');
+		break;
+	case 'v':
+		set_add(tmp, '\v');
+		break;
+	case 'x':
+		hi = hex_digit(ps->p[0]);
+		lo = hi < 0 ? -1 : hex_digit(ps->p[1]);
+		if (lo < 0) {
+			ps->err = "\\x needs two hex digits";
+			return -1;
+		}
+		set_add(tmp, hi << 4 | lo);
+		ps->p += 2;
+		break;
+	case '\0':
+		ps->p--;
+		ps->err = "trailing backslash";
+		return -1;
+	default:
+		if (isalnum((unsigned char)c)) {
+			ps->err = "unknown escape";
+			return -1;
+		}
+		set_add(tmp, (uint8_t)c);
+		break;
+	}
+	if (c == 'D' || c == 'W' || c == 'S')
+		set_invert(tmp);
+	for (lo = 0; lo < 32; lo++)
+		set[lo] |= tmp[lo];
+	return 0;
+}
+
+/* One class member for a range bound: a byte or a single byte escape */
+static int re_class_byte(struct re_parser *ps, uint8_t *set)
+{
+	uint8_t tmp[32];
+	int i;
+
+	if (*ps->p != '\\')
+		return (uint8_t)*ps->p++;
+
+	ps->p++;
+	memset(tmp, 0, sizeof(tmp));
+	if (re_parse_escape(ps, tmp) < 0)
+		return -1;
+	if (set_single(tmp) < 0) {
+		/* \d and friends, no range possible */
+		for (i = 0; i < 32; i++)
+			set[i] |= tmp[i];
+		return 256;
+	}
+	return set_single(tmp);
+}
+
+static int re_parse_class(struct re_parser *ps)
+{
+	int neg = 0, first = 1, lo, hi, s;
+	uint8_t *set;
+
+	s = re_new_set(ps);
+	if (s < 0)
+		return -1;
+	if (*ps->p == '^') {
+		neg = 1;
+		ps->p++;
+	}
+	while (*ps->p && (*ps->p != ']' || first)) {
+		first = 0;
+		set = ps->set[s];
+		lo = re_class_byte(ps, set);
+		if (lo < 0)
+			return -1;
+		if (lo == 256)
+			continue;
+		if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+			ps->p++;
+			hi = re_class_byte(ps, set);
+			if (hi < 0)
+				return -1;
+			if (hi == 256 || hi < lo) {
+				ps->err = "bad range in class";
+				return -1;
+			}
+			set_range(set, lo, hi);
+		} else
+			set_add(set, lo);
+	}
+	if (*ps->p != ']') {
+		ps->err = "missing ]";
+		return -1;
+	}
+	ps->p++;
+	if (neg)
+		set_invert(ps->set[s]);
+	return re_new_node(ps, RE_NODE_SET, s, 0);
+}
+
+static int re_parse_alt(struct re_parser *ps);
+
+static int re_parse_atom(struct re_parser *ps)
+{
+	int n, s;
+
+	switch (*ps->p) {
+	case '(':
+		ps->p++;
+		if (ps->p[0] == '?' && ps->p[1] == ':')
+			ps->p += 2;
+		n = re_parse_alt(ps);
+		if (n < 0)
+			return -1;
+		if (*ps->p != ')') {
+			ps->err = "missing )";
+			return -1;
+		}
+		ps->p++;
+		return n;
+	case '[':
+		ps->p++;
+		return re_parse_class(ps);
+	case '^':
+	case '$':
+		ps->err = "anchors only at the start and the end";
+		return -1;
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		ps->err = "nothing to repeat";
+		return -1;
+	}
+
+	s = re_new_set(ps);
+	if (s < 0)
+		return -1;
+	if (*ps->p == '.') {
+		ps->p++;
+		set_range(ps->set[s], 0, 255);
+		ps->set[s]['\n' >> 3] &= ~(1 << ('\n' & 7));
+	} else if (*ps->p == '\\') {
+		ps->p++;
+		if (re_parse_escape(ps, ps->set[s]) < 0)
+			return -1;
+	} else
+		set_add(ps->set[s], (uint8_t)*ps->p++);
+	return re_new_node(ps, RE_NODE_SET, s, 0);
+}
+
+static int re_parse_bound(struct re_parser *ps)
+{
+	int n = 0;
+
+	if (!isdigit((unsigned char)*ps->p))
+		return -1;
+	while (isdigit((unsigned char)*ps->p)) {
+		n = n * 10 + *ps->p++ - '0';
+		if (n > RE_REP_MAX)
+			return -1;
+	}
+	return n;
+}
+
+static int re_parse_repeat(struct re_parser *ps)
+{
+	int n, min, max;
+
+	n = re_parse_atom(ps);
+	while (n >= 0) {
+		switch (*ps->p) {
+		case '*':
+			min = 0, max = -1;
+			break;
+		case '+':
+			min = 1, max = -1;
+			break;
+		case '?':
+			min = 0, max = 1;
+			break;
+		case '{':
+			ps->p++;
+			min = max = re_parse_bound(ps);
+			if (min >= 0 && *ps->p == ',') {
+				ps->p++;
+				max = *ps->p == '}' ? -1 : re_parse_bound(ps);
+				if (max == -1 && *ps->p != '}')
+					min = -1;
+			}
+			if (min < 0 || *ps->p != '}' ||
+			    (max >= 0 && max < min)) {
+				ps->err = "bad repetition bound, at most "
+					"{255,255}";
+				return -1;
+			}
+			break;
+		default:
+			return n;
+		}
+		ps->p++;
+		n = re_new_node(ps, RE_NODE_REP, n, 0);
+		if (n >= 0) {
+			ps->node[n].min = min;
+			ps->node[n].max = max;
+		}
+	}
+	return n;
+}
+
+static int re_parse_cat(struct re_parser *ps)
+{
+	int n = -1, m;
+
+	while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+		m = re_parse_repeat(ps);
+		if (m < 0)
+			return -1;
+		n = n < 0 ? m : re_new_node(ps, RE_NODE_CAT, n, m);
+		if (n < 0)
+			return -1;
+	}
+	if (n < 0)
+		n = re_new_node(ps, RE_NODE_EMPTY, 0, 0);
+	return n;
+}
+
+static int re_parse_alt(struct re_parser *ps)
+{
+	int n, m;
+
+	n = re_parse_cat(ps);
+	while (n >= 0 && *ps->p == '|') {
+		ps->p++;
+		m = re_parse_cat(ps);
+		if (m < 0)
+			return -1;
+		n = re_new_node(ps, RE_NODE_ALT, n, m);
+	}
+	return n;
+}
+
+/*
+ * Longest run of single byte nodes in the top level concatenation. Each
+ * match holds it, *prefix tells if each match starts with it.
+ */
+static unsigned int re_literal(struct re_parser *ps, int n, uint8_t *lit,
+			       int *prefix)
+{
+	int seq[256], stack[256];
+	unsigned int n_seq = 0, sp = 0, i, run = 0, best = 0, best_at = 0;
+
+	/* flatten the left deep concatenation */
+	stack[sp++] = n;
+	while (sp && n_seq < 256) {
+		n = stack[--sp];
+		if (ps->node[n].op == RE_NODE_CAT && sp + 2 <= 256) {
+			stack[sp++] = ps->node[n].b;
+			stack[sp++] = ps->node[n].a;
+		} else
+			seq[n_seq++] = n;
+	}
+
+	for (i = 0; i < n_seq; i++) {
+		if (ps->node[seq[i]].op == RE_NODE_SET &&
+		    set_single(ps->set[ps->node[seq[i]].a]) >= 0)
+			run++;
+		else
+			run = 0;
+		if (run > best) {
+			best = run;
+			best_at = i + 1 - run;
+		}
+	}
+	best = MIN(best, (unsigned int)SEARCH_RE_LIT_MAX);
+	for (i = 0; i < best; i++)
+		lit[i] = set_single(ps->set[ps->node[seq[best_at + i]].a]);
+	*prefix = best != 0 && best_at == 0;
+	return best;
+}
+
+static int nfa_new(struct re_parser *ps, struct re_nfa *nfa, int op, int set,
+		   int out, int out1)
+{
+	search_re_nfa_t *st;
+
+	if (nfa->n == nfa->max) {
+		unsigned int max = nfa->max ? 2 * nfa->max : 256;
+
+		if (max > RE_NFA_MAX ||
+		    (st = realloc(nfa->st, max * sizeof(*st))) == NULL) {
+			ps->err = "expression too large";
+			return -1;
+		}
+		nfa->st = st;
+		nfa->max = max;
+	}
+	st = &nfa->st[nfa->n];
+	st->op = op;
+	st->set = set;
+	st->out = out;
+	st->out1 = out1;
+	return nfa->n++;
+}
+
+/* Emits node n into the NFA, continuing to next. Returns its start. */
+static int nfa_emit(struct re_parser *ps, struct re_nfa *nfa, int n, int next)
+{
+	const struct re_node *nd = &ps->node[n];
+	int i, x, y, cur = next;
+
+	if (next < 0)
+		return -1;
+
+	switch (nd->op) {
+	case RE_NODE_SET:
+		return nfa_new(ps, nfa, SEARCH_RE_OP_SET, nd->a, next, 0);
+	case RE_NODE_CAT:
+		return nfa_emit(ps, nfa, nd->a, nfa_emit(ps, nfa, nd->b, next));
+	case RE_NODE_ALT:
+		x = nfa_emit(ps, nfa, nd->a, next);
+		y = nfa_emit(ps, nfa, nd->b, next);
+		if (x < 0 || y < 0)
+			return -1;
+		return nfa_new(ps, nfa, SEARCH_RE_OP_SPLIT, 0, x, y);
+	case RE_NODE_REP:
+		if (nd->max < 0) {
+			cur = nfa_new(ps, nfa, SEARCH_RE_OP_SPLIT, 0, 0, next);
+			x = nfa_emit(ps, nfa, nd->a, cur);
+			if (x < 0)
+				return -1;
+			nfa->st[cur].out = x;
+		}
+		/* x{0,k} is (x(x(...)?)?)? */
+		for (i = nd->min; i < nd->max && cur >= 0; i++) {
+			x = nfa_emit(ps, nfa, nd->a, cur);
+			if (x < 0)
+				return -1;
+			cur = nfa_new(ps, nfa, SEARCH_RE_OP_SPLIT, 0, x, next);
+		}
+		for (i = 0; i < nd->min && cur >= 0; i++)
+			cur = nfa_emit(ps, nfa, nd->a, cur);
+		return cur;
+	default:
+		return next;
+	}
+}
+
+/* Subset construction state */
+struct re_dfa {
+	const struct re_nfa *nfa;
+	const uint8_t (*set)[32];
+	uint32_t flags;
+	unsigned int n_classes;
+	uint8_t rep[256];	/* a byte of each class */
+	unsigned int match;	/* NFA match state */
+	unsigned int eol_match;	/* pseudo state: matched before a \n */
+
+	uint32_t *mark, gen;
+	uint32_t *stack;
+	uint32_t *list;
+	unsigned int n_list;
+
+	uint32_t *pool;		/* the NFA state sets of all DFA states */
+	size_t n_pool, max_pool;
+	size_t *set_off;
+	unsigned int *set_len;
+	uint32_t *trans;	/* DFA state ids */
+	unsigned int n, max;
+
+	unsigned int *hash;	/* DFA state id + 1, 0 is empty */
+	unsigned int hash_size;
+};
+
+static void dfa_closure(struct re_dfa *d, uint32_t s)
+{
+	const search_re_nfa_t *st = d->nfa->st;
+	unsigned int sp = 0;
+
+	d->stack[sp++] = s;
+	while (sp) {
+		s = d->stack[--sp];
+		if (d->mark[s] == d->gen)
+			continue;
+		d->mark[s] = d->gen;
+		if (st[s].op == SEARCH_RE_OP_SPLIT) {
+			d->stack[sp++] = st[s].out1;
+			d->stack[sp++] = st[s].out;
+		} else
+			d->list[d->n_list++] = s;
+	}
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t dfa_hash(const uint32_t *list, unsigned int n)
+{
+	uint32_t h = 2166136261u;
+
+	while (n--)
+		h = (h ^ *list++) * 16777619u;
+	return h;
+}
+
+static int dfa_grow(struct re_dfa *d)
+{
+	unsigned int max = d->max ? 2 * d->max : 256;
+	unsigned int i, k, *hash;
+	void *p;
+
+	if ((p = realloc(d->set_off, max * sizeof(*d->set_off))) == NULL)
+		return -1;
+	d->set_off = p;
+	if ((p = realloc(d->set_len, max * sizeof(*d->set_len))) == NULL)
+		return -1;
+	d->set_len = p;
+	p = realloc(d->trans, (size_t)max * d->n_classes * sizeof(*d->trans));
+	if (p == NULL)
+		return -1;
+	d->trans = p;
+	d->max = max;
+
+	/* keep the hash table at most half full */
+	hash = calloc(2 * max, sizeof(*hash));
+	if (hash == NULL)
+		return -1;
+	for (i = 0; i < d->n; i++) {
+		k = dfa_hash(d->pool + d->set_off[i], d->set_len[i]);
+		for (k &= 2 * max - 1; hash[k]; k = (k + 1) & (2 * max - 1))
+			;
+		hash[k] = i + 1;
+	}
+	free(d->hash);
+	d->hash = hash;
+	d->hash_size = 2 * max;
+	return 0;
+}
+
+/* DFA state for d->list, new if needed. -1 on errors, -2 on overflow. */
+static int dfa_state(struct re_dfa *d, unsigned int max_states)
+{
+	unsigned int k, id;
+
+	qsort(d->list, d->n_list, sizeof(*d->list), cmp_u32);
+	k = dfa_hash(d->list, d->n_list) & (d->hash_size - 1);
+	for (; d->hash[k]; k = (k + 1) & (d->hash_size - 1)) {
+		id = d->hash[k] - 1;
+		if (d->set_len[id] == d->n_list &&
+		    memcmp(d->pool + d->set_off[id], d->list,
+			   d->n_list * sizeof(*d->list)) == 0)
+			return id;
+	}
+
+	if (d->n == max_states ||
+	    (size_t)(d->n + 1) * d->n_classes * 4 > RE_TABLE_MAX)
+		return -2;
+	if (d->n_pool + d->n_list > d->max_pool) {
+		size_t max = 2 * (d->max_pool + d->n_list);
+		void *p = realloc(d->pool, max * sizeof(*d->pool));
+
+		if (p == NULL)
+			return -1;
+		d->pool = p;
+		d->max_pool = max;
+	}
+	if (d->n == d->max) {
+		if (dfa_grow(d) < 0)
+			return -1;
+		return dfa_state(d, max_states);	/* rehashed */
+	}
+
+	id = d->n++;
+	d->set_off[id] = d->n_pool;
+	d->set_len[id] = d->n_list;
+	memcpy(d->pool + d->n_pool, d->list, d->n_list * sizeof(*d->list));
+	d->n_pool += d->n_list;
+	d->hash[k] = id + 1;
+	return id;
+}
+
+static int dfa_accepts(const struct re_dfa *d, unsigned int id)
+{
+	const uint32_t *s = d->pool + d->set_off[id];
+	unsigned int i, m = (d->flags & SEARCH_RE_EOL) ?
+		d->eol_match : d->match;
+
+	for (i = 0; i < d->set_len[id]; i++)
+		if (s[i] == m)
+			return 1;
+	return 0;
+}
+
+static int dfa_build(struct re_dfa *d, unsigned int start,
+		     unsigned int max_states)
+{
+	const search_re_nfa_t *st = d->nfa->st;
+	unsigned int id, c, i;
+	int next;
+
+	d->gen++;
+	d->n_list = 0;
+	dfa_closure(d, start);
+	if (dfa_state(d, max_states) < 0)
+		return -1;
+
+	for (id = 0; id < d->n; id++) {
+		for (c = 0; c < d->n_classes; c++) {
+			const uint32_t *s = d->pool + d->set_off[id];
+			unsigned int n = d->set_len[id];
+			int newline = d->rep[c] == '\n';
+
+			d->gen++;
+			d->n_list = 0;
+			for (i = 0; i < n; i++) {
+				if (s[i] == d->eol_match)
+					continue;
+				if (st[s[i]].op == SEARCH_RE_OP_MATCH) {
+					if ((d->flags & SEARCH_RE_EOL) &&
+					    newline)
+						d->list[d->n_list++] =
+							d->eol_match;
+					continue;
+				}
+				if (search_re_set_has(d->set[st[s[i]].set],
+						      d->rep[c]))
+					dfa_closure(d, st[s[i]].out);
+			}
+			/* a new match may start behind each byte */
+			if (!(d->flags & SEARCH_RE_BOL) || newline)
+				dfa_closure(d, start);
+
+			next = dfa_state(d, max_states);
+			if (next < 0)
+				return next;
+			/* d->pool may have moved, s is not used anymore */
+			d->trans[id * d->n_classes + c] = next;
+		}
+	}
+	return 0;
+}
+
+/* Moore partition refinement, state 0 stays the start state */
+static const uint32_t *min_trans;
+static const unsigned int *min_block;
+static unsigned int min_classes;
+
+/* Compares the block of two states and of all their successors */
+static int min_sig_cmp(unsigned int x, unsigned int y)
+{
+	const uint32_t *tx = min_trans + (size_t)x * min_classes;
+	const uint32_t *ty = min_trans + (size_t)y * min_classes;
+	unsigned int c;
+
+	if (min_block[x] != min_block[y])
+		return min_block[x] < min_block[y] ? -1 : 1;
+	for (c = 0; c < min_classes; c++)
+		if (min_block[tx[c]] != min_block[ty[c]])
+			return min_block[tx[c]] < min_block[ty[c]] ? -1 : 1;
+	return 0;
+}
+
+static int min_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+	int rc = min_sig_cmp(x, y);
+
+	return rc ? rc : (x < y ? -1 : x > y);
+}
+
+static unsigned int dfa_minimize(struct re_dfa *d, unsigned int *block)
+{
+	unsigned int *idx, *nblock, i, n_blocks = 0, n_new, b0;
+
+	idx = malloc(d->n * sizeof(*idx));
+	nblock = malloc(d->n * sizeof(*nblock));
+	if (idx == NULL || nblock == NULL) {
+		free(idx);
+		free(nblock);
+		return 0;
+	}
+
+	for (i = 0; i < d->n; i++) {
+		block[i] = dfa_accepts(d, i);
+		idx[i] = i;
+	}
+	min_trans = d->trans;
+	min_classes = d->n_classes;
+	for (;;) {
+		min_block = block;
+		qsort(idx, d->n, sizeof(*idx), min_cmp);
+		for (n_new = 0, i = 0; i < d->n; i++) {
+			if (i && min_sig_cmp(idx[i - 1], idx[i]) != 0)
+				n_new++;
+			nblock[idx[i]] = n_new;
+		}
+		n_new++;
+		memcpy(block, nblock, d->n * sizeof(*block));
+		if (n_new == n_blocks)
+			break;
+		n_blocks = n_new;
+	}
+
+	/* renumber, such that the start state is block 0 */
+	b0 = block[0];
+	for (i = 0; i < d->n; i++) {
+		if (block[i] == b0)
+			block[i] = 0;
+		else if (block[i] == 0)
+			block[i] = b0;
+	}
+	free(idx);
+	free(nblock);
+	return n_blocks;
+}
+
+/* Splits the bytes into classes which no byte set tells apart */
+static unsigned int re_classes(const uint8_t (*set)[32], unsigned int n_set,
+			       uint32_t flags, uint8_t *classmap)
+{
+	uint8_t nl[32];
+	int map[2][256];
+	unsigned int i, c, n_classes = 1, n;
+	const uint8_t *s;
+
+	memset(nl, 0, sizeof(nl));
+	set_add(nl, '\n');
+	memset(classmap, 0, 256);
+	for (i = 0; i <= n_set; i++) {
+		if (i < n_set)
+			s = set[i];
+		else if (flags & (SEARCH_RE_BOL | SEARCH_RE_EOL))
+			s = nl;
+		else
+			break;
+
+		memset(map, 0xff, sizeof(map));
+		for (n = 0, c = 0; c < 256; c++) {
+			int in = search_re_set_has(s, c);
+
+			if (map[in][classmap[c]] < 0)
+				map[in][classmap[c]] = n++;
+			classmap[c] = map[in][classmap[c]];
+		}
+		n_classes = n;
+	}
+	return n_classes;
+}
+
+static void re_dfa_free(struct re_dfa *d)
+{
+	free(d->mark);
+	free(d->stack);
+	free(d->list);
+	free(d->pool);
+	free(d->set_off);
+	free(d->set_len);
+	free(d->trans);
+	free(d->hash);
+}
+
+static search_re_t *re_image(const struct re_dfa *d, const unsigned int *block,
+			     unsigned int n_blocks)
+{
+	search_re_t *re;
+	uint32_t *trans;
+	size_t size;
+	unsigned int i, c, b;
+
+	size = sizeof(*re) + (size_t)n_blocks * d->n_classes * sizeof(*trans);
+	re = calloc(1, size);
+	if (re == NULL)
+		return NULL;
+	re->magic = SEARCH_RE_MAGIC;
+	re->n_states = n_blocks;
+	re->n_classes = d->n_classes;
+	re->size = size;
+
+	trans = (uint32_t *)(re + 1);
+	for (i = 0; i < d->n; i++) {
+		b = block[i];
+		for (c = 0; c < d->n_classes; c++) {
+			unsigned int t = d->trans[i * d->n_classes + c];
+
+			trans[b * d->n_classes + c] = block[t] * d->n_classes |
+				(dfa_accepts(d, t) ? SEARCH_DFA_MATCH : 0);
+		}
+	}
+	return re;
+}
+
+static search_re_t *re_image_nfa(const struct re_nfa *nfa,
+				 const uint8_t (*set)[32], unsigned int n_set,
+				 unsigned int start)
+{
+	search_re_t *re;
+	size_t size;
+
+	size = sizeof(*re) + nfa->n * sizeof(*nfa->st) + n_set * 32;
+	size = (size + 7) & ~7ul;
+	re = calloc(1, size);
+	if (re == NULL)
+		return NULL;
+	re->magic = SEARCH_RE_MAGIC;
+	re->flags = SEARCH_RE_NFA;
+	re->n_classes = 1;
+	re->n_nfa = nfa->n;
+	re->n_sets = n_set;
+	re->nfa_start = start;
+	re->size = size;
+	memcpy((void *)search_re_nfa(re), nfa->st, nfa->n * sizeof(*nfa->st));
+	memcpy((void *)search_re_sets(re), set, n_set * 32);
+	return re;
+}
+
+/*
+ * Compiles expr into a search_re image, NULL on errors. The DFA gets at
+ * most max_states states before minimization, bigger ones fall back to
+ * the NFA on lines holding the required literal.
+ */
+search_re_t *search_re_compile(const char *expr, unsigned int max_states,
+			       struct search_re_stats *stats)
+{
+	struct re_parser ps;
+	struct re_nfa nfa;
+	struct re_dfa d;
+	search_re_t *re = NULL;
+	char *body = NULL;
+	unsigned int *block = NULL, n_blocks, i, len;
+	uint8_t literal[SEARCH_RE_LIT_MAX];
+	uint8_t classmap[256];
+	uint32_t flags = 0;
+	int root, match, start, prefix, rc, parsed = 0;
+
+	memset(&ps, 0, sizeof(ps));
+	memset(&nfa, 0, sizeof(nfa));
+	memset(&d, 0, sizeof(d));
+	memset(stats, 0, sizeof(*stats));
+	if (max_states == 0)
+		max_states = 1;
+
+	/* anchors, a trailing \$ is a literal */
+	if (*expr == '^') {
+		flags |= SEARCH_RE_BOL;
+		expr++;
+	}
+	body = strdup(expr);
+	if (body == NULL)
+		return NULL;
+	len = strlen(body);
+	if (len && body[len - 1] == '$') {
+		for (i = len - 1; i > 0 && body[i - 1] == '\\'; i--)
+			;
+		if ((len - 1 - i) % 2 == 0) {
+			flags |= SEARCH_RE_EOL;
+			body[--len] = '\0';
+		}
+	}
+
+	ps.p = body;
+	root = re_parse_alt(&ps);
+	if (root >= 0 && *ps.p != '\0') {
+		ps.err = "unmatched )";
+		root = -1;
+	}
+	if (root < 0)
+		goto out_err;
+	parsed = 1;
+
+	match = nfa_new(&ps, &nfa, SEARCH_RE_OP_MATCH, 0, 0, 0);
+	start = nfa_emit(&ps, &nfa, root, match);
+	if (start < 0)
+		goto out_err;
+	stats->nfa_states = nfa.n;
+
+	d.nfa = &nfa;
+	d.set = (const uint8_t (*)[32])ps.set;
+	d.flags = flags;
+	d.match = match;
+	d.eol_match = nfa.n;
+	d.n_classes = re_classes(d.set, ps.n_set, flags, classmap);
+	for (i = 256; i-- > 0; )
+		d.rep[classmap[i]] = i;
+	d.mark = calloc(nfa.n + 1, sizeof(*d.mark));
+	d.stack = malloc(2 * (nfa.n + 1) * sizeof(*d.stack));
+	d.list = malloc((nfa.n + 1) * sizeof(*d.list));
+	if (d.mark == NULL || d.stack == NULL || d.list == NULL ||
+	    dfa_grow(&d) < 0) {
+		ps.err = "out of memory";
+		goto out_err;
+	}
+
+	rc = dfa_build(&d, start, max_states);
+	if (rc == -1) {
+		ps.err = "out of memory";
+		goto out_err;
+	}
+	stats->dfa_states = d.n;
+	/* DFA state 0 is the closure of the NFA start */
+	for (i = 0; i < d.set_len[0]; i++) {
+		if (d.pool[d.set_off[0] + i] == (uint32_t)match) {
+			ps.err = "expression matches the empty string";
+			goto out_err;
+		}
+	}
+
+	len = re_literal(&ps, root, literal, &prefix);
+	if (rc == 0) {
+		block = malloc(d.n * sizeof(*block));
+		n_blocks = block ? dfa_minimize(&d, block) : 0;
+		if (n_blocks == 0) {
+			ps.err = "out of memory";
+			goto out_err;
+		}
+		re = re_image(&d, block, n_blocks);
+		if (re)
+			memcpy(re->classmap, classmap, sizeof(classmap));
+	} else {
+		/* too many states: literal prefilter and NFA per line */
+		for (i = 0; i < ps.n_set; i++)
+			if (search_re_set_has(ps.set[i], '\n'))
+				break;
+		if (len == 0 || i < ps.n_set) {
+			fprintf(stderr, "err: regex needs more than %u DFA "
+				"states and has no literal to prefilter "
+				"lines\n", max_states);
+			goto out;
+		}
+		re = re_image_nfa(&nfa, (const uint8_t (*)[32])ps.set,
+				  ps.n_set, start);
+	}
+	if (re == NULL) {
+		ps.err = "out of memory";
+		goto out_err;
+	}
+	re->flags |= flags;
+	re->lit_len = len;
+	memcpy(re->literal, literal, len);
+	if (prefix)
+		re->flags |= SEARCH_RE_PREFIX;
+	goto out;
+
+ out_err:
+	if (parsed)
+		fprintf(stderr, "err: regex: %s\n", ps.err);
+	else
+		fprintf(stderr, "err: regex: %s at offset %d\n", ps.err,
+			(int)(ps.p - body) +
+			((flags & SEARCH_RE_BOL) ? 1 : 0));
+ out:
+	re_dfa_free(&d);
+	free(block);
+	free(nfa.st);
+	free(ps.node);
+	free(ps.set);
+	free(body);
+	return re;
+}
@@ -84,6 +84,978 @@ file_read(const char *fname, uint8_t *buff, size_t len)
 	return rc;
 }
 
+/* Pattern set for AC_method, one pattern per line in a file */
+struct search_patterns {
+	unsigned int n;
+	char **pat;
+	unsigned int *len;
+	char *buf;		/* file content, NULL for a single pattern */
+};
+
+static void patterns_free(struct search_patterns *p)
+{
+	free(p->pat);
+	free(p->len);
+	free(p->buf);
+	memset(p, 0, sizeof(*p));
+}
+
+static int patterns_alloc(struct search_patterns *p, unsigned int n)
+{
+	p->pat = malloc(n * sizeof(*p->pat));
+	p->len = malloc(n * sizeof(*p->len));
+	if (p->pat == NULL || p->len == NULL) {
+		patterns_free(p);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/* Empty lines are skipped, a trailing '\r' is not part of the pattern */
+static int patterns_load(struct search_patterns *p, const char *fname)
+{
+	ssize_t size;
+	unsigned int lines = 0;
+	char *line, *end;
+
+	memset(p, 0, sizeof(*p));
+	size = file_size(fname);
+	if (size <= 0)
+		return -EINVAL;
+
+	p->buf = malloc(size + 1);
+	if (p->buf == NULL)
+		return -ENOMEM;
+	if (file_read(fname, (uint8_t *)p->buf, size) < 0) {
+		patterns_free(p);
+		return -EIO;
+	}
+	p->buf[size] = '\n';
+
+	for (line = p->buf; line < p->buf + size; line++)
+		if (*line == '\n')
+			lines++;
+	if (patterns_alloc(p, lines + 1) != 0)
+		return -ENOMEM;
+
+	for (line = p->buf; line < p->buf + size; line = end + 1) {
+		end = memchr(line, '\n', p->buf + size + 1 - line);
+		if (end > line && end[-1] == '\r')
+			end[-1] = '\0';
+		*end = '\0';
+		if (*line == '\0')
+			continue;
+
+		p->pat[p->n] = line;
+		p->len[p->n] = strlen(line);
+		p->n++;
+	}
+	if (p->n == 0) {
+		fprintf(stderr, "err: no patterns in %s\n", fname);
+		patterns_free(p);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Compile a pattern set into the search_dfa image used by AC_method.
+ *
+ * Bytes which do not occur in any pattern always lead back to the
+ * root and share class 0, every other byte gets a class of its own.
+ * The trie is built over those classes, then a breadth first pass sets
+ * the failure links and turns it into a complete DFA. The output list
+ * of a state is its own patterns plus the list of its failure state,
+ * so the matcher never walks failure links.
+ *
+ * Returns a snap_malloc'ed image, which can be shipped in the job as is.
+ */
+static search_dfa_t *search_dfa_compile(struct search_patterns *p)
+{
+	search_dfa_t *dfa = NULL;
+	uint8_t classmap[256];
+	unsigned int i, j, c, u, v, q, qt;
+	unsigned int C = 1, n_states = 1, n_out = 0;
+	unsigned long long max_states = 1, size;
+	uint32_t *go = NULL, *fail = NULL, *head = NULL, *link = NULL;
+	uint32_t *own = NULL, *outcnt = NULL, *queue = NULL;
+	uint32_t *trans, *out_idx, *out, *pat_len;
+
+	memset(classmap, 0, sizeof(classmap));
+	for (i = 0; i < p->n; i++) {
+		for (j = 0; j < p->len[i]; j++) {
+			uint8_t b = p->pat[i][j];
+
+			if (classmap[b] == 0 && C < 256)
+				classmap[b] = C++;
+			else if (classmap[b] == 0)
+				C = 257;	/* all bytes used */
+		}
+		max_states += p->len[i];
+	}
+	if (C > 256) {			/* no class left for "other" */
+		for (i = 0; i < 256; i++)
+			classmap[i] = i;
+		C = 256;
+	}
+	if (max_states * C >= SEARCH_DFA_MATCH) {
+		fprintf(stderr, "err: pattern set too large (%llu states)\n",
+			max_states);
+		return NULL;
+	}
+
+	go     = calloc(max_states * C, sizeof(*go));
+	fail   = calloc(max_states, sizeof(*fail));
+	head   = calloc(max_states, sizeof(*head));
+	own    = calloc(max_states, sizeof(*own));
+	outcnt = calloc(max_states, sizeof(*outcnt));
+	queue  = calloc(max_states, sizeof(*queue));
+	link   = calloc(p->n, sizeof(*link));
+	if (!go || !fail || !head || !own || !outcnt || !queue || !link)
+		goto out_free;
+
+	/* trie, go[] == 0 means no child since the root is nobody's child */
+	for (i = 0; i < p->n; i++) {
+		u = 0;
+		for (j = 0; j < p->len[i]; j++) {
+			c = classmap[(uint8_t)p->pat[i][j]];
+			if (go[u * C + c] == 0)
+				go[u * C + c] = n_states++;
+			u = go[u * C + c];
+		}
+		link[i] = head[u];	/* pattern ids + 1, 0 ends the list */
+		head[u] = i + 1;
+		own[u]++;
+	}
+
+	/* failure links and missing transitions, breadth first */
+	queue[0] = 0;
+	for (q = 0, qt = 1; q < qt; q++) {
+		u = queue[q];
+		outcnt[u] = own[u] + (u ? outcnt[fail[u]] : 0);
+		n_out += outcnt[u];
+
+		for (c = 0; c < C; c++) {
+			v = go[u * C + c];
+			if (v) {
+				fail[v] = u ? go[fail[u] * C + c] : 0;
+				queue[qt++] = v;
+			} else
+				go[u * C + c] = u ? go[fail[u] * C + c] : 0;
+		}
+	}
+
+	size = sizeof(*dfa) + sizeof(uint32_t) *
+		((unsigned long long)n_states * C + n_states + 1 +
+		 n_out + p->n);
+	if (size > UINT32_MAX) {
+		fprintf(stderr, "err: automaton too large (%llu bytes)\n",
+			size);
+		goto out_free;
+	}
+	dfa = snap_malloc(size);
+	if (dfa == NULL)
+		goto out_free;
+
+	dfa->magic = SEARCH_DFA_MAGIC;
+	dfa->n_states = n_states;
+	dfa->n_classes = C;
+	dfa->n_patterns = p->n;
+	dfa->n_out = n_out;
+	dfa->size = size;
+	memcpy(dfa->classmap, classmap, sizeof(classmap));
+
+	trans   = (uint32_t *)search_dfa_trans(dfa);
+	out_idx = (uint32_t *)search_dfa_out_idx(dfa);
+	out     = (uint32_t *)search_dfa_out(dfa);
+	pat_len = (uint32_t *)search_dfa_pat_len(dfa);
+
+	for (u = 0; u < n_states; u++) {
+		for (c = 0; c < C; c++) {
+			v = go[u * C + c];
+			trans[u * C + c] = v * C |
+				(outcnt[v] ? SEARCH_DFA_MATCH : 0);
+		}
+	}
+
+	/* failure states come first in BFS order, so their list is ready */
+	out_idx[0] = 0;
+	for (u = 0; u < n_states; u++)
+		out_idx[u + 1] = out_idx[u] + outcnt[u];
+	for (q = 0; q < n_states; q++) {
+		u = queue[q];
+		j = out_idx[u];
+		for (i = head[u]; i != 0; i = link[i - 1])
+			out[j++] = i - 1;
+		if (u != 0)
+			memcpy(&out[j], &out[out_idx[fail[u]]],
+			       outcnt[fail[u]] * sizeof(*out));
+	}
+	for (i = 0; i < p->n; i++)
+		pat_len[i] = p->len[i];
+
+ out_free:
+	free(go);
+	free(fail);
+	free(head);
+	free(own);
+	free(outcnt);
+	free(queue);
+	free(link);
+	return dfa;
+}
+
+/*
+ * Query table for BATCH_method: the patterns, one offset page of
+ * page_items per query in the result, and their AC automaton such
+ * that one scan of the text serves all queries.
+ */
+static search_batch_t *search_batch_build(struct search_patterns *p,
+					  unsigned int page_items)
+{
+	search_batch_t *batch;
+	search_batch_query_t *query;
+	search_dfa_t *dfa;
+	unsigned long long size;
+	unsigned int i, pos;
+
+	if (p->n > SEARCH_BATCH_MAX) {
+		fprintf(stderr, "err: at most %u queries per batch\n",
+			SEARCH_BATCH_MAX);
+		return NULL;
+	}
+	dfa = search_dfa_compile(p);
+	if (dfa == NULL)
+		return NULL;
+
+	size = sizeof(*batch) + p->n * sizeof(*query);
+	for (i = 0; i < p->n; i++)
+		size += p->len[i];
+	size = ((size + 7) & ~7ull) + dfa->size;
+	if (size > UINT32_MAX) {
+		fprintf(stderr, "err: query table too large\n");
+		__free(dfa);
+		return NULL;
+	}
+	batch = snap_malloc(size);
+	if (batch == NULL) {
+		__free(dfa);
+		return NULL;
+	}
+
+	batch->magic = SEARCH_BATCH_MAGIC;
+	batch->n_queries = p->n;
+	batch->page_items = page_items;
+	batch->size = size;
+	batch->reserved = 0;
+	query = (search_batch_query_t *)search_batch_query(batch);
+	pos = sizeof(*batch) + p->n * sizeof(*query);
+	for (i = 0; i < p->n; i++) {
+		query[i].offset = pos;
+		query[i].len = p->len[i];
+		memcpy((uint8_t *)batch + pos, p->pat[i], p->len[i]);
+		pos += p->len[i];
+	}
+	batch->dfa_offset = (pos + 7) & ~7u;
+	memcpy((uint8_t *)batch + batch->dfa_offset, dfa, dfa->size);
+	__free(dfa);
+	return batch;
+}
+
+/*
+ * Multi-pattern benchmark on the host: n random substrings of the text
+ * (4..16 bytes) are searched in one AC pass. KMP, one pass per pattern,
+ * checks the counts of up to 100 patterns; its time for the full set
+ * is extrapolated from those.
+ */
+#define AC_BENCH_BYTES (64ull * 1024 * 1024)	/* scanned per set */
+#define AC_BENCH_KMP_MAX 100
+
+static int search_ac_bench(char *text, size_t text_size)
+{
+	static const unsigned int sets[] = { 1, 10, 100, 1000, 10000 };
+	struct search_patterns p;
+	struct timeval etime, stime;
+	unsigned int i, s, l, loops, found, checked;
+	unsigned int seed = 42;
+	uint32_t *counts;
+	search_dfa_t *dfa;
+	long long c_usec, ac_usec, kmp_usec;
+	double mib;
+
+	if (text_size < 64) {
+		fprintf(stderr, "err: text too small for benchmark\n");
+		return -1;
+	}
+	loops = MAX(1ull, AC_BENCH_BYTES / text_size);
+	mib = (double)text_size * loops / (1024 * 1024);
+
+	printf("Aho-Corasick benchmark: %zu bytes text, %u loops\n"
+	       "%8s %10s %9s %7s %10s %10s %12s %10s\n",
+	       text_size, loops, "patterns", "compile", "states",
+	       "classes", "KiB", "AC MiB/s", "KMP MiB/s", "matches");
+
+	for (s = 0; s < ARRAY_SIZE(sets); s++) {
+		memset(&p, 0, sizeof(p));
+		if (patterns_alloc(&p, sets[s]) != 0)
+			return -1;
+		p.n = sets[s];
+		for (i = 0; i < p.n; i++) {
+			p.len[i] = 4 + rand_r(&seed) % 13;
+			p.pat[i] = text + rand_r(&seed) %
+				(text_size - p.len[i]);
+		}
+
+		gettimeofday(&stime, NULL);
+		dfa = search_dfa_compile(&p);
+		gettimeofday(&etime, NULL);
+		c_usec = timediff_usec(&etime, &stime);
+		if (dfa == NULL) {
+			patterns_free(&p);
+			return -1;
+		}
+
+		counts = calloc(p.n, sizeof(*counts));
+		if (counts == NULL) {
+			__free(dfa);
+			patterns_free(&p);
+			return -1;
+		}
+
+		found = 0;
+		gettimeofday(&stime, NULL);
+		for (l = 0; l < loops; l++)
+			found = AC_search(dfa, text, text_size, counts,
+					  NULL, 0);
+		gettimeofday(&etime, NULL);
+		ac_usec = MAX(1ll, timediff_usec(&etime, &stime));
+
+		checked = MIN(p.n, (unsigned int)AC_BENCH_KMP_MAX);
+		gettimeofday(&stime, NULL);
+		for (i = 0; i < checked; i++) {
+			int kmp = KMP_search(p.pat[i], p.len[i],
+					     text, text_size);
+
+			if ((unsigned int)kmp * loops != counts[i]) {
+				fprintf(stderr, "err: pattern %u: AC %u, "
+					"KMP %d matches\n", i,
+					counts[i] / loops, kmp);
+				free(counts);
+				__free(dfa);
+				patterns_free(&p);
+				return -1;
+			}
+		}
+		gettimeofday(&etime, NULL);
+		kmp_usec = MAX(1ll, timediff_usec(&etime, &stime) *
+			       p.n / checked);
+
+		printf("%8u %8lldus %9u %7u %10.1f %10.1f %12.3f %10u\n",
+		       p.n, c_usec, dfa->n_states, dfa->n_classes,
+		       dfa->size / 1024.0, mib * 1000000 / ac_usec,
+		       (double)text_size * 1000000 / (1024 * 1024) / kmp_usec,
+		       found);
+
+		free(counts);
+		__free(dfa);
+		patterns_free(&p);
+	}
+	return 0;
+}
+
+/*
+ * Batch benchmark on the host: sets of 50 to 500 queries, random
+ * substrings of the text, in one BATCH_method scan against one Naive
+ * scan per query as separate jobs would do. Counts and the offset
+ * pages must match.
+ */
+#define BATCH_BENCH_ITEMS 16
+
+static int search_batch_bench(char *text, size_t text_size)
+{
+	static const unsigned int sets[] = { 50, 100, 200, 500 };
+	struct search_patterns p;
+	struct timeval etime, stime;
+	search_batch_t *batch;
+	search_batch_result_t *res = NULL;
+	uint64_t *pages = NULL, offs[BATCH_BENCH_ITEMS];
+	unsigned int i, s, found, seed = 42;
+	unsigned long long n;
+	long long b_usec, q_usec;
+	int rc = 0;
+
+	if (text_size < 64) {
+		fprintf(stderr, "err: text too small for benchmark\n");
+		return -1;
+	}
+	printf("Batch benchmark: %zu bytes text, %u offsets per query\n"
+	       "%8s %12s %12s %12s %8s %10s\n", text_size, BATCH_BENCH_ITEMS,
+	       "queries", "batch usec", "usec/query", "single usec",
+	       "speedup", "matches");
+
+	for (s = 0; s < ARRAY_SIZE(sets) && rc == 0; s++) {
+		memset(&p, 0, sizeof(p));
+		if (patterns_alloc(&p, sets[s]) != 0)
+			return -1;
+		p.n = sets[s];
+		for (i = 0; i < p.n; i++) {
+			p.len[i] = 4 + rand_r(&seed) % 13;
+			p.pat[i] = text + rand_r(&seed) %
+				(text_size - p.len[i]);
+		}
+		batch = search_batch_build(&p, BATCH_BENCH_ITEMS);
+		res = calloc(p.n, sizeof(*res));
+		pages = calloc(p.n * BATCH_BENCH_ITEMS, sizeof(*pages));
+		if (batch == NULL || res == NULL || pages == NULL) {
+			rc = -1;
+			goto next;
+		}
+
+		gettimeofday(&stime, NULL);
+		found = AC_search_pages(search_batch_dfa(batch), text,
+					text_size, res, pages,
+					BATCH_BENCH_ITEMS);
+		gettimeofday(&etime, NULL);
+		b_usec = MAX(1ll, timediff_usec(&etime, &stime));
+
+		gettimeofday(&stime, NULL);
+		for (i = 0; i < p.n; i++) {
+			n = search_mt(NAIVE_method, p.pat[i], p.len[i], text,
+				      text_size, 1, offs, BATCH_BENCH_ITEMS);
+			if (n != res[i].count ||
+			    memcmp(offs, &pages[i * BATCH_BENCH_ITEMS],
+				   res[i].n_offs * sizeof(*offs)) != 0) {
+				fprintf(stderr, "err: query %u \"%.*s\": batch "
+					"%u, single %llu matches or offsets "
+					"differ\n", i, (int)p.len[i], p.pat[i],
+					res[i].count, n);
+				rc = -1;
+				goto next;
+			}
+		}
+		gettimeofday(&etime, NULL);
+		q_usec = MAX(1ll, timediff_usec(&etime, &stime));
+
+		printf("%8u %12lld %12.1f %12lld %8.1f %10u\n", p.n, b_usec,
+		       (double)b_usec / p.n, q_usec,
+		       (double)q_usec / b_usec, found);
+	next:
+		free(pages);
+		free(res);
+		__free(batch);
+		patterns_free(&p);
+	}
+	return rc;
+}
+
+/*
+ * SIMD_method benchmark: the input is repeated up to 64 MiB and patterns
+ * of 1..64 bytes are cut out of it. Every variant the CPU supports is
+ * checked against KMP.
+ */
+#define SIMD_BENCH_BYTES (64 * 1024 * 1024)
+
+static int search_simd_bench(const char *text, size_t text_size)
+{
+	static const int lens[] = { 1, 2, 3, 4, 8, 16, 32, 64 };
+	const struct simd_search_impl *impl;
+	struct timeval etime, stime;
+	char pat[64 + 1];	/* KMP reads one byte beyond */
+	unsigned int seed = 42;
+	unsigned int l;
+	size_t size, i;
+	char *buf;
+	int kmp;
+
+	buf = malloc(SIMD_BENCH_BYTES);
+	if (buf == NULL)
+		return -1;
+	for (i = 0; i < SIMD_BENCH_BYTES; i += size) {
+		size = MIN(text_size, SIMD_BENCH_BYTES - i);
+		memcpy(buf + i, text, size);
+	}
+	size = SIMD_BENCH_BYTES;
+
+	printf("SIMD search benchmark: %zu bytes, GB/s\n%4s %8s",
+	       size, "len", "kmp");
+	for (impl = simd_search_impls; impl->name; impl++)
+		if (impl->supported())
+			printf(" %8s", impl->name);
+	printf(" %10s\n", "matches");
+
+	for (l = 0; l < ARRAY_SIZE(lens); l++) {
+		long long usec;
+
+		if ((size_t)lens[l] > text_size)
+			break;
+		memcpy(pat, text + rand_r(&seed) % (text_size - lens[l] + 1),
+		       lens[l]);
+		pat[lens[l]] = 0;
+
+		gettimeofday(&stime, NULL);
+		kmp = KMP_search(pat, lens[l], buf, size);
+		gettimeofday(&etime, NULL);
+		usec = MAX(1ll, timediff_usec(&etime, &stime));
+		printf("%4d %8.2f", lens[l], (double)size / usec / 1000);
+
+		for (impl = simd_search_impls; impl->name; impl++) {
+			int n;
+
+			if (!impl->supported())
+				continue;
+			gettimeofday(&stime, NULL);
+			n = impl->search(pat, lens[l], buf, size, NULL, 0);
+			gettimeofday(&etime, NULL);
+			usec = MAX(1ll, timediff_usec(&etime, &stime));
+			if (n != kmp) {
+				fprintf(stderr, "\nerr: %s found %d, KMP %d "
+					"matches of \"%s\"\n", impl->name,
+					n, kmp, pat);
+				free(buf);
+				return -1;
+			}
+			printf(" %8.2f", (double)size / usec / 1000);
+		}
+		printf(" %10d\n", kmp);
+	}
+	free(buf);
+	return 0;
+}
+
+/*
+ * REGEX_method benchmark: the input is repeated up to 64 MiB and run
+ * through the minimized DFA and through the literal prefiltered NFA
+ * fallback, which have to agree.
+ */
+#define RE_BENCH_BYTES (64 * 1024 * 1024)
+
+static int search_re_bench(const char *text, size_t text_size,
+			   const char *expr, unsigned int max_states)
+{
+	static const char *engine[] = { "DFA", "NFA" };
+	struct search_re_stats stats;
+	struct timeval etime, stime;
+	search_re_t *re;
+	unsigned int e, n, ref = 0;
+	int have_ref = 0;
+	long long cusec, usec;
+	size_t size, i;
+	char *buf;
+
+	buf = malloc(RE_BENCH_BYTES);
+	if (buf == NULL)
+		return -1;
+	for (i = 0; i < RE_BENCH_BYTES; i += size) {
+		size = MIN(text_size, RE_BENCH_BYTES - i);
+		memcpy(buf + i, text, size);
+	}
+	size = RE_BENCH_BYTES;
+
+	printf("REGEX search benchmark: \"%s\", %zu bytes\n"
+	       "%6s %8s %8s %10s %10s %10s %8s\n", expr, size, "engine",
+	       "states", "classes", "table", "compile", "Mmatch/s", "MB/s");
+	for (e = 0; e < ARRAY_SIZE(engine); e++) {
+		/* a limit of one state forces the NFA fallback */
+		gettimeofday(&stime, NULL);
+		re = search_re_compile(expr, e ? 1 : max_states, &stats);
+		gettimeofday(&etime, NULL);
+		cusec = timediff_usec(&etime, &stime);
+		if (re == NULL && e == 0) {
+			free(buf);
+			return -1;
+		}
+		if (re == NULL)
+			continue;
+		if (!(re->flags & SEARCH_RE_NFA) != !e) {
+			printf("%6s DFA with %u states over the limit\n",
+			       engine[e], stats.dfa_states);
+			free(re);
+			continue;
+		}
+
+		gettimeofday(&stime, NULL);
+		n = RE_search(re, buf, size, NULL, 0);
+		gettimeofday(&etime, NULL);
+		usec = MAX(1ll, timediff_usec(&etime, &stime));
+		printf("%6s %8u %8u %10lu %8lldus %10.3f %8.1f\n", engine[e],
+		       e ? re->n_nfa : re->n_states, re->n_classes,
+		       (unsigned long)(re->size - sizeof(*re)), cusec,
+		       (double)n / usec, (double)size / usec);
+		free(re);
+
+		if (have_ref && n != ref) {
+			fprintf(stderr, "err: NFA found %u, DFA %u matches\n",
+				n, ref);
+			free(buf);
+			return -1;
+		}
+		ref = n;
+		have_ref = 1;
+	}
+	printf("%u matches\n", ref);
+	free(buf);
+	return 0;
+}
+
+/*
+ * SHIFTAND_method and MYERS_method test and benchmark: patterns cut out
+ * of the input get k random substitutions and, for the case folding
+ * runs, random case flips. The first APPROX_CHECK_BYTES of the input are
+ * compared against the plain dynamic programming definitions, then the
+ * input is repeated up to 16 MiB to measure the throughput.
+ */
+#define APPROX_BENCH_BYTES (16 * 1024 * 1024)
+#define APPROX_CHECK_BYTES (256 * 1024)
+#define APPROX_CHECK_OFFS  4096
+
+static inline int approx_eq(char a, char b, int nocase)
+{
+	return nocase ? tolower((uint8_t)a) == tolower((uint8_t)b) : a == b;
+}
+
+/* Windows with at most k mismatches, by start */
+static int hamming_ref(const char *pat, int M, const char *txt, int N,
+		       unsigned int k, int nocase, uint64_t *offs)
+{
+	int i, j, count = 0;
+	unsigned int d;
+
+	for (j = 0; j + M <= N; j++) {
+		for (d = 0, i = 0; i < M && d <= k; i++)
+			d += !approx_eq(pat[i], txt[j + i], nocase);
+		if (d <= k) {
+			if (count < APPROX_CHECK_OFFS)
+				offs[count] = j;
+			count++;
+		}
+	}
+	return count;
+}
+
+/* Substrings within edit distance k, by end (Sellers) */
+static int edit_ref(const char *pat, int M, const char *txt, int N,
+		    unsigned int k, int nocase, uint64_t *offs)
+{
+	unsigned int col[64 + 1], diag, up;
+	int i, j, count = 0;
+
+	for (i = 0; i <= M; i++)
+		col[i] = i;
+	for (j = 0; j < N; j++) {
+		diag = col[0];	/* a match may start anywhere */
+		for (i = 1; i <= M; i++) {
+			up = col[i];
+			col[i] = MIN(MIN(col[i] + 1, col[i - 1] + 1),
+				     diag + !approx_eq(pat[i - 1], txt[j],
+						       nocase));
+			diag = up;
+		}
+		if (col[M] <= k) {
+			if (count < APPROX_CHECK_OFFS)
+				offs[count] = j + 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+static int search_approx_bench(const char *text, size_t text_size)
+{
+	static const int lens[] = { 4, 8, 16, 32, 64 };
+	static const unsigned int ks[] = { 0, 1, 2, 4 };
+	struct timeval etime, stime;
+	uint64_t *ref, *offs;
+	char pat[64 + 1];
+	unsigned int seed = 42, k, l, nocase, i;
+	size_t size, check = MIN(text_size, (size_t)APPROX_CHECK_BYTES);
+	long long usec[2];
+	int n[2], r[2], m;
+	char *buf;
+
+	buf = malloc(APPROX_BENCH_BYTES);
+	ref = malloc(2 * APPROX_CHECK_OFFS * sizeof(*ref));
+	if (buf == NULL || ref == NULL) {
+		free(buf);
+		free(ref);
+		return -1;
+	}
+	offs = ref + APPROX_CHECK_OFFS;
+	for (i = 0; i < APPROX_BENCH_BYTES; i += size) {
+		size = MIN(text_size, APPROX_BENCH_BYTES - i);
+		memcpy(buf + i, text, size);
+	}
+	size = APPROX_BENCH_BYTES;
+
+	printf("Approximate search benchmark: %zu bytes, GB/s\n"
+	       "%4s %3s %6s %9s %9s %10s %10s\n", size, "len", "k",
+	       "nocase", "shiftand", "myers", "hamming", "edit");
+	for (l = 0; l < ARRAY_SIZE(lens); l++) {
+		if ((size_t)lens[l] > text_size)
+			break;
+		for (k = 0; k < ARRAY_SIZE(ks); k++)
+		for (nocase = 0; nocase < 2; nocase++) {
+			if (ks[k] >= (unsigned int)lens[l])
+				continue;
+			memcpy(pat, text + rand_r(&seed) %
+			       (text_size - lens[l] + 1), lens[l]);
+			for (i = 0; i < ks[k]; i++)
+				pat[rand_r(&seed) % lens[l]] =
+					'a' + rand_r(&seed) % 26;
+			for (i = 0; nocase && i < (unsigned int)lens[l]; i++)
+				if (rand_r(&seed) & 1)
+					pat[i] ^= isalpha((uint8_t)pat[i]) ?
+						0x20 : 0;
+			pat[lens[l]] = 0;
+
+			for (m = 0; m < 2; m++) {
+				int (*search)(char *, int, char *, int,
+					      unsigned int, int, uint64_t *,
+					      unsigned int) =
+					m ? Myers_search_pos :
+					ShiftAnd_search_pos;
+
+				r[m] = (m ? edit_ref : hamming_ref)(pat,
+					lens[l], text, check, ks[k], nocase,
+					ref);
+				n[m] = search(pat, lens[l], (char *)text,
+					      check, ks[k], nocase, offs,
+					      APPROX_CHECK_OFFS);
+				if (n[m] != r[m] || memcmp(offs, ref,
+				    MIN(n[m], APPROX_CHECK_OFFS) *
+				    sizeof(*offs)) != 0) {
+					fprintf(stderr, "\nerr: %s found %d, "
+						"reference %d matches of "
+						"\"%s\" k=%u nocase=%u\n",
+						m ? "myers" : "shiftand",
+						n[m], r[m], pat, ks[k],
+						nocase);
+					free(buf);
+					free(ref);
+					return -1;
+				}
+
+				gettimeofday(&stime, NULL);
+				n[m] = search(pat, lens[l], buf, size, ks[k],
+					      nocase, NULL, 0);
+				gettimeofday(&etime, NULL);
+				usec[m] = MAX(1ll, timediff_usec(&etime,
+								 &stime));
+			}
+			printf("%4d %3u %6u %9.2f %9.2f %10d %10d\n",
+			       lens[l], ks[k], nocase,
+			       (double)size / usec[0] / 1000,
+			       (double)size / usec[1] / 1000, n[0], n[1]);
+		}
+	}
+	free(buf);
+	free(ref);
+	return 0;
+}
+
+/*
+ * Scaling benchmark for the chunked parallel search: the input is
+ * repeated up to 1 GiB and searched with 1, 2, 4, ... threads. Counts
+ * and offsets must match the single thread run.
+ */
+#define MT_BENCH_BYTES (1024ul * 1024 * 1024)
+#define MT_BENCH_OFFS  (1024 * 1024)
+
+static int search_mt_bench(unsigned int method, const char *text,
+			   size_t text_size, char *pattern,
+			   unsigned int psize, unsigned int threads)
+{
+	struct timeval etime, stime;
+	unsigned long long count, ref = 0;
+	uint64_t *offs, *ref_offs;
+	long long usec, ref_usec = 1;
+	unsigned int t;
+	size_t size, i;
+	char *buf;
+	int rc = 0;
+
+	buf = malloc(MT_BENCH_BYTES);
+	offs = malloc(MT_BENCH_OFFS * sizeof(*offs));
+	ref_offs = malloc(MT_BENCH_OFFS * sizeof(*ref_offs));
+	if (buf == NULL || offs == NULL || ref_offs == NULL) {
+		rc = -1;
+		goto out;
+	}
+	for (i = 0; i < MT_BENCH_BYTES; i += size) {
+		size = MIN(text_size, MT_BENCH_BYTES - i);
+		memcpy(buf + i, text, size);
+	}
+
+	printf("Parallel search benchmark: method %u, %lu bytes, "
+	       "pattern \"%s\"\n%8s %10s %8s %8s\n", method,
+	       MT_BENCH_BYTES, pattern, "threads", "usec", "GB/s", "speedup");
+
+	for (t = 1; t <= threads; t = (t == threads) ? t + 1 :
+		     MIN(2 * t, threads)) {
+		gettimeofday(&stime, NULL);
+		count = search_mt(method, pattern, psize, buf, MT_BENCH_BYTES,
+				  t, offs, MT_BENCH_OFFS);
+		gettimeofday(&etime, NULL);
+		usec = MAX(1ll, timediff_usec(&etime, &stime));
+
+		if (t == 1) {
+			ref = count;
+			ref_usec = usec;
+			memcpy(ref_offs, offs, MT_BENCH_OFFS * sizeof(*offs));
+		} else if (count != ref ||
+			   memcmp(offs, ref_offs, MIN(count,
+				  (unsigned long long)MT_BENCH_OFFS) *
+				  sizeof(*offs)) != 0) {
+			fprintf(stderr, "err: %u threads found %llu, "
+				"1 thread %llu or offsets differ\n",
+				t, count, ref);
+			rc = -1;
+			goto out;
+		}
+		printf("%8u %10lld %8.2f %8.2f\n", t, usec,
+		       (double)MT_BENCH_BYTES / usec / 1000,
+		       (double)ref_usec / usec);
+	}
+	printf("%llu matches\n", ref);
+ out:
+	free(ref_offs);
+	free(offs);
+	free(buf);
+	return rc;
+}
+
+/*
+ * Trigram index of the text, loaded from fname if it belongs to the
+ * text, else built and saved there for the next run.
+ */
+static struct search_index *search_index_open(const char *fname,
+					      const uint8_t *text,
+					      size_t size)
+{
+	struct search_index *ix;
+	struct timeval etime, stime;
+	const char *how = "loaded";
+
+	gettimeofday(&stime, NULL);
+	ix = search_index_load(fname, text, size);
+	if (ix == NULL) {
+		how = "built";
+		ix = search_index_build(text, size);
+		if (ix == NULL) {
+			fprintf(stderr, "err: cannot build index\n");
+			return NULL;
+		}
+		if (search_index_save(ix, fname) != 0)
+			fprintf(stderr, "warn: index not saved to %s\n",
+				fname);
+	}
+	gettimeofday(&etime, NULL);
+
+	printf("Index %s in %lld usec: %u blocks of %u bytes, %u trigrams, "
+	       "%llu bytes (%.1f%% of the text)\n", how,
+	       (long long)timediff_usec(&etime, &stime), ix->n_blocks,
+	       ix->block_size, ix->n_keys, (unsigned long long)ix->size,
+	       size ? 100.0 * ix->size / size : 0.0);
+	return ix;
+}
+
+/* Text range of candidate blocks blocks[i] .. blocks[*j - 1] */
+static void search_index_run(const struct search_index *ix,
+			     const uint32_t *blocks, uint32_t n,
+			     uint32_t i, uint32_t *j, unsigned int psize,
+			     uint64_t *start, uint64_t *size)
+{
+	uint64_t end;
+
+	for (*j = i + 1; *j < n && blocks[*j] == blocks[*j - 1] + 1; (*j)++)
+		;
+	*start = (uint64_t)blocks[i] * ix->block_size;
+	end = (uint64_t)(blocks[*j - 1] + 1) * ix->block_size + psize - 1;
+	*size = MIN(end, ix->text_size) - *start;
+}
+
+/*
+ * Index benchmark: selective patterns are taken from the text, every
+ * second one with a byte changed such that it mostly does not occur.
+ * Each is searched through the index, i.e. query plus a scan of the
+ * candidate blocks, and by a full scan. Counts must match.
+ */
+#define INDEX_BENCH_QUERIES 200
+
+static int search_index_bench(const struct search_index *ix,
+			      const char *text, size_t text_size,
+			      unsigned int method)
+{
+	struct timeval etime, stime;
+	long long usec[2] = { 0, 0 };
+	unsigned long long n[2], found = 0, scanned = 0;
+	uint64_t start, size;
+	uint32_t *blocks, nb, i, j;
+	unsigned int q, len;
+	char pat[64];
+	int rc = 0;
+
+	if (text_size < 64) {
+		fprintf(stderr, "err: text too small\n");
+		return -1;
+	}
+	blocks = malloc(ix->n_blocks * sizeof(*blocks));
+	if (blocks == NULL)
+		return -1;
+
+	srand(1);
+	for (q = 0; q < INDEX_BENCH_QUERIES; q++) {
+		len = 8 + rand() % 25;
+		memcpy(pat, text + rand() % (text_size - len), len);
+		if (q & 1)
+			pat[rand() % len] ^= 0x20;
+
+		gettimeofday(&stime, NULL);
+		nb = search_index_query(ix, pat, len, blocks);
+		for (n[0] = 0, i = 0; i < nb; i = j) {
+			search_index_run(ix, blocks, nb, i, &j, len,
+					 &start, &size);
+			n[0] += search_mt(method, pat, len,
+					  (char *)text + start, size, 1,
+					  NULL, 0);
+			scanned += size;
+		}
+		gettimeofday(&etime, NULL);
+		usec[0] += timediff_usec(&etime, &stime);
+
+		gettimeofday(&stime, NULL);
+		n[1] = search_mt(method, pat, len, (char *)text, text_size,
+				 1, NULL, 0);
+		gettimeofday(&etime, NULL);
+		usec[1] += timediff_usec(&etime, &stime);
+
+		if (n[0] != n[1]) {
+			fprintf(stderr, "err: query %u \"%.*s\": index %llu, "
+				"full scan %llu matches\n", q, (int)len, pat,
+				n[0], n[1]);
+			rc = -1;
+			break;
+		}
+		found += n[0];
+	}
+	free(blocks);
+	if (rc != 0)
+		return rc;
+
+	usec[0] = MAX(1ll, usec[0]);
+	usec[1] = MAX(1ll, usec[1]);
+	printf("Index benchmark: method %u, %u queries, %llu matches\n"
+	       "%10s %12s %10s\n"
+	       "%10s %12.1f %9.2f%%\n"
+	       "%10s %12.1f %9.2f%%\n"
+	       "speedup %.1f\n", method, INDEX_BENCH_QUERIES, found,
+	       "", "usec/query", "scanned",
+	       "index", (double)usec[0] / INDEX_BENCH_QUERIES,
+	       100.0 * scanned / ((double)text_size * INDEX_BENCH_QUERIES),
+	       "full scan", (double)usec[1] / INDEX_BENCH_QUERIES, 100.0,
+	       (double)usec[1] / usec[0]);
+	return 0;
+}
+
 static void print_snap_addr(struct snap_addr *a)
 {
 	fprintf(stderr, "  addr: %016llx size: %08llx\n",
@@ -107,7 +1079,7 @@ static void snap_prepare_search(struct snap_job *cjob,
 				struct search_job *sjob_in,
 				struct search_job *sjob_out,
 				const uint8_t *dbuff, ssize_t dsize,
-				uint64_t *offs, unsigned int items,
+				void *offs, size_t offs_size,
 				const uint8_t *pbuff, unsigned int psize,
 				const int method, const int step)
 {
@@ -122,13 +1094,13 @@ static void snap_prepare_search(struct snap_job *cjob,
 	      SNAP_ADDRFLAG_END);
 
     // result moved to Host
-    snap_addr_set(&sjob_in->src_result, offs, items * sizeof(*offs),
+    snap_addr_set(&sjob_in->src_result, offs, offs_size,
 		  SNAP_ADDRTYPE_HOST_DRAM,
 		  SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST);
 
      // result will be in DDR
      ddr_offaddr = (uint64_t) DDR_OFFS_START;
-     snap_addr_set(&sjob_in->ddr_result, (void*) ddr_offaddr, items * sizeof(*offs),
+     snap_addr_set(&sjob_in->ddr_result, (void*) ddr_offaddr, offs_size,
 		      SNAP_ADDRTYPE_CARD_DRAM,
 		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_DST);
 
@@ -170,12 +1142,25 @@ static void snap_prepare_search(struct snap_job *cjob,
 		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
 
     }
+    else if (step == 6)
+    {
+        // Step6 searches one DDR slot while the next chunk is uploaded
+        // to the other, the caller sets the chunk addresses and sizes
+	snap_addr_set(&sjob_in->src_text1, dbuff, dsize,
+		      SNAP_ADDRTYPE_HOST_DRAM,
+		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
+
+        ddr_addr = (uint64_t) DDR_PIPE_SLOT_ADDR(0);
+	snap_addr_set(&sjob_in->ddr_text1, (void *) ddr_addr, dsize,
+		      SNAP_ADDRTYPE_CARD_DRAM,
+		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC);
+    }
     else if (step == 5)
     {
         // Step5 is copying results in DDR back to Host
         // result is in DDR
         ddr_offaddr = (uint64_t) DDR_OFFS_START;
-	snap_addr_set(&sjob_in->ddr_result, (void*) ddr_offaddr, items * sizeof(*offs),
+	snap_addr_set(&sjob_in->ddr_result, (void*) ddr_offaddr, offs_size,
 		      SNAP_ADDRTYPE_CARD_DRAM,
 		      SNAP_ADDRFLAG_ADDR | SNAP_ADDRFLAG_SRC |
 		      SNAP_ADDRFLAG_END);
@@ -194,6 +1179,37 @@ static void snap_prepare_search(struct snap_job *cjob,
     snap_job_set(cjob, sjob_in, sizeof(*sjob_in),
 		     sjob_out, sizeof(*sjob_out));
 }
+/* Restart the step 3 search at text position pos, in DDR and on the host */
+static void snap_search_resume(struct search_job *sjob,
+			       const uint8_t *dbuff, ssize_t dsize,
+			       uint64_t pos)
+{
+	sjob->src_text1.addr = (unsigned long)(dbuff + pos);
+	sjob->src_text1.size = dsize - pos;
+	sjob->ddr_text1.addr = DDR_TEXT_START + pos;
+	sjob->ddr_text1.size = dsize - pos;
+}
+
+/*
+ * REGEX_method and MYERS_method results are not paged, a job with more
+ * matches than items offsets fails. Tell why, the job retc alone does
+ * not.
+ */
+static int search_truncated(int method, unsigned int found,
+			    unsigned int items)
+{
+	if ((method != REGEX_method &&
+	     (method & SEARCH_METHOD_MASK) != MYERS_method) ||
+	    items == 0 || found <= items)
+		return 0;
+
+	fprintf(stderr, "err: %u matches, but the result page holds %u "
+		"offsets and %s results\n     are not paged, raise -I or "
+		"count only with -c\n", found, items,
+		method == REGEX_method ? "REGEX" : "Myers");
+	return 1;
+}
+
 static int run_one_step(struct snap_queue *queue,
 			struct snap_job *cjob,
 			unsigned long timeout,
@@ -226,7 +1242,349 @@ static int run_one_step(struct snap_queue *queue,
 	return rc;
 }
 
-static void snap_print_search_results(struct snap_job *cjob, unsigned int run)
+static void snap_print_search_results(struct snap_job *cjob, unsigned int run,
+				      uint64_t text_pos);
+
+/*
+ * One step 6 job of the pipeline: upload [up_start, up_start + up_size)
+ * into the slot other than @slot and search [start, start + size),
+ * which is in @slot. Full result pages of the search are drained with
+ * step 3. Results are printed and counted unless @run is NULL.
+ */
+static int snap_pipe_job(struct snap_queue *queue, unsigned long timeout,
+			 const uint8_t *dbuff, ssize_t dsize,
+			 void *offs, size_t offs_size,
+			 const uint8_t *pbuff, unsigned int psize,
+			 const int method, unsigned long up_start,
+			 unsigned long up_size, unsigned int slot,
+			 unsigned long start, unsigned long size,
+			 unsigned int *run, unsigned int *total_found)
+{
+	struct snap_job cjob;
+	struct search_job sjob_in;
+	struct search_job sjob_out;
+	uint64_t pos = 0;
+	int rc;
+
+	snap_prepare_search(&cjob, &sjob_in, &sjob_out,
+			    dbuff, dsize, offs, offs_size,
+			    pbuff, psize, method, 6);
+	sjob_in.src_text1.addr = (unsigned long)(dbuff + up_start);
+	sjob_in.src_text1.size = up_size;
+	sjob_in.ddr_text1.addr = DDR_PIPE_SLOT_ADDR(slot);
+	sjob_in.ddr_text1.size = size;
+
+	rc = run_one_step(queue, &cjob, timeout, 6);
+	if (rc == 0 && cjob.retc != SNAP_RETC_SUCCESS) {
+		fprintf(stderr, "err: job retc %x!\n", cjob.retc);
+		rc = -1;
+	}
+	if (rc != 0)
+		return rc;
+
+	while (size != 0) {
+		if (run != NULL) {
+			snap_print_search_results(&cjob, (*run)++,
+						  start + pos);
+			*total_found += sjob_out.nb_of_occurrences;
+		}
+		if (sjob_out.next_input_addr == 0x0)
+			break;
+
+		/* result page full, continue behind its last offset */
+		if (sjob_out.next_input_addr <= sjob_in.ddr_text1.addr ||
+		    sjob_out.next_input_addr - sjob_in.ddr_text1.addr >
+		    sjob_in.ddr_text1.size) {
+			fprintf(stderr, "err: bad resume address %016llx\n",
+				(long long)sjob_out.next_input_addr);
+			return -1;
+		}
+		pos += sjob_out.next_input_addr - sjob_in.ddr_text1.addr;
+
+		snap_prepare_search(&cjob, &sjob_in, &sjob_out,
+				    dbuff, dsize, offs, offs_size,
+				    pbuff, psize, method, 3);
+		sjob_in.src_text1.addr = (unsigned long)(dbuff + start + pos);
+		sjob_in.src_text1.size = size - pos;
+		sjob_in.ddr_text1.addr = DDR_PIPE_SLOT_ADDR(slot) + pos;
+		sjob_in.ddr_text1.size = size - pos;
+
+		rc = run_one_step(queue, &cjob, timeout, 3);
+		if (rc == 0 && cjob.retc != SNAP_RETC_SUCCESS) {
+			fprintf(stderr, "err: job retc %x!\n", cjob.retc);
+			rc = -1;
+		}
+		if (rc != 0)
+			return rc;
+	}
+	return 0;
+}
+
+/*
+ * Pipelined search: the text is cut into chunks that alternate between
+ * the two DDR text slots. Job k uploads chunk k and searches chunk k-1
+ * (step 6), so transfer and search overlap on the card. Each chunk
+ * carries psize - 1 bytes of the next one, such that matches across a
+ * chunk border are found once. Full result pages of a chunk are drained
+ * with step 3 before its slot is reused.
+ *
+ * The overlap is measured, not assumed: a second pass runs the same
+ * jobs with the upload and the search of each chunk in separate jobs,
+ * and the time the pipeline saves against it is reported as the share
+ * of the shorter stage that was hidden. Returns 0 or the failing rc.
+ */
+static int snap_search_pipeline(struct snap_queue *queue,
+				unsigned long timeout,
+				const uint8_t *dbuff, ssize_t dsize,
+				void *offs, size_t offs_size,
+				const uint8_t *pbuff, unsigned int psize,
+				const int method, unsigned long chunk,
+				unsigned int *total_found)
+{
+	unsigned long n_chunks, k, start = 0, size = 0;
+	unsigned long next_start, next_size;
+	unsigned int run = 0;
+	struct timeval etime, stime;
+	long long usec, up_usec = 0, search_usec = 0;
+	int rc;
+
+	if (chunk == 0 || chunk % 64 != 0 ||
+	    chunk + psize - 1 > DDR_PIPE_SLOT) {
+		fprintf(stderr, "err: chunk must be a multiple of 64 bytes "
+			"and fit a %u MiB DDR slot\n",
+			DDR_PIPE_SLOT / (1024 * 1024));
+		return -1;
+	}
+	n_chunks = (dsize + chunk - 1) / chunk;
+
+	gettimeofday(&stime, NULL);
+	for (k = 0; k <= n_chunks; k++) {
+		/* chunk k goes up, chunk k - 1 is searched */
+		next_start = k * chunk;
+		next_size = 0;
+		if (k < n_chunks)
+			next_size = MIN((unsigned long)dsize - next_start,
+					chunk + psize - 1);
+
+		rc = snap_pipe_job(queue, timeout, dbuff, dsize,
+				   offs, offs_size, pbuff, psize, method,
+				   next_start, next_size, (k + 1) % 2,
+				   start, size, &run, total_found);
+		if (rc != 0)
+			return rc;
+		start = next_start;
+		size = next_size;
+	}
+	gettimeofday(&etime, NULL);
+	usec = timediff_usec(&etime, &stime);
+
+	/* the same chunks, upload and search one after the other */
+	for (k = 0; k < n_chunks; k++) {
+		start = k * chunk;
+		size = MIN((unsigned long)dsize - start, chunk + psize - 1);
+
+		gettimeofday(&stime, NULL);
+		rc = snap_pipe_job(queue, timeout, dbuff, dsize,
+				   offs, offs_size, pbuff, psize, method,
+				   start, size, (k + 1) % 2, 0, 0, NULL, NULL);
+		gettimeofday(&etime, NULL);
+		up_usec += timediff_usec(&etime, &stime);
+		if (rc != 0)
+			return rc;
+
+		gettimeofday(&stime, NULL);
+		rc = snap_pipe_job(queue, timeout, dbuff, dsize,
+				   offs, offs_size, pbuff, psize, method,
+				   0, 0, k % 2, start, size, NULL, NULL);
+		gettimeofday(&etime, NULL);
+		search_usec += timediff_usec(&etime, &stime);
+		if (rc != 0)
+			return rc;
+	}
+
+	printf("Pipeline: %lu chunks of %lu KiB, %lld usec, %.3f GB/s\n",
+	       n_chunks, chunk / 1024, usec,
+	       usec ? (double)dsize / usec / 1000.0 : 0.0);
+	printf("Serial:   upload %lld usec + search %lld usec = %lld usec\n",
+	       up_usec, search_usec, up_usec + search_usec);
+	printf("Overlap:  %lld usec saved, %.0f%% of the shorter stage "
+	       "hidden\n", up_usec + search_usec - usec,
+	       MIN(up_usec, search_usec) ?
+	       100.0 * (up_usec + search_usec - usec) /
+	       MIN(up_usec, search_usec) : 0.0);
+	return 0;
+}
+
+/*
+ * Step 3 over the text range [start, start + size), which is in DDR at
+ * the same offset. Full result pages continue behind their last offset.
+ */
+static int snap_search_range(struct snap_queue *queue,
+			     unsigned long timeout,
+			     const uint8_t *dbuff, ssize_t dsize,
+			     void *offs, size_t offs_size,
+			     const uint8_t *pbuff, unsigned int psize,
+			     const int method, uint64_t start, uint64_t size,
+			     unsigned int *run, unsigned int *found)
+{
+	struct snap_job cjob;
+	struct search_job sjob_in;
+	struct search_job sjob_out;
+	uint64_t pos = 0;
+	int rc;
+
+	do {
+		snap_prepare_search(&cjob, &sjob_in, &sjob_out,
+				    dbuff, dsize, offs, offs_size,
+				    pbuff, psize, method, 3);
+		sjob_in.src_text1.addr = (unsigned long)(dbuff + start + pos);
+		sjob_in.src_text1.size = size - pos;
+		sjob_in.ddr_text1.addr = DDR_TEXT_START + start + pos;
+		sjob_in.ddr_text1.size = size - pos;
+
+		rc = run_one_step(queue, &cjob, timeout, 3);
+		if (rc == 0 && cjob.retc != SNAP_RETC_SUCCESS) {
+			fprintf(stderr, "err: job retc %x!\n", cjob.retc);
+			rc = -1;
+		}
+		if (rc != 0)
+			return rc;
+
+		snap_print_search_results(&cjob, (*run)++, start + pos);
+		*found += sjob_out.nb_of_occurrences;
+		if (sjob_out.next_input_addr == 0x0)
+			break;
+
+		if (sjob_out.next_input_addr <= sjob_in.ddr_text1.addr ||
+		    sjob_out.next_input_addr - sjob_in.ddr_text1.addr >
+		    sjob_in.ddr_text1.size) {
+			fprintf(stderr, "err: bad resume address %016llx\n",
+				(long long)sjob_out.next_input_addr);
+			return -1;
+		}
+		pos += sjob_out.next_input_addr - sjob_in.ddr_text1.addr;
+	} while (pos < size);
+
+	return 0;
+}
+
+/*
+ * Indexed search of the text resident in DDR: per query the trigram
+ * index names the candidate blocks, and only those are searched, one
+ * step 3 job per run of adjacent blocks.
+ */
+static int snap_search_indexed(struct snap_queue *queue,
+			       unsigned long timeout,
+			       const struct search_index *ix,
+			       const uint8_t *dbuff, ssize_t dsize,
+			       void *offs, size_t offs_size,
+			       uint8_t *pbuff,
+			       const struct search_patterns *queries,
+			       const int method, unsigned int *total_found)
+{
+	struct timeval etime, stime;
+	unsigned long long scanned = 0;
+	long long usec, total_usec = 0;
+	uint64_t start, size;
+	uint32_t *blocks, nb, i, j;
+	unsigned int q, found, run = 0;
+	int rc = 0;
+
+	blocks = malloc(ix->n_blocks * sizeof(*blocks));
+	if (blocks == NULL)
+		return -ENOMEM;
+
+	for (q = 0; q < queries->n; q++) {
+		unsigned int psize = queries->len[q];
+
+		memcpy(pbuff, queries->pat[q], psize);
+		found = 0;
+
+		gettimeofday(&stime, NULL);
+		nb = search_index_query(ix, queries->pat[q], psize, blocks);
+		for (i = 0; i < nb && rc == 0; i = j) {
+			search_index_run(ix, blocks, nb, i, &j, psize,
+					 &start, &size);
+			rc = snap_search_range(queue, timeout, dbuff, dsize,
+					       offs, offs_size, pbuff, psize,
+					       method, start, size, &run,
+					       &found);
+			scanned += size;
+		}
+		gettimeofday(&etime, NULL);
+		if (rc != 0)
+			break;
+
+		usec = timediff_usec(&etime, &stime);
+		total_usec += usec;
+		*total_found += found;
+		printf("Query %u \"%s\": %u/%u blocks, %u matches, "
+		       "%lld usec\n", q, queries->pat[q], nb, ix->n_blocks,
+		       found, usec);
+	}
+	free(blocks);
+	if (rc != 0)
+		return rc;
+
+	printf("Index: %u queries, %u matches, %.2f%% of the text "
+	       "searched, %.1f usec per query\n", queries->n, *total_found,
+	       dsize ? 100.0 * scanned / ((double)dsize * queries->n) : 0.0,
+	       (double)total_usec / queries->n);
+	return 0;
+}
+
+static void snap_print_ac_results(const search_dfa_t *dfa,
+				  struct search_patterns *p,
+				  void *result, size_t result_size,
+				  unsigned int found)
+{
+	unsigned int i;
+	uint32_t *counts = (uint32_t *)result;
+	size_t counts_size = SEARCH_AC_COUNTS_SIZE(dfa->n_patterns);
+	search_match_t *match = (search_match_t *)
+		((uint8_t *)result + counts_size);
+	unsigned int match_max = (result_size - counts_size) / sizeof(*match);
+
+	if (verbose_flag > 0) {
+		for (i = 0; i < p->n; i++) {
+			if (counts[i] == 0)
+				continue;
+			printf("  %5d: %-32.*s %u\n", i, (int)p->len[i],
+			       p->pat[i], counts[i]);
+		}
+	}
+	if (verbose_flag > 2) {
+		for (i = 0; i < MIN(found, match_max); i++)
+			printf("%3d: %016llx pattern %u\n", i,
+			       (long long)match[i].offset, match[i].pattern);
+	}
+}
+
+static void snap_print_batch_results(const search_batch_t *batch,
+				     struct search_patterns *p,
+				     void *result)
+{
+	unsigned int i, j;
+	search_batch_result_t *res = (search_batch_result_t *)result;
+	uint64_t *page;
+
+	for (i = 0; i < batch->n_queries; i++) {
+		if (verbose_flag > 0 && res[i].count)
+			printf("  %5d: %-32.*s %u%s\n", i, (int)p->len[i],
+			       p->pat[i], res[i].count,
+			       res[i].n_offs < res[i].count &&
+			       batch->page_items ? " (page full)" : "");
+		if (verbose_flag > 2) {
+			page = (uint64_t *)((uint8_t *)result + res[i].page);
+			for (j = 0; j < res[i].n_offs; j++)
+				printf("%3d: %016llx query %u\n", j,
+				       (long long)page[j], i);
+		}
+	}
+}
+
+static void snap_print_search_results(struct snap_job *cjob, unsigned int run,
+				      uint64_t text_pos)
 {
 	unsigned int i;
 	struct search_job *sjob = (struct search_job *)
@@ -257,7 +1615,7 @@ static void snap_print_search_results(struct snap_job *cjob, unsigned int run)
 		offs_max = sjob->src_result.size / sizeof(uint64_t);
 		for (i = 0; i < MIN(sjob->nb_of_occurrences, offs_max); i++) {
 			printf("%3d: %016llx", i,
-			       (long long)__le64_to_cpu(offs[i]));
+			       (long long)__le64_to_cpu(offs[i]) + text_pos);
 			if (((i+1) % 3) == 0)
 				printf("\n");
 		}
@@ -282,10 +1640,45 @@ static void usage(const char *prog)
 	printf("Usage: %s [-h] [-v, --verbose] [-V, --version]\n"
 	       "  -C, --card <cardno> can be (0...3)\n"
 	       "  -s, --software         Test the software flow \n"
-	       "  -m, --method           Can be (1,2) different method search\n"
+	       "  -m, --method           Can be (1..8) different method search\n"
+	       "                         3: Aho-Corasick, all patterns at once\n"
+	       "                         4: SIMD first/last byte filter\n"
+	       "                         5: -p is a regular expression, "
+	       "offsets are match ends\n"
+	       "                         6: Shift-And, up to -k mismatches\n"
+	       "                         7: Myers, up to -k edits, "
+	       "offsets are match ends\n"
+	       "                         8: batch of queries from -f, "
+	       "one scan, -I offsets each\n"
+	       "  -R, --max-states <n>   DFA state limit for method 5 "
+	       "(default 4096)\n"
+	       "  -k, --distance <k>     Mismatches/edits for method 6 "
+	       "and 7\n"
+	       "  -n, --nocase           Ignore ASCII case, method 6 "
+	       "and 7\n"
 	       "  -i, --input <data.bin> Input data.\n"
-	       "  -I, --items <items>    Max items to find.\n"
+	       "  -I, --items <items>    Offsets per result page.\n"
+	       "  -c, --count-only       Count matches, return no offsets\n"
 	       "  -p, --pattern <str>    Pattern to search for\n"
+	       "  -f, --pattern-file <f> Patterns, one per line (method 3, "
+	       "8, or -x)\n"
+	       "  -T, --threads <n>      Threads for the software flow, "
+	       "0: all CPUs\n"
+	       "  -P, --pipeline <KiB>   Upload and search the text in "
+	       "chunks, overlapped;\n"
+	       "                         a second, serial pass measures "
+	       "the overlap\n"
+	       "  -x, --index <file>     Trigram index of the text, built "
+	       "if missing or stale;\n"
+	       "                         searches only candidate blocks, "
+	       "-f gives one query per line\n"
+	       "  -b, --bench            Benchmark method 3 (1..10000 "
+	       "patterns), 4, 5, 8 (50..500 queries),\n"
+	       "                         or test 6 and 7,\n"
+	       "                         with -T scaling of methods 1, 2, "
+	       "4 up to n threads,\n"
+	       "                         with -x index against full "
+	       "scan latency\n"
 	       "  -E, --expected <num>   Expected # of patterns to find\n"
 	       "  -t, --timeout <num>    timeout in sec (default 10 sec)\n"
 	       "  -X, --irq              Enable Interrupts, "
@@ -293,6 +1686,10 @@ static void usage(const char *prog)
 	       "\n"
 	       "Example:\n"
 	       "  snap_search ...\n"
+	       "  snap_search -m 3 -f signatures.txt -i data.bin -v\n"
+	       "  snap_search -m 5 -p '^ERROR [0-9]{4}:' -i data.bin -v\n"
+	       "  snap_search -x data.idx -f queries.txt -i data.bin\n"
+	       "  snap_search -m 8 -f queries.txt -I 100 -i data.bin -v\n"
 	       "\n",
 	       prog);
 }
@@ -309,15 +1706,30 @@ int main(int argc, char *argv[])
 	char device[128];
 	const char *fname = NULL;
 	const char *pattern_str = "Snap";
+	const char *pattern_file = NULL;
+	const char *index_file = NULL;
+	struct search_index *ix = NULL;
+	struct search_patterns patterns;
+	search_dfa_t *dfa = NULL;
+	search_batch_t *batch = NULL;
+	search_re_t *re = NULL;
+	struct search_re_stats re_stats;
+	unsigned int re_states = SEARCH_RE_MAX_STATES;
+	size_t offs_size;
+	int bench = 0;
+	int count_only = 0;
+	int threads = 1;
+	unsigned int dist = 0;
+	int nocase = 0;
+	unsigned long chunk = 0;
 	struct snap_job cjob;
 	struct search_job sjob_in;
 	struct search_job sjob_out;
 	ssize_t dsize;
-	uint8_t *pbuff;		/* pattern buffer */
+	uint8_t *pbuff = NULL;	/* pattern buffer */
 	uint8_t *dbuff;		/* data buffer */
 	uint64_t *offs;		/* offset buffer */
-	uint8_t *input_addr;
-	uint32_t input_size;
+	uint64_t text_pos;
 	unsigned int attach_timeout = 60;
 	unsigned int timeout = 10;
 	unsigned int items = 42;
@@ -338,6 +1750,15 @@ int main(int argc, char *argv[])
 			{ "method",      required_argument, NULL, 'm' },
 			{ "input",	 required_argument, NULL, 'i' },
 			{ "pattern",	 required_argument, NULL, 'p' },
+			{ "pattern-file", required_argument, NULL, 'f' },
+			{ "bench",	 no_argument,	    NULL, 'b' },
+			{ "count-only",	 no_argument,	    NULL, 'c' },
+			{ "threads",	 required_argument, NULL, 'T' },
+			{ "pipeline",	 required_argument, NULL, 'P' },
+			{ "index",	 required_argument, NULL, 'x' },
+			{ "max-states",	 required_argument, NULL, 'R' },
+			{ "distance",	 required_argument, NULL, 'k' },
+			{ "nocase",	 no_argument,	    NULL, 'n' },
 			{ "items",	 required_argument, NULL, 'I' },
 			{ "timeout",	 required_argument, NULL, 't' },
 			{ "expected",	 required_argument, NULL, 'E' },
@@ -349,7 +1770,7 @@ int main(int argc, char *argv[])
 		};
 
 		ch = getopt_long(argc, argv,
-				 "C:E:m:i:p:I:t:sVvhX",
+				 "C:E:m:i:p:f:I:t:T:P:R:k:x:bcnsVvhX",
 				 long_options, &option_index);
 		if (ch == -1)	/* all params processed ? */
 			break;
@@ -371,6 +1792,35 @@ int main(int argc, char *argv[])
 		case 'p':
 			pattern_str = optarg;
 			break;
+		case 'f':
+			pattern_file = optarg;
+			break;
+		case 'b':
+			bench = 1;
+			break;
+		case 'c':
+			count_only = 1;
+			break;
+		case 'T':
+			threads = strtol(optarg, (char **)NULL, 0);
+			if (threads <= 0)
+				threads = sysconf(_SC_NPROCESSORS_ONLN);
+			break;
+		case 'P':
+			chunk = strtoul(optarg, (char **)NULL, 0) * 1024;
+			break;
+		case 'x':
+			index_file = optarg;
+			break;
+		case 'k':
+			dist = strtol(optarg, (char **)NULL, 0);
+			break;
+		case 'n':
+			nocase = 1;
+			break;
+		case 'R':
+			re_states = strtol(optarg, (char **)NULL, 0);
+			break;
 		case 'I':
 			items = strtol(optarg, (char **)NULL, 0);
 			break;
@@ -404,6 +1854,24 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if ((dist || nocase) && method != SHIFTAND_method &&
+	    method != MYERS_method) {
+		fprintf(stderr, "err: -k and -n need method 6 or 7\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((method == SHIFTAND_method || method == MYERS_method) &&
+	    (dist > SEARCH_K_MAX || dist >= strlen(pattern_str))) {
+		fprintf(stderr, "err: -k must be below the pattern size\n");
+		exit(EXIT_FAILURE);
+	}
+	if (index_file && method != STRM_method &&
+	    method != NAIVE_method && method != KMP_method &&
+	    method != SIMD_method) {
+		fprintf(stderr, "err: --index needs method 0, 1, 2 or 4\n");
+		exit(EXIT_FAILURE);
+	}
+	method = SEARCH_METHOD(method, dist, nocase ? SEARCH_NOCASE : 0);
+
 	dsize = file_size(fname);
 	if (dsize < 0)
 		goto out_error;
@@ -412,28 +1880,173 @@ int main(int argc, char *argv[])
 	if (dbuff == NULL)
 		goto out_error;
 
-	psize = strlen(pattern_str);
-	/* FIXME pattern is limited to 64 Bytes by hardware in this preliminary release */
-	if (psize > 64) {
-		printf("Pattern is limited to 64 bytes\n");
+	rc = file_read(fname, dbuff, dsize);
+	if (rc < 0)
+		goto out_error0;
+
+	if (index_file) {
+		ix = search_index_open(index_file, dbuff, dsize);
+		if (ix == NULL)
+			goto out_error0;
+	}
+
+	if (bench) {
+		if (ix)
+			rc = search_index_bench(ix, (char *)dbuff, dsize,
+						method);
+		else if ((method & SEARCH_METHOD_MASK) == SHIFTAND_method ||
+		    (method & SEARCH_METHOD_MASK) == MYERS_method)
+			rc = search_approx_bench((char *)dbuff, dsize);
+		else if (method == BATCH_method)
+			rc = search_batch_bench((char *)dbuff, dsize);
+		else if (threads > 1 && method != AC_method)
+			rc = search_mt_bench(method, (char *)dbuff, dsize,
+					     (char *)pattern_str,
+					     strlen(pattern_str), threads);
+		else if (method == AC_method)
+			rc = search_ac_bench((char *)dbuff, dsize);
+		else if (method == SIMD_method)
+			rc = search_simd_bench((char *)dbuff, dsize);
+		else if (method == REGEX_method)
+			rc = search_re_bench((char *)dbuff, dsize, pattern_str,
+					     re_states);
+		else {
+			fprintf(stderr, "err: no benchmark for method %d\n",
+				method);
+			rc = -1;
+		}
+		free(ix);
+		free(dbuff);
+		exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	if (count_only)
+		items = 0;
+
+	if (chunk && (sw || method == AC_method || method == REGEX_method ||
+		      method == BATCH_method ||
+		      (method & SEARCH_METHOD_MASK) == MYERS_method)) {
+		fprintf(stderr, "err: --pipeline needs the hardware flow "
+			"and a single pattern method\n");
 		goto out_error0;
 	}
-	pbuff = snap_malloc(psize);
-	if (pbuff == NULL)
+	if (ix && (sw || chunk)) {
+		fprintf(stderr, "err: --index needs the hardware flow "
+			"without --pipeline\n");
 		goto out_error0;
-	memcpy(pbuff, pattern_str, psize);
+	}
 
-	rc = file_read(fname, dbuff, dsize);
-	if (rc < 0)
-		goto out_errorX;
+	memset(&patterns, 0, sizeof(patterns));
+	if (method == AC_method) {
+		if (pattern_file)
+			rc = patterns_load(&patterns, pattern_file);
+		else if ((rc = patterns_alloc(&patterns, 1)) == 0) {
+			patterns.n = 1;
+			patterns.pat[0] = (char *)pattern_str;
+			patterns.len[0] = strlen(pattern_str);
+		}
+		if (rc != 0)
+			goto out_error0;
+
+		dfa = search_dfa_compile(&patterns);
+		if (dfa == NULL)
+			goto out_errorX;
+		printf("%u patterns compiled: %u states, %u byte classes, "
+		       "%u bytes\n", dfa->n_patterns, dfa->n_states,
+		       dfa->n_classes, dfa->size);
+
+		pbuff = (uint8_t *)dfa;
+		psize = dfa->size;
+		offs_size = SEARCH_AC_COUNTS_SIZE(patterns.n) +
+			items * sizeof(search_match_t);
+	} else if (method == BATCH_method) {
+		if (pattern_file)
+			rc = patterns_load(&patterns, pattern_file);
+		else if ((rc = patterns_alloc(&patterns, 1)) == 0) {
+			patterns.n = 1;
+			patterns.pat[0] = (char *)pattern_str;
+			patterns.len[0] = strlen(pattern_str);
+		}
+		if (rc != 0)
+			goto out_error0;
+		for (run = 0; run < (int)patterns.n; run++)
+			if (patterns.len[run] > 64) {
+				printf("Pattern is limited to 64 bytes\n");
+				goto out_errorX;
+			}
+
+		batch = search_batch_build(&patterns, items);
+		if (batch == NULL)
+			goto out_errorX;
+		printf("%u queries in a %u bytes table, %u offsets per "
+		       "query page\n", batch->n_queries, batch->size,
+		       batch->page_items);
+
+		pbuff = (uint8_t *)batch;
+		psize = batch->size;
+		offs_size = SEARCH_BATCH_RESULT_SIZE(patterns.n, items);
+	} else if (method == REGEX_method) {
+		re = search_re_compile(pattern_str, re_states, &re_stats);
+		if (re == NULL)
+			goto out_error0;
+		if (re->flags & SEARCH_RE_NFA)
+			printf("regex compiled: DFA over %u states, NFA with "
+			       "%u states on lines holding \"%.*s\"\n",
+			       re_states, re->n_nfa, (int)re->lit_len,
+			       re->literal);
+		else
+			printf("regex compiled: %u DFA states (%u before "
+			       "minimization), %u byte classes, %lu table "
+			       "bytes\n", re->n_states, re_stats.dfa_states,
+			       re->n_classes,
+			       (unsigned long)(re->size - sizeof(*re)));
+
+		pbuff = (uint8_t *)re;
+		psize = re->size;
+		offs_size = items * sizeof(*offs);
+	} else if (ix) {
+		/* queries from -f, one per line, else -p */
+		if (pattern_file)
+			rc = patterns_load(&patterns, pattern_file);
+		else if ((rc = patterns_alloc(&patterns, 1)) == 0) {
+			patterns.n = 1;
+			patterns.pat[0] = (char *)pattern_str;
+			patterns.len[0] = strlen(pattern_str);
+		}
+		if (rc != 0)
+			goto out_error0;
+		for (psize = 0, run = 0; run < (int)patterns.n; run++)
+			psize = MAX(psize, (int)patterns.len[run]);
+		if (psize > 64) {
+			printf("Pattern is limited to 64 bytes\n");
+			goto out_errorX;
+		}
+		pbuff = snap_malloc(psize);
+		if (pbuff == NULL)
+			goto out_errorX;
+		offs_size = items * sizeof(*offs);
+	} else {
+		psize = strlen(pattern_str);
+		/* FIXME pattern is limited to 64 Bytes by hardware in this preliminary release */
+		if (psize > 64) {
+			printf("Pattern is limited to 64 bytes\n");
+			goto out_error0;
+		}
+		pbuff = snap_malloc(psize);
+		if (pbuff == NULL)
+			goto out_error0;
+		memcpy(pbuff, pattern_str, psize);
+		offs_size = items * sizeof(*offs);
+	}
 
-	offs = snap_malloc(items * sizeof(*offs));
-	if (offs == NULL)
-		goto out_errorX;
-	memset(offs, 0xAB, items * sizeof(*offs));
+	offs = NULL;
+	if (offs_size) {
+		offs = snap_malloc(offs_size);
+		if (offs == NULL)
+			goto out_errorX;
+		memset(offs, 0xAB, offs_size);
+	}
 
-	input_addr = dbuff;
-	input_size = dsize;
 
 	/*
 	 * Apply for exclusive action access for action type 0xC0FE.
@@ -457,6 +2070,20 @@ int main(int argc, char *argv[])
 	}
 
 	run = 0;
+	if (chunk) {
+		printf("...................................................\n");
+		printf("Start Step6 (Upload and search %lu KiB chunks) ...\n",
+		       chunk / 1024);
+		printf("...................................................\n");
+		gettimeofday(&stime, NULL);
+		rc = snap_search_pipeline(queue, timeout, dbuff, dsize,
+					  offs, offs_size, pbuff, psize,
+					  method, chunk, &total_found);
+		if (rc != 0)
+			goto out_error3;
+		goto search_done;
+	}
+
     	/*
  	 * Run Step 1, 2, 4 for Software search
  	 * Run Step 1, 3, 5 for Hardware search
@@ -469,7 +2096,7 @@ int main(int argc, char *argv[])
 
 	snap_prepare_search(&cjob, &sjob_in, &sjob_out,
 			    dbuff, dsize,
-			    offs, items,
+			    offs, offs_size,
 			    pbuff, psize,
 			    method, step);
 
@@ -480,6 +2107,18 @@ int main(int argc, char *argv[])
 		goto out_error3;
 
 	gettimeofday(&stime, NULL);
+	if (ix) {
+		printf("...................................................\n");
+		printf("Start Step3 (Search the indexed candidate blocks) .\n");
+		printf("...................................................\n");
+		rc = snap_search_indexed(queue, timeout, ix, dbuff, dsize,
+					 offs, offs_size, pbuff, &patterns,
+					 method, &total_found);
+		if (rc != 0)
+			goto out_error3;
+		goto search_done;
+	}
+
     	if(sw)
     	{
                 printf("...................................................\n");
@@ -488,7 +2127,7 @@ int main(int argc, char *argv[])
  	 	step = 2;
         	snap_prepare_search(&cjob, &sjob_in, &sjob_out,
 				    dbuff, dsize,
-				    offs, items,
+				    offs, offs_size,
 				    pbuff, psize,
 				    method, step);
 
@@ -502,25 +2141,60 @@ int main(int argc, char *argv[])
         	printf("...................................................\n");
  	 	step = 4;
 
-        	sjob_out.nb_of_occurrences = run_sw_search(method, (char *)pbuff, psize,
-					(char *)dbuff, dsize);
-
-            	snap_print_search_results(&cjob, run);
+		if (method == AC_method)
+			sjob_out.nb_of_occurrences = run_sw_ac_search(dfa,
+					(char *)dbuff, dsize, offs, offs_size);
+		else if (method == BATCH_method)
+			sjob_out.nb_of_occurrences = run_sw_batch_search(batch,
+					(char *)dbuff, dsize, offs, offs_size);
+		else if (method == REGEX_method)
+			sjob_out.nb_of_occurrences = run_sw_re_search(re,
+					(char *)dbuff, dsize, offs, items);
+		else
+			sjob_out.nb_of_occurrences = run_sw_search(method,
+					(char *)pbuff, psize,
+					(char *)dbuff, dsize, threads,
+					offs, items);
+
+            	snap_print_search_results(&cjob, run, 0);
         	printf("Step 4 : RESULT :  %d occurrences \n", sjob_out.nb_of_occurrences);
 		total_found += sjob_out.nb_of_occurrences;
+		if (search_truncated(method, sjob_out.nb_of_occurrences,
+				     items))
+			goto out_error3;
     	}
    	else
     	{
            	printf("...................................................\n");
             	printf("Start Step3 (Do Search by hardware, in DDR) .......\n");
            	printf(" >>> Searching : iteration number %d \n", run);
-                switch(method) {
+                switch(method & SEARCH_METHOD_MASK) {
                 case(1):
                         printf(" >>> Naive method (%d) \n", method);
                         break;
                 case(2):
                         printf(" >>> KMP method (%d) \n", method);
                         break;
+                case(3):
+                        printf(" >>> Aho-Corasick method (%d) \n", method);
+                        break;
+                case(4):
+                        printf(" >>> SIMD method (%d) \n", method);
+                        break;
+                case(5):
+                        printf(" >>> REGEX method (%d) \n", method);
+                        break;
+                case(6):
+                        printf(" >>> Shift-And method (%d) \n",
+                               method & SEARCH_METHOD_MASK);
+                        break;
+                case(7):
+                        printf(" >>> Myers method (%d) \n",
+                               method & SEARCH_METHOD_MASK);
+                        break;
+                case(8):
+                        printf(" >>> Batch method (%d) \n", method);
+                        break;
                 case(0):
 #ifdef STREAMING_METHOD
                         printf(" >>> Streaming method (%d) \n", method);
@@ -535,12 +2209,14 @@ int main(int argc, char *argv[])
 		step = 3;
 
         	run = 0;
+		text_pos = 0;
         	do {
             		snap_prepare_search(&cjob, &sjob_in, &sjob_out,
 					    dbuff, dsize,
-					    offs, items,
+					    offs, offs_size,
 					    pbuff, psize,
 					    method, step);
+			snap_search_resume(&sjob_in, dbuff, dsize, text_pos);
         		printf("dsize = %d - psize = %d \n", (int)dsize, (int)psize);
 
             		rc |= run_one_step(queue, &cjob, timeout, step);
@@ -549,10 +2225,13 @@ int main(int argc, char *argv[])
                 		goto out_error3;
             		}
 
-            		snap_print_search_results(&cjob, run);
+            		snap_print_search_results(&cjob, run, text_pos);
 
             		if (cjob.retc != SNAP_RETC_SUCCESS)  {
                 		fprintf(stderr, "err: job retc %x!\n", cjob.retc);
+				search_truncated(method,
+						 sjob_out.nb_of_occurrences,
+						 items);
                 		goto out_error3;
             		}
 
@@ -568,24 +2247,25 @@ int main(int argc, char *argv[])
 			step = 5;
 
             		snap_prepare_search(&cjob, &sjob_in, &sjob_out, dbuff, dsize,
-                    		offs, items, pbuff, psize, method, step);
+                    		offs, offs_size, pbuff, psize, method, step);
         		printf("dsize = %d - psize = %d \n", (int)dsize, (int)psize);
-            		snap_print_search_results(&cjob, run);
+            		snap_print_search_results(&cjob, run, text_pos);
 			*/
 
-            		/* trigger repeat if search was not complete */
-            		sjob_in.nb_of_occurrences = sjob_out.nb_of_occurrences;
-                    	sjob_in.next_input_addr = sjob_out.next_input_addr;
-
+            		/* result page full, continue behind its last offset */
             		if (sjob_out.next_input_addr != 0x0) {
-                		input_size -= (sjob_out.next_input_addr -
-                           		(unsigned long)input_addr);
-                		input_addr = (uint8_t *)(unsigned long)
-                    		sjob_out.next_input_addr;
-
-                		/* Fixup input address and size for next search */
-                		sjob_in.src_text1.addr = (unsigned long)input_addr;
-                		sjob_in.src_text1.size = input_size;
+				uint64_t next = sjob_out.next_input_addr -
+					sjob_in.ddr_text1.addr;
+
+				if (sjob_out.next_input_addr <=
+				    sjob_in.ddr_text1.addr ||
+				    next > sjob_in.ddr_text1.size) {
+					fprintf(stderr, "err: bad resume "
+						"address %016llx\n",
+						(long long)sjob_out.next_input_addr);
+					goto out_error3;
+				}
+				text_pos += next;
             		}
             		run++;
 
@@ -593,9 +2273,15 @@ int main(int argc, char *argv[])
         	} while (sjob_out.next_input_addr != 0x0);
 	}
 
+ search_done:
 	gettimeofday(&etime, NULL);
 
 	fprintf(stdout, PR_RED "%d patterns found.\n" PR_STD, total_found);
+	if (dfa)
+		snap_print_ac_results(dfa, &patterns, offs, offs_size,
+				      total_found);
+	if (batch)
+		snap_print_batch_results(batch, &patterns, offs);
 
 	/* Post action verification, simplifies test-scripts */
 	if (expected_patterns >= 0) {
@@ -615,6 +2301,8 @@ int main(int argc, char *argv[])
 	free(dbuff);
 	free(pbuff);
 	free(offs);
+	free(ix);
+	patterns_free(&patterns);
 
 	snap_queue_free(queue);
 	snap_card_free(card);
@@ -628,7 +2316,9 @@ int main(int argc, char *argv[])
 	free(offs);
  out_errorX:
 	free(pbuff);
+	patterns_free(&patterns);
  out_error0:
+	free(ix);
 	free(dbuff);
  out_error:
 	exit(EXIT_FAILURE);
@@ -21,9 +21,165 @@
 #include <action_search.h>
 
 unsigned int run_sw_search(unsigned int Method, char *Pattern,
-           unsigned int PatternSize, char *Text, unsigned int TextSize);
+           unsigned int PatternSize, char *Text, unsigned long TextSize,
+           unsigned int threads, uint64_t *offs, unsigned int offs_max);
 int Naive_search(char *pat, int M, char *txt, int N);
 void preprocess_KMP_table(char *pat, int M, int KMP_table[]);
 int KMP_search(char *pat, int M, char *txt, int N);
+int SIMD_search(char *pat, int M, char *txt, int N);
+
+int Naive_search_pos(char *pat, int M, char *txt, int N,
+		     uint64_t *offs, unsigned int offs_max);
+int KMP_search_pos(char *pat, int M, char *txt, int N,
+		   uint64_t *offs, unsigned int offs_max);
+int SIMD_search_pos(char *pat, int M, char *txt, int N,
+		    uint64_t *offs, unsigned int offs_max);
+int ShiftAnd_search_pos(char *pat, int M, char *txt, int N,
+			unsigned int k, int nocase,
+			uint64_t *offs, unsigned int offs_max);
+int Myers_search_pos(char *pat, int M, char *txt, int N,
+		     unsigned int k, int nocase,
+		     uint64_t *offs, unsigned int offs_max);
+
+unsigned long long search_mt(unsigned int Method, char *Pattern,
+			     unsigned int PatternSize, char *Text,
+			     unsigned long TextSize, unsigned int threads,
+			     uint64_t *offs, unsigned int offs_max);
+
+/* SIMD_method variants, the best one supported by the CPU is used */
+struct simd_search_impl {
+	const char *name;
+	int (*search)(const char *pat, int M, const char *txt, int N,
+		      uint64_t *offs, unsigned int offs_max);
+	int (*supported)(void);
+};
+
+extern const struct simd_search_impl simd_search_impls[];
+const struct simd_search_impl *simd_search_best(void);
+
+unsigned int AC_search(const search_dfa_t *dfa, const char *txt,
+		       unsigned int N, uint32_t *counts,
+		       search_match_t *match, unsigned int match_max);
+unsigned int run_sw_ac_search(const search_dfa_t *dfa, char *txt,
+			      unsigned int N, void *result,
+			      unsigned int result_size);
+
+unsigned int AC_search_pages(const search_dfa_t *dfa, const char *txt,
+			     unsigned int N, search_batch_result_t *res,
+			     uint64_t *pages, unsigned int page_items);
+unsigned int run_sw_batch_search(const search_batch_t *batch, char *txt,
+				 unsigned int N, void *result,
+				 unsigned int result_size);
+
+static inline const search_batch_query_t *
+search_batch_query(const search_batch_t *batch)
+{
+	return (const search_batch_query_t *)(batch + 1);
+}
+
+static inline const search_dfa_t *search_batch_dfa(const search_batch_t *batch)
+{
+	return (const search_dfa_t *)((const uint8_t *)batch +
+				      batch->dfa_offset);
+}
+
+/* REGEX_method, compiled by search_regex.c */
+#define SEARCH_RE_MAX_STATES	4096	/* default DFA state limit */
+
+struct search_re_stats {
+	unsigned int nfa_states;
+	unsigned int dfa_states;	/* before minimization */
+};
+
+search_re_t *search_re_compile(const char *expr, unsigned int max_states,
+			       struct search_re_stats *stats);
+unsigned int RE_search(const search_re_t *re, const char *txt,
+		       unsigned long N, uint64_t *offs, unsigned int offs_max);
+unsigned int run_sw_re_search(const search_re_t *re, char *txt,
+			      unsigned long N, uint64_t *offs,
+			      unsigned int offs_max);
+
+static inline const uint32_t *search_re_trans(const search_re_t *re)
+{
+	return (const uint32_t *)(re + 1);
+}
+
+static inline const search_re_nfa_t *search_re_nfa(const search_re_t *re)
+{
+	return (const search_re_nfa_t *)
+		(search_re_trans(re) + re->n_states * re->n_classes);
+}
+
+static inline const uint8_t *search_re_sets(const search_re_t *re)
+{
+	return (const uint8_t *)(search_re_nfa(re) + re->n_nfa);
+}
+
+static inline int search_re_set_has(const uint8_t *set, uint8_t c)
+{
+	return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+/* Trigram index over the text, built by search_index.c */
+#define SEARCH_INDEX_MAGIC	0x58495253	/* "SRIX" */
+#define SEARCH_INDEX_BLOCK	4096		/* text bytes per block */
+#define SEARCH_INDEX_OVERLAP	61		/* covers patterns <= 64 */
+
+struct search_index {
+	uint32_t magic;
+	uint32_t block_size;
+	uint32_t n_blocks;
+	uint32_t n_keys;		/* trigrams which occur */
+	uint64_t text_size;
+	uint64_t text_hash;
+	uint64_t size;			/* of the whole image */
+	/* uint32_t keys[n_keys], sorted */
+	/* uint32_t offs[n_keys + 1], into the postings */
+	/* uint8_t postings[], delta varint block numbers */
+};
+
+uint64_t search_index_hash(const uint8_t *text, size_t size);
+struct search_index *search_index_build(const uint8_t *text, size_t size);
+int search_index_save(const struct search_index *ix, const char *fname);
+struct search_index *search_index_load(const char *fname,
+				       const uint8_t *text, size_t size);
+uint32_t search_index_query(const struct search_index *ix,
+			    const char *pattern, unsigned int psize,
+			    uint32_t *blocks);
+
+static inline uint32_t *search_index_keys(const struct search_index *ix)
+{
+	return (uint32_t *)(ix + 1);
+}
+
+static inline uint32_t *search_index_offs(const struct search_index *ix)
+{
+	return search_index_keys(ix) + ix->n_keys;
+}
+
+static inline const uint8_t *search_index_postings(const struct search_index *ix)
+{
+	return (const uint8_t *)(search_index_offs(ix) + ix->n_keys + 1);
+}
+
+static inline const uint32_t *search_dfa_trans(const search_dfa_t *dfa)
+{
+	return (const uint32_t *)(dfa + 1);
+}
+
+static inline const uint32_t *search_dfa_out_idx(const search_dfa_t *dfa)
+{
+	return search_dfa_trans(dfa) + dfa->n_states * dfa->n_classes;
+}
+
+static inline const uint32_t *search_dfa_out(const search_dfa_t *dfa)
+{
+	return search_dfa_out_idx(dfa) + dfa->n_states + 1;
+}
+
+static inline const uint32_t *search_dfa_pat_len(const search_dfa_t *dfa)
+{
+	return search_dfa_out(dfa) + dfa->n_out;
+}
 
 #endif	/* __ACTION_SEARCH_H__ */